@@ -0,0 +1,60 @@
+#pragma once
+
+#include "cbe.h"
+#include "Block.h"
+
+namespace cbe
+{
+
+// first byte of every chunk payload
+enum CHUNK_CODEC
+{
+	CHUNK_CODEC_RAW,			// the block array as is
+	CHUNK_CODEC_PALETTE_RLE,	// runs of indices into the distinct blocks
+	CHUNK_CODEC_COUNT
+};
+
+//////////////////////////////////////////////////////////////////////////
+// chunk payload encoding for map files
+//
+// raw:
+// |codec|pad|blocks...|
+//
+// the blocks start 2 bytes into the payload, region payloads are sector
+// aligned, so a mapped map file can use them in place (RawBlocks).
+//
+// palette rle:
+// |codec|order|palette size|palette...|run|run|...
+//
+// the palette lists the distinct block values (type, group and state),
+// a run is its length - 1 as a varint followed by the palette index, one
+// byte for up to 256 entries, two otherwise. the runs follow the blocks
+// in the scan order, level 0 keeps the chunk order, level 1 also tries
+// horizontal layers bottom up and keeps the shorter payload. a payload
+// that would not be smaller than the blocks is stored raw.
+class CBE_API ChunkCodec
+{
+private:
+	enum SCAN_ORDER
+	{
+		SCAN_CHUNK,		// chunk order, z fastest
+		SCAN_LAYERS,	// y slowest, then x, then z
+		SCAN_ORDER_COUNT
+	};
+
+	static void Gather(int order, int chunkSize, const Block* pBlocks, unsigned __int16* pValues);
+	static void Scatter(int order, int chunkSize, const unsigned __int16* pValues, Block* pBlocks);
+	static bool EncodePaletteRle(const unsigned __int16* pValues, UINT count, int order, UINT limit, int* pIndices, std::vector<BYTE>* pPayload);
+	static bool DecodePaletteRle(const BYTE* pPayload, UINT length, UINT count, int* pOrder, unsigned __int16* pValues);
+
+public:
+	static void Encode(int codec, int level, int chunkSize, const Block* pBlocks, std::vector<BYTE>* pPayload);
+	static bool Decode(int chunkSize, const BYTE* pPayload, UINT length, Block* pBlocks);
+
+	// the blocks of a raw payload, NULL for any other codec
+	static const Block* RawBlocks(int chunkSize, const BYTE* pPayload, UINT length);
+
+	static const int MaxLevel() { return 1; }
+};
+
+}
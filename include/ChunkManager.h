@@ -3,6 +3,16 @@
 #include "BlockTypeManager.h"
 #include "BlockType.h"
 #include "Chunk.h"
+#include "EditJournal.h"
+#include "RegionFile.h"
+#include "ChunkCodec.h"
+#include "CoordDivider.h"
+#include "Frustum.h"
+#include "OcclusionBuffer.h"
+#include "MeshBuffer.h"
+#include "DrawList.h"
+#include "TranslucentSorter.h"
+#include "MeshCache.h"
 #include "cbe.h"
 #include <cmath>
 
@@ -18,15 +28,19 @@ private:
 	int m_height;
 	int m_depth;
 	int m_chunkSize;
+	CoordDivider m_chunkDivider;
 	float m_absoluteChunkSize;
+	Chunk::MeshBuilder m_pMeshBuilder;
 
 	XMFLOAT4X4 m_matWorld;
 	XMFLOAT4X4 m_matWorldInverse;
-	cgl::PD3D11EffectVariable	m_pMatWorld;
 
 	bool m_upToDate;
 	
+#ifndef CBE_HEADLESS
 	// d3d
+	cgl::PD3D11EffectVariable	m_pMatWorld;
+
 	struct RENDER_TECHNIQUE
 	{
 		cgl::PD3D11EffectTechnique pTechnique;
@@ -40,6 +54,7 @@ private:
 	cgl::PD3D11EffectVariable	m_pNormals;
 	cgl::PD3D11EffectVariable	m_pBlockTypes;
 	cgl::PD3D11EffectVariable	m_pTextureAtlas;
+#endif
 
 
 	// threading
@@ -50,6 +65,7 @@ private:
 		JOB_TYPE_BLOCKTYPE
 	};
 
+	// indices are [x, y, z, flattened], applying a job only needs [3]
 	#pragma pack(push, 1)
 	struct UpdateJob
 	{
@@ -65,30 +81,47 @@ private:
 	};
 	#pragma pack(pop)
 	
-	CRITICAL_SECTION m_criticalSection;
-	HANDLE m_thread;
-	HANDLE m_startEvent;
-	HANDLE m_endEvent;
+	// m_structureLock guards m_ppChunks itself: shared for every access to
+	// a chunk, exclusive only to create or delete chunks. block data is
+	// guarded per chunk by the chunk's own lock, so work on different
+	// chunks runs in parallel. m_settingsMutex only guards settings.
+	RWLock m_structureLock;
+	std::mutex m_settingsMutex;
+	std::thread m_thread;
+	Event m_workEvent;
+	std::atomic<UINT> m_wakeups;
+	std::atomic<UINT> m_wakeLatency;
+	std::atomic<int> m_pinnedChunks;
 	ThreadSafe<std::list<int>>						m_tsChunksToChangeIndices;
-	ThreadSafe<std::vector<int>>					m_tsChunksToUpdateIndices;
+	ThreadSafe<std::deque<int>>						m_tsChunksToUpdateIndices;
 	ThreadSafe<std::vector<std::vector<UpdateJob>>>	m_tsUpdateJobs;
-	bool m_processing;
+	std::atomic<bool> m_processing;
 
 	inline Chunk* GetChunk(int index) { return m_ppChunks[index]; }
-	HANDLE GetStartEvent();
-	HANDLE GetEndEvent();
 
-	void BuildNextChunk();
-	bool UpdateNextChunk();
-	static DWORD WINAPI UpdateAsync(LPVOID data);
+	bool BuildNextChunk();
+	void UploadChunks();
+	void UpdateAsync();
 	
 	bool IsAsyncProccessing();
 	void SetAsyncProccessing(bool processing);
 
-	inline int _3dto1d(unsigned __int16 x, unsigned __int16 y, unsigned __int16 z, unsigned __int16 width, unsigned __int16 height) { return z + y * width + x * height * width; }
+	// chunk and block indices are (x * height + y) * depth + z everywhere: m_ppChunks,
+	// the update jobs, the region file and the occupancy grid
+	inline int _3dto1d(unsigned __int16 x, unsigned __int16 y, unsigned __int16 z, unsigned __int16 height, unsigned __int16 depth) { return (x * height + y) * depth + z; }
+	inline void _1dto3d(int index, int height, int depth, int* pX, int* pY, int* pZ) { *pZ = index % depth; *pY = (index / depth) % height; *pX = index / (depth * height); }
 	bool TransformCoords(int x, int y, int z, int* pChunkIndex,int* pBlockIndex);
+	template <bool PowerOfTwo>
+	int TransformCoordsBatch(int count, const int* pX, const int* pY, const int* pZ, int* pChunkIndices, int* pBlockIndices);
 	bool CreateChunk(int chunkIndex, int x, int y, int z );
-	void CheckChunk(int* pIndices);
+	void CheckChunk(int chunkIndex);
+	Chunk* LockChunk(int chunkIndex, bool create);
+	void UnlockChunk();
+	// keeps the chunk alive without holding m_structureLock, for long work
+	// like meshing that must not stall a waiting chunk creation. chunks
+	// are only deleted by Exit, which waits for the pins
+	Chunk* PinChunk(int chunkIndex);
+	void UnpinChunk(Chunk* pChunk);
 
 	#pragma pack (push, 1)
 	struct MapInfo
@@ -100,51 +133,440 @@ private:
 	};
 	#pragma pack (pop)
 
-	void AddChangedChunk(int index, bool highPriority = false);
+	bool DeserializeLegacy(std::string fileName);
+	void EncodeChunk(Chunk* pChunk, std::vector<BYTE>* pPayload, UINT* pGeneration);
+	bool LoadChunk(int chunkIndex, const std::vector<BYTE>& payload, bool saved);
+	bool SetChunkBlocks(int chunkIndex, const Block* pBlocks, bool saved);
+
+	// signal is false for chunks queued by the thread building them, it
+	// looks at the queue again before it sleeps
+	void AddChangedChunk(int index, bool highPriority = false, bool signal = true);
 	void AddBuiltChunk(int index);
 	void CreateChunk(int ix, int iy, int iz);
-	void RenderBatched();
 	void ChunkChanged(int* pChunkIndices, int* pBlockIndices);
-	void ProcessPendingJobs();
+	bool ProcessPendingJobs();
 
 	// synchronized access
 	void _setBlockState(int* chunkIndices, int* blockIndices, BOOL state);
 	void _setBlockType( int* chunkIndices, int* blockIndices, USHORT type);
 	void _setBlockGroup(int* chunkIndices, int* blockIndices, BYTE group);
 
+	// chunk payload encoding of the map file (see ChunkCodec)
+	int m_chunkCodec;
+	int m_chunkCodecLevel;
+
+	// map file whose raw payloads chunks use in place
+	const BYTE* m_pMappedFile;
+	__int64 m_mappedSize;
+	FileId m_mappedFileId;
+
+	void ReleaseMappedFile();
+	bool IsMappedFile(std::string fileName);
+
+	// map file the saved generations of the chunks refer to, the last one
+	// loaded or written in full. SaveChangedChunks only patches this one
+	FileId m_savedFileId;
+	bool m_hasSavedFile;
+
+	bool IsSavedFile(std::string fileName);
+	void MarkChunksSaved(const std::vector<int>& chunkIndices, const std::vector<UINT>& generations);
+
+	// parallel load and save. the calling thread reads or writes the file
+	// in batches of neighbouring payloads, workers decode or encode them.
+	// loaded chunks are created without the structure lock and put into
+	// place once per batch
+	struct IO_BATCH
+	{
+		std::vector<int> chunkIndices;
+		std::vector<std::vector<BYTE>> payloads;	// save, one per chunk
+		std::vector<UINT> generations;				// save, of the encoded blocks
+		std::vector<BYTE> data;						// load, the file span
+		const BYTE* pData;							// load, data or the mapped file
+		bool mapped;
+		__int64 offset;
+		UINT length;
+		bool ready;									// read or encoded
+		bool success;
+
+		IO_BATCH()
+			: pData(NULL), mapped(false), offset(0), length(0), ready(false), success(true)
+		{		}
+	};
+	struct IO_PIPELINE
+	{
+		RegionFile* pRegion;
+		std::vector<IO_BATCH> batches;
+		std::mutex mutex;
+		std::condition_variable condition;
+		int next;		// batch the next worker takes
+		int staged;		// batches read or written by the i/o thread
+		int finished;	// batches decoded or encoded by the workers
+		int window;		// batches held in memory at most
+		bool failed;
+		std::atomic<int> mappedChunks;
+
+		IO_PIPELINE(RegionFile* _pRegion, int _window)
+			: pRegion(_pRegion), next(0), staged(0), finished(0), window(_window), failed(false), mappedChunks(0)
+		{		}
+	};
+	int m_ioThreads;
+
+	int IoWorkerCount();
+	bool LoadRegion(RegionFile& region, const BYTE* pMapped, __int64 mappedSize, int* pMappedChunks);
+	bool SaveRegion(RegionFile& region, const std::vector<int>& chunkIndices, std::vector<UINT>* pGenerations);
+	void LoadWorker(IO_PIPELINE* pPipeline);
+	void SaveWorker(IO_PIPELINE* pPipeline);
+	void InsertChunks(const std::vector<Chunk*>& chunks);
+	Chunk* NewChunk(int ix, int iy, int iz);
+
+	static const UINT IoBatchBytes() { return 4 << 20; }
+
+	// edit journal
+	EditJournal* m_pJournal;
+	std::string m_compactionFileName;
+	UINT m_compactionThreshold;
+	UINT m_compactionRetry;		// journal length of the next try after a failure
+	std::atomic<UINT> m_compactionFailures;
+
+	void JournalEdit(int* chunkIndices, int* blockIndices);
+	void ReplayJournal(std::vector<EditJournal::Record>& records);
+	bool CompactJournal(std::string mapFileName);
+	void CompactJournalIfNeeded();
+
+	// all chunk meshes live in one vertex and index buffer, allocations
+	// and index ranges are kept per mesh slot (chunk and lod level)
+	MeshBuffer m_meshBuffer;
+	std::vector<MESH_ALLOCATION> m_allocations;
+
+	inline int MeshSlot(int chunkIndex, int level) { return chunkIndex * CHUNK_LOD_LEVELS + level; }
+
+	// built meshes by content hash, shared by all chunks
+	MeshCache m_meshCache;
+	UINT m_loadedMeshes;
+
+	// draw lists, after culling the draw list thread fills the back list,
+	// Render replays the front one without touching any chunk. Update waits
+	// for the job of the last frame before it changes the culling state
+	DrawList m_drawLists[2];
+	int m_frontDrawList;
+	std::mutex m_drawListMutex;
+	std::thread m_drawListThread;
+	Event m_drawListEvent;
+	Event m_drawListDone;
+	bool m_drawListPending;
+	UINT m_frame;
+
+	void BuildDrawList();
+	void BuildDrawListsAsync();
+
+	// chunks are drawn front to back to let early z reject hidden pixels.
+	// m_drawOrder holds positions in m_visibleChunks and is only sorted
+	// again once the camera enters another chunk or the visible set changes
+	bool m_drawHasCamera;
+	XMFLOAT3 m_drawCamera;
+	bool m_drawOrderValid;
+	bool m_drawOrderHasCamera;
+	int m_drawOrderCell[3];
+	std::vector<int> m_drawOrderVisible;
+	std::vector<int> m_drawOrder;
+	std::vector<std::pair<float, int>> m_drawOrderKeys;
+	std::atomic<UINT> m_drawOrderSorts;
+
+	void SortDrawOrder();
+
+	// translucent quads are sorted back to front on the draw list thread,
+	// Update writes the sorted indices into the mesh buffer
+	TranslucentSorter m_translucentSorter;
+	std::vector<XMFLOAT3> m_translucentCentroids;
+	std::vector<DWORD> m_translucentIndices;
+	std::vector<int> m_translucentChunks;
+	float m_translucentSortThreshold;
+	float m_translucentSortWork;
+	float m_translucentSortTime;
+	UINT m_translucentSortedQuads;
+
+	void SortTranslucentQuads();
+	void WriteTranslucentQuads();
+
+	// gpu upload budget, 0 means unlimited
+	float m_uploadBudgetMs;
+	UINT m_uploadBudgetBytes;
+	UINT m_uploadedBytes;
+	UINT m_uploadedChunks;
+
+	// frustum culling, bounds of the uploaded meshes by chunk index as
+	// structure of arrays, empty chunks have min > max
+	struct CHUNK_BOUNDS
+	{
+		std::vector<float> minX, minY, minZ;
+		std::vector<float> maxX, maxY, maxZ;
+	};
+	CHUNK_BOUNDS m_bounds;
+	Frustum m_frustum;
+	bool m_culling;
+	XMFLOAT4X4 m_matViewProj;
+	std::vector<int> m_visibleChunks;
+
+	// connectivity culling, breadth first from the camera chunk through
+	// connected chunk faces
+	struct TRAVERSAL_NODE
+	{
+		int chunkIndex;
+		int entryFace;
+		int directions;
+	};
+	std::vector<unsigned __int16> m_connectivity;
+	std::vector<unsigned char> m_reachable;
+	std::vector<TRAVERSAL_NODE> m_traversal;
+	UINT m_connectivityCulled;
+
+	// camera position in chunk manager space, if the user set one
+	bool m_hasCamera;
+	XMFLOAT3 m_cameraPosition;
+
+	// orientation culling, CHUNK_RANGE_COUNT index ranges per mesh slot and
+	// the directions drawn of each visible chunk
+	std::vector<Chunk::INDEX_RANGE> m_indexRanges;
+	std::vector<unsigned char> m_visibleDirections;
+	UINT m_submittedTriangles;
+
+	// occlusion culling, the solid layers of the nearest visible chunks
+	// are rasterized and every visible chunk is tested against them
+	OcclusionBuffer m_occlusion;
+	bool m_occlusionCulling;
+	UINT m_maxOccluders;
+	std::vector<unsigned __int8> m_occluderLayers;
+	std::vector<std::pair<float, int>> m_occluderOrder;
+	UINT m_occlusionCulled;
+	UINT m_occluderQuads;
+	float m_occlusionTime;
+
+	void GetChunkCell(const XMFLOAT3& position, int* pX, int* pY, int* pZ);
+	// lod, the level drawn per visible chunk. wanted levels that are not
+	// uploaded yet are requested from the worker, meanwhile the finest
+	// uploaded coarser level or the full mesh is drawn
+	float m_lodDistance;
+	int m_lodLevels;
+	std::vector<unsigned char> m_lodUploaded;
+	std::vector<unsigned char> m_lodRequested;
+	std::vector<unsigned char> m_visibleLods;
+	ThreadSafe<std::deque<int>> m_tsLodRequests;
+	ThreadSafe<std::deque<int>> m_tsBuiltLods;
+	UINT m_lodChunks;
+	std::atomic<UINT> m_lodBuilds;
+
+	void SelectLods();
+	void RequestLod(int chunkIndex, int level);
+	bool BuildNextLod();
+	void UploadLods();
+	void SetLodCullingInfo(int chunkIndex, int level, Chunk* pChunk);
+
+	// occupancy of the chunk grid above the pyramids of the chunks, level 0
+	// has a byte per chunk that is set if the chunk has an active block,
+	// every further level halves the grid until one cell covers the world.
+	// written under m_occupancyLock by the thread applying edits and by
+	// the loaders (Deserialize workers, LoadChunks)
+	struct OCCUPANCY_LEVEL
+	{
+		int width;
+		int height;
+		int depth;
+		UINT offset;
+	};
+	std::vector<OCCUPANCY_LEVEL> m_gridLevels;
+	std::vector<unsigned char> m_gridOccupancy;
+	RWLock m_occupancyLock;
+
+	inline UINT GridIndex(int level, int x, int y, int z)
+	{
+		const OCCUPANCY_LEVEL& grid = m_gridLevels[level];
+		return grid.offset + (x * grid.height + y) * grid.depth + z;
+	}
+	void InitGridOccupancy();
+	void UpdateGridOccupancy(Chunk* pChunk);
+	bool GridChildrenOccupied(int level, int x, int y, int z);
+	bool GridRegionOccupied(int level, int x, int y, int z, const int* pMin, const int* pMax, std::vector<int>* pChunks);
+	bool GetEmptyRegion(const int* pBlock, int* pMin, int* pMax);
+
+	void SetChunkCullingInfo(int chunkIndex, Chunk* pChunk);
+	void CullChunks();
+	void CullByConnectivity();
+	void CullByOcclusion(const float* pMatWorldViewProj);
+	void SelectDirections();
+
 public:
+#ifndef CBE_HEADLESS
 	ChunkManager(cgl::PD3D11Effect pEffect);
+#else
+	ChunkManager();
+#endif
 	~ChunkManager(void);
 
 	bool Init(int widht, int height, int depth, int chunkSize);
+#ifndef CBE_HEADLESS
 	void Render();
+#endif
 	void Update();
 	void Exit();
 
-	void Serialize(std::string fileName);
-	bool Deserialize(std::string fileName);
+	// maps are region files (see RegionFile), the old sequential format
+	// is still read by Deserialize and converted by ConvertLegacyMap.
+	// both write <fileName>.tmp and replace the map with it, a failed save
+	// leaves the old map in place
+	bool Serialize(std::string fileName);
+	bool Deserialize(std::string fileName, bool mapped = false);
+	static bool ConvertLegacyMap(std::string legacyFileName, std::string fileName, int codec = CHUNK_CODEC_PALETTE_RLE, int level = 1);
+
+	// codec chunks are saved with, a loaded map brings its own. palette
+	// rle by default, CHUNK_CODEC_RAW keeps the blocks as they are
+	void SetChunkCodec(int codec, int level);
+	inline int GetChunkCodec() { return m_chunkCodec; }
+	inline int GetChunkCodecLevel() { return m_chunkCodecLevel; }
+
+	// rewrites the chunks edited since the map was loaded or saved, any
+	// other file is written in full. chunks count as saved once their
+	// entries are written, a failed save keeps them for the next one
+	bool SaveChangedChunks(std::string fileName);
+	// reads single chunks from a region file of the same layout and queues
+	// them for building, returns the number of chunks read
+	int LoadChunks(std::string fileName, int count, const int* pChunkIndices);
+
+	// a mapped load (Deserialize) leaves raw chunks in the mapped file,
+	// their pages are read on first access and shared between processes
+	// loading the same map. the first edit copies a chunk to private
+	// memory. save such maps with CHUNK_CODEC_RAW, other payloads are
+	// decoded as usual. writing the whole map over the mapped file, by
+	// any path, copies the remaining chunks first
+	int GetMappedChunkCount();
+
+	// threads decoding and encoding payloads while Deserialize, Serialize
+	// and SaveChangedChunks move the file, 0 (the default) takes one per
+	// core beside the thread doing the file i/o
+	void SetIoThreads(int count);
+	inline int GetIoThreads() { return m_ioThreads; }
+
+	// journal of applied edits, replayed on top of the loaded map
+	// open after Init/Deserialize and before StartAsyncUpdating. a journal
+	// written against another map is not opened.
+	// the thread applying edits saves the map and truncates the journal
+	// once it holds maxRecords. a failed save is tried again after another
+	// maxRecords, twice as many after each further failure
+	bool OpenJournal(std::string fileName);
+	void CloseJournal();
+	void SetJournalCompaction(std::string mapFileName, UINT maxRecords);
+	UINT GetJournalRecordCount();
+	inline UINT GetJournalCompactionFailures() { return m_compactionFailures; }
 
 	void SetBlockState(int x, int y, int z, BOOL state);
 	void SetBlockType(int x, int y, int z, BlockType& type);
 	void SetBlockGroup(int x, int y, int z, BYTE group);
 	void SetChunkChanged(int x, int y, int z, bool changed);
 
+	// bulk access, coordinates are transformed in one batch
+	void SetBlockStates(int count, const int* pX, const int* pY, const int* pZ, BOOL state);
+	int GetBlockStates(int count, const int* pX, const int* pY, const int* pZ, bool* pStates);
+	int TransformCoords(int count, const int* pX, const int* pY, const int* pZ, int* pChunkIndices, int* pBlockIndices);
+
 	void SetWorldMatrix(float* pMat);
+#ifndef CBE_HEADLESS
 	void SetWorldMatrix(CXMMATRIX mat);
+#endif
 	void SetWorldMatrix(XMFLOAT4X4 mat);
 
+	// chunks are culled against this camera in Update, row major like
+	// the world matrix. NULL turns culling off
+	void SetViewProjection(const float* pMat);
+	inline const std::vector<int>& GetVisibleChunks() { return m_visibleChunks; }
+	inline MeshBuffer& GetMeshBuffer() { return m_meshBuffer; }
+
+	// chunks whose blocks were meshed before (a repeated structure, an
+	// edit undone) take the cached mesh instead of running the mesher. the
+	// cache keeps up to bytes of meshes, 16 MB by default, 0 turns it off
+	void SetMeshCacheSize(UINT bytes);
+	inline MeshCache& GetMeshCache() { return m_meshCache; }
+
+	// sidecar file of the chunk meshes, so loading a map skips the mesher.
+	// holds every built chunk, meshes are taken from the mesh cache or
+	// built again if it dropped them. load after Deserialize and before
+	// StartAsyncUpdating, chunks whose blocks or types changed since the
+	// save are built as usual
+	bool SaveMeshes(std::string fileName);
+	bool LoadMeshes(std::string fileName);
+	inline UINT GetLoadedMeshCount() { return m_loadedMeshes; }
+
+	// frames counted by Update, the draw list Render replays next
+	inline UINT GetFrame() { return m_frame; }
+	void GetDrawRecords(std::vector<DRAW_RECORD>* pRecords, UINT* pFrame = NULL);
+	// times the visible chunks were sorted by distance to the camera
+	inline UINT GetDrawOrderSorts() { return m_drawOrderSorts; }
+
+	// the translucent quads of a chunk are sorted again once the camera
+	// moved this far since their last sort, by default one block
+	void SetTranslucentSortThreshold(float distance);
+	inline UINT GetTranslucentSortedQuads()	{ return m_translucentSortedQuads; }
+	inline float GetTranslucentSortTime()	{ return m_translucentSortTime; }
+
+	// chunks farther than distance from the camera are drawn with 2x
+	// merged blocks, each doubling of the distance merges twice as many.
+	// 0 turns lod off. needs the camera position
+	void SetLodDistance(float distance);
+	inline const std::vector<unsigned char>& GetVisibleLods() { return m_visibleLods; }
+	inline UINT GetLodChunkCount()	{ return m_lodChunks; }	// visible chunks drawn coarser
+	inline UINT GetLodBuilds()		{ return m_lodBuilds; }
+	// normal index bits drawn per visible chunk and the triangles they have
+	inline const std::vector<unsigned char>& GetVisibleDirections() { return m_visibleDirections; }
+	inline UINT GetSubmittedTriangles() { return m_submittedTriangles; }
+
+	// camera position in chunk manager space, NULL if unknown. with it only
+	// chunks reachable from the camera chunk through open space are
+	// visible and quads facing away from the camera are skipped
+	void SetCameraPosition(const float* pPosition);
+	inline UINT GetConnectivityCulledCount() { return m_connectivityCulled; }
+
+	// software occlusion culling, needs the view projection. the depth
+	// buffer has width x height pixels, occluders come from the
+	// maxOccluders nearest visible chunks
+	void SetOcclusionCulling(bool enable, int width = 256, int height = 128, UINT maxOccluders = 64);
+	inline UINT GetOcclusionCulledCount()	{ return m_occlusionCulled; }
+	inline UINT GetOccluderQuadCount()		{ return m_occluderQuads; }
+	inline float GetOcclusionTime()			{ return m_occlusionTime; }
+	inline const OcclusionBuffer& GetOcclusionBuffer() { return m_occlusion; }
+
 	bool GetBlockState(int x, int y, int z);
 	int GetActiveChunkCount();
+
+	// occupancy queries on the pyramids of the chunk grid and the chunks,
+	// an empty region is found with a few lookups instead of reading every
+	// block. block coordinates, the bounds are included
+	bool IsRegionEmpty(const int* pMin, const int* pMax);
+	// first active block along the ray in chunk manager space, empty cells
+	// are crossed in one step. false if nothing is hit within maxDistance
+	bool Raycast(const float* pOrigin, const float* pDirection, float maxDistance, int* pBlock, float* pDistance = NULL);
 	int GetActiveBlockCount();
 	int GetVertexCount();
 
+	// the worker sleeps until an edit or a rebuild is queued
 	void StartAsyncUpdating();
+	// applies the queued edits and builds the queued chunks on the calling
+	// thread, for tools and tests running without StartAsyncUpdating
+	void BuildPending();
+	inline UINT GetWorkerWakeups()			{ return m_wakeups;		}
+	inline UINT GetWorkerWakeLatency()		{ return m_wakeLatency;	} // microseconds, last wake up
+
+	// built chunks are uploaded in Update until one of the budgets is used
+	// up, at least one chunk is uploaded per frame. headless builds only
+	// publish the cpu meshes (see Chunk::GetMeshVertices)
+	void SetUploadBudget(float milliseconds, UINT bytes);
+	int GetUploadBacklog();
+	inline UINT GetUploadedBytes()	{ return m_uploadedBytes;  }
+	inline UINT GetUploadedChunks()	{ return m_uploadedChunks; }
 
 	inline float Width()	{ return m_absoluteChunkSize * m_width;	 }
 	inline float Height()	{ return m_absoluteChunkSize * m_height; }
 	inline float Depth()	{ return m_absoluteChunkSize * m_depth;  }
 
 	BlockTypeManager* TypeManager();
+	inline Chunk::MeshBuilder GetMeshBuilder() { return m_pMeshBuilder; }
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "cbe.h"
+
+namespace cbe
+{
+
+// one DrawIndexed call on the mesh buffer
+struct DRAW_RECORD
+{
+	UINT bucket;
+	UINT indexOffset;
+	UINT indexCount;
+	UINT vertexOffset;
+};
+
+// render buckets, drawn in this order. opaque records are added front to
+// back, transparent ones back to front
+#define DRAW_BUCKET_OPAQUE		0
+#define DRAW_BUCKET_TRANSPARENT	1
+
+//////////////////////////////////////////////////////////////////////////
+// flat list of draws for one frame
+//
+// filled after culling without any d3d calls, Replay only walks the
+// records. ranges that follow each other in the index buffer with the same
+// base vertex and bucket are merged into one record when added. Sort
+// orders by bucket and keeps the insertion order inside a bucket, Replay
+// draws one bucket.
+class CBE_API DrawList
+{
+private:
+	std::vector<DRAW_RECORD> m_records;
+	UINT m_frame;
+	UINT m_triangles;
+
+public:
+	DrawList();
+
+	void Clear(UINT frame);
+	void Add(UINT bucket, UINT indexOffset, UINT indexCount, UINT vertexOffset);
+	void Sort();
+
+#ifndef CBE_HEADLESS
+	void Replay(ID3D11DeviceContext* pContext, UINT bucket) const;
+#endif
+
+	inline const std::vector<DRAW_RECORD>& Records() const	{ return m_records; }
+	inline UINT Frame() const								{ return m_frame; }
+	inline UINT Triangles() const							{ return m_triangles; }
+};
+
+}
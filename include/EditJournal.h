@@ -0,0 +1,77 @@
+#pragma once
+
+#include "cbe.h"
+#include "Block.h"
+
+namespace cbe
+{
+
+//////////////////////////////////////////////////////////////////////////
+// append-only journal of applied block edits
+//
+// |Header|Record|Record|Record|...
+//
+// records are buffered by Append and written in one go by Commit
+// (group commit), so the worker pays one fwrite/fflush per job batch.
+// replaying all records on top of the map file they were written
+// against restores the edited world; Truncate is called after the
+// map has been re-saved (compaction).
+class CBE_API EditJournal
+{
+public:
+	#pragma pack(push, 1)
+	struct Record
+	{
+		__int32 chunkIndex;
+		__int32 blockIndex;
+		unsigned __int16 data;
+	};
+	#pragma pack(pop)
+
+private:
+	#pragma pack(push, 1)
+	struct Header
+	{
+		char magic[4];
+		__int32 version;
+		__int32 chunkCount;
+		__int32 chunkSize;
+	};
+	#pragma pack(pop)
+
+	FILE* m_pFile;
+	std::string m_fileName;
+	int m_chunkCount;
+	int m_chunkSize;
+
+	std::vector<Record> m_pendingRecords;
+	UINT m_committedRecords;
+
+	std::mutex m_mutex;
+
+	bool WriteHeader();
+	static bool ReadHeader(FILE* pFile, int chunkCount, int chunkSize);
+
+public:
+	EditJournal();
+	~EditJournal();
+
+	bool Open(std::string fileName, int chunkCount, int chunkSize);
+	void Close();
+
+	void Append(int chunkIndex, int blockIndex, Block block);
+	bool Commit();
+	bool Truncate();
+
+	static bool Read(std::string fileName, int chunkCount, int chunkSize, std::vector<Record>& records);
+
+	bool IsOpen();
+	UINT CommittedRecords();
+	UINT PendingRecords();
+	inline std::string FileName() { return m_fileName; }
+
+	static const char*	Magic()		{ return "CBEJ"; }
+	static const int	Version()	{ return 1; }
+};
+
+}
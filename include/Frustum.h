@@ -0,0 +1,48 @@
+#pragma once
+
+#include "cbe.h"
+
+#if !defined(CBE_NO_SIMD) && (defined(_M_IX86) || defined(_M_X64) || defined(__SSE__))
+#define CBE_SSE
+#include <xmmintrin.h>
+#endif
+
+namespace cbe
+{
+
+//////////////////////////////////////////////////////////////////////////
+// view frustum for culling axis aligned boxes
+//
+// planes are extracted from a row major matrix (d3d convention, clip =
+// v * M, 0 <= z <= w), so passing world * view * projection gives the
+// planes in model space. a box is visible if its corner furthest along
+// each plane normal is on the inner side of all six planes.
+//
+// CullAABBs tests boxes stored as structure of arrays, four at a time
+// with sse (scalar without it or with CBE_NO_SIMD). empty boxes are
+// stored as min = FLT_MAX, max = -FLT_MAX and never pass.
+class CBE_API Frustum
+{
+private:
+	// a * x + b * y + c * z + d >= 0 is inside
+	float m_planes[6][4];
+
+public:
+	Frustum();
+
+	void Extract(const float* pMatrix);
+	bool TestAABB(const XMFLOAT3& min, const XMFLOAT3& max) const;
+
+	// writes the indices of the visible boxes to pVisible, returns their count
+	int CullAABBs(int count, const float* pMinX, const float* pMinY, const float* pMinZ,
+				  const float* pMaxX, const float* pMaxY, const float* pMaxZ, int* pVisible) const;
+	int CullAABBsScalar(int first, int count, const float* pMinX, const float* pMinY, const float* pMinZ,
+						const float* pMaxX, const float* pMaxY, const float* pMaxZ, int* pVisible) const;
+
+	inline const float* Plane(int index) const { return m_planes[index]; }
+
+	// row major 4x4, out = a * b
+	static void MultiplyMatrix(const float* pA, const float* pB, float* pOut);
+};
+
+}
@@ -1,13 +1,109 @@
+#pragma once
+
 #include "cbe.h"
 
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
 namespace cbe
 {
 
+//////////////////////////////////////////////////////////////////////////
+// reader-writer lock
+//
+// any number of readers or one writer. slim reader-writer lock on
+// windows, pthread rwlock everywhere else. not recursive, a thread
+// holding the lock must not lock it again (use the guard's ->).
+class RWLock
+{
+private:
+#ifdef _WIN32
+	SRWLOCK m_lock;
+#else
+	pthread_rwlock_t m_lock;
+#endif
+
+	RWLock(const RWLock&);
+	RWLock& operator = (const RWLock&);
+
+public:
+#ifdef _WIN32
+	RWLock()					{ ::InitializeSRWLock(&m_lock); }
+	~RWLock()					{ }
+
+	inline void LockShared()		{ ::AcquireSRWLockShared(&m_lock); }
+	inline void UnlockShared()		{ ::ReleaseSRWLockShared(&m_lock); }
+	inline void LockExclusive()		{ ::AcquireSRWLockExclusive(&m_lock); }
+	inline void UnlockExclusive()	{ ::ReleaseSRWLockExclusive(&m_lock); }
+#else
+	RWLock()					{ pthread_rwlock_init(&m_lock, NULL); }
+	~RWLock()					{ pthread_rwlock_destroy(&m_lock); }
+
+	inline void LockShared()		{ pthread_rwlock_rdlock(&m_lock); }
+	inline void UnlockShared()		{ pthread_rwlock_unlock(&m_lock); }
+	inline void LockExclusive()		{ pthread_rwlock_wrlock(&m_lock); }
+	inline void UnlockExclusive()	{ pthread_rwlock_unlock(&m_lock); }
+#endif
+};
+
+//////////////////////////////////////////////////////////////////////////
+// auto reset event
+//
+// Set wakes one waiting thread, or the next one to wait if nobody is
+// waiting yet; a wait consumes the signal. Wait returns the time in ms
+// between the first Set of the signal and the wake up.
+class Event
+{
+private:
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	bool m_signaled;
+	double m_signalTime;
+
+	Event(const Event&);
+	Event& operator = (const Event&);
+
+public:
+	Event() : m_signaled(false), m_signalTime(0.0) { }
+
+	void Set()
+	{
+		m_mutex.lock();
+		bool notify = !m_signaled;
+		if (notify)
+		{
+			m_signaled = true;
+			m_signalTime = TimeMilliseconds();
+		}
+		m_mutex.unlock();
+
+		// already signaled, the waiter has been woken before
+		if (notify)
+			m_condition.notify_one();
+	}
+	double Wait()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (!m_signaled)
+			m_condition.wait(lock);
+
+		m_signaled = false;
+		return TimeMilliseconds() - m_signalTime;
+	}
+};
+
+//////////////////////////////////////////////////////////////////////////
+// object behind a reader-writer lock
+//
+// blockSecurity() / -> lock exclusively, sharedSecurity() locks for
+// reading only and hands out a const object. guards unlock when they go
+// out of scope; a copied guard takes over the lock from the original.
 template <class T>
 class ThreadSafe
 {
 private:
-	CRITICAL_SECTION m_cs;
+	RWLock m_lock;
 	std::shared_ptr<T> m_obj;
 
 
@@ -15,87 +111,132 @@ private:
 public:
 	class BlockSecurity
 	{
-		ThreadSafe& m_pParent;
-		int m_lockCount;
+		ThreadSafe* m_pParent;
+		mutable bool m_owner;
 
 	public:
-		BlockSecurity(ThreadSafe& pParent) : m_pParent(pParent), m_lockCount(0)
+		BlockSecurity(ThreadSafe& pParent) : m_pParent(&pParent), m_owner(true)
 		{
 			pParent.enterSecureMode();
 		}
+		BlockSecurity(const BlockSecurity& rhs) : m_pParent(rhs.m_pParent), m_owner(rhs.m_owner)
+		{
+			rhs.m_owner = false;
+		}
 		~BlockSecurity()
 		{
-			m_pParent.leaveSecureMode();
+			if (m_owner)
+				m_pParent->leaveSecureMode();
 		}
 
 		T* operator ->()
 		{
-			return m_pParent.m_obj.get();
+			return m_pParent->m_obj.get();
 		}
 		T* operator *()
 		{
-			return m_pParent.m_obj.get();
+			return m_pParent->m_obj.get();
+		}
+	};
+
+	class SharedSecurity
+	{
+		ThreadSafe* m_pParent;
+		mutable bool m_owner;
+
+	public:
+		SharedSecurity(ThreadSafe& pParent) : m_pParent(&pParent), m_owner(true)
+		{
+			pParent.enterSharedMode();
+		}
+		SharedSecurity(const SharedSecurity& rhs) : m_pParent(rhs.m_pParent), m_owner(rhs.m_owner)
+		{
+			rhs.m_owner = false;
+		}
+		~SharedSecurity()
+		{
+			if (m_owner)
+				m_pParent->leaveSharedMode();
+		}
+
+		const T* operator ->()
+		{
+			return m_pParent->m_obj.get();
+		}
+		const T* operator *()
+		{
+			return m_pParent->m_obj.get();
 		}
 	};
 
 	ThreadSafe(T* obj = NULL) : m_obj(obj)
 	{
-		::InitializeCriticalSection(&m_cs);
 	}
 	ThreadSafe(ThreadSafe& rhs)
 	{
-		::InitializeCriticalSection(&m_cs);
-
-		rhs.enterSecureMode();
+		rhs.enterSharedMode();
 		m_obj = rhs.m_obj;
-		rhs.leaveSecureMode();
+		rhs.leaveSharedMode();
 	}
 	~ThreadSafe()
 	{
-		::DeleteCriticalSection(&m_cs);
 	}
 	ThreadSafe& operator = (ThreadSafe& rhs)
 	{
 		if (&rhs == this)
 			return *this;
 
-		this->m_obj = rhs.m_obj;
+		rhs.enterSharedMode();
+		std::shared_ptr<T> obj = rhs.m_obj;
+		rhs.leaveSharedMode();
+
+		BlockSecurity __blockSec(*this);
+		this->m_obj = obj;
 
 		return *this;
 	}
 
 	void enterSecureMode()
 	{
-		::EnterCriticalSection(&m_cs);
+		m_lock.LockExclusive();
 	}
 	void leaveSecureMode()
 	{
-		::LeaveCriticalSection(&m_cs);
+		m_lock.UnlockExclusive();
+	}
+	void enterSharedMode()
+	{
+		m_lock.LockShared();
+	}
+	void leaveSharedMode()
+	{
+		m_lock.UnlockShared();
 	}
 
 	inline BlockSecurity blockSecurity() { return *this; }
+	inline SharedSecurity sharedSecurity() { return *this; }
 
 	void set(T* obj)
 	{
 		BlockSecurity __blockSec(*this);
-		m_obj = std::tr1::shared_ptr<T>(obj);
+		m_obj = std::shared_ptr<T>(obj);
 	}
 	void reset()
 	{
-		BlockSecurity __blockSec(this);
-		m_obj = NULL;
+		BlockSecurity __blockSec(*this);
+		m_obj.reset();
 	}
 
-	inline T* get() { return m_obj; }
-	
+	inline T* get() { return m_obj.get(); }
+
 	operator bool()
 	{
-		BlockSecurity __blockSec(*this);
+		SharedSecurity __sharedSec(*this);
 		return (bool)m_obj;
 	}
 	bool operator !()
 	{
-		BlockSecurity __blockSec(*this);
+		SharedSecurity __sharedSec(*this);
 		return !m_obj;
 	}
 
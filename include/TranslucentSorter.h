@@ -0,0 +1,77 @@
+#pragma once
+
+#include "cbe.h"
+
+namespace cbe
+{
+
+//////////////////////////////////////////////////////////////////////////
+// back to front order of the translucent quads of every chunk
+//
+// each chunk keeps the centroids and the six indices of its translucent
+// quads in mesher order. Sort orders the quads of the given chunks by
+// distance to the camera with a radix sort on the float bits and only
+// touches chunks the camera moved away from by more than the threshold
+// since their last sort. the sorted indices wait in the sorter until the
+// owner writes them over the chunk's translucent index range.
+class CBE_API TranslucentSorter
+{
+public:
+	// sorted indices of one chunk, first is an offset into SortedIndices
+	struct SORTED_RANGE
+	{
+		int chunkIndex;
+		UINT version;
+		UINT first;
+		UINT count;
+	};
+
+private:
+	struct CHUNK_QUADS
+	{
+		std::vector<XMFLOAT3> centroids;
+		std::vector<DWORD> indices;
+		UINT version;
+		bool sorted;
+		XMFLOAT3 sortedFrom;
+	};
+
+	std::vector<CHUNK_QUADS> m_chunks;
+	float m_threshold;
+
+	std::vector<SORTED_RANGE> m_sorted;
+	std::vector<DWORD> m_sortedIndices;
+	UINT m_sortedQuads;
+
+	// radix sort scratch
+	std::vector<UINT> m_keys;
+	std::vector<UINT> m_order;
+	std::vector<UINT> m_tmpKeys;
+	std::vector<UINT> m_tmpOrder;
+
+	void SortChunk(int chunkIndex, const XMFLOAT3& camera);
+
+public:
+	TranslucentSorter();
+
+	void Init(UINT chunkCount);
+
+	// replaces the quads of a chunk, the next Sort sorts it in any case
+	void SetQuads(int chunkIndex, const XMFLOAT3* pCentroids, const DWORD* pIndices, UINT quadCount);
+	// camera distance that triggers a new sort of a chunk
+	void SetThreshold(float distance);
+
+	void Sort(const XMFLOAT3& camera, const int* pChunkIndices, UINT chunkCount);
+
+	inline UINT Version(int chunkIndex) const						{ return m_chunks[chunkIndex].version; }
+	inline const std::vector<SORTED_RANGE>& Sorted() const			{ return m_sorted; }
+	inline const DWORD* SortedIndices(const SORTED_RANGE& range) const	{ return &m_sortedIndices[range.first]; }
+	inline UINT SortedQuads() const									{ return m_sortedQuads; }
+	void ClearSorted();
+
+	// ascending by key, values move with their keys. the temporary arrays
+	// hold count elements
+	static void RadixSort(UINT count, UINT* pKeys, UINT* pValues, UINT* pTmpKeys, UINT* pTmpValues);
+};
+
+}
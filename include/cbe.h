@@ -5,27 +5,39 @@
 
 #pragma once
 
-#ifdef CLEARBLOCKENGINE_EXPORTS
+#if !defined(_WIN32)
+#define CBE_API
+#elif defined(CLEARBLOCKENGINE_EXPORTS)
 #define CBE_API __declspec(dllexport)
 #else
 #define CBE_API __declspec(dllimport)
 #endif
 
 
+#ifdef _WIN32
 #include "targetver.h"
+#endif
 
 #define WIN32_LEAN_AND_MEAN             // Selten verwendete Teile der Windows-Header nicht einbinden.
 #define _CRT_SECURE_NO_WARNINGS
 
-// windows
-#include <Windows.h>
+// windows or the portable shim
+#include "Platform.h"
 
 // stl
 #include <vector>
+#include <deque>
+#include <list>
 #include <fstream>
 #include <string>
 #include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <map>
 
+#ifndef CBE_HEADLESS
 // d3d
 #define CGL_DEBUG
 #include <cgl.h>
@@ -35,12 +47,25 @@
 #include <xnamath.h>
 #include <d3dx9.h>
 #pragma comment(lib, "d3dx9.lib")
+#endif
 
 #include "ThreadSafe.h"
 #include "Block.h"
+#include "CoordDivider.h"
+#include "Hash.h"
+#include "Frustum.h"
+#include "OcclusionBuffer.h"
+#include "BufferAllocator.h"
+#include "MeshBuffer.h"
+#include "DrawList.h"
+#include "TranslucentSorter.h"
 #include "BlockType.h"
 #include "BlockTypeManager.h"
 #include "Chunk.h"
+#include "MeshCache.h"
 #include "ChunkManager.h"
+#include "EditJournal.h"
+#include "RegionFile.h"
+#include "ChunkCodec.h"
 
 // TODO: Hier auf zustzliche Header, die das Programm erfordert, verweisen.
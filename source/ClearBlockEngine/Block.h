@@ -1,5 +1,7 @@
 #pragma once
 
+#include "Platform.h"
+
 namespace cbe
 {
 
@@ -60,6 +62,10 @@ public:
 	inline unsigned __int16 Group() const { return (m_data & GroupReadMask()) >> GroupBitOffset(); }
 	inline bool Active()			const { return (m_data & ActiveReadMask()) == ActiveReadMask();}
 
+	// raw access for persistence (journal, serialization)
+	inline unsigned __int16 Data()	const { return m_data; }
+	inline void SetData(unsigned __int16 data) { m_data = data; }
+
 	const __forceinline static unsigned __int16 MaxType()  { return 1023;}
 	const __forceinline static unsigned __int16 MaxGroup() { return 31;  }
 };
@@ -7,7 +7,7 @@ BlockType::BlockType()
 	m_id = 0;
 	m_name = "invalid";
 	m_diffuseTexture = "";
-	m_transparent = true;
+	m_transparent = false;
 	m_color = XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f);
 	m_hasTexture = false;
 	m_relTexSize = 0.0f;
@@ -41,6 +41,7 @@ private:
 
 public:
 	BlockType();
+	virtual ~BlockType() { }
 	
 	const inline USHORT			Id()			const { return m_id; }
 	const inline bool			Transparent()	const { return m_transparent; }
@@ -16,7 +16,9 @@ BlockTypeManager::BlockTypeManager( UINT texSize )
 
 	m_texSize = texSize;
 
+#ifndef CBE_HEADLESS
 	m_pViewCollection = cgl::CGLRenderTargetViewCollection::Create();
+#endif
 }
 BlockTypeManager::~BlockTypeManager()
 {
@@ -58,6 +60,32 @@ void BlockTypeManager::RemoveLastType()
 	m_upToDate = false;
 }
 
+unsigned __int64 BlockTypeManager::GetMeshHash()
+{
+	// ids, transparency and the atlas rectangle of the texture coordinates
+	unsigned __int64 hash = HashMix64(m_types.size());
+	for (UINT index = 0; index < m_types.size(); index++)
+	{
+		BlockType* pType = m_types[index];
+		if (!pType)
+			continue;
+
+		XMFLOAT2 texCoords = pType->TexCoords();
+		float relTexSize = pType->RelTexSize();
+		unsigned __int32 bits[3];
+		memcpy(&bits[0], &texCoords.x, sizeof(float));
+		memcpy(&bits[1], &texCoords.y, sizeof(float));
+		memcpy(&bits[2], &relTexSize, sizeof(float));
+
+		hash = HashCombine(hash, ((unsigned __int64)pType->Id() << 32) | pType->Transparent());
+		hash = HashCombine(hash, ((unsigned __int64)bits[0] << 32) | bits[1]);
+		hash = HashCombine(hash, bits[2]);
+	}
+
+	return hash;
+}
+
+#ifndef CBE_HEADLESS
 bool BlockTypeManager::Build()
 {
 	float texturedTypes = 0;
@@ -939,6 +967,20 @@ bool BlockTypeManager::Init()
 
 	return true;
 }
+#else
+bool BlockTypeManager::Init()
+{
+	return true;
+}
+bool BlockTypeManager::Update()
+{
+	// no atlas to build, types are used by id only
+	m_upToDate = true;
+	return false;
+}
+#endif
+
+#ifndef CBE_HEADLESS
 bool BlockTypeManager::Update()
 {
 
@@ -980,6 +1022,7 @@ void BlockTypeManager::SetAtlasRenderSize( int size )
 	m_atlas->SetWidth((float)size);
 	m_atlas->SetHeight((float)size);
 }
+#endif
 
 
 
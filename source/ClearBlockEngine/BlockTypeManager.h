@@ -8,15 +8,23 @@
 namespace cbe
 {
 
+//////////////////////////////////////////////////////////////////////////
+// headless builds only keep the type table, the atlas needs d3d
+#ifndef CBE_HEADLESS
 class CBE_API BlockTypeManager : private cgl::CGLManagerConnector
+#else
+class CBE_API BlockTypeManager
+#endif
 {
 private:
-	cgl::drawing::PCGLSprite m_atlas;
-	cgl::drawing::PCGLSpriteBatch m_spriteBatch;
 	std::vector<BlockType*> m_types;
 	std::vector<PackedBlockType> m_packedTypes;
+#ifndef CBE_HEADLESS
+	cgl::drawing::PCGLSprite m_atlas;
+	cgl::drawing::PCGLSpriteBatch m_spriteBatch;
 	cgl::PD3D11Effect m_pEffect;
 	cgl::PCGLRenderTargetViewCollection m_pViewCollection;
+#endif
 
 	UINT m_texSize;
 	float m_relTexSize;
@@ -25,6 +33,7 @@ private:
 	
 	bool m_upToDate;
 
+#ifndef CBE_HEADLESS
 	D3D11_VIEWPORT m_viewPort;
 	D3D11_VIEWPORT m_savedViewPort;
 
@@ -53,10 +62,11 @@ protected:
 	bool BuildWithVaryingTextureSizesAndMultipleAtlases();
 	bool BuildWithVaryingTextureSizesAndMultipleAtlasesWithVaryingSize();
 	//////////////////////////////////////////////////////////////////////////
+#endif
 
 public:
 	BlockTypeManager(UINT texSize);
-	~BlockTypeManager();
+	virtual ~BlockTypeManager();
 
 	bool Init();
 	void AddType(BlockType& type);
@@ -64,19 +74,25 @@ public:
 	void ResetType(UINT index);
 	void RemoveLastType();
 	bool Update();
+#ifndef CBE_HEADLESS
 	void Render();
 	void SetAtlasRenderSize(int size);
 
 	inline cgl::drawing::PCGLSprite& GetAtlas()					{ return m_atlas; }
+	inline cgl::PCGLShaderResourceViewCollection& GetAtlases()	{ return m_resourceCollection; }
+	inline cgl::PD3D11ShaderResourceView& GetAtlasArraySRV()	{ return m_pAtlasTexture2DArrSRV; }
+#endif
 	inline UINT GetAtlasSize()									{ return m_atlasSize; }
 	inline float GetRelativeTextureSize()						{ return m_relTexSize; }
 	inline UINT GetTextureSize()								{ return m_texSize; }
 	inline UINT GetTypeCount()									{ return m_types.size(); }
 	inline BlockType* GetType(UINT index)						{ return m_types.at(index); }
-	inline cgl::PCGLShaderResourceViewCollection& GetAtlases()	{ return m_resourceCollection; }
-	inline cgl::PD3D11ShaderResourceView& GetAtlasArraySRV()	{ return m_pAtlasTexture2DArrSRV; }
 	inline std::vector<PackedBlockType>& GetPackedTypes()		{ return m_packedTypes; }
 
+	// hash of every type field a chunk mesh depends on, meshes built
+	// against another hash may have wrong ids or texture coordinates
+	unsigned __int64 GetMeshHash();
+
 	virtual bool Serialize(std::string filename)		{ throw "not implemented"; }
 	virtual bool Deserialize(std::string filename)		{ throw "not implemented"; }
 };
@@ -0,0 +1,130 @@
+#include "cbe.h"
+
+using namespace cbe;
+
+BufferAllocator::BufferAllocator( UINT capacity )
+{
+	Reset(capacity);
+}
+
+void BufferAllocator::Reset( UINT capacity )
+{
+	m_capacity = capacity;
+	m_used = 0;
+	m_allocations = 0;
+
+	m_free.clear();
+	if (capacity != 0)
+		m_free[0] = capacity;
+}
+
+void BufferAllocator::Grow( UINT capacity )
+{
+	if (capacity <= m_capacity)
+		return;
+
+	// the new space joins a free range ending at the old capacity
+	UINT offset = m_capacity;
+	UINT size = capacity - m_capacity;
+	if (!m_free.empty())
+	{
+		std::map<UINT, UINT>::iterator last = m_free.end();
+		last--;
+		if (last->first + last->second == offset)
+		{
+			offset = last->first;
+			size += last->second;
+			m_free.erase(last);
+		}
+	}
+
+	m_free[offset] = size;
+	m_capacity = capacity;
+}
+
+bool BufferAllocator::Allocate( UINT size, UINT* pOffset )
+{
+	if (size == 0)
+		return false;
+
+	std::map<UINT, UINT>::iterator best = m_free.end();
+	for (std::map<UINT, UINT>::iterator it = m_free.begin(); it != m_free.end(); it++)
+	{
+		if (it->second < size || (best != m_free.end() && it->second >= best->second))
+			continue;
+
+		best = it;
+		if (best->second == size)
+			break;
+	}
+
+	if (best == m_free.end())
+		return false;
+
+	*pOffset = best->first;
+
+	// the rest of the range stays free
+	UINT rest = best->second - size;
+	UINT restOffset = best->first + size;
+	m_free.erase(best);
+	if (rest != 0)
+		m_free[restOffset] = rest;
+
+	m_used += size;
+	m_allocations++;
+	return true;
+}
+
+void BufferAllocator::Free( UINT offset, UINT size )
+{
+	if (size == 0)
+		return;
+
+	m_used -= size;
+	m_allocations--;
+
+	std::map<UINT, UINT>::iterator next = m_free.lower_bound(offset);
+
+	// merge with the range ending at offset
+	if (next != m_free.begin())
+	{
+		std::map<UINT, UINT>::iterator prev = next;
+		prev--;
+		if (prev->first + prev->second == offset)
+		{
+			offset = prev->first;
+			size += prev->second;
+			m_free.erase(prev);
+		}
+	}
+
+	// merge with the range starting at the end
+	if (next != m_free.end() && offset + size == next->first)
+	{
+		size += next->second;
+		m_free.erase(next);
+	}
+
+	m_free[offset] = size;
+}
+
+UINT BufferAllocator::LargestFreeRange() const
+{
+	UINT largest = 0;
+	for (std::map<UINT, UINT>::const_iterator it = m_free.begin(); it != m_free.end(); it++)
+	{
+		if (it->second > largest)
+			largest = it->second;
+	}
+
+	return largest;
+}
+
+float BufferAllocator::Fragmentation() const
+{
+	UINT freeSpace = FreeSpace();
+	if (freeSpace == 0)
+		return 0.0f;
+
+	return 1.0f - (float)LargestFreeRange() / (float)freeSpace;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "cbe.h"
+
+namespace cbe
+{
+
+//////////////////////////////////////////////////////////////////////////
+// sub-allocator for ranges of one large buffer
+//
+// sizes and offsets are in elements. free ranges are kept sorted by
+// offset, Allocate takes the smallest one that fits (best fit) and Free
+// merges a range with its free neighbours right away, so two free ranges
+// never touch. knows nothing about the memory it manages.
+class CBE_API BufferAllocator
+{
+private:
+	UINT m_capacity;
+	UINT m_used;
+	UINT m_allocations;
+
+	// offset -> size
+	std::map<UINT, UINT> m_free;
+
+public:
+	BufferAllocator(UINT capacity = 0);
+
+	// forgets every allocation
+	void Reset(UINT capacity);
+
+	// appends free space at the end, existing offsets stay valid
+	void Grow(UINT capacity);
+
+	bool Allocate(UINT size, UINT* pOffset);
+	void Free(UINT offset, UINT size);
+
+	inline UINT Capacity() const		{ return m_capacity; }
+	inline UINT Used() const			{ return m_used; }
+	inline UINT FreeSpace() const		{ return m_capacity - m_used; }
+	inline UINT Allocations() const		{ return m_allocations; }
+	inline UINT FreeRangeCount() const	{ return (UINT)m_free.size(); }
+	UINT LargestFreeRange() const;
+
+	// 0 when all free space is one range, towards 1 the more it is split
+	float Fragmentation() const;
+};
+
+}
@@ -6,50 +6,72 @@ using namespace cbe;
 // chunk triangle merged
 // 
 Chunk::Chunk(ChunkManager* pManager, int ix, int iy, int iz, XMFLOAT3 pos, unsigned __int8 chunkSize, float blockSize, ChunkManager* pMgr )
-	: m_pManager(pManager), m_ix(ix), m_iy(iy), m_iz(iz), m_vecPos(pos), m_size(chunkSize), m_blockSize(blockSize), m_numTris(0), m_numVertices(0),
-		m_numActiveBlocks(0), m_numIndices(0), m_numBlocksVisible(0)
+	: m_vecPos(pos), m_ix(ix), m_iy(iy), m_iz(iz), m_pManager(pManager), m_size(chunkSize), m_blockSize(blockSize), m_numVertices(0), m_numIndices(0), m_numTris(0),
+	  m_numActiveBlocks(0), m_numBlocksVisible(0), m_numOpaqueBlocks(0)
 {
 	m_pBlocks = new Block[chunkSize * chunkSize * chunkSize];
+	m_mappedBlocks = false;
 	m_upToDate = false;
 	m_building = false;
-	
-	InitializeCriticalSection(&m_criticalSection);
+	m_meshPending = false;
+	m_hasBounds = false;
+	m_buildConnectivity = CHUNK_CONNECTIVITY_ALL;
+	m_connectivity = CHUNK_CONNECTIVITY_ALL;
+	memset(m_buildOccluders, CHUNK_NO_OCCLUDER, sizeof(m_buildOccluders));
+	memset(m_occluders, CHUNK_NO_OCCLUDER, sizeof(m_occluders));
+	ZeroMemory(m_buildRanges, sizeof(m_buildRanges));
+	ZeroMemory(m_ranges, sizeof(m_ranges));
+	ZeroMemory(&m_allocation, sizeof(m_allocation));
+
+	m_meshGeneration = 0;
+	for (int level = 0; level < CHUNK_LOD_LEVELS; level++)
+	{
+		m_lods[level].state = CHUNK_LOD_NONE;
+		m_lods[level].generation = 0;
+		m_lods[level].hasBounds = false;
+		ZeroMemory(&m_lods[level].allocation, sizeof(MESH_ALLOCATION));
+		ZeroMemory(m_lods[level].ranges, sizeof(m_lods[level].ranges));
+	}
+
+	InitOccupancy();
+	m_blockHash = 0;
+	m_buildTypesHash = 0;
+	m_meshKey = 0;
+	m_editGeneration = 0;
+	m_savedGeneration = 0;
 }
 Chunk::~Chunk( void )
 {
-	EnterCriticalSection(&m_criticalSection);
+	m_lock.LockExclusive();
 
-	SAFE_DELETE_ARRAY(m_pBlocks);
+	if (!m_mappedBlocks)
+		SAFE_DELETE_ARRAY(m_pBlocks);
 
-	m_pVertexBuffer->ResetData();
-	m_pIndexBuffer->ResetData();
+	// lod builds mesh into temporary chunks that never upload
+	if (m_allocation.indexCount != 0)
+		m_pManager->GetMeshBuffer().Free(&m_allocation, m_pManager->GetFrame());
+	FreeLods();
 
-	LeaveCriticalSection(&m_criticalSection);
-	DeleteCriticalSection(&m_criticalSection);
+	m_lock.UnlockExclusive();
 }
 
 void Chunk::SetBlockState( int x, int y, int z, BOOL state )
 {
-	EnterCriticalSection(&m_criticalSection);
-
-	m_pBlocks[_3dto1d(x, y, z)].SetActive(state);
-	m_upToDate = false;
-
-	LeaveCriticalSection(&m_criticalSection);
+	SetBlockState(_3dto1d(x, y, z), state);
 }
 void Chunk::SetBlockState( int index, BOOL state )
 {	
-	EnterCriticalSection(&m_criticalSection);
+	m_lock.LockExclusive();
+	OwnBlocks();
 
+	Block previous = m_pBlocks[index];
 	m_pBlocks[index].SetActive(state);
-	m_upToDate = false;
+	BlockChanged(index, previous);
 
-	LeaveCriticalSection(&m_criticalSection);
+	m_lock.UnlockExclusive();
 }
 bool Chunk::GetBlockState( int x, int y, int z )
 {
-	EnterCriticalSection(&m_criticalSection);
-
 	if ( x < 0 || x >= m_size ||
 		 y < 0 || y >= m_size ||
 		 z < 0 || z >= m_size)
@@ -57,252 +79,1061 @@ bool Chunk::GetBlockState( int x, int y, int z )
 		return false;
 	}
 
+	m_lock.LockShared();
 	bool active =  m_pBlocks[_3dto1d(x, y, z)].Active();
-	LeaveCriticalSection(&m_criticalSection);
+	m_lock.UnlockShared();
 	return active;
 }
 bool Chunk::GetBlockState( int index )
 {
-	EnterCriticalSection(&m_criticalSection);
+	m_lock.LockShared();
 	bool active =  m_pBlocks[index].Active();
-	LeaveCriticalSection(&m_criticalSection);
+	m_lock.UnlockShared();
 	return active;
 }
 
-void Chunk::SetBlockType( int x, int y, int z, unsigned __int16 type )
+Block Chunk::GetBlock( int index )
 {
-	EnterCriticalSection(&m_criticalSection);
+	m_lock.LockShared();
+	Block block = m_pBlocks[index];
+	m_lock.UnlockShared();
 
-	m_pBlocks[_3dto1d(x, y, z)].SetType(type);
-	m_upToDate = false;
+	return block;
+}
+void Chunk::SetBlock( int index, Block block )
+{
+	m_lock.LockExclusive();
+	OwnBlocks();
+
+	Block previous = m_pBlocks[index];
+	m_pBlocks[index] = block;
+	BlockChanged(index, previous);
 
-	LeaveCriticalSection(&m_criticalSection);
+	m_lock.UnlockExclusive();
+}
+
+void Chunk::SetBlockType( int x, int y, int z, unsigned __int16 type )
+{
+	SetBlockType(_3dto1d(x, y, z), type);
 }
 void Chunk::SetBlockType( int index, unsigned __int16 type )
 {
-	EnterCriticalSection(&m_criticalSection);
+	m_lock.LockExclusive();
+	OwnBlocks();
 
+	Block previous = m_pBlocks[index];
 	m_pBlocks[index].SetType(type);
-	m_upToDate = false;
+	BlockChanged(index, previous);
 
-	LeaveCriticalSection(&m_criticalSection);
+	m_lock.UnlockExclusive();
 }
 unsigned __int16 Chunk::GetBlockType( int x, int y, int z )
 {
-	EnterCriticalSection(&m_criticalSection);
+	m_lock.LockShared();
 	unsigned __int16 type = m_pBlocks[z + y * m_size + x * m_size * m_size].Type();
-	LeaveCriticalSection(&m_criticalSection);
+	m_lock.UnlockShared();
 
 	return type;
 }
 
 void Chunk::SetBlockGroup( int index, BYTE group )
 {
-	EnterCriticalSection(&m_criticalSection);
+	m_lock.LockExclusive();
+	OwnBlocks();
 
+	Block previous = m_pBlocks[index];
 	m_pBlocks[index].SetGroup(group);
+	BlockChanged(index, previous);
+
+	m_lock.UnlockExclusive();
+}
+
+void Chunk::BlockChanged( int index, const Block& previous )
+{
+	// called with the lock held
+	const Block& block = m_pBlocks[index];
+	m_blockHash ^= BlockHash(index, previous) ^ BlockHash(index, block);
+	if (block.Active() != previous.Active())
+		UpdateOccupancy(index, block.Active());
+
 	m_upToDate = false;
+	m_editGeneration++;
+}
+unsigned __int64 Chunk::GetContentHash()
+{
+	m_lock.LockShared();
+	unsigned __int64 hash = m_blockHash;
+	m_lock.UnlockShared();
 
-	LeaveCriticalSection(&m_criticalSection);
+	return hash;
 }
 
 bool Chunk::Init()
 {
-	m_pIndexBuffer = cgl::CD3D11IndexBuffer::Create(sizeof(DWORD), D3D11_USAGE_DYNAMIC, D3D11_CPU_ACCESS_WRITE);
-	m_pVertexBuffer = cgl::CD3D11VertexBuffer::Create(sizeof(BlockVertex), D3D11_USAGE_DYNAMIC, D3D11_CPU_ACCESS_WRITE);
-
 	return true;
 }
-bool Chunk::Update()
+bool Chunk::Update(UINT* pUploadedBytes)
 {
-	EnterCriticalSection(&m_criticalSection);
+	m_lock.LockExclusive();
 	if (!m_building && m_upToDate)
 	{
-		if (m_numTris != 0)
+		// only a fresh build has anything to upload
+		UINT bytes = 0;
+		if (m_meshPending)
 		{
-			m_pVertexBuffer->Update();
-			m_pIndexBuffer->Update();
+			// the old mesh makes room first, a failed upload is retried
+			MeshBuffer& meshBuffer = m_pManager->GetMeshBuffer();
+			meshBuffer.Free(&m_allocation, m_pManager->GetFrame());
+			if (!meshBuffer.Allocate(m_pendingVertices.data(), m_pendingVertices.size(), m_pendingIndices.data(), m_pendingIndices.size(), &m_allocation))
+			{
+				m_lock.UnlockExclusive();
+				return false;
+			}
+
+			bytes = m_pendingVertices.size() * sizeof(BlockVertex) + m_pendingIndices.size() * sizeof(DWORD);
+
+			const INDEX_RANGE& translucent = m_buildRanges[CHUNK_RANGE_TRANSPARENT];
+			m_translucentCentroids = m_buildCentroids;
+			m_translucentIndices.assign(m_pendingIndices.begin() + translucent.start, m_pendingIndices.begin() + translucent.start + translucent.count);
+
+#ifndef CBE_HEADLESS
+			// the mesh buffer keeps its copy, release the cpu mesh
+			std::vector<BlockVertex>().swap(m_pendingVertices);
+			std::vector<DWORD>().swap(m_pendingIndices);
+#endif
+			m_meshPending = false;
+
+			// the lod meshes were made for the old blocks
+			FreeLods();
+			m_meshGeneration++;
+
+			m_hasBounds = GetBuildBounds(&m_boundsMin, &m_boundsMax);
+			m_connectivity = m_buildConnectivity;
+			memcpy(m_occluders, m_buildOccluders, sizeof(m_occluders));
+			memcpy(m_ranges, m_buildRanges, sizeof(m_ranges));
 		}
 
-		LeaveCriticalSection(&m_criticalSection);
+		if (pUploadedBytes)
+			*pUploadedBytes = bytes;
+
+		m_lock.UnlockExclusive();
 		return true;
 	}
-	LeaveCriticalSection(&m_criticalSection);
+	m_lock.UnlockExclusive();
 	return false;
 }
-void Chunk::Render()
+bool Chunk::GetBuildBounds( XMFLOAT3* pMin, XMFLOAT3* pMax )
 {
-	EnterCriticalSection(&m_criticalSection);
-	if (m_pVertexBuffer && m_pVertexBuffer->GetBufferSize() != 0)
-	{
-		m_pVertexBuffer->Bind();
-		m_pIndexBuffer->Bind();
-		m_pIndexBuffer->Draw();
-	}
-	LeaveCriticalSection(&m_criticalSection);
+	// blocks are centered on their position, half a block each way
+	float half = m_blockSize / 2.0f;
+	*pMin = XMFLOAT3(m_vecPos.x + m_buildMin[0] * m_blockSize - half, m_vecPos.y + m_buildMin[1] * m_blockSize - half, m_vecPos.z + m_buildMin[2] * m_blockSize - half);
+	*pMax = XMFLOAT3(m_vecPos.x + m_buildMax[0] * m_blockSize + half, m_vecPos.y + m_buildMax[1] * m_blockSize + half, m_vecPos.z + m_buildMax[2] * m_blockSize + half);
+
+	return m_numTris != 0 && m_buildMax[0] >= 0;
 }
-void Chunk::RenderBatched( UINT* pOffset )
+bool Chunk::GetBounds( XMFLOAT3* pMin, XMFLOAT3* pMax )
 {
-	if (m_numTris == 0)
-		return;
+	m_lock.LockShared();
+	bool hasBounds = m_hasBounds;
+	*pMin = m_boundsMin;
+	*pMax = m_boundsMax;
+	m_lock.UnlockShared();
 
-	m_pIndexBuffer->Bind();
-	m_pIndexBuffer->Draw(0, m_numIndices, *pOffset);
-	(*pOffset) += m_numVertices;
+	return hasBounds;
+}
+unsigned __int16 Chunk::GetConnectivity()
+{
+	m_lock.LockShared();
+	unsigned __int16 connectivity = m_connectivity;
+	m_lock.UnlockShared();
+
+	return connectivity;
+}
+void Chunk::GetOccluderLayers( unsigned __int8* pLayers )
+{
+	m_lock.LockShared();
+	memcpy(pLayers, m_occluders, sizeof(m_occluders));
+	m_lock.UnlockShared();
+}
+void Chunk::GetIndexRanges( INDEX_RANGE* pRanges )
+{
+	m_lock.LockShared();
+	memcpy(pRanges, m_ranges, sizeof(m_ranges));
+	m_lock.UnlockShared();
+}
+void Chunk::GetTranslucentQuads( std::vector<XMFLOAT3>* pCentroids, std::vector<DWORD>* pIndices )
+{
+	m_lock.LockShared();
+	*pCentroids = m_translucentCentroids;
+	*pIndices = m_translucentIndices;
+	m_lock.UnlockShared();
 }
 
 bool Chunk::Build(ChunkManager* pMgr)
 {
 	bool leave = false;
-	EnterCriticalSection(&m_criticalSection);
+	m_lock.LockShared();
 	leave = m_building || m_upToDate;
-	LeaveCriticalSection(&m_criticalSection);
+	m_lock.UnlockShared();
 
 	if (leave)
 		return false;
 
-	EnterCriticalSection(&m_criticalSection);
+	m_lock.LockExclusive();
 	m_building = true;
-	m_pVertexBuffer->ResetData();
-	m_pIndexBuffer->ResetData();
+	m_lock.UnlockExclusive();
+
+	// mesh a private copy, so the merge loops run without locking
+	UINT blockCount = m_size * m_size * m_size;
+	Block* pBlocks = new Block[blockCount];
+	m_lock.LockShared();
+	memcpy(pBlocks, m_pBlocks, blockCount * sizeof(Block));
+	unsigned __int64 blockHash = m_blockHash;
+	m_lock.UnlockShared();
+
+	// the same blocks and types mesh the same up to the position, empty
+	// chunks are cheap to build and stay out of the cache
+	LoadTransparency(pMgr);
+	MeshCache& cache = pMgr->GetMeshCache();
+	unsigned __int64 key = MeshKey(blockHash, m_buildTypesHash, m_size);
+	bool cacheable = blockHash != 0 && cache.Enabled();
+
+	CACHED_MESH mesh;
+	if (cacheable && cache.Find(key, &mesh))
+	{
+		LoadMesh(&mesh);
+	}
+	else
+	{
+		// instantiation chosen by the manager for its chunk size
+		BuildFromBlocks(pMgr, pMgr->GetMeshBuilder(), pBlocks);
+
+		if (cacheable)
+		{
+			StoreMesh(&mesh);
+			cache.Insert(key, mesh);
+		}
+	}
+
+	SAFE_DELETE_ARRAY(pBlocks);
+
+	// an edit that bypassed the worker meanwhile gets built again
+	m_lock.LockExclusive();
+	m_meshKey = cacheable ? key : 0;
+	m_upToDate = m_blockHash == blockHash;
+	m_building = false;
+	m_meshPending = true;
+	m_lock.UnlockExclusive();
+
+	return true;
+}
+bool Chunk::SetMesh( unsigned __int64 key, unsigned __int64 typesHash, CACHED_MESH* pMesh )
+{
+	// claimed like a build, so the worker leaves the chunk alone meanwhile
+	m_lock.LockExclusive();
+	bool current = !m_building && !m_upToDate && m_blockHash != 0 && MeshKey(m_blockHash, typesHash, m_size) == key;
+	if (current)
+		m_building = true;
+	m_lock.UnlockExclusive();
+
+	if (!current)
+		return false;
+
+	LoadMesh(pMesh);
+
+	m_lock.LockExclusive();
+	m_meshKey = key;
+	m_upToDate = true;
+	m_building = false;
+	m_meshPending = true;
+	m_lock.UnlockExclusive();
+
+	return true;
+}
+bool Chunk::BuildCachedMesh( ChunkManager* pMgr, unsigned __int64 blockHash, CACHED_MESH* pMesh )
+{
+	Chunk copy(m_pManager, m_ix, m_iy, m_iz, m_vecPos, m_size, m_blockSize, pMgr);
+
+	m_lock.LockShared();
+	bool current = m_blockHash == blockHash;
+	if (current)
+		memcpy(copy.m_pBlocks, m_pBlocks, m_size * m_size * m_size * sizeof(Block));
+	m_lock.UnlockShared();
+
+	if (!current)
+		return false;
+
+	copy.LoadTransparency(pMgr);
+	copy.BuildFromBlocks(pMgr, pMgr->GetMeshBuilder(), copy.m_pBlocks);
+	copy.StoreMesh(pMesh);
+
+	return true;
+}
+unsigned __int64 Chunk::GetMeshKey()
+{
+	m_lock.LockShared();
+	unsigned __int64 key = m_meshKey;
+	m_lock.UnlockShared();
+
+	return key;
+}
+void Chunk::BuildFromBlocks( ChunkManager* pMgr, MeshBuilder builder, const Block* pBlocks )
+{
+	m_lock.LockExclusive();
+	m_pendingVertices.clear();
+	m_pendingIndices.clear();
+	m_buildCentroids.clear();
 	m_numActiveBlocks = 0;
+	m_numOpaqueBlocks = 0;
 	m_numBlocksVisible = 0;
 	m_numIndices = 0;
 	m_numTris = 0;
 	m_numVertices = 0;
-	LeaveCriticalSection(&m_criticalSection);
+	m_lock.UnlockExclusive();
+
+	for (int i = 0; i < 3; i++)
+	{
+		m_buildMin[i] = m_size;
+		m_buildMax[i] = -1;
+	}
+
+	UINT blockCount = m_size * m_size * m_size;
+	BLOCK_INFO* pBlockInfo = new BLOCK_INFO[blockCount];
+	ZeroMemory(pBlockInfo, blockCount * sizeof(BLOCK_INFO));
+
+	(this->*builder)(pMgr, pBlocks, pBlockInfo);
+
+	SAFE_DELETE_ARRAY(pBlockInfo);
+}
+void Chunk::LoadTransparency( ChunkManager* pMgr )
+{
+	BlockTypeManager* pTypeMgr = pMgr->TypeManager();
+	m_buildTransparent.assign(pTypeMgr->GetTypeCount(), 0);
+	for (UINT type = 0; type < m_buildTransparent.size(); type++)
+		m_buildTransparent[type] = pTypeMgr->GetType(type) && pTypeMgr->GetType(type)->Transparent();
+
+	m_buildTypesHash = pTypeMgr->GetMeshHash();
+}
+void Chunk::StoreMesh( CACHED_MESH* pMesh )
+{
+	m_lock.LockShared();
+
+	pMesh->origin = m_vecPos;
+	pMesh->vertices = m_pendingVertices;
+	pMesh->indices = m_pendingIndices;
+	pMesh->centroids = m_buildCentroids;
+	memcpy(pMesh->ranges, m_buildRanges, sizeof(m_buildRanges));
+	memcpy(pMesh->buildMin, m_buildMin, sizeof(m_buildMin));
+	memcpy(pMesh->buildMax, m_buildMax, sizeof(m_buildMax));
+	pMesh->connectivity = m_buildConnectivity;
+	memcpy(pMesh->occluders, m_buildOccluders, sizeof(m_buildOccluders));
+	pMesh->activeBlocks = m_numActiveBlocks;
+	pMesh->opaqueBlocks = m_numOpaqueBlocks;
+	pMesh->visibleBlocks = m_numBlocksVisible;
+
+	m_lock.UnlockShared();
+}
+void Chunk::LoadMesh( CACHED_MESH* pMesh )
+{
+	// the cached mesh was built at another chunk position
+	float dx = m_vecPos.x - pMesh->origin.x;
+	float dy = m_vecPos.y - pMesh->origin.y;
+	float dz = m_vecPos.z - pMesh->origin.z;
+	if (dx != 0.0f || dy != 0.0f || dz != 0.0f)
+	{
+		for (UINT i = 0; i < pMesh->vertices.size(); i++)
+		{
+			pMesh->vertices[i].pos.x += dx;
+			pMesh->vertices[i].pos.y += dy;
+			pMesh->vertices[i].pos.z += dz;
+		}
+		for (UINT i = 0; i < pMesh->centroids.size(); i++)
+		{
+			pMesh->centroids[i].x += dx;
+			pMesh->centroids[i].y += dy;
+			pMesh->centroids[i].z += dz;
+		}
+	}
+
+	m_lock.LockExclusive();
+
+	m_pendingVertices.swap(pMesh->vertices);
+	m_pendingIndices.swap(pMesh->indices);
+	m_buildCentroids.swap(pMesh->centroids);
+	memcpy(m_buildRanges, pMesh->ranges, sizeof(m_buildRanges));
+	memcpy(m_buildMin, pMesh->buildMin, sizeof(m_buildMin));
+	memcpy(m_buildMax, pMesh->buildMax, sizeof(m_buildMax));
+	m_buildConnectivity = pMesh->connectivity;
+	memcpy(m_buildOccluders, pMesh->occluders, sizeof(m_buildOccluders));
+	m_numActiveBlocks = pMesh->activeBlocks;
+	m_numOpaqueBlocks = pMesh->opaqueBlocks;
+	m_numBlocksVisible = pMesh->visibleBlocks;
+	m_numVertices = m_pendingVertices.size();
+	m_numIndices = m_pendingIndices.size();
+	m_numTris = m_numIndices / 3;
+
+	m_lock.UnlockExclusive();
+}
+bool Chunk::BuildIt( ChunkManager* pMgr )
+{
+	m_lock.LockExclusive();
+	if (m_building || m_upToDate)
+	{
+		m_lock.UnlockExclusive();
+		return false;
+	}
+
+	m_building = true;
+	m_lock.UnlockExclusive();
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// lod meshes
+//
+// level n meshes a chunk of size >> n whose blocks are 2^n blocks wide. a
+// cell is active if any of its blocks is, so the coarse solid always
+// contains the fine one: the full mesh occluders and connectivity stay
+// valid and nothing opens up at a seam to a finer neighbor, every chunk
+// mesh is closed at the chunk border anyway. the cell takes the most
+// frequent opaque type, or translucent type if it has no opaque block
+int Chunk::LodLevels( int chunkSize )
+{
+	int levels = 1;
+	while (levels < CHUNK_LOD_LEVELS && chunkSize % (1 << levels) == 0)
+		levels++;
+
+	return levels;
+}
+bool Chunk::RequestLod( int level )
+{
+	m_lock.LockExclusive();
+	bool requested = m_lods[level].state == CHUNK_LOD_NONE;
+	if (requested)
+		m_lods[level].state = CHUNK_LOD_BUILDING;
+	m_lock.UnlockExclusive();
+
+	return requested;
+}
+bool Chunk::BuildLod( ChunkManager* pMgr, int level )
+{
+	const int factor = 1 << level;
+	const int size = m_size / factor;
+	UINT blockCount = m_size * m_size * m_size;
+	Block* pBlocks = new Block[blockCount];
+
+	// the occupancy level of the lod has one cell per coarse block, empty
+	// cells are skipped without looking at their blocks
+	const unsigned char* pFirstCell = &m_occupancy[m_occupancyOffsets[level]];
+	std::vector<unsigned char> cells;
+
+	m_lock.LockShared();
+	bool requested = m_lods[level].state == CHUNK_LOD_BUILDING;
+	UINT generation = m_meshGeneration;
+	memcpy(pBlocks, m_pBlocks, blockCount * sizeof(Block));
+	cells.assign(pFirstCell, pFirstCell + size * size * size);
+	m_lock.UnlockShared();
+
+	if (!requested)
+	{
+		SAFE_DELETE_ARRAY(pBlocks);
+		return false;
+	}
+
+	// the cells are centered like blocks of the coarse size
+	float offset = (factor - 1) * m_blockSize / 2.0f;
+	XMFLOAT3 pos(m_vecPos.x + offset, m_vecPos.y + offset, m_vecPos.z + offset);
+	Chunk lod(m_pManager, m_ix, m_iy, m_iz, pos, size, m_blockSize * factor, pMgr);
+	lod.LoadTransparency(pMgr);
+
+	// cell types in a sortable form, translucent ones after all opaque
+	std::vector<unsigned __int16> keys;
+	keys.reserve(factor * factor * factor);
+	const unsigned __int16 translucentKey = Block::MaxType() + 1;
+
+	for (int cx = 0; cx < size; cx++)
+	{
+		for (int cy = 0; cy < size; cy++)
+		{
+			for (int cz = 0; cz < size; cz++)
+			{
+				if (!cells[OccupancyIndex(level, cx, cy, cz) - m_occupancyOffsets[level]])
+					continue;
+
+				keys.clear();
+				for (int x = cx * factor; x < (cx + 1) * factor; x++)
+				{
+					for (int y = cy * factor; y < (cy + 1) * factor; y++)
+					{
+						for (int z = cz * factor; z < (cz + 1) * factor; z++)
+						{
+							const Block& block = pBlocks[_3dto1d(x, y, z)];
+							if (block.Active())
+								keys.push_back(block.Type() | (lod.Transparent(block) ? translucentKey : 0));
+						}
+					}
+				}
+
+				if (keys.empty())
+					continue;
+
+				// longest run, the first key already is opaque if any is
+				std::sort(keys.begin(), keys.end());
+				bool opaque = keys[0] < translucentKey;
+				unsigned __int16 best = keys[0];
+				UINT bestCount = 0;
+				for (UINT run = 0; run < keys.size(); )
+				{
+					UINT end = run;
+					while (end < keys.size() && keys[end] == keys[run])
+						end++;
+
+					if ((keys[run] < translucentKey) == opaque && end - run > bestCount)
+					{
+						best = keys[run];
+						bestCount = end - run;
+					}
+					run = end;
+				}
+
+				Block& cell = lod.m_pBlocks[lod._3dto1d(cx, cy, cz)];
+				cell.SetType(best & Block::MaxType());
+				cell.SetActive(1);
+			}
+		}
+	}
+
+	SAFE_DELETE_ARRAY(pBlocks);
+
+	lod.BuildFromBlocks(pMgr, SelectMeshBuilder(size), lod.m_pBlocks);
+
+	m_lock.LockExclusive();
+	LOD_MESH& mesh = m_lods[level];
+	bool current = mesh.state == CHUNK_LOD_BUILDING && generation == m_meshGeneration;
+	if (current)
+	{
+		mesh.vertices.swap(lod.m_pendingVertices);
+		mesh.indices.swap(lod.m_pendingIndices);
+		memcpy(mesh.ranges, lod.m_buildRanges, sizeof(mesh.ranges));
+		mesh.hasBounds = lod.GetBuildBounds(&mesh.boundsMin, &mesh.boundsMax);
+		mesh.generation = generation;
+		mesh.state = CHUNK_LOD_BUILT;
+	}
+	m_lock.UnlockExclusive();
+
+	return current;
+}
+bool Chunk::UpdateLod( int level, UINT* pUploadedBytes )
+{
+	m_lock.LockExclusive();
+	LOD_MESH& mesh = m_lods[level];
+	if (mesh.state != CHUNK_LOD_BUILT)
+	{
+		m_lock.UnlockExclusive();
+		return false;
+	}
+
+	if (!m_pManager->GetMeshBuffer().Allocate(mesh.vertices.data(), mesh.vertices.size(), mesh.indices.data(), mesh.indices.size(), &mesh.allocation))
+	{
+		m_lock.UnlockExclusive();
+		return false;
+	}
+
+	if (pUploadedBytes)
+		*pUploadedBytes = mesh.vertices.size() * sizeof(BlockVertex) + mesh.indices.size() * sizeof(DWORD);
+
+#ifndef CBE_HEADLESS
+	std::vector<BlockVertex>().swap(mesh.vertices);
+	std::vector<DWORD>().swap(mesh.indices);
+#endif
+	mesh.state = CHUNK_LOD_UPLOADED;
+
+	m_lock.UnlockExclusive();
+	return true;
+}
+bool Chunk::GetLodMesh( int level, MESH_ALLOCATION* pAllocation, INDEX_RANGE* pRanges, XMFLOAT3* pMin, XMFLOAT3* pMax )
+{
+	m_lock.LockShared();
+	const LOD_MESH& mesh = m_lods[level];
+	bool uploaded = mesh.state == CHUNK_LOD_UPLOADED;
+	if (uploaded)
+	{
+		*pAllocation = mesh.allocation;
+		memcpy(pRanges, mesh.ranges, sizeof(mesh.ranges));
+		*pMin = mesh.hasBounds ? mesh.boundsMin : XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX);
+		*pMax = mesh.hasBounds ? mesh.boundsMax : XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	}
+	m_lock.UnlockShared();
 
-	BLOCK_INFO* pBlockInfo = new BLOCK_INFO[m_size * m_size * m_size];
-	ZeroMemory(pBlockInfo, m_size * m_size * m_size * sizeof(BLOCK_INFO));
+	return uploaded;
+}
+int Chunk::GetLodState( int level )
+{
+	m_lock.LockShared();
+	int state = m_lods[level].state;
+	m_lock.UnlockShared();
 
-	for (int z = 0; z < m_size; z++)
+	return state;
+}
+void Chunk::FreeLods()
+{
+	// called with the lock held
+	for (int level = 1; level < CHUNK_LOD_LEVELS; level++)
 	{
+		LOD_MESH& mesh = m_lods[level];
+		if (mesh.allocation.indexCount != 0)
+			m_pManager->GetMeshBuffer().Free(&mesh.allocation, m_pManager->GetFrame());
+
+		std::vector<BlockVertex>().swap(mesh.vertices);
+		std::vector<DWORD>().swap(mesh.indices);
+		mesh.state = CHUNK_LOD_NONE;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+// occupancy pyramid
+//
+// an edit walks up from the block and stops at the first cell that keeps
+// its value: setting a block only fills empty cells, clearing one looks at
+// the eight children of each cell on the way
+void Chunk::InitOccupancy()
+{
+	m_occupancySizes.assign(1, m_size);
+	m_occupancyOffsets.assign(1, 0);
+
+	UINT cells = 0;
+	while (m_occupancySizes.back() > 1)
+	{
+		int size = (m_occupancySizes.back() + 1) / 2;
+		m_occupancyOffsets.push_back(cells);
+		m_occupancySizes.push_back(size);
+		cells += size * size * size;
+	}
+
+	m_occupancy.assign(cells, 0);
+}
+bool Chunk::ChildrenOccupied( int level, int x, int y, int z ) const
+{
+	int size = m_occupancySizes[level - 1];
+	int maxX = 2 * x + 1 < size ? 2 * x + 1 : size - 1;
+	int maxY = 2 * y + 1 < size ? 2 * y + 1 : size - 1;
+	int maxZ = 2 * z + 1 < size ? 2 * z + 1 : size - 1;
+
+	for (int cx = 2 * x; cx <= maxX; cx++)
+		for (int cy = 2 * y; cy <= maxY; cy++)
+			for (int cz = 2 * z; cz <= maxZ; cz++)
+				if (Occupied(level - 1, cx, cy, cz))
+					return true;
+
+	return false;
+}
+void Chunk::RebuildOccupancy()
+{
+	// called with the lock held. the first level in one sweep over the
+	// blocks, the coarser ones from their children
+	if (m_occupancySizes.size() < 2)
+		return;
+
+	int cells = m_occupancySizes[1];
+	unsigned char* pCells = &m_occupancy[m_occupancyOffsets[1]];
+	memset(pCells, 0, cells * cells * cells);
+
+	const Block* pBlock = m_pBlocks;
+	for (int x = 0; x < m_size; x++)
 		for (int y = 0; y < m_size; y++)
+			for (int z = 0; z < m_size; z++, pBlock++)
+				if (pBlock->Active())
+					pCells[(z >> 1) + (y >> 1) * cells + (x >> 1) * cells * cells] = 1;
+
+	for (int level = 2; level < (int)m_occupancySizes.size(); level++)
+	{
+		int size = m_occupancySizes[level];
+		for (int x = 0; x < size; x++)
+			for (int y = 0; y < size; y++)
+				for (int z = 0; z < size; z++)
+					m_occupancy[OccupancyIndex(level, x, y, z)] = ChildrenOccupied(level, x, y, z);
+	}
+}
+void Chunk::UpdateOccupancy( int index, bool active )
+{
+	// called with the lock held, after the block changed
+	int x = index / (m_size * m_size);
+	int y = (index / m_size) % m_size;
+	int z = index % m_size;
+
+	for (int level = 1; level < (int)m_occupancySizes.size(); level++)
+	{
+		x >>= 1;
+		y >>= 1;
+		z >>= 1;
+
+		unsigned char& cell = m_occupancy[OccupancyIndex(level, x, y, z)];
+		unsigned char occupied = active || ChildrenOccupied(level, x, y, z);
+		if (cell == occupied)
+			break;
+
+		cell = occupied;
+	}
+}
+bool Chunk::RegionOccupied( int level, int x, int y, int z, const int* pMin, const int* pMax ) const
+{
+	if (!Occupied(level, x, y, z))
+		return false;
+
+	// an occupied cell inside the region needs no closer look
+	int cell[3] = { x, y, z };
+	bool inside = true;
+	for (int i = 0; i < 3; i++)
+	{
+		int first = cell[i] << level;
+		int last = ((cell[i] + 1) << level) - 1;
+		inside &= first >= pMin[i] && last <= pMax[i];
+	}
+
+	if (inside || level == 0)
+		return true;
+
+	int size = m_occupancySizes[level - 1];
+	for (int cx = 2 * x; cx <= 2 * x + 1 && cx < size; cx++)
+	{
+		if ((cx << (level - 1)) > pMax[0] || (((cx + 1) << (level - 1)) - 1) < pMin[0])
+			continue;
+
+		for (int cy = 2 * y; cy <= 2 * y + 1 && cy < size; cy++)
+		{
+			if ((cy << (level - 1)) > pMax[1] || (((cy + 1) << (level - 1)) - 1) < pMin[1])
+				continue;
+
+			for (int cz = 2 * z; cz <= 2 * z + 1 && cz < size; cz++)
+			{
+				if ((cz << (level - 1)) > pMax[2] || (((cz + 1) << (level - 1)) - 1) < pMin[2])
+					continue;
+
+				if (RegionOccupied(level - 1, cx, cy, cz, pMin, pMax))
+					return true;
+			}
+		}
+	}
+
+	return false;
+}
+bool Chunk::GetOccupancy( int level, int x, int y, int z )
+{
+	m_lock.LockShared();
+	bool occupied = Occupied(level, x, y, z);
+	m_lock.UnlockShared();
+
+	return occupied;
+}
+int Chunk::GetEmptyLevel( int x, int y, int z )
+{
+	int level = (int)m_occupancySizes.size() - 1;
+
+	// below an empty cell everything is empty
+	m_lock.LockShared();
+	while (level >= 0 && Occupied(level, x >> level, y >> level, z >> level))
+		level--;
+	m_lock.UnlockShared();
+
+	return level;
+}
+bool Chunk::IsEmpty()
+{
+	return !GetOccupancy((int)m_occupancySizes.size() - 1, 0, 0, 0);
+}
+bool Chunk::IsRegionEmpty( const int* pMin, const int* pMax )
+{
+	int min[3], max[3];
+	for (int i = 0; i < 3; i++)
+	{
+		min[i] = pMin[i] > 0 ? pMin[i] : 0;
+		max[i] = pMax[i] < m_size - 1 ? pMax[i] : m_size - 1;
+		if (min[i] > max[i])
+			return true;
+	}
+
+	m_lock.LockShared();
+	bool occupied = RegionOccupied((int)m_occupancySizes.size() - 1, 0, 0, 0, min, max);
+	m_lock.UnlockShared();
+
+	return !occupied;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// mesher
+//
+// every function below is instantiated per chunk dimension, so for the
+// power of two sizes all index math folds into shifts and ors
+template <class Dim>
+void Chunk::BuildMesh( ChunkManager* pMgr, const Block* pBlocks, BLOCK_INFO* pBlockInfo )
+{
+	Dim dim(m_size);
+	const int size = dim.Size();
+
+	// opaque quads are collected per direction, translucent ones apart,
+	// all are concatenated at the end
+	std::vector<DWORD> directionIndices[VERT_NORMAL_COUNT];
+	std::vector<DWORD> transparentIndices;
+
+	// nobody reads the pending mesh while m_building is set, it is
+	// filled here and handed over once at the end
+	std::vector<BlockVertex> vertices;
+	BlockType unknownType;
+
+	// keeps the capacity of the last build
+	m_lock.LockExclusive();
+	vertices.swap(m_pendingVertices);
+	m_lock.UnlockExclusive();
+
+	for (int z = 0; z < size; z++)
+	{
+		for (int y = 0; y < size; y++)
 		{
-			for (int x = 0; x < m_size; x++)
+			for (int x = 0; x < size; x++)
 			{
-				GetBlockInfo(x, y, z, pBlockInfo);
-				if(pBlockInfo[_3dto1d(x, y, z)].info & BLOCK_VISIBLE)
+				GetBlockInfo(dim, x, y, z, pBlocks, pBlockInfo);
+				if(pBlockInfo[dim.Index(x, y, z)].info & BLOCK_VISIBLE)
 				{
-					EnterCriticalSection(&m_criticalSection);
 					m_numBlocksVisible++;
-					unsigned __int16 blockTypeIndex = m_pBlocks[_3dto1d(x, y, z)].Type();
-					unsigned __int16 blockTypeGroup = m_pBlocks[_3dto1d(x, y, z)].Group();
-					LeaveCriticalSection(&m_criticalSection);
+
+					// grow the bounds of the drawn blocks
+					if (x < m_buildMin[0]) m_buildMin[0] = x;
+					if (y < m_buildMin[1]) m_buildMin[1] = y;
+					if (z < m_buildMin[2]) m_buildMin[2] = z;
+					if (x > m_buildMax[0]) m_buildMax[0] = x;
+					if (y > m_buildMax[1]) m_buildMax[1] = y;
+					if (z > m_buildMax[2]) m_buildMax[2] = z;
+
+					unsigned __int16 blockTypeIndex = pBlocks[dim.Index(x, y, z)].Type();
+					unsigned __int16 blockTypeGroup = pBlocks[dim.Index(x, y, z)].Group();
 
 					BlockType* type = pMgr->TypeManager()->GetType(blockTypeIndex);
-					bool invalidType = false;
 					if (!type)
-					{
-						type = new BlockType();
-						invalidType = true;
-					}
+						type = &unknownType;
 
 					// merge
 					RECTANGLE rects[6];
-					UINT numRects = Merge(x, y, z, blockTypeGroup, *type, rects, pBlockInfo);
+					UINT numRects = Merge(dim, x, y, z, blockTypeGroup, *type, rects, pBlocks, pBlockInfo);
 					if (numRects == 0)
 						continue;
 
-					BlockVertex* pVerts = new BlockVertex[numRects * 4];
-					DWORD* pIndices = new DWORD[numRects * 6];
+					DWORD pIndices[6 * 6];
 					DWORD baseIndices[6] = { 0, 1, 2, 0, 2, 3};
 					for (UINT rect = 0; rect < numRects; rect++)
 					{
+						// indices
+						for (int i = 0; i < 6; i++)
+							pIndices[rect * 6 + i] = vertices.size() + baseIndices[i];
+
 						// Vertices
 						for (int i = 0; i < 4; i++)
 						{
-							pVerts[rect * 4 + i].indices[VERT_INDEX_TYPE] = type->Id();
-							pVerts[rect * 4 + i].indices[VERT_INDEX_NORMAL] = rects[rect].normalIndex;
-							pVerts[rect * 4 + i].pos = rects[rect].corners[i];
-							pVerts[rect * 4 + i].texCoord = rects[rect].texCoords[i];
+							BlockVertex vertex;
+							vertex.indices[VERT_INDEX_TYPE] = type->Id();
+							vertex.indices[VERT_INDEX_NORMAL] = rects[rect].normalIndex;
+							vertex.pos = rects[rect].corners[i];
+							vertex.texCoord = rects[rect].texCoords[i];
+							vertices.push_back(vertex);
 						}
+					}
 
-						// indices
-						EnterCriticalSection(&m_criticalSection);
-						for (int i = 0; i < 6; i++)
-							pIndices[rect * 6 + i] = m_numVertices + rect * 4 + baseIndices[i];
-						LeaveCriticalSection(&m_criticalSection);
+					// merged quads never mix block types
+					bool transparent = Transparent(pBlocks[dim.Index(x, y, z)]);
+					for (UINT rect = 0; rect < numRects; rect++)
+					{
+						std::vector<DWORD>& bucket = transparent ? transparentIndices : directionIndices[rects[rect].normalIndex];
+						bucket.insert(bucket.end(), pIndices + rect * 6, pIndices + rect * 6 + 6);
+
+						if (transparent)
+						{
+							const XMFLOAT4* pCorners = rects[rect].corners;
+							m_buildCentroids.push_back(XMFLOAT3((pCorners[0].x + pCorners[1].x + pCorners[2].x + pCorners[3].x) * 0.25f,
+																(pCorners[0].y + pCorners[1].y + pCorners[2].y + pCorners[3].y) * 0.25f,
+																(pCorners[0].z + pCorners[1].z + pCorners[2].z + pCorners[3].z) * 0.25f));
+						}
 					}
+				}
+			}
+		}
+	}
+
+	m_lock.LockExclusive();
+	m_pendingVertices.swap(vertices);
+	for (int direction = 0; direction < VERT_NORMAL_COUNT; direction++)
+	{
+		m_buildRanges[direction].start = m_pendingIndices.size();
+		m_buildRanges[direction].count = directionIndices[direction].size();
+		m_pendingIndices.insert(m_pendingIndices.end(), directionIndices[direction].begin(), directionIndices[direction].end());
+	}
+	m_buildRanges[CHUNK_RANGE_TRANSPARENT].start = m_pendingIndices.size();
+	m_buildRanges[CHUNK_RANGE_TRANSPARENT].count = transparentIndices.size();
+	m_pendingIndices.insert(m_pendingIndices.end(), transparentIndices.begin(), transparentIndices.end());
+	m_numVertices = m_pendingVertices.size();
+	m_numIndices = m_pendingIndices.size();
+	m_numTris = m_numIndices / 3;
+	m_lock.UnlockExclusive();
+
+	BuildConnectivity(dim, pBlocks);
+	BuildOccluders(dim, pBlocks);
+}
+
+template <class Dim>
+void Chunk::BuildConnectivity( const Dim& dim, const Block* pBlocks )
+{
+	const int size = dim.Size();
+	const int blockCount = size * size * size;
+
+	if (m_numOpaqueBlocks == 0)
+	{
+		m_buildConnectivity = CHUNK_CONNECTIVITY_ALL;
+		return;
+	}
+
+	m_buildConnectivity = 0;
+	if (m_numOpaqueBlocks == (UINT)blockCount)
+		return;
+
+	// every region of inactive or translucent blocks touching the border
+	// connects all the faces it touches with each other
+	std::vector<unsigned char> visited(blockCount, 0);
+	std::vector<int> stack;
 
-					EnterCriticalSection(&m_criticalSection);
+	for (int x = 0; x < size; x++)
+	{
+		for (int y = 0; y < size; y++)
+		{
+			// only border blocks can start a region that reaches a face
+			bool border = x == 0 || y == 0 || x == size - 1 || y == size - 1;
+			for (int z = 0; z < size; z += (border || z == size - 1) ? 1 : size - 1)
+			{
+				if (visited[dim.Index(x, y, z)] || Opaque(pBlocks[dim.Index(x, y, z)]))
+					continue;
 
-					m_numVertices += numRects * 4;
-					m_numIndices += numRects * 6;
-					m_numTris += numRects * 2;
+				int faces = 0;
+				visited[dim.Index(x, y, z)] = 1;
+				stack.push_back(x | (y << 8) | (z << 16));
 
-					m_pIndexBuffer->AddData((char*)pIndices, numRects * 6);
-					m_pVertexBuffer->AddData((char*)pVerts, numRects * 4);
+				while (!stack.empty())
+				{
+					int packed = stack.back();
+					stack.pop_back();
+
+					int ix = packed & 0xFF;
+					int iy = (packed >> 8) & 0xFF;
+					int iz = packed >> 16;
+
+					if (iz == 0)		faces |= 1 << CHUNK_FACE_FRONT;
+					if (iz == size - 1)	faces |= 1 << CHUNK_FACE_BACK;
+					if (ix == 0)		faces |= 1 << CHUNK_FACE_LEFT;
+					if (ix == size - 1)	faces |= 1 << CHUNK_FACE_RIGHT;
+					if (iy == 0)		faces |= 1 << CHUNK_FACE_BOTTOM;
+					if (iy == size - 1)	faces |= 1 << CHUNK_FACE_TOP;
+
+					const int neighbors[6][3] = { { ix, iy, iz - 1 }, { ix, iy, iz + 1 }, { ix - 1, iy, iz }, { ix + 1, iy, iz }, { ix, iy - 1, iz }, { ix, iy + 1, iz } };
+					for (int n = 0; n < 6; n++)
+					{
+						int nx = neighbors[n][0];
+						int ny = neighbors[n][1];
+						int nz = neighbors[n][2];
 
-					LeaveCriticalSection(&m_criticalSection);
+						if (nx < 0 || nx >= size || ny < 0 || ny >= size || nz < 0 || nz >= size)
+							continue;
 
-					SAFE_DELETE_ARRAY(pVerts);
-					SAFE_DELETE_ARRAY(pIndices);
+						UINT index = dim.Index(nx, ny, nz);
+						if (visited[index] || Opaque(pBlocks[index]))
+							continue;
 
-					if (invalidType)
-						SAFE_DELETE(type);
+						visited[index] = 1;
+						stack.push_back(nx | (ny << 8) | (nz << 16));
+					}
+				}
+
+				for (int a = 0; a < CHUNK_FACE_COUNT; a++)
+				{
+					for (int b = a + 1; b < CHUNK_FACE_COUNT; b++)
+					{
+						if ((faces & (1 << a)) && (faces & (1 << b)))
+							m_buildConnectivity |= 1 << FacePairBit(a, b);
+					}
 				}
 			}
 		}
 	}
+}
 
-	SAFE_DELETE_ARRAY(pBlockInfo);
-
- 	if (m_numTris > 0)
- 	{
-		EnterCriticalSection(&m_criticalSection);
+template <class Dim>
+void Chunk::BuildOccluders( const Dim& dim, const Block* pBlocks )
+{
+	const int size = dim.Size();
+	memset(m_buildOccluders, CHUNK_NO_OCCLUDER, sizeof(m_buildOccluders));
 
-		LeaveCriticalSection(&m_criticalSection);
-	}
+	if (m_numOpaqueBlocks < (UINT)(size * size))
+		return;
 
-	EnterCriticalSection(&m_criticalSection);
-	m_upToDate = true;
-	m_building = false;
-	LeaveCriticalSection(&m_criticalSection);
+	// opaque blocks per layer along x, y and z
+	std::vector<int> counts(3 * size, 0);
+	for (int x = 0; x < size; x++)
+	{
+		for (int y = 0; y < size; y++)
+		{
+			for (int z = 0; z < size; z++)
+			{
+				if (!Opaque(pBlocks[dim.Index(x, y, z)]))
+					continue;
 
-	return true;
-}
-bool Chunk::BuildIt( ChunkManager* pMgr )
-{
-	EnterCriticalSection(&m_criticalSection);
-	if (m_building || m_upToDate)
-		return false;
-	LeaveCriticalSection(&m_criticalSection);
+				counts[x]++;
+				counts[size + y]++;
+				counts[2 * size + z]++;
+			}
+		}
+	}
 
-	m_building = true;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		for (int layer = 0; layer < size; layer++)
+		{
+			if (counts[axis * size + layer] != size * size)
+				continue;
 
-	return true;
+			if (m_buildOccluders[axis * 2] == CHUNK_NO_OCCLUDER)
+				m_buildOccluders[axis * 2] = layer;
+			m_buildOccluders[axis * 2 + 1] = layer;
+		}
+	}
 }
 
-void Chunk::GetBlockInfo( __in unsigned __int8 x, __in unsigned __int8 y, __in unsigned __int8 z, __inout BLOCK_INFO* pBlockInfo )
+template <class Dim>
+void Chunk::GetBlockInfo( const Dim& dim, int x, int y, int z, const Block* pBlocks, BLOCK_INFO* pBlockInfo )
 {
-	EnterCriticalSection(&m_criticalSection);
-	unsigned short info = pBlockInfo[_3dto1d(x, y, z)].info;
-	LeaveCriticalSection(&m_criticalSection);
-
-	if (x < 0 || x >= m_size ||
-		y < 0 || y >= m_size ||
-		z < 0 || z >= m_size ||
-		info & BLOCK_CHECKED)
+	const int size = dim.Size();
+	if (x < 0 || x >= size ||
+		y < 0 || y >= size ||
+		z < 0 || z >= size)
 	{
 		return;
 	}
 
-	if (!GetBlockState(x, y, z))
-	{
-		info = 0;
-		info |= BLOCK_CHECKED;
-
-		EnterCriticalSection(&m_criticalSection);
-		pBlockInfo[_3dto1d(x, y, z)].info = info;
-		LeaveCriticalSection(&m_criticalSection);
+	unsigned short info = pBlockInfo[dim.Index(x, y, z)].info;
+	if (info & BLOCK_CHECKED)
+		return;
 
+	if (!pBlocks[dim.Index(x, y, z)].Active())
+	{
+		pBlockInfo[dim.Index(x, y, z)].info = BLOCK_CHECKED;
 		return;
 	}
 
 	info |= BLOCK_ACTIVE;
 	m_numActiveBlocks++;
 
+	// a translucent block hides nothing behind it, between two translucent
+	// blocks of the same type there is no face
+	const Block& block = pBlocks[dim.Index(x, y, z)];
+	bool transparent = Transparent(block);
+	if (!transparent)
+		m_numOpaqueBlocks++;
+
 	unsigned __int8 numFacesVisible = 0;
 	for ( unsigned __int16 face = 1; face <= BLOCK_FACE_COUNT; face *= 4 )
 	{
@@ -320,23 +1151,21 @@ void Chunk::GetBlockInfo( __in unsigned __int8 x, __in unsigned __int8 y, __in u
 		case BLOCK_FACE_VISIBLE_TOP:	{ iy++; } break; 
 		}
 
-		if (ix < 0 || ix >= m_size ||
-			iy < 0 || iy >= m_size ||
-			iz < 0 || iz >= m_size)
+		if (ix < 0 || ix >= size ||
+			iy < 0 || iy >= size ||
+			iz < 0 || iz >= size)
 		{
-// 			if (!m_pManager->GetBlockState(m_ix * m_size + ix, m_iy * m_size + iy, m_iz * m_size + iz))
-// 			{
-// 				info |= face;
-// 				numFacesVisible++;
-// 			}
-
 			info |= face;
 			numFacesVisible++;
 		}
-		else if (GetBlockState(ix, iy, iz) == false)
+		else
 		{
-			info |= face;
-			numFacesVisible++;
+			const Block& neighbor = pBlocks[dim.Index(ix, iy, iz)];
+			if (!neighbor.Active() || (Transparent(neighbor) && !(transparent && neighbor.Type() == block.Type())))
+			{
+				info |= face;
+				numFacesVisible++;
+			}
 		}
 	}
 
@@ -346,17 +1175,13 @@ void Chunk::GetBlockInfo( __in unsigned __int8 x, __in unsigned __int8 y, __in u
 	}
 
 	info |= BLOCK_CHECKED;
-
-	EnterCriticalSection(&m_criticalSection);
-	pBlockInfo[_3dto1d(x, y, z)].info = info;
-	LeaveCriticalSection(&m_criticalSection);
+	pBlockInfo[dim.Index(x, y, z)].info = info;
 }
 
-unsigned __int8 Chunk::Merge( unsigned __int8 x, unsigned __int8 y, unsigned __int8 z, unsigned __int16 group, BlockType& type, RECTANGLE* pRect, BLOCK_INFO* pBlockInfo )
+template <class Dim>
+unsigned __int8 Chunk::Merge( const Dim& dim, int x, int y, int z, unsigned __int16 group, BlockType& type, RECTANGLE* pRect, const Block* pBlocks, BLOCK_INFO* pBlockInfo )
 {
-	EnterCriticalSection(&m_criticalSection);
-	unsigned short info = pBlockInfo[_3dto1d(x, y, z)].info;
-	LeaveCriticalSection(&m_criticalSection);
+	unsigned short info = pBlockInfo[dim.Index(x, y, z)].info;
 
 	unsigned __int8 numRects = 0;
 	for ( unsigned __int16 face = 1; face <= BLOCK_FACE_COUNT; face *= 4 )
@@ -368,131 +1193,110 @@ unsigned __int8 Chunk::Merge( unsigned __int8 x, unsigned __int8 y, unsigned __i
 			case BLOCK_FACE_VISIBLE_FRONT:
 			case BLOCK_FACE_VISIBLE_BACK: 
 				{ 	  
-					MergeXY(x, y, z, face, group, type, &pRect[numRects], pBlockInfo); 
+					MergeXY(dim, x, y, z, face, group, type, &pRect[numRects], pBlocks, pBlockInfo); 
 				} break;
 
 			case BLOCK_FACE_VISIBLE_LEFT:
 			case BLOCK_FACE_VISIBLE_RIGHT: 
 				{ 
-					MergeYZ(x, y, z, face, group, type, &pRect[numRects], pBlockInfo);
+					MergeYZ(dim, x, y, z, face, group, type, &pRect[numRects], pBlocks, pBlockInfo);
 				} break; 
 
 			case BLOCK_FACE_VISIBLE_BOTTOM:
 			case BLOCK_FACE_VISIBLE_TOP:	
 				{ 
-					MergeXZ(x, y, z, face, group, type, &pRect[numRects], pBlockInfo);
+					MergeXZ(dim, x, y, z, face, group, type, &pRect[numRects], pBlocks, pBlockInfo);
 				} break; 
 			}
 
-			pBlockInfo[_3dto1d(x, y, z)].info |= (2 * face);
+			pBlockInfo[dim.Index(x, y, z)].info |= (2 * face);
 			numRects++;
 		}
 	}
 
 	return numRects;
 }
-void Chunk::MergeXY( unsigned __int8 x, unsigned __int8 y, unsigned __int8 z, unsigned __int16 face, unsigned __int16 group, BlockType& type, RECTANGLE* pRect, BLOCK_INFO* pBlockInfo )
+template <class Dim>
+void Chunk::MergeXY( const Dim& dim, int x, int y, int z, unsigned __int16 face, unsigned __int16 group, BlockType& type, RECTANGLE* pRect, const Block* pBlocks, BLOCK_INFO* pBlockInfo )
 {
+	const int size = dim.Size();
+
 	// left border
-	unsigned __int8 left = 0;
-	if (x != left)
+	int left = 0;
+	for (int ix = x - 1; ix >= 0; ix--)
 	{
-		for (unsigned __int8 ix = x - 1; ix >= 0; ix--)
+		GetBlockInfo(dim, ix, y, z, pBlocks, pBlockInfo);
+		if (!BlockMergeable(dim, ix, y, z, face, group, type, pBlocks, pBlockInfo))
 		{
-			GetBlockInfo(ix, y, z, pBlockInfo);
-			if (!BlockMergeable(ix, y, z, face, group, type, pBlockInfo))
-			{
-				left = ix + 1;
-				break;
-			}
-
-			EnterCriticalSection(&m_criticalSection);
-			pBlockInfo[_3dto1d(ix, y, z)].info |= (2 * face);
-			LeaveCriticalSection(&m_criticalSection);
+			left = ix + 1;
+			break;
 		}
+
+		pBlockInfo[dim.Index(ix, y, z)].info |= (2 * face);
 	}
 
 	// right border
-	unsigned __int8 right = m_size - 1;
-	if (x != right)
+	int right = size - 1;
+	for (int ix = x + 1; ix < size; ix++)
 	{
-		for (unsigned __int8 ix = x + 1; ix < m_size; ix++)
+		GetBlockInfo(dim, ix, y, z, pBlocks, pBlockInfo);
+		if (!BlockMergeable(dim, ix, y, z, face, group, type, pBlocks, pBlockInfo))
 		{
-			GetBlockInfo(ix, y, z, pBlockInfo);
-			if (!BlockMergeable(ix, y, z, face, group, type, pBlockInfo))
-			{
-				right = ix - 1;
-				break;
-			}
-
-			EnterCriticalSection(&m_criticalSection);
-			pBlockInfo[_3dto1d(ix, y, z)].info |= (2 * face);
-			LeaveCriticalSection(&m_criticalSection);
+			right = ix - 1;
+			break;
 		}
+
+		pBlockInfo[dim.Index(ix, y, z)].info |= (2 * face);
 	}
 
 	// bottom border
-	unsigned __int8 bottom = 0;
-	if ( y != bottom)
-	{
-		for (unsigned __int8 iy = y - 1; iy >= 0; iy--)
-		{		
-			bool bottomLine = false;
-			for (unsigned __int8 ix = left; ix <= right; ix++)
-			{
-				GetBlockInfo(ix, iy, z, pBlockInfo);
-				if (!BlockMergeable(ix, iy, z, face, group, type, pBlockInfo))
-				{
-					bottomLine = true;
-					break;
-				}
-			}
-		
-			if (bottomLine)
+	int bottom = 0;
+	for (int iy = y - 1; iy >= 0; iy--)
+	{		
+		bool bottomLine = false;
+		for (int ix = left; ix <= right; ix++)
+		{
+			GetBlockInfo(dim, ix, iy, z, pBlocks, pBlockInfo);
+			if (!BlockMergeable(dim, ix, iy, z, face, group, type, pBlocks, pBlockInfo))
 			{
-				bottom = iy + 1;
+				bottomLine = true;
 				break;
 			}
-
-			EnterCriticalSection(&m_criticalSection);
-
-			for (unsigned __int8 ix = left; ix <= right; ix++)
-				pBlockInfo[_3dto1d(ix, iy, z)].info |= (2 * face);
-
-			LeaveCriticalSection(&m_criticalSection);
 		}
+	
+		if (bottomLine)
+		{
+			bottom = iy + 1;
+			break;
+		}
+
+		for (int ix = left; ix <= right; ix++)
+			pBlockInfo[dim.Index(ix, iy, z)].info |= (2 * face);
 	}
 
 	// top border
-	unsigned __int8 top = m_size - 1;
-	if (y != top)
+	int top = size - 1;
+	for (int iy = y + 1; iy < size; iy++)
 	{
-		for (unsigned __int8 iy = y + 1; iy < m_size; iy++)
+		bool topLine = false;
+		for (int ix = left; ix <= right; ix++)
 		{
-			bool topLine = false;
-			for (unsigned __int8 ix = left; ix <= right; ix++)
+			GetBlockInfo(dim, ix, iy, z, pBlocks, pBlockInfo);
+			if (!BlockMergeable(dim, ix, iy, z, face, group, type, pBlocks, pBlockInfo))
 			{
-				GetBlockInfo(ix, iy, z, pBlockInfo);
-				if (!BlockMergeable(ix, iy, z, face, group, type, pBlockInfo))
-				{
-					topLine = true;
-					break;
-				}
-			}
-
-			if (topLine)
-			{
-				top = iy - 1;
+				topLine = true;
 				break;
 			}
+		}
 
-			EnterCriticalSection(&m_criticalSection);
-
-			for (unsigned __int8 ix = left; ix <= right; ix++)
-				pBlockInfo[_3dto1d(ix, iy, z)].info |= (2 * face);
-
-			LeaveCriticalSection(&m_criticalSection);
+		if (topLine)
+		{
+			top = iy - 1;
+			break;
 		}
+
+		for (int ix = left; ix <= right; ix++)
+			pBlockInfo[dim.Index(ix, iy, z)].info |= (2 * face);
 	}
 	
 	// build corner points
@@ -514,109 +1318,91 @@ void Chunk::MergeXY( unsigned __int8 x, unsigned __int8 y, unsigned __int8 z, un
 	}
 	
 	// build tex coords
-	SetTextureCoordinates(x, y, z, right - left + 1, top - bottom + 1, type, pRect);
+	SetTextureCoordinates(right - left + 1, top - bottom + 1, group, type, pRect);
 }
-void Chunk::MergeYZ( unsigned __int8 x, unsigned __int8 y, unsigned __int8 z, unsigned __int16 face, unsigned __int16 group, BlockType& type, RECTANGLE* pRect, BLOCK_INFO* pBlockInfo )
+template <class Dim>
+void Chunk::MergeYZ( const Dim& dim, int x, int y, int z, unsigned __int16 face, unsigned __int16 group, BlockType& type, RECTANGLE* pRect, const Block* pBlocks, BLOCK_INFO* pBlockInfo )
 {
+	const int size = dim.Size();
+
 	// left border
-	unsigned __int8 left = 0;
-	if (z != left)
+	int left = 0;
+	for (int iz = z - 1; iz >= 0; iz--)
 	{
-		for (unsigned __int8 iz = z - 1; iz >= 0; iz--)
+		GetBlockInfo(dim, x, y, iz, pBlocks, pBlockInfo);
+		if (!BlockMergeable(dim, x, y, iz, face, group, type, pBlocks, pBlockInfo))
 		{
-			GetBlockInfo(x, y, iz, pBlockInfo);
-			if (!BlockMergeable(x, y, iz, face, group, type, pBlockInfo))
-			{
-				left = iz + 1;
-				break;
-			}
-
-			EnterCriticalSection(&m_criticalSection);
-			pBlockInfo[_3dto1d(x, y, iz)].info |= (2 * face);
-			LeaveCriticalSection(&m_criticalSection);
+			left = iz + 1;
+			break;
 		}
+
+		pBlockInfo[dim.Index(x, y, iz)].info |= (2 * face);
 	}
 
 	// right border
-	unsigned __int8 right = m_size - 1;
-	if (z != right)
+	int right = size - 1;
+	for (int iz = z + 1; iz < size; iz++)
 	{
-		for (unsigned __int8 iz = z + 1; iz < m_size; iz++)
+		GetBlockInfo(dim, x, y, iz, pBlocks, pBlockInfo);
+		if (!BlockMergeable(dim, x, y, iz, face, group, type, pBlocks, pBlockInfo))
 		{
-			GetBlockInfo(x, y, iz, pBlockInfo);
-			if (!BlockMergeable(x, y, iz, face, group, type, pBlockInfo))
-			{
-				right = iz - 1;
-				break;
-			}
-
-			EnterCriticalSection(&m_criticalSection);
-			pBlockInfo[_3dto1d(x, y, iz)].info |= (2 * face);
-			LeaveCriticalSection(&m_criticalSection);
+			right = iz - 1;
+			break;
 		}
+
+		pBlockInfo[dim.Index(x, y, iz)].info |= (2 * face);
 	}
 
 	// bottom border
-	unsigned __int8 bottom = 0;
-	if (y != bottom)
+	int bottom = 0;
+	for (int iy = y - 1; iy >= 0; iy--)
 	{
-		for (unsigned __int8 iy = y - 1; iy >= 0; iy--)
+		bool bottomLine = false;
+		for (int iz = left; iz <= right; iz++)
 		{
-			bool bottomLine = false;
-			for (unsigned __int8 iz = left; iz <= right; iz++)
-			{
-				GetBlockInfo(x, iy, iz, pBlockInfo);
+			GetBlockInfo(dim, x, iy, iz, pBlocks, pBlockInfo);
 
-				if (!BlockMergeable(x, iy, iz, face, group, type, pBlockInfo))
-				{
-					bottomLine = true;
-					break;
-				}
-			}
-
-			if (bottomLine)
+			if (!BlockMergeable(dim, x, iy, iz, face, group, type, pBlocks, pBlockInfo))
 			{
-				bottom = iy + 1;
+				bottomLine = true;
 				break;
 			}
+		}
 
-			EnterCriticalSection(&m_criticalSection);
-			for (unsigned __int8 iz = left; iz <= right; iz++)
-				pBlockInfo[_3dto1d(x, iy, iz)].info |= (2 * face);
-			LeaveCriticalSection(&m_criticalSection);
+		if (bottomLine)
+		{
+			bottom = iy + 1;
+			break;
 		}
+
+		for (int iz = left; iz <= right; iz++)
+			pBlockInfo[dim.Index(x, iy, iz)].info |= (2 * face);
 	}
 	
 	// top border
-	unsigned __int8 top = m_size - 1 ;
-	if (y != top)
+	int top = size - 1 ;
+	for (int iy = y + 1; iy < size; iy++)
 	{
-		for (unsigned __int8 iy = y + 1; iy < m_size; iy++)
+		bool topLine = false;
+		for (int iz = left; iz <= right; iz++)
 		{
-			bool topLine = false;
-			for (unsigned __int8 iz = left; iz <= right; iz++)
-			{
-				GetBlockInfo(x, iy, iz, pBlockInfo);
-				if (!BlockMergeable(x, iy, iz, face, group, type, pBlockInfo) )
-				{
-					topLine = true;
-					break;
-				}
-			}
-
-			if (topLine)
+			GetBlockInfo(dim, x, iy, iz, pBlocks, pBlockInfo);
+			if (!BlockMergeable(dim, x, iy, iz, face, group, type, pBlocks, pBlockInfo) )
 			{
-				top = iy - 1;
+				topLine = true;
 				break;
 			}
+		}
 
-			EnterCriticalSection(&m_criticalSection);
-			for (unsigned __int8 iz = left; iz <= right; iz++)
-				pBlockInfo[_3dto1d(x, iy, iz)].info |= (2 * face);
-			LeaveCriticalSection(&m_criticalSection);
+		if (topLine)
+		{
+			top = iy - 1;
+			break;
 		}
-	}
 
+		for (int iz = left; iz <= right; iz++)
+			pBlockInfo[dim.Index(x, iy, iz)].info |= (2 * face);
+	}
 	// build corner points
 	if (face == BLOCK_FACE_VISIBLE_LEFT)
 	{
@@ -636,106 +1422,89 @@ void Chunk::MergeYZ( unsigned __int8 x, unsigned __int8 y, unsigned __int8 z, un
 	}
 
 	// build tex coords
-	SetTextureCoordinates(x, y, z, right - left + 1, top - bottom + 1, type, pRect);
+	SetTextureCoordinates(right - left + 1, top - bottom + 1, group, type, pRect);
 }
-void Chunk::MergeXZ( unsigned __int8 x, unsigned __int8 y, unsigned __int8 z, unsigned __int16 face, unsigned __int16 group, BlockType& type, RECTANGLE* pRect, BLOCK_INFO* pBlockInfo )
+template <class Dim>
+void Chunk::MergeXZ( const Dim& dim, int x, int y, int z, unsigned __int16 face, unsigned __int16 group, BlockType& type, RECTANGLE* pRect, const Block* pBlocks, BLOCK_INFO* pBlockInfo )
 {
+	const int size = dim.Size();
+
 	// left border
-	unsigned __int8 left = 0;
-	if (x != left)
+	int left = 0;
+	for (int ix = x - 1; ix >= 0; ix--)
 	{
-		for (unsigned __int8 ix = x - 1; ix >= 0; ix--)
+		GetBlockInfo(dim, ix, y, z, pBlocks, pBlockInfo);
+		if (!BlockMergeable(dim, ix, y, z, face, group, type, pBlocks, pBlockInfo))
 		{
-			GetBlockInfo(ix, y, z, pBlockInfo);
-			if (!BlockMergeable(ix, y, z, face, group, type, pBlockInfo))
-			{
-				left = ix + 1;
-				break;
-			}
-
-			EnterCriticalSection(&m_criticalSection);
-			pBlockInfo[_3dto1d(ix, y, z)].info |= (2 * face);
-			LeaveCriticalSection(&m_criticalSection);
+			left = ix + 1;
+			break;
 		}
+
+		pBlockInfo[dim.Index(ix, y, z)].info |= (2 * face);
 	}
 
 	// right border
-	unsigned __int8 right = m_size - 1;
-	if (x != right)
+	int right = size - 1;
+	for (int ix = x + 1; ix < size; ix++)
 	{
-		for (unsigned __int8 ix = x + 1; ix < m_size; ix++)
+		GetBlockInfo(dim, ix, y, z, pBlocks, pBlockInfo);
+		if (!BlockMergeable(dim, ix, y, z, face, group, type, pBlocks, pBlockInfo))
 		{
-			GetBlockInfo(ix, y, z, pBlockInfo);
-			if (!BlockMergeable(ix, y, z, face, group, type, pBlockInfo))
-			{
-				right = ix - 1;
-				break;
-			}
-
-			EnterCriticalSection(&m_criticalSection);
-			pBlockInfo[_3dto1d(ix, y, z)].info |= (2 * face);
-			LeaveCriticalSection(&m_criticalSection);
+			right = ix - 1;
+			break;
 		}
+
+		pBlockInfo[dim.Index(ix, y, z)].info |= (2 * face);
 	}
 
 	// bottom border
-	unsigned __int8 bottom = 0;
-	if (z != bottom)
+	int bottom = 0;
+	for (int iz = z - 1; iz >= 0; iz--)
 	{
-		for (unsigned __int8 iz = z - 1; iz >= 0; iz--)
+		bool bottomLine = false;
+		for (int ix = left; ix <= right; ix++)
 		{
-			bool bottomLine = false;
-			for (unsigned __int8 ix = left; ix <= right; ix++)
+			GetBlockInfo(dim, ix, y, iz, pBlocks, pBlockInfo);
+			if (!BlockMergeable(dim, ix, y, iz, face, group, type, pBlocks, pBlockInfo))
 			{
-				GetBlockInfo(ix, y, iz, pBlockInfo);
-				if (!BlockMergeable(ix, y, iz, face, group, type, pBlockInfo))
-				{
-					bottomLine = true;
-					break;
-				}
-			}
-
-			if (bottomLine)
-			{
-				bottom = iz + 1;
+				bottomLine = true;
 				break;
 			}
+		}
 
-			EnterCriticalSection(&m_criticalSection);
-			for (unsigned __int8 ix = left; ix <= right; ix++)
-				pBlockInfo[_3dto1d(ix, y, iz)].info |= (2 * face);
-			LeaveCriticalSection(&m_criticalSection);
+		if (bottomLine)
+		{
+			bottom = iz + 1;
+			break;
 		}
+
+		for (int ix = left; ix <= right; ix++)
+			pBlockInfo[dim.Index(ix, y, iz)].info |= (2 * face);
 	}
 
 	// top border
-	unsigned __int8 top = m_size - 1;
-	if (z != top)
+	int top = size - 1;
+	for (int iz = z + 1; iz < size; iz++)
 	{
-		for (unsigned __int8 iz = z + 1; iz < m_size; iz++)
+		bool topLine = false;
+		for (int ix = left; ix <= right; ix++)
 		{
-			bool topLine = false;
-			for (unsigned __int8 ix = left; ix <= right; ix++)
+			GetBlockInfo(dim, ix, y, iz, pBlocks, pBlockInfo);
+			if (!BlockMergeable(dim, ix, y, iz, face, group, type, pBlocks, pBlockInfo))
 			{
-				GetBlockInfo(ix, y, iz, pBlockInfo);
-				if (!BlockMergeable(ix, y, iz, face, group, type, pBlockInfo))
-				{
-					topLine = true;
-					break;
-				}
-			}
-
-			if (topLine)
-			{
-				top = iz - 1;
+				topLine = true;
 				break;
 			}
+		}
 
-			EnterCriticalSection(&m_criticalSection);
-			for (unsigned __int8 ix = left; ix <= right; ix++)
-				pBlockInfo[_3dto1d(ix, y, iz)].info |= (2 * face);
-			LeaveCriticalSection(&m_criticalSection);
+		if (topLine)
+		{
+			top = iz - 1;
+			break;
 		}
+
+		for (int ix = left; ix <= right; ix++)
+			pBlockInfo[dim.Index(ix, y, iz)].info |= (2 * face);
 	}
 
 	// build corner points
@@ -757,15 +1526,13 @@ void Chunk::MergeXZ( unsigned __int8 x, unsigned __int8 y, unsigned __int8 z, un
 	}
 
 	// build tex coords
-	SetTextureCoordinates(x, y, z, right - left + 1, top - bottom + 1, type, pRect);
+	SetTextureCoordinates(right - left + 1, top - bottom + 1, group, type, pRect);
 }
-void Chunk::SetTextureCoordinates( unsigned __int8 x, unsigned __int8 y, unsigned __int8 z, unsigned __int8 width, unsigned __int8 height, BlockType& type, RECTANGLE* pRect )
+void Chunk::SetTextureCoordinates( unsigned __int8 width, unsigned __int8 height, unsigned __int16 group, BlockType& type, RECTANGLE* pRect )
 {
 	// if group is 0 -> tiling
 	XMFLOAT4 texCoords;
-	
-	EnterCriticalSection(&m_criticalSection);
-	if (m_pBlocks[_3dto1d(x, y, z)].Group() == 0)
+	if (group == 0)
 	{
 		texCoords = type.GetRectangleTexCoords(width, height);
 	}
@@ -773,7 +1540,6 @@ void Chunk::SetTextureCoordinates( unsigned __int8 x, unsigned __int8 y, unsigne
 	{
 		texCoords = type.GetRectangleTexCoords(1, 1);
 	}
-	LeaveCriticalSection(&m_criticalSection);
 
 	pRect->texCoords[0] = XMFLOAT2(texCoords.z, texCoords.w);
 	pRect->texCoords[1] = XMFLOAT2(texCoords.x, texCoords.w);
@@ -781,20 +1547,115 @@ void Chunk::SetTextureCoordinates( unsigned __int8 x, unsigned __int8 y, unsigne
 	pRect->texCoords[3] = XMFLOAT2(texCoords.z, texCoords.y);
 }
 
-void Chunk::Serialize( FILE* pFile )
+Chunk::MeshBuilder Chunk::SelectMeshBuilder( int chunkSize )
 {
-	EnterCriticalSection(&m_criticalSection);
-	fwrite(m_pBlocks, sizeof(Block), m_size * m_size * m_size, pFile);
-	LeaveCriticalSection(&m_criticalSection);
+#ifndef CBE_RUNTIME_CHUNK_SIZE
+	switch (chunkSize)
+	{
+	case 16: return &Chunk::BuildMesh<StaticChunkDimension<4>>;
+	case 32: return &Chunk::BuildMesh<StaticChunkDimension<5>>;
+	case 64: return &Chunk::BuildMesh<StaticChunkDimension<6>>;
+	}
+#endif
+
+	return &Chunk::BuildMesh<ChunkDimension>;
 }
-bool Chunk::Deserialize( FILE* pFile )
+
+void Chunk::Serialize( std::vector<BYTE>* pData, UINT* pGeneration )
 {
-	EnterCriticalSection(&m_criticalSection);
-	fread(m_pBlocks, sizeof(Block), m_size * m_size * m_size, pFile);
-	LeaveCriticalSection(&m_criticalSection);
+	UINT length = m_size * m_size * m_size * sizeof(Block);
+	pData->resize(length);
+
+	// edits lock exclusively, the generation matches the copy
+	m_lock.LockShared();
+	memcpy(pData->data(), m_pBlocks, length);
+	*pGeneration = m_editGeneration;
+	m_lock.UnlockShared();
+}
+bool Chunk::Deserialize( const BYTE* pData, UINT length, bool saved )
+{
+	if (length != m_size * m_size * m_size * sizeof(Block))
+		return false;
+
+	m_lock.LockExclusive();
+	if (m_mappedBlocks)
+	{
+		m_pBlocks = new Block[m_size * m_size * m_size];
+		m_mappedBlocks = false;
+	}
+	memcpy(m_pBlocks, pData, length);
+	BlocksReplaced(saved);
+	m_lock.UnlockExclusive();
 
 	return true;
 }
+void Chunk::MarkSaved( UINT generation )
+{
+	// an older save finishing late must not hide newer edits
+	m_lock.LockExclusive();
+	if ((int)(generation - m_savedGeneration) > 0)
+		m_savedGeneration = generation;
+	m_lock.UnlockExclusive();
+}
+bool Chunk::IsUnsaved()
+{
+	m_lock.LockShared();
+	bool unsaved = m_editGeneration != m_savedGeneration;
+	m_lock.UnlockShared();
+
+	return unsaved;
+}
+void Chunk::MapBlocks( const Block* pBlocks )
+{
+	m_lock.LockExclusive();
+	if (!m_mappedBlocks)
+		SAFE_DELETE_ARRAY(m_pBlocks);
+
+	// never written through, see OwnBlocks
+	m_pBlocks = const_cast<Block*>(pBlocks);
+	m_mappedBlocks = true;
+	BlocksReplaced(true);
+	m_lock.UnlockExclusive();
+}
+void Chunk::UnmapBlocks()
+{
+	m_lock.LockExclusive();
+	OwnBlocks();
+	m_lock.UnlockExclusive();
+}
+bool Chunk::IsMapped()
+{
+	m_lock.LockShared();
+	bool mapped = m_mappedBlocks;
+	m_lock.UnlockShared();
+
+	return mapped;
+}
+void Chunk::BlocksReplaced( bool saved )
+{
+	RebuildOccupancy();
+
+	m_blockHash = 0;
+	for (int index = 0; index < m_size * m_size * m_size; index++)
+		m_blockHash ^= BlockHash(index, m_pBlocks[index]);
+
+	m_upToDate = false;
+	m_editGeneration++;
+	if (saved)
+		m_savedGeneration = m_editGeneration;
+}
+void Chunk::OwnBlocks()
+{
+	if (!m_mappedBlocks)
+		return;
+
+	UINT blockCount = m_size * m_size * m_size;
+	Block* pBlocks = new Block[blockCount];
+	memcpy(pBlocks, m_pBlocks, blockCount * sizeof(Block));
+
+	m_pBlocks = pBlocks;
+	m_mappedBlocks = false;
+}
 
 void cbe::Chunk::SetChunkChanged( bool changed )
 {
@@ -1,7 +1,6 @@
 #pragma once
 
 #include "cbe.h"
-#include "ChunkManager.h"
 #include "BlockTypeManager.h"
 #include "Block.h"
 
@@ -37,9 +36,83 @@ struct BlockVertex
 #define VERT_NORMAL_DOWN		XMFLOAT4( 0.0f,-1.0f, 0.0f, 0.0f)
 #define VERT_NORMAL_DOWN_INDEX 5
 
+#define VERT_NORMAL_COUNT 6
+
+// one bit per normal index, index ranges of a chunk to draw
+#define CHUNK_DIRECTIONS_ALL 0x3F
+
+// index ranges of a chunk mesh, the opaque quads by normal index come
+// first, the translucent quads follow in one range
+#define CHUNK_RANGE_TRANSPARENT	VERT_NORMAL_COUNT
+#define CHUNK_RANGE_COUNT		(VERT_NORMAL_COUNT + 1)
+
+// mesh levels of a chunk, level n merges 2^n blocks along every axis
+#define CHUNK_LOD_LEVELS	4
+
+#define CHUNK_LOD_NONE		0
+#define CHUNK_LOD_BUILDING	1
+#define CHUNK_LOD_BUILT		2
+#define CHUNK_LOD_UPLOADED	3
+
+// chunk faces for the connectivity mask, same order as the block faces
+#define CHUNK_FACE_FRONT	0 // -z
+#define CHUNK_FACE_BACK		1 // +z
+#define CHUNK_FACE_LEFT		2 // -x
+#define CHUNK_FACE_RIGHT	3 // +x
+#define CHUNK_FACE_BOTTOM	4 // -y
+#define CHUNK_FACE_TOP		5 // +y
+#define CHUNK_FACE_COUNT	6
+
+#define CHUNK_CONNECTIVITY_ALL 0x7FFF
+
+// occluder layers of a chunk, first and last along x, y and z
+#define CHUNK_OCCLUDER_LAYERS	6
+#define CHUNK_NO_OCCLUDER		0xFF
+
+//////////////////////////////////////////////////////////////////////////
+// chunk dimensions for the mesher
+//
+// ChunkDimension works for every size, StaticChunkDimension bakes a power
+// of two size into the type, so indexing becomes shifts and the merge
+// loops get constant trip counts
+struct ChunkDimension
+{
+	int size;
+
+	ChunkDimension(int _size) : size(_size) {}
+
+	inline int Size() const { return size; }
+	inline UINT Index(int x, int y, int z) const { return z + y * size + x * size * size; }
+};
+
+template <int SizeLog2>
+struct StaticChunkDimension
+{
+	enum
+	{
+		SIZE = 1 << SizeLog2,
+		SHIFT = SizeLog2,
+		MASK = SIZE - 1
+	};
+
+	StaticChunkDimension(int) {}
+
+	inline int Size() const { return SIZE; }
+	inline UINT Index(int x, int y, int z) const { return z | (y << SHIFT) | (x << (2 * SHIFT)); }
+};
+
 class ChunkManager;
+struct CACHED_MESH;
 class CBE_API Chunk
 {
+public:
+	// indices of the quads facing one direction
+	struct INDEX_RANGE
+	{
+		UINT start;
+		UINT count;
+	};
+
 private:
 	XMFLOAT3	m_vecPos;
 	int m_ix;
@@ -51,14 +124,14 @@ private:
 	ChunkManager* m_pManager;
 
 	Block* m_pBlocks;
+	bool m_mappedBlocks;	// m_pBlocks points into a mapped map file, read only
 	unsigned __int8 m_size;
 	float m_blockSize;
 
-	// d3d buffer
-	cgl::PD3D11VertexBuffer		m_pVertexBuffer;
-	cgl::PD3D11IndexBuffer		m_pIndexBuffer;
+	// place of the uploaded mesh in the manager's mesh buffer
+	MESH_ALLOCATION m_allocation;
 
-	// data generation
+	// data generation, Build writes the mesh here, Update uploads it
 	std::vector<BlockVertex> m_pendingVertices;
 	std::vector<DWORD>		 m_pendingIndices;
 	UINT m_numVertices;
@@ -67,10 +140,123 @@ private:
 	UINT m_numActiveBlocks;
 	UINT m_numBlocksVisible;
 
-	// thread safety
-	HANDLE m_thread;
-	CRITICAL_SECTION m_criticalSection;
+	// the mesher groups the opaque indices by normal index and puts the
+	// translucent ones last (see CHUNK_RANGE_COUNT), published in Update
+	INDEX_RANGE m_buildRanges[CHUNK_RANGE_COUNT];
+	INDEX_RANGE m_ranges[CHUNK_RANGE_COUNT];
+
+	// transparency by block type id, taken from the type manager when the
+	// build starts. blocks that are not opaque neither occlude nor block
+	// the connectivity
+	std::vector<unsigned char> m_buildTransparent;
+	UINT m_numOpaqueBlocks;
+
+	// centroids of the translucent quads in index order, published in
+	// Update together with a copy of their indices for depth sorting
+	std::vector<XMFLOAT3> m_buildCentroids;
+	std::vector<XMFLOAT3> m_translucentCentroids;
+	std::vector<DWORD> m_translucentIndices;
+
+	inline bool Transparent(const Block& block) const
+	{
+		return block.Type() < m_buildTransparent.size() && m_buildTransparent[block.Type()] != 0;
+	}
+	inline bool Opaque(const Block& block) const { return block.Active() && !Transparent(block); }
+
+	// block range of the visible blocks, tracked by the mesher and
+	// published with the mesh in Update (bounds of the drawn mesh)
+	int m_buildMin[3];
+	int m_buildMax[3];
+	XMFLOAT3 m_boundsMin;
+	XMFLOAT3 m_boundsMax;
+	bool m_hasBounds;
+
+	// pairs of chunk faces connected through inactive blocks, one bit per
+	// pair (see FacePairBit), published in Update like the bounds
+	unsigned __int16 m_buildConnectivity;
+	unsigned __int16 m_connectivity;
+
+	// first and last completely solid block layer along each axis, used as
+	// occluders (CHUNK_NO_OCCLUDER if there is none), published in Update
+	unsigned __int8 m_buildOccluders[CHUNK_OCCLUDER_LAYERS];
+	unsigned __int8 m_occluders[CHUNK_OCCLUDER_LAYERS];
+
+	// occupancy pyramid, a cell of level n covers 2^n blocks along every
+	// axis and is set if any of them is active. level 0 are the blocks
+	// themselves, the last level is one cell for the whole chunk. kept up
+	// to date by every edit under the lock, so it never waits for a build
+	std::vector<unsigned char> m_occupancy;
+	std::vector<UINT> m_occupancyOffsets;
+	std::vector<int> m_occupancySizes;
+
+	inline UINT OccupancyIndex(int level, int x, int y, int z) const
+	{
+		int size = m_occupancySizes[level];
+		return m_occupancyOffsets[level] + z + y * size + x * size * size;
+	}
+	inline bool Occupied(int level, int x, int y, int z) const
+	{
+		return level == 0 ? m_pBlocks[z + y * m_size + x * m_size * m_size].Active() : m_occupancy[OccupancyIndex(level, x, y, z)] != 0;
+	}
+	bool ChildrenOccupied(int level, int x, int y, int z) const;
+	void InitOccupancy();
+	void RebuildOccupancy();
+	void UpdateOccupancy(int index, bool active);
+	bool RegionOccupied(int level, int x, int y, int z, const int* pMin, const int* pMax) const;
+
+	// content hash of the blocks, the xor of a hash per active block and
+	// its index, so an edit updates it in place and undoing the edit
+	// restores it. the mesh cache key adds the types the mesher read
+	unsigned __int64 m_blockHash;
+	unsigned __int64 m_buildTypesHash;
+	unsigned __int64 m_meshKey;	// of the last built mesh, 0 if uncached
+
+	// counts edits and whole block replacements. the map file holds the
+	// blocks of m_savedGeneration, see ChunkManager::SaveChangedChunks
+	UINT m_editGeneration;
+	UINT m_savedGeneration;
+
+	// copies mapped blocks to private memory before the first edit,
+	// called with the lock held
+	void OwnBlocks();
+	// derived state after the whole block array was replaced, saved if
+	// the blocks came from the map file
+	void BlocksReplaced(bool saved);
+
+	static inline unsigned __int64 BlockHash(int index, const Block& block)
+	{
+		return block.Active() ? HashMix64(((unsigned __int64)index << 16) | block.Data()) : 0;
+	}
+	void BlockChanged(int index, const Block& previous);
+	void StoreMesh(CACHED_MESH* pMesh);
+	void LoadMesh(CACHED_MESH* pMesh);
+
+	// coarser meshes, built on request from a downsampled copy of the
+	// blocks and dropped when the full mesh is replaced. a lod build only
+	// keeps its result if m_meshGeneration did not change meanwhile
+	struct LOD_MESH
+	{
+		int state;
+		UINT generation;
+		MESH_ALLOCATION allocation;
+		INDEX_RANGE ranges[CHUNK_RANGE_COUNT];
+		bool hasBounds;
+		XMFLOAT3 boundsMin;
+		XMFLOAT3 boundsMax;
+		std::vector<BlockVertex> vertices;
+		std::vector<DWORD> indices;
+	};
+	LOD_MESH m_lods[CHUNK_LOD_LEVELS];
+	UINT m_meshGeneration;
+
+	void FreeLods();
+	void LoadTransparency(ChunkManager* pMgr);
+	bool GetBuildBounds(XMFLOAT3* pMin, XMFLOAT3* pMax);
+
+	// thread safety, readers (queries, render, serialize) share the lock
+	RWLock m_lock;
 	bool m_building;
+	bool m_meshPending;
 	
 	struct BLOCK_INFO
 	{
@@ -119,33 +305,58 @@ private:
 	
 	inline UINT _3dto1d(unsigned __int8 x, unsigned __int8 y, unsigned __int8 z) { return z + y * m_size + x * m_size * m_size; }
 
+	// mesher, works on a copy of the blocks (see Build)
+	template <class Dim>
+	void BuildMesh( ChunkManager* pMgr, const Block* pBlocks, BLOCK_INFO* pBlockInfo );
+
+	// flood fill the inactive blocks from the chunk faces
+	template <class Dim>
+	void BuildConnectivity( const Dim& dim, const Block* pBlocks );
+
+	// find the solid layers
+	template <class Dim>
+	void BuildOccluders( const Dim& dim, const Block* pBlocks );
+
 	// check block info
-	void GetBlockInfo( unsigned __int8 x, unsigned __int8 y, unsigned __int8 z, BLOCK_INFO* pBlockInfo);
-	inline bool BlockMergeable( unsigned __int8 x, unsigned __int8 y, unsigned __int8 z, unsigned __int16 face, unsigned __int16 group, BlockType& type, BLOCK_INFO* pBlockInfo)
+	template <class Dim>
+	void GetBlockInfo( const Dim& dim, int x, int y, int z, const Block* pBlocks, BLOCK_INFO* pBlockInfo);
+	template <class Dim>
+	inline bool BlockMergeable( const Dim& dim, int x, int y, int z, unsigned __int16 face, unsigned __int16 group, BlockType& type, const Block* pBlocks, BLOCK_INFO* pBlockInfo)
 	{
-		return ( pBlockInfo[_3dto1d(x, y, z)].info & face &&				// has this face visible
-				(pBlockInfo[_3dto1d(x, y, z)].info & (2 * face)) == 0 &&	// this face hasn't been already used
-				 m_pBlocks[_3dto1d(x, y, z)].Type() == type.Id() &&			// it has the same type
-				 m_pBlocks[_3dto1d(x, y, z)].Group() == group);				// has the same group
+		return ( pBlockInfo[dim.Index(x, y, z)].info & face &&				// has this face visible
+				(pBlockInfo[dim.Index(x, y, z)].info & (2 * face)) == 0 &&	// this face hasn't been already used
+				 pBlocks[dim.Index(x, y, z)].Type() == type.Id() &&			// it has the same type
+				 pBlocks[dim.Index(x, y, z)].Group() == group);				// has the same group
 	}
 
 	// get rectangles
-	unsigned __int8 Merge ( unsigned __int8 x, unsigned __int8 y, unsigned __int8 z, unsigned __int16 group, BlockType& type,  RECTANGLE* pRect, BLOCK_INFO* pBlockInfo );
-	void MergeXY( unsigned __int8 x, unsigned __int8 y, unsigned __int8 z, unsigned __int16 face, unsigned __int16 group, BlockType& type, RECTANGLE* pRect, BLOCK_INFO* pBlockInfo );
-	void MergeYZ( unsigned __int8 x, unsigned __int8 y, unsigned __int8 z, unsigned __int16 face, unsigned __int16 group, BlockType& type, RECTANGLE* pRect, BLOCK_INFO* pBlockInfo );
-	void MergeXZ( unsigned __int8 x, unsigned __int8 y, unsigned __int8 z, unsigned __int16 face, unsigned __int16 group, BlockType& type, RECTANGLE* pRect, BLOCK_INFO* pBlockInfo );
-
-	void SetTextureCoordinates( unsigned __int8 x, unsigned __int8 y, unsigned __int8 z, unsigned __int8 width, unsigned __int8 height, BlockType&, RECTANGLE* pRect );
+	template <class Dim>
+	unsigned __int8 Merge ( const Dim& dim, int x, int y, int z, unsigned __int16 group, BlockType& type,  RECTANGLE* pRect, const Block* pBlocks, BLOCK_INFO* pBlockInfo );
+	template <class Dim>
+	void MergeXY( const Dim& dim, int x, int y, int z, unsigned __int16 face, unsigned __int16 group, BlockType& type, RECTANGLE* pRect, const Block* pBlocks, BLOCK_INFO* pBlockInfo );
+	template <class Dim>
+	void MergeYZ( const Dim& dim, int x, int y, int z, unsigned __int16 face, unsigned __int16 group, BlockType& type, RECTANGLE* pRect, const Block* pBlocks, BLOCK_INFO* pBlockInfo );
+	template <class Dim>
+	void MergeXZ( const Dim& dim, int x, int y, int z, unsigned __int16 face, unsigned __int16 group, BlockType& type, RECTANGLE* pRect, const Block* pBlocks, BLOCK_INFO* pBlockInfo );
+
+	void SetTextureCoordinates( unsigned __int8 width, unsigned __int8 height, unsigned __int16 group, BlockType&, RECTANGLE* pRect );
 		
 
 public:
+	// mesher instantiation for one chunk size, picked once by the manager
+	typedef void (Chunk::*MeshBuilder)(ChunkManager* pMgr, const Block* pBlocks, BLOCK_INFO* pBlockInfo);
+	static MeshBuilder SelectMeshBuilder(int chunkSize);
+
+private:
+	void BuildFromBlocks(ChunkManager* pMgr, MeshBuilder builder, const Block* pBlocks);
+
+public:
+
 	Chunk(ChunkManager* pManager, int ix, int iy, int iz,XMFLOAT3 pos, unsigned __int8 chunkSize, float blockSize, ChunkManager* pMgr);
 	~Chunk(void);
 
 	bool Init();
-	bool Update();
-	void Render();
-	void RenderBatched(UINT* pOffset);
+	bool Update(UINT* pUploadedBytes = NULL);
 	bool Build(ChunkManager* pMgr);
 	bool BuildIt(ChunkManager* pMgr);
 	
@@ -155,25 +366,97 @@ public:
 	void SetBlockState(int x, int y, int z, BOOL state);
 	void SetBlockState(int index, BOOL state);
 
+	Block GetBlock(int index);
+	void SetBlock(int index, Block block);
+
 	unsigned __int16 GetBlockType(int x, int y, int z);
 	void SetBlockType(int x, int y, int z,  unsigned __int16 type);
 	void SetBlockType(int index, unsigned __int16 type);
 	void SetBlockGroup(int index, BYTE group);
 	void SetChunkChanged(bool changed);
 
+	unsigned __int64 GetContentHash();
+
+	// mesh cache key of blocks meshed against a type table (see
+	// BlockTypeManager::GetMeshHash)
+	static inline unsigned __int64 MeshKey(unsigned __int64 blockHash, unsigned __int64 typesHash, int chunkSize)
+	{
+		return HashCombine(HashCombine(blockHash, typesHash), chunkSize);
+	}
+	unsigned __int64 GetMeshKey();
+	// takes a stored mesh instead of building one if the key still matches
+	// the blocks, Update uploads it like a built mesh
+	bool SetMesh(unsigned __int64 key, unsigned __int64 typesHash, CACHED_MESH* pMesh);
+	// meshes a copy of the blocks into pMesh and leaves the own mesh
+	// alone, fails if the blocks no longer have the content hash
+	bool BuildCachedMesh(ChunkManager* pMgr, unsigned __int64 blockHash, CACHED_MESH* pMesh);
+
 	inline UINT ActiveBlocks()	{ return m_numActiveBlocks; }
 	inline UINT VisibleBlocks() { return m_numBlocksVisible; }
 	inline UINT VertexCount()	{ return m_numVertices; }
 	inline UINT IndexCount()	{ return m_numIndices; }
 	inline UINT TriangleCount() { return m_numTris; }
-	inline cgl::PD3D11VertexBuffer& GetVertexBuffer() { return m_pVertexBuffer; }
+	bool GetBounds(XMFLOAT3* pMin, XMFLOAT3* pMax);
+	unsigned __int16 GetConnectivity();
+	void GetOccluderLayers(unsigned __int8* pLayers);
+	void GetIndexRanges(INDEX_RANGE* pRanges);
+	void GetTranslucentQuads(std::vector<XMFLOAT3>* pCentroids, std::vector<DWORD>* pIndices);
+
+	// lod meshes, levels 1 to LodLevels() - 1. RequestLod marks a level for
+	// building, BuildLod runs on the worker, UpdateLod uploads the result
+	static int LodLevels(int chunkSize);
+	bool RequestLod(int level);
+	bool BuildLod(ChunkManager* pMgr, int level);
+	bool UpdateLod(int level, UINT* pUploadedBytes = NULL);
+	bool GetLodMesh(int level, MESH_ALLOCATION* pAllocation, INDEX_RANGE* pRanges, XMFLOAT3* pMin, XMFLOAT3* pMax);
+	int GetLodState(int level);
+
+	// occupancy pyramid, level 0 are the blocks, the last level is the
+	// whole chunk. GetEmptyLevel is the coarsest level whose cell around
+	// the block is empty, -1 if the block is active. the region is given in
+	// block coordinates, bounds included
+	inline int OccupancyLevels()	{ return (int)m_occupancySizes.size(); }
+	bool GetOccupancy(int level, int x, int y, int z);
+	int GetEmptyLevel(int x, int y, int z);
+	bool IsEmpty();
+	bool IsRegionEmpty(const int* pMin, const int* pMax);
+
+	// bit of the face pair (a, b) in the connectivity mask, a != b
+	static inline int FacePairBit(int a, int b)
+	{
+		if (a > b)
+		{
+			int tmp = a;
+			a = b;
+			b = tmp;
+		}
+
+		return a * (11 - a) / 2 + (b - a - 1);
+	}
+	inline const MESH_ALLOCATION& GetAllocation() { return m_allocation; }
+#ifdef CBE_HEADLESS
+	// cpu mesh of the last build, stable while the chunk is up to date
+	inline const std::vector<BlockVertex>& GetMeshVertices()	{ return m_pendingVertices; }
+	inline const std::vector<DWORD>& GetMeshIndices()			{ return m_pendingIndices;  }
+#endif
 
 	inline UINT GetChunkIndexX() { return m_ix; }
 	inline UINT GetChunkIndexY() { return m_iy; }
 	inline UINT GetChunkIndexZ() { return m_iz; }
 
-	void Serialize(FILE* pFile);
-	bool Deserialize(FILE* pFile);
+	// raw blocks and the edit generation they were copied at. the chunk
+	// is unsaved until MarkSaved is called with that generation once
+	// the map file holds them
+	void Serialize(std::vector<BYTE>* pData, UINT* pGeneration);
+	bool Deserialize(const BYTE* pData, UINT length, bool saved);
+	void MarkSaved(UINT generation);
+	bool IsUnsaved();
+
+	// uses the blocks of the map file in place, they have to stay valid
+	// until the chunk is destroyed or edited (see ChunkManager::Deserialize)
+	void MapBlocks(const Block* pBlocks);
+	void UnmapBlocks();
+	bool IsMapped();
 };
 
 }
\ No newline at end of file
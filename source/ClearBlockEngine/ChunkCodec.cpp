@@ -0,0 +1,236 @@
+#include "cbe.h"
+
+using namespace cbe;
+
+void ChunkCodec::Encode( int codec, int level, int chunkSize, const Block* pBlocks, std::vector<BYTE>* pPayload )
+{
+	UINT count = chunkSize * chunkSize * chunkSize;
+	UINT rawLength = 2 + count * sizeof(Block);
+
+	pPayload->clear();
+	if (codec == CHUNK_CODEC_PALETTE_RLE)
+	{
+		std::vector<unsigned __int16> values(count);
+		std::vector<int> indices(0x10000, -1);
+		std::vector<BYTE> candidate;
+
+		int orders = level >= 1 ? SCAN_ORDER_COUNT : 1;
+		for (int order = 0; order < orders; order++)
+		{
+			// only a payload shorter than the best so far is finished
+			UINT limit = pPayload->empty() ? rawLength : pPayload->size();
+
+			Gather(order, chunkSize, pBlocks, values.data());
+			if (EncodePaletteRle(values.data(), count, order, limit, indices.data(), &candidate))
+				pPayload->swap(candidate);
+		}
+	}
+
+	// noise does not compress, raw is the bound
+	if (pPayload->empty() || pPayload->size() >= rawLength)
+	{
+		pPayload->resize(rawLength);
+		(*pPayload)[0] = CHUNK_CODEC_RAW;
+		(*pPayload)[1] = 0;
+		memcpy(pPayload->data() + 2, pBlocks, count * sizeof(Block));
+	}
+}
+bool ChunkCodec::Decode( int chunkSize, const BYTE* pPayload, UINT length, Block* pBlocks )
+{
+	UINT count = chunkSize * chunkSize * chunkSize;
+	if (length == 0)
+		return false;
+
+	switch (pPayload[0])
+	{
+	case CHUNK_CODEC_RAW:
+		{
+			const Block* pRaw = RawBlocks(chunkSize, pPayload, length);
+			if (!pRaw)
+				return false;
+
+			memcpy(pBlocks, pRaw, count * sizeof(Block));
+			return true;
+		}
+
+	case CHUNK_CODEC_PALETTE_RLE:
+		{
+			std::vector<unsigned __int16> values(count);
+			int order = 0;
+			if (!DecodePaletteRle(pPayload, length, count, &order, values.data()))
+				return false;
+
+			Scatter(order, chunkSize, values.data(), pBlocks);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+const Block* ChunkCodec::RawBlocks( int chunkSize, const BYTE* pPayload, UINT length )
+{
+	UINT count = chunkSize * chunkSize * chunkSize;
+	if (length != 2 + count * sizeof(Block) || pPayload[0] != CHUNK_CODEC_RAW)
+		return NULL;
+
+	return (const Block*)(pPayload + 2);
+}
+
+void ChunkCodec::Gather( int order, int chunkSize, const Block* pBlocks, unsigned __int16* pValues )
+{
+	UINT count = chunkSize * chunkSize * chunkSize;
+	if (order == SCAN_CHUNK)
+	{
+		for (UINT i = 0; i < count; i++)
+			pValues[i] = pBlocks[i].Data();
+		return;
+	}
+
+	// same indexing as Chunk::_3dto1d
+	UINT i = 0;
+	for (int y = 0; y < chunkSize; y++)
+	{
+		for (int x = 0; x < chunkSize; x++)
+		{
+			const Block* pRow = pBlocks + y * chunkSize + x * chunkSize * chunkSize;
+			for (int z = 0; z < chunkSize; z++)
+				pValues[i++] = pRow[z].Data();
+		}
+	}
+}
+void ChunkCodec::Scatter( int order, int chunkSize, const unsigned __int16* pValues, Block* pBlocks )
+{
+	UINT count = chunkSize * chunkSize * chunkSize;
+	if (order == SCAN_CHUNK)
+	{
+		for (UINT i = 0; i < count; i++)
+			pBlocks[i].SetData(pValues[i]);
+		return;
+	}
+
+	UINT i = 0;
+	for (int y = 0; y < chunkSize; y++)
+	{
+		for (int x = 0; x < chunkSize; x++)
+		{
+			Block* pRow = pBlocks + y * chunkSize + x * chunkSize * chunkSize;
+			for (int z = 0; z < chunkSize; z++)
+				pRow[z].SetData(pValues[i++]);
+		}
+	}
+}
+
+bool ChunkCodec::EncodePaletteRle( const unsigned __int16* pValues, UINT count, int order, UINT limit, int* pIndices, std::vector<BYTE>* pPayload )
+{
+	// palette in order of appearance, pIndices maps a value to its entry
+	// and is all -1 again on return
+	std::vector<unsigned __int16> palette;
+	for (UINT i = 0; i < count; i++)
+	{
+		if (pIndices[pValues[i]] < 0)
+		{
+			pIndices[pValues[i]] = palette.size();
+			palette.push_back(pValues[i]);
+		}
+	}
+
+	bool encoded = palette.size() <= 0xFFFF && 4 + palette.size() * 2 < limit;
+
+	pPayload->clear();
+	if (!encoded)
+	{
+		for (UINT i = 0; i < palette.size(); i++)
+			pIndices[palette[i]] = -1;
+		return false;
+	}
+
+	pPayload->push_back(CHUNK_CODEC_PALETTE_RLE);
+	pPayload->push_back((BYTE)order);
+	pPayload->push_back((BYTE)palette.size());
+	pPayload->push_back((BYTE)(palette.size() >> 8));
+	for (UINT i = 0; i < palette.size(); i++)
+	{
+		pPayload->push_back((BYTE)palette[i]);
+		pPayload->push_back((BYTE)(palette[i] >> 8));
+	}
+
+	bool wide = palette.size() > 256;
+	for (UINT i = 0; i < count && encoded; )
+	{
+		UINT run = 1;
+		while (i + run < count && pValues[i + run] == pValues[i])
+			run++;
+
+		// 7 bits per byte, the high bit continues
+		UINT length = run - 1;
+		while (length >= 0x80)
+		{
+			pPayload->push_back((BYTE)(length | 0x80));
+			length >>= 7;
+		}
+		pPayload->push_back((BYTE)length);
+
+		int index = pIndices[pValues[i]];
+		pPayload->push_back((BYTE)index);
+		if (wide)
+			pPayload->push_back((BYTE)(index >> 8));
+
+		i += run;
+		encoded = pPayload->size() < limit;
+	}
+
+	for (UINT i = 0; i < palette.size(); i++)
+		pIndices[palette[i]] = -1;
+
+	return encoded;
+}
+bool ChunkCodec::DecodePaletteRle( const BYTE* pPayload, UINT length, UINT count, int* pOrder, unsigned __int16* pValues )
+{
+	if (length < 4)
+		return false;
+
+	*pOrder = pPayload[1];
+	UINT paletteSize = pPayload[2] | (pPayload[3] << 8);
+	if (*pOrder >= SCAN_ORDER_COUNT || paletteSize == 0 || (length - 4) / 2 < paletteSize)
+		return false;
+
+	const BYTE* pPalette = pPayload + 4;
+	UINT pos = 4 + paletteSize * 2;
+	UINT indexBytes = paletteSize > 256 ? 2 : 1;
+
+	UINT filled = 0;
+	while (filled < count)
+	{
+		UINT run = 0;
+		BYTE byte = 0;
+		int shift = 0;
+		do
+		{
+			if (pos >= length || shift > 28)
+				return false;
+
+			byte = pPayload[pos++];
+			run |= (UINT)(byte & 0x7F) << shift;
+			shift += 7;
+		}
+		while (byte & 0x80);
+
+		if (run >= count - filled || length - pos < indexBytes)
+			return false;
+
+		UINT index = pPayload[pos];
+		if (indexBytes == 2)
+			index |= pPayload[pos + 1] << 8;
+		pos += indexBytes;
+
+		if (index >= paletteSize)
+			return false;
+
+		unsigned __int16 value = pPalette[index * 2] | (pPalette[index * 2 + 1] << 8);
+		for (UINT end = filled + run + 1; filled < end; filled++)
+			pValues[filled] = value;
+	}
+
+	return pos == length;
+}
@@ -2,10 +2,39 @@
 
 using namespace cbe;
 
+#ifndef CBE_HEADLESS
 ChunkManager::ChunkManager(cgl::PD3D11Effect pEffect)
-	: m_ppChunks(NULL), m_pEffect(pEffect), m_width(0), m_height(0), m_depth(0)
+	: m_pTypeMgr(NULL), m_ppChunks(NULL), m_width(0), m_height(0), m_depth(0), m_pMeshBuilder(NULL), m_pEffect(pEffect), m_wakeups(0), m_wakeLatency(0), m_pinnedChunks(0), m_processing(false),
+	  m_chunkCodec(CHUNK_CODEC_PALETTE_RLE), m_chunkCodecLevel(1), m_pMappedFile(NULL), m_mappedSize(0), m_hasSavedFile(false), m_ioThreads(0), m_pJournal(NULL), m_compactionThreshold(0),
+	  m_compactionRetry(0), m_compactionFailures(0), m_loadedMeshes(0), m_frontDrawList(0), m_drawListPending(false), m_frame(0), m_drawHasCamera(false),
+	  m_drawOrderValid(false), m_drawOrderHasCamera(false), m_drawOrderSorts(0), m_translucentSortThreshold(0.0f), m_translucentSortWork(0.0f), m_translucentSortTime(0.0f),
+	  m_translucentSortedQuads(0), m_uploadBudgetMs(2.0f), m_uploadBudgetBytes(0), m_uploadedBytes(0), m_uploadedChunks(0), m_culling(false), m_connectivityCulled(0),
+	  m_hasCamera(false), m_submittedTriangles(0), m_occlusionCulling(false), m_maxOccluders(64), m_occlusionCulled(0), m_occluderQuads(0), m_occlusionTime(0.0f),
+	  m_lodDistance(0.0f), m_lodLevels(1), m_lodChunks(0), m_lodBuilds(0)
 {
+	static const float identity[16] = { 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f };
+	m_matWorld = XMFLOAT4X4(identity);
+	m_matWorldInverse = XMFLOAT4X4(identity);
+	m_matViewProj = XMFLOAT4X4(identity);
+	m_meshCache.SetCapacity(16 << 20);
 }
+#else
+ChunkManager::ChunkManager()
+	: m_pTypeMgr(NULL), m_ppChunks(NULL), m_width(0), m_height(0), m_depth(0), m_pMeshBuilder(NULL), m_wakeups(0), m_wakeLatency(0), m_pinnedChunks(0), m_processing(false),
+	  m_chunkCodec(CHUNK_CODEC_PALETTE_RLE), m_chunkCodecLevel(1), m_pMappedFile(NULL), m_mappedSize(0), m_hasSavedFile(false), m_ioThreads(0), m_pJournal(NULL), m_compactionThreshold(0),
+	  m_compactionRetry(0), m_compactionFailures(0), m_loadedMeshes(0), m_frontDrawList(0), m_drawListPending(false), m_frame(0), m_drawHasCamera(false),
+	  m_drawOrderValid(false), m_drawOrderHasCamera(false), m_drawOrderSorts(0), m_translucentSortThreshold(0.0f), m_translucentSortWork(0.0f), m_translucentSortTime(0.0f),
+	  m_translucentSortedQuads(0), m_uploadBudgetMs(2.0f), m_uploadBudgetBytes(0), m_uploadedBytes(0), m_uploadedChunks(0), m_culling(false), m_connectivityCulled(0),
+	  m_hasCamera(false), m_submittedTriangles(0), m_occlusionCulling(false), m_maxOccluders(64), m_occlusionCulled(0), m_occluderQuads(0), m_occlusionTime(0.0f),
+	  m_lodDistance(0.0f), m_lodLevels(1), m_lodChunks(0), m_lodBuilds(0)
+{
+	static const float identity[16] = { 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f };
+	m_matWorld = XMFLOAT4X4(identity);
+	m_matWorldInverse = XMFLOAT4X4(identity);
+	m_matViewProj = XMFLOAT4X4(identity);
+	m_meshCache.SetCapacity(16 << 20);
+}
+#endif
 ChunkManager::~ChunkManager(void)
 {
 	Exit();
@@ -13,6 +42,7 @@ ChunkManager::~ChunkManager(void)
 
 bool ChunkManager::Init(int widht, int height, int depth, int chunkSize)
 {
+#ifndef CBE_HEADLESS
 	UINT techniqueCount = m_pEffect->Techniques();
 	for (UINT technique = 0; technique < techniqueCount; technique++)
 	{
@@ -35,6 +65,7 @@ bool ChunkManager::Init(int widht, int height, int depth, int chunkSize)
 	m_pInputLayout = cgl::CD3D11InputLayout::Create(m_techniques[0].passes[0]);
 	if (!CGL_RESTORE(m_pInputLayout))
 		return false;
+#endif
 
 	m_pTypeMgr = new BlockTypeManager(256);
 	if(!m_pTypeMgr->Init())
@@ -50,8 +81,11 @@ bool ChunkManager::Init(int widht, int height, int depth, int chunkSize)
 		m_ppChunks[i] = NULL;
 
 	m_chunkSize = chunkSize;
+	m_chunkDivider.Init(chunkSize);
 	m_absoluteChunkSize = 50.0f;
+	m_pMeshBuilder = Chunk::SelectMeshBuilder(chunkSize);
 
+#ifndef CBE_HEADLESS
 	m_pBlockTypes = cgl::CD3D11EffectVariableFromSemantic::Create(m_pEffect, "BLOCKTYPES");
 	if (!CGL_RESTORE(m_pBlockTypes))
 		return false;
@@ -68,10 +102,6 @@ bool ChunkManager::Init(int widht, int height, int depth, int chunkSize)
 	if (!CGL_RESTORE(m_pMatWorld))
 		return false;
 
-	InitializeCriticalSection(&m_criticalSection);
-	m_startEvent = CreateEvent(NULL, false, false, L"update asnyc start event");
-	m_endEvent = CreateEvent(NULL, false, false, L"update asnyc end event");
-
 	XMFLOAT4 normals[6];
 	normals[VERT_NORMAL_FRONT_INDEX] = VERT_NORMAL_FRONT;
 	normals[VERT_NORMAL_BACK_INDEX] = VERT_NORMAL_BACK;
@@ -81,207 +111,190 @@ bool ChunkManager::Init(int widht, int height, int depth, int chunkSize)
 	normals[VERT_NORMAL_UP_INDEX] = VERT_NORMAL_UP;
 
 	m_pNormals->get()->AsVector()->SetFloatVectorArray((float*)normals, 0, 6);
+#endif
+
+	// grows on demand, start with room for a few hundred chunk meshes
+	if (!m_meshBuffer.Init(sizeof(BlockVertex), 1 << 18, 1 << 19))
+		return false;
+
 	m_upToDate = false;
+	m_hasSavedFile = false;
 
 	m_tsChunksToChangeIndices.set(new std::list<int>());
-	m_tsChunksToUpdateIndices.set(new std::vector<int>());
+	m_tsChunksToUpdateIndices.set(new std::deque<int>());
+	m_tsLodRequests.set(new std::deque<int>());
+	m_tsBuiltLods.set(new std::deque<int>());
 	m_tsUpdateJobs.set(new std::vector<std::vector<UpdateJob>>());
-	m_tsUpdateJobs->resize(m_width*m_height*m_width);
+	m_tsUpdateJobs->resize(m_width*m_height*m_depth);
+
+	int chunkCount = m_width * m_height * m_depth;
+	m_bounds.minX.assign(chunkCount, FLT_MAX);
+	m_bounds.minY.assign(chunkCount, FLT_MAX);
+	m_bounds.minZ.assign(chunkCount, FLT_MAX);
+	m_bounds.maxX.assign(chunkCount, -FLT_MAX);
+	m_bounds.maxY.assign(chunkCount, -FLT_MAX);
+	m_bounds.maxZ.assign(chunkCount, -FLT_MAX);
+	m_connectivity.assign(chunkCount, CHUNK_CONNECTIVITY_ALL);
+	m_occluderLayers.assign(chunkCount * CHUNK_OCCLUDER_LAYERS, CHUNK_NO_OCCLUDER);
+	Chunk::INDEX_RANGE noRange = { 0, 0 };
+	m_indexRanges.assign(chunkCount * CHUNK_LOD_LEVELS * CHUNK_RANGE_COUNT, noRange);
+	MESH_ALLOCATION noAllocation = { 0, 0, 0, 0 };
+	m_allocations.assign(chunkCount * CHUNK_LOD_LEVELS, noAllocation);
+	m_lodLevels = Chunk::LodLevels(chunkSize);
+	m_lodUploaded.assign(chunkCount, 0);
+	m_lodRequested.assign(chunkCount, 0);
+	m_visibleLods.clear();
+	m_visibleDirections.clear();
+	m_visibleChunks.clear();
+	m_drawOrderValid = false;
+	m_translucentSorter.Init(chunkCount);
+	m_translucentSortThreshold = m_absoluteChunkSize / m_chunkSize;
+	InitGridOccupancy();
 
 	return true;
 }
 void ChunkManager::StartAsyncUpdating()
 {
-	m_thread = CreateThread(NULL, NULL, UpdateAsync, this, NULL, NULL);
+	SetAsyncProccessing(true);
+	m_thread = std::thread(&ChunkManager::UpdateAsync, this);
+	m_drawListThread = std::thread(&ChunkManager::BuildDrawListsAsync, this);
+}
+void ChunkManager::BuildPending()
+{
+	while (ProcessPendingJobs() | BuildNextChunk());
 }
 
 void ChunkManager::Exit()
 {
+	// the worker checks the flag after every wake up, join instead of
+	// waiting for an end signal
 	SetAsyncProccessing(false);
-	SetEvent(m_startEvent);
-	WaitForSingleObject(GetEndEvent(), INFINITE);
+	m_workEvent.Set();
+	if (m_thread.joinable())
+		m_thread.join();
+
+	m_drawListEvent.Set();
+	if (m_drawListThread.joinable())
+		m_drawListThread.join();
+	m_drawListPending = false;
+
+	CloseJournal();
 
-	m_processing = false;
 	if(m_ppChunks)
 	{
+		// a pinned chunk is used without the lock, wait for it. a pin is
+		// only taken under the shared lock, none starts meanwhile
+		m_structureLock.LockExclusive();
+		while (m_pinnedChunks != 0)
+		{
+			m_structureLock.UnlockExclusive();
+			std::this_thread::yield();
+			m_structureLock.LockExclusive();
+		}
+
 		for (int i = 0; i < m_width * m_height * m_depth; i++)
 			SAFE_DELETE(m_ppChunks[i]);
 		
 		SAFE_DELETE(m_ppChunks);
+
+		m_structureLock.UnlockExclusive();
 	}
 
-	SAFE_DELETE(m_pTypeMgr);
+	// no chunk refers to the mapped file anymore
+	if (m_pMappedFile)
+		UnmapFile(m_pMappedFile, m_mappedSize);
+	m_pMappedFile = NULL;
+	m_mappedSize = 0;
+
+	m_meshBuffer.Release();
 
-	DeleteCriticalSection(&m_criticalSection);
+	SAFE_DELETE(m_pTypeMgr);
 }
 
 void ChunkManager::_setBlockState(int* chunkIndices, int* blockIndices, BOOL state )
 {
-	EnterCriticalSection(&m_criticalSection);
+	Chunk* pChunk = LockChunk(chunkIndices[3], true);
 
-	CheckChunk(chunkIndices);
-	m_ppChunks[chunkIndices[3]]->SetBlockState(blockIndices[3], state);
+	pChunk->SetBlockState(blockIndices[3], state);
+	UpdateGridOccupancy(pChunk);
+	JournalEdit(chunkIndices, blockIndices);
 	ChunkChanged(chunkIndices, blockIndices);
 
-	LeaveCriticalSection(&m_criticalSection);
+	UnlockChunk();
 }
 void ChunkManager::_setBlockType( int* chunkIndices, int* blockIndices, USHORT type )
 {
-	EnterCriticalSection(&m_criticalSection);
+	Chunk* pChunk = LockChunk(chunkIndices[3], true);
 
-	CheckChunk(chunkIndices);
-	m_ppChunks[chunkIndices[3]]->SetBlockType(blockIndices[3], type);
+	pChunk->SetBlockType(blockIndices[3], type);
+	JournalEdit(chunkIndices, blockIndices);
 	ChunkChanged(chunkIndices, blockIndices);
 
-	LeaveCriticalSection(&m_criticalSection);
+	UnlockChunk();
 }
 void ChunkManager::_setBlockGroup(int* chunkIndices, int* blockIndices, BYTE group )
 {
-	EnterCriticalSection(&m_criticalSection);
+	Chunk* pChunk = LockChunk(chunkIndices[3], true);
 
-	CheckChunk(chunkIndices);
-	m_ppChunks[chunkIndices[3]]->SetBlockGroup(blockIndices[3], group);
+	pChunk->SetBlockGroup(blockIndices[3], group);
+	JournalEdit(chunkIndices, blockIndices);
 	ChunkChanged(chunkIndices, blockIndices);
 
-	LeaveCriticalSection(&m_criticalSection);
+	UnlockChunk();
 }
 
+#ifndef CBE_HEADLESS
 void ChunkManager::Render()
 {
+	// bound once, every record draws by offset
+	cgl::CGLManagerConnector conn;
 	m_pInputLayout->Bind();
+	m_meshBuffer.Bind(conn.Context());
 
+	// the lock only keeps the list from being switched while it is drawn
+	m_drawListMutex.lock();
+	const DrawList& list = m_drawLists[m_frontDrawList];
 	for (UINT pass = 0; pass < m_techniques[0].passes.size(); pass++)
 	{
 		m_techniques[0].passes[pass]->Apply();
-		for (int i = 0; i < m_width * m_height * m_depth; i++)
-		{
-			Chunk* pChunk = m_ppChunks[i];
-			if (pChunk)
-				pChunk->Render();
-		}
-	}
-}
-void ChunkManager::RenderBatched()
-{
-	EnterCriticalSection(&m_criticalSection);
-
-	// these are always the same
-	UINT strides[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
-	UINT offsets[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
-	ZeroMemory(strides, sizeof(UINT) * D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT);
-	ZeroMemory(offsets, sizeof(UINT) * D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT);
-
-	UINT currPos = 0;
-	ID3D11Buffer*** pppVertexBuffers = new ID3D11Buffer**[10];
-	pppVertexBuffers[0] = new ID3D11Buffer*[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
-	
-	UINT currBatch = 0;
-	for (int i = 0; i < m_width * m_height * m_depth; i++)
-	{
-		Chunk* pChunk = m_ppChunks[i];
-		if (pChunk)
-		{
-			pppVertexBuffers[currBatch][currPos] = pChunk->GetVertexBuffer()->get();
-			currPos++;
-			
-			if (currPos >= D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT)
-			{
-				currPos = 0;
-				currBatch++;
-				pppVertexBuffers[currBatch] = new ID3D11Buffer*[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
-			}
-		}
-	}
-
-	cgl::CGLManagerConnector conn;
-
-	UINT lastBatch = currBatch;
-	UINT lastVertexBufferCount = currPos;
-	if (currPos == 0)
-	{
-		lastBatch--;
-		lastVertexBufferCount = D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT;
+		list.Replay(conn.Context(), DRAW_BUCKET_OPAQUE);
 	}
 
-	UINT vertexOffset = 0;
-	currPos = 0;
-	currBatch = 0;
-
-	m_pInputLayout->Bind();
-	
-	for (UINT pass = 0; pass < m_techniques[0].passes.size(); pass++)
+	// translucent quads blend without writing depth
+	const RENDER_TECHNIQUE& blend = m_techniques.size() > 1 ? m_techniques[1] : m_techniques[0];
+	for (UINT pass = 0; pass < blend.passes.size(); pass++)
 	{
-		m_techniques[0].passes[pass]->Apply();
-
-		if (lastBatch == 0)
-		{
-			conn.Context()->IASetVertexBuffers(0, lastVertexBufferCount, pppVertexBuffers[0], strides, offsets);
-		}
-		else
-		{
-			conn.Context()->IASetVertexBuffers(0, D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT, pppVertexBuffers[0], strides, offsets);	
-		}
-		
-		for (int i = 0; i < m_width * m_height * m_depth; i++)
-		{
-			if (currPos >= D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT)
-			{
-				if (currBatch == lastBatch)
-				{
-					conn.Context()->IASetVertexBuffers(0, lastVertexBufferCount, pppVertexBuffers[currBatch], strides, offsets);
-				}
-				else
-				{
-					conn.Context()->IASetVertexBuffers(0, D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT, pppVertexBuffers[currBatch], strides, offsets);
-				}
-				
-				currBatch++;
-				currPos = 0;
-			}
-
-			Chunk* pChunk = m_ppChunks[i];
-			if (pChunk)
-			{
-				pChunk->RenderBatched(&vertexOffset);
-				currPos++;
-			}
-		}
+		blend.passes[pass]->Apply();
+		list.Replay(conn.Context(), DRAW_BUCKET_TRANSPARENT);
 	}
-
-	for (UINT i = 0; i < lastBatch + 1; i++)
-		SAFE_DELETE_ARRAY(pppVertexBuffers[i]);
-
-	SAFE_DELETE_ARRAY(pppVertexBuffers);
-
-	LeaveCriticalSection(&m_criticalSection);
+	m_drawListMutex.unlock();
 }
+#endif
 
 bool ChunkManager::GetBlockState( int x, int y, int z )
 {
-	EnterCriticalSection(&m_criticalSection);
-
 	int chunkIndices[4];
 	int blockIndices[4];
-	bool state = false;
+	if (!TransformCoords(x, y, z, chunkIndices, blockIndices))
+		return false;
 
-	if (TransformCoords(x, y, z, chunkIndices, blockIndices))
-		state = m_ppChunks[chunkIndices[3]]->GetBlockState(blockIndices[3]);
+	bool state = false;
 
-	LeaveCriticalSection(&m_criticalSection);
+	Chunk* pChunk = LockChunk(chunkIndices[3], false);
+	if (pChunk)
+		state = pChunk->GetBlockState(blockIndices[3]);
+	UnlockChunk();
 
 	return state;
 }
 bool ChunkManager::TransformCoords( int x, int y, int z, int* pChunkIndex, int* pBlockIndex)
 {
-	EnterCriticalSection(&m_criticalSection);
-
+	// the dimensions never change after Init, no need to lock
 	int width = m_width;
 	int height = m_height;
 	int depth = m_depth;
 	int chunkSize = m_chunkSize;
 
-	LeaveCriticalSection(&m_criticalSection);
-
 	if (x < 0 || y < 0 || z < 0 ||
 		x >= chunkSize * width || 
 		y >= chunkSize * height ||
@@ -290,19 +303,16 @@ bool ChunkManager::TransformCoords( int x, int y, int z, int* pChunkIndex, int*
 		return false;
 	}
 
-	double tmp = (double)x / chunkSize;
-	pChunkIndex[0] = (int)(tmp + 0.0000000000005);
+	pChunkIndex[0] = m_chunkDivider.Divide(x);
 	pBlockIndex[0] = x - pChunkIndex[0] * chunkSize;
 
-	tmp  = (double)y / chunkSize;
-	pChunkIndex[1] = (int)(tmp + 0.0000000000005);
+	pChunkIndex[1] = m_chunkDivider.Divide(y);
 	pBlockIndex[1] = y - pChunkIndex[1] * chunkSize;
 
-	tmp  = (double)z / chunkSize;
-	pChunkIndex[2] = (int)(tmp + 0.0000000000005);
+	pChunkIndex[2] = m_chunkDivider.Divide(z);
 	pBlockIndex[2] = z - pChunkIndex[2] * chunkSize; 
 
-	pChunkIndex[3] = _3dto1d(pChunkIndex[0], pChunkIndex[1], pChunkIndex[2], width, height);
+	pChunkIndex[3] = _3dto1d(pChunkIndex[0], pChunkIndex[1], pChunkIndex[2], height, depth);
 	pBlockIndex[3] = _3dto1d(pBlockIndex[0], pBlockIndex[1], pBlockIndex[2], chunkSize, chunkSize);
 
 	// 	// create/init chunk if it doesn't exist
@@ -324,8 +334,7 @@ bool ChunkManager::TransformCoords( int x, int y, int z, int* pChunkIndex, int*
 
 void ChunkManager::Update()
 {
-	SetEvent(m_startEvent);
-
+#ifndef CBE_HEADLESS
 	if (m_pTypeMgr->Update())
 	{
 		m_pTextureAtlas->get()->AsShaderResource()->SetResourceArray(m_pTypeMgr->GetAtlases()->get(), 0, m_pTypeMgr->GetAtlases()->GetCollectionSize());
@@ -333,26 +342,228 @@ void ChunkManager::Update()
 	}
 
 	m_pMatWorld->get()->AsMatrix()->SetMatrix((float*)&m_matWorld);
+#endif
+
+	if (m_drawListPending)
+	{
+		m_drawListDone.Wait();
+		m_drawListPending = false;
+	}
+
+	// the allocations are still those the sort saw
+	WriteTranslucentQuads();
+	m_translucentSorter.SetThreshold(m_translucentSortThreshold);
+
+	// lists older than the front one are never replayed again, what was
+	// freed before it was built can be reused
+	m_frame++;
+	m_drawListMutex.lock();
+	UINT replayedFrame = m_drawLists[m_frontDrawList].Frame();
+	m_drawListMutex.unlock();
+	m_meshBuffer.Collect(replayedFrame);
+
+	UploadChunks();
+	UploadLods();
+	CullChunks();
+
+	// SetCameraPosition may be called while the list is built
+	m_drawHasCamera = m_hasCamera;
+	m_drawCamera = m_cameraPosition;
+
+	if (m_drawListThread.joinable())
+	{
+		m_drawListPending = true;
+		m_drawListEvent.Set();
+	}
+	else
+	{
+		BuildDrawList();
+	}
+}
+void ChunkManager::BuildDrawListsAsync()
+{
+	for (;;)
+	{
+		m_drawListEvent.Wait();
+		if (!IsAsyncProccessing())
+			break;
+
+		BuildDrawList();
+		m_drawListDone.Set();
+	}
+}
+void ChunkManager::BuildDrawList()
+{
+	// only this function switches the lists, the back one is never replayed
+	int back = 1 - m_frontDrawList;
+	DrawList& list = m_drawLists[back];
+	list.Clear(m_frame);
+
+	SortDrawOrder();
+
+	for (UINT order = 0; order < m_drawOrder.size(); order++)
+	{
+		int i = m_drawOrder[order];
+		int slot = MeshSlot(m_visibleChunks[i], m_visibleLods[i]);
+		const MESH_ALLOCATION& allocation = m_allocations[slot];
+		const Chunk::INDEX_RANGE* pRanges = &m_indexRanges[slot * CHUNK_RANGE_COUNT];
+		int directions = m_visibleDirections[i];
+
+		// the opaque ranges are in front of the translucent one
+		if (directions == CHUNK_DIRECTIONS_ALL)
+		{
+			list.Add(DRAW_BUCKET_OPAQUE, allocation.indexOffset, pRanges[CHUNK_RANGE_TRANSPARENT].start, allocation.vertexOffset);
+			continue;
+		}
 
-	UpdateNextChunk();
+		for (int direction = 0; direction < VERT_NORMAL_COUNT; direction++)
+		{
+			if (directions & (1 << direction))
+				list.Add(DRAW_BUCKET_OPAQUE, allocation.indexOffset + pRanges[direction].start, pRanges[direction].count, allocation.vertexOffset);
+		}
+	}
+
+	// translucent quads blend over what is behind them, back to front
+	for (UINT order = m_drawOrder.size(); order-- > 0; )
+	{
+		int i = m_drawOrder[order];
+		int slot = MeshSlot(m_visibleChunks[i], m_visibleLods[i]);
+		const MESH_ALLOCATION& allocation = m_allocations[slot];
+		const Chunk::INDEX_RANGE& range = m_indexRanges[slot * CHUNK_RANGE_COUNT + CHUNK_RANGE_TRANSPARENT];
+
+		list.Add(DRAW_BUCKET_TRANSPARENT, allocation.indexOffset + range.start, range.count, allocation.vertexOffset);
+	}
+
+	list.Sort();
+
+	m_drawListMutex.lock();
+	m_frontDrawList = back;
+	m_drawListMutex.unlock();
+
+	SortTranslucentQuads();
+}
+void ChunkManager::SortTranslucentQuads()
+{
+	m_translucentSortWork = 0.0f;
+	if (!m_drawHasCamera)
+		return;
+
+	double start = TimeMilliseconds();
+
+	// lod meshes keep the mesher order
+	m_translucentChunks.clear();
+	for (UINT i = 0; i < m_visibleChunks.size(); i++)
+	{
+		int index = m_visibleChunks[i];
+		if (m_visibleLods[i] == 0 && m_indexRanges[MeshSlot(index, 0) * CHUNK_RANGE_COUNT + CHUNK_RANGE_TRANSPARENT].count != 0)
+			m_translucentChunks.push_back(index);
+	}
+
+	m_translucentSorter.Sort(m_drawCamera, m_translucentChunks.data(), m_translucentChunks.size());
+
+	m_translucentSortWork = (float)(TimeMilliseconds() - start);
+}
+void ChunkManager::WriteTranslucentQuads()
+{
+	m_translucentSortTime = m_translucentSortWork;
+	m_translucentSortedQuads = m_translucentSorter.SortedQuads();
+
+	const std::vector<TranslucentSorter::SORTED_RANGE>& sorted = m_translucentSorter.Sorted();
+	for (UINT i = 0; i < sorted.size(); i++)
+	{
+		int index = sorted[i].chunkIndex;
+		int slot = MeshSlot(index, 0);
+		const Chunk::INDEX_RANGE& range = m_indexRanges[slot * CHUNK_RANGE_COUNT + CHUNK_RANGE_TRANSPARENT];
+		if (sorted[i].version != m_translucentSorter.Version(index) || sorted[i].count != range.count)
+			continue;
+
+		m_meshBuffer.WriteIndices(m_allocations[slot].indexOffset + range.start, m_translucentSorter.SortedIndices(sorted[i]), range.count);
+	}
+
+	m_translucentSorter.ClearSorted();
+}
+void ChunkManager::SetTranslucentSortThreshold( float distance )
+{
+	// the sorter may be running, Update passes it on
+	m_translucentSortThreshold = distance;
 }
-DWORD WINAPI ChunkManager::UpdateAsync( LPVOID data )
+void ChunkManager::SortDrawOrder()
 {
-	ChunkManager* pManager = (ChunkManager*)data;
-	while (pManager->IsAsyncProccessing())
+	int cell[3] = { 0, 0, 0 };
+	if (m_drawHasCamera)
+		GetChunkCell(m_drawCamera, &cell[0], &cell[1], &cell[2]);
+
+	// the order of chunks can only change once the camera enters another
+	// chunk, inside one chunk a few near chunks may swap but never one
+	// behind the other
+	if (m_drawOrderValid && m_drawOrderHasCamera == m_drawHasCamera && m_drawOrderCell[0] == cell[0] && m_drawOrderCell[1] == cell[1] &&
+		m_drawOrderCell[2] == cell[2] && m_drawOrderVisible == m_visibleChunks)
+		return;
+
+	m_drawOrderValid = true;
+	m_drawOrderHasCamera = m_drawHasCamera;
+	memcpy(m_drawOrderCell, cell, sizeof(cell));
+	m_drawOrderVisible = m_visibleChunks;
+
+	UINT count = (UINT)m_visibleChunks.size();
+	m_drawOrder.resize(count);
+	if (!m_drawHasCamera)
+	{
+		for (UINT i = 0; i < count; i++)
+			m_drawOrder[i] = i;
+		return;
+	}
+
+	// front to back by the distance to the chunk centre
+	m_drawOrderKeys.resize(count);
+	for (UINT i = 0; i < count; i++)
 	{
-		pManager->ProcessPendingJobs();
-		pManager->BuildNextChunk();
+		int index = m_visibleChunks[i];
+		float dx = (m_bounds.minX[index] + m_bounds.maxX[index]) * 0.5f - m_drawCamera.x;
+		float dy = (m_bounds.minY[index] + m_bounds.maxY[index]) * 0.5f - m_drawCamera.y;
+		float dz = (m_bounds.minZ[index] + m_bounds.maxZ[index]) * 0.5f - m_drawCamera.z;
+		m_drawOrderKeys[i] = std::make_pair(dx * dx + dy * dy + dz * dz, (int)i);
 	}
 
-	SetEvent(pManager->GetEndEvent());
+	std::sort(m_drawOrderKeys.begin(), m_drawOrderKeys.end());
+	for (UINT i = 0; i < count; i++)
+		m_drawOrder[i] = m_drawOrderKeys[i].second;
+
+	m_drawOrderSorts++;
+}
+void ChunkManager::GetDrawRecords( std::vector<DRAW_RECORD>* pRecords, UINT* pFrame )
+{
+	m_drawListMutex.lock();
+	*pRecords = m_drawLists[m_frontDrawList].Records();
+	if (pFrame)
+		*pFrame = m_drawLists[m_frontDrawList].Frame();
+	m_drawListMutex.unlock();
+}
+void ChunkManager::UpdateAsync()
+{
+	while (IsAsyncProccessing())
+	{
+		bool worked = ProcessPendingJobs();
+		worked |= BuildNextChunk();
+
+		// coarser meshes only when no chunk waits for its full mesh
+		if (!worked)
+			worked = BuildNextLod();
 
-	return 0;
+		// nothing queued, sleep until an enqueue raises the signal. a
+		// signal raised while working is kept, so no wake up is lost
+		if (!worked)
+		{
+			double latency = m_workEvent.Wait();
+			m_wakeLatency = (UINT)(latency * 1000.0);
+			m_wakeups++;
+		}
+	}
 }
 
 int ChunkManager::GetActiveBlockCount()
 {
-	EnterCriticalSection(&m_criticalSection);
+	m_structureLock.LockShared();
 
 	int blockCount = 0;
 	for (int i = 0; i < m_width * m_height * m_depth; i++)
@@ -362,13 +573,13 @@ int ChunkManager::GetActiveBlockCount()
 			blockCount += pChunk->ActiveBlocks();
 	}
 
-	LeaveCriticalSection(&m_criticalSection);
+	m_structureLock.UnlockShared();
 
 	return blockCount;
 }
 int ChunkManager::GetVertexCount()
 {
-	EnterCriticalSection(&m_criticalSection);
+	m_structureLock.LockShared();
 
 	int vertexCount = 0;
 	for (int i = 0; i < m_width * m_height * m_depth; i++)
@@ -378,13 +589,13 @@ int ChunkManager::GetVertexCount()
 			vertexCount += pChunk->VertexCount();
 	}
 
-	LeaveCriticalSection(&m_criticalSection);
+	m_structureLock.UnlockShared();
 
 	return vertexCount;
 }
 int ChunkManager::GetActiveChunkCount()
 {
-	EnterCriticalSection(&m_criticalSection);
+	m_structureLock.LockShared();
 
 	int chunkCount = 0;
 	for (int i = 0; i < m_width * m_height * m_depth; i++)
@@ -393,181 +604,665 @@ int ChunkManager::GetActiveChunkCount()
 			chunkCount++;
 	}
 
-	LeaveCriticalSection(&m_criticalSection);
+	m_structureLock.UnlockShared();
 
 	return chunkCount;
 }
 
 bool ChunkManager::IsAsyncProccessing()
 {
-	bool processing; 
-	
-	EnterCriticalSection(&m_criticalSection); 
-	processing = m_processing; 
-	LeaveCriticalSection(&m_criticalSection); 
-	
-	return processing;
+	return m_processing;
 }
 void cbe::ChunkManager::SetAsyncProccessing(bool processing)
 {
-	EnterCriticalSection(&m_criticalSection); 
-	m_processing = processing ; 
-	LeaveCriticalSection(&m_criticalSection); 
+	m_processing = processing;
 }
 
-void ChunkManager::Serialize( std::string fileName )
+bool ChunkManager::Serialize( std::string fileName )
 {
-	FILE* pFile = fopen(fileName.c_str(), "wb");
-	if (!pFile)
-		return;
+	if (!m_ppChunks)
+		return false;
 
-	// write map info
-	MapInfo mapInfo;
-	mapInfo.depth = m_depth;
-	mapInfo.width = m_width;
-	mapInfo.height = m_height;
-	mapInfo.chunkSize = m_chunkSize;
+	// never truncate the map, a failed save would destroy it
+	std::string tmpFileName = fileName + ".tmp";
+	RegionFile region;
+	if (!region.Create(tmpFileName, m_width, m_height, m_depth, m_chunkSize, m_chunkCodec, m_chunkCodecLevel))
+		return false;
+
+	std::vector<int> chunkIndices;
+	for (int i = 0; i < m_width * m_height * m_depth; i++)
+	{
+		if (LockChunk(i, false))
+			chunkIndices.push_back(i);
+		UnlockChunk();
+	}
 
-	fwrite(&mapInfo, sizeof(MapInfo), 1, pFile);
+	std::vector<UINT> generations;
+	bool success = SaveRegion(region, chunkIndices, &generations) && region.Flush();
+	region.Close();
 
-	for (int x = 0; x < m_width; x++)
+	// windows does not replace a mapped file
+	if (success && IsMappedFile(fileName))
+		ReleaseMappedFile();
+	if (!success || !MoveFileReplace(tmpFileName.c_str(), fileName.c_str()))
 	{
-		for (int y = 0; y < m_height; y++)
-		{
-			for (int z = 0; z < m_depth; z++)
-			{
-				bool writing;
-				if (m_ppChunks[_3dto1d(x, y, z, m_height, m_width)])
-				{
-					writing = true;
-					fwrite(&writing, 1, 1, pFile);
-					m_ppChunks[_3dto1d(x, y, z, m_height, m_width)]->Serialize(pFile);
-				}
-				else
-				{
-					writing = false;
-					fwrite(&writing, 1, 1, pFile);
-				}
-			}
-		}
+		remove(tmpFileName.c_str());
+		return false;
 	}
 
-	fclose(pFile);
+	// partial saves go to this file from now on
+	FileId fileId = { 0, 0 };
+	bool known = GetFileId(fileName.c_str(), &fileId);
+	m_settingsMutex.lock();
+	m_savedFileId = fileId;
+	m_hasSavedFile = known;
+	m_settingsMutex.unlock();
+
+	MarkChunksSaved(chunkIndices, generations);
+
+	return true;
 }
-bool ChunkManager::Deserialize( std::string fileName )
+bool ChunkManager::Deserialize( std::string fileName, bool mapped )
 {
-	FILE* pFile = fopen(fileName.c_str(), "rb");
-	if (!pFile)
-		return false;
+	if (!RegionFile::IsRegionFile(fileName))
+		return DeserializeLegacy(fileName);
 
-	MapInfo mapInfo;
-	fread(&mapInfo, sizeof(MapInfo), 1, pFile);
+	RegionFile region;
+	if (!region.Open(fileName, false))
+		return false;
 
-	if(!Init(mapInfo.width, mapInfo.height, mapInfo.depth, mapInfo.chunkSize))
+	if (!Init(region.Width(), region.Height(), region.Depth(), region.ChunkSize()))
 		return false;
 
-	for (int x = 0; x < m_width; x++)
-	{
-		for (int y = 0; y < m_height; y++)
-		{
-			for (int z = 0; z < m_depth; z++)
-			{
-				bool exists = false;
-				fread(&exists, 1, 1, pFile);
+	SetChunkCodec(region.Codec(), region.Level());
 
-				if (exists)
-				{
-					EnterCriticalSection(&m_criticalSection);
-					CreateChunk(x, y, z);
-					m_ppChunks[_3dto1d(x, y, z, m_height, m_width)]->Deserialize(pFile);
-					m_tsChunksToChangeIndices->push_back(_3dto1d(x, y, z, m_width, m_height));
-					LeaveCriticalSection(&m_criticalSection);
-				}
+	__int64 mappedSize = 0;
+	FileId mappedFileId;
+	const BYTE* pMapped = mapped && GetFileId(fileName.c_str(), &mappedFileId) ? MapFile(fileName.c_str(), &mappedSize) : NULL;
+	int mappedChunks = 0;
 
-				
-			}
-		}
+	bool success = LoadRegion(region, pMapped, mappedSize, &mappedChunks);
+
+	if (pMapped && mappedChunks == 0)
+	{
+		UnmapFile(pMapped, mappedSize);
+	}
+	else if (pMapped)
+	{
+		m_pMappedFile = pMapped;
+		m_mappedSize = mappedSize;
+		m_mappedFileId = mappedFileId;
 	}
 
-	fclose(pFile);
+	// the loaded chunks are saved in this file
+	FileId fileId = { 0, 0 };
+	bool known = success && GetFileId(fileName.c_str(), &fileId);
+	m_settingsMutex.lock();
+	m_savedFileId = fileId;
+	m_hasSavedFile = known;
+	m_settingsMutex.unlock();
 
-	return true;
+	return success;
 }
-
-void ChunkManager::CreateChunk( int ix, int iy, int iz )
+void ChunkManager::SetChunkCodec( int codec, int level )
 {
-	m_ppChunks[_3dto1d(ix, iy, iz, m_width, m_height)] = new Chunk(this, ix, iy, iz, XMFLOAT3((float)(ix * (m_absoluteChunkSize)),
-																							  (float)(iy * (m_absoluteChunkSize)), 
-																							  (float)(iz * (m_absoluteChunkSize))), m_chunkSize, m_absoluteChunkSize / m_chunkSize, this);
-	m_ppChunks[_3dto1d(ix, iy, iz, m_width, m_height)]->Init();
-}
+	if (codec < 0 || codec >= CHUNK_CODEC_COUNT)
+		return;
 
-HANDLE ChunkManager::GetStartEvent()
+	m_chunkCodec = codec;
+	m_chunkCodecLevel = level < 0 ? 0 : (level > ChunkCodec::MaxLevel() ? ChunkCodec::MaxLevel() : level);
+}
+bool ChunkManager::SaveChangedChunks( std::string fileName )
 {
-	HANDLE startEvent;
-	EnterCriticalSection(&m_criticalSection);
-	startEvent = m_startEvent;
-	LeaveCriticalSection(&m_criticalSection);
+	if (!m_ppChunks)
+		return false;
+
+	// the unsaved chunks are relative to the file last loaded or saved
+	RegionFile region;
+	if (!IsSavedFile(fileName) || !region.Open(fileName, true) || region.Width() != m_width || region.Height() != m_height ||
+		region.Depth() != m_depth || region.ChunkSize() != m_chunkSize)
+	{
+		region.Close();
+		return Serialize(fileName);
+	}
+
+	std::vector<int> chunkIndices;
+	for (int i = 0; i < m_width * m_height * m_depth; i++)
+	{
+		Chunk* pChunk = LockChunk(i, false);
+		if (pChunk && pChunk->IsUnsaved())
+			chunkIndices.push_back(i);
+		UnlockChunk();
+	}
+
+	std::vector<UINT> generations;
+	bool success = region.SetCodec(m_chunkCodec, m_chunkCodecLevel) && SaveRegion(region, chunkIndices, &generations) && region.Flush();
+	if (success)
+		MarkChunksSaved(chunkIndices, generations);
 
-	return startEvent;
+	return success;
 }
-HANDLE cbe::ChunkManager::GetEndEvent()
+int ChunkManager::LoadChunks( std::string fileName, int count, const int* pChunkIndices )
 {
-	HANDLE endEvent;
-	EnterCriticalSection(&m_criticalSection);
-	endEvent = m_endEvent;
-	LeaveCriticalSection(&m_criticalSection);
+	if (!m_ppChunks)
+		return 0;
 
-	return endEvent;
-}
+	RegionFile region;
+	if (!region.Open(fileName, false) || region.Width() != m_width || region.Height() != m_height ||
+		region.Depth() != m_depth || region.ChunkSize() != m_chunkSize)
+	{
+		return 0;
+	}
 
-BlockTypeManager* ChunkManager::TypeManager()
+	// chunks from another file differ from the saved map
+	bool saved = IsSavedFile(fileName);
+	int loaded = 0;
+	std::vector<BYTE> payload;
+	for (int i = 0; i < count; i++)
+	{
+		int chunkIndex = pChunkIndices[i];
+		if (chunkIndex < 0 || chunkIndex >= region.ChunkCount() || !region.HasChunk(chunkIndex))
+			continue;
+
+		if (region.ReadChunk(chunkIndex, &payload) && LoadChunk(chunkIndex, payload, saved))
+		{
+			AddChangedChunk(chunkIndex);
+			loaded++;
+		}
+	}
+
+	return loaded;
+}
+void ChunkManager::EncodeChunk( Chunk* pChunk, std::vector<BYTE>* pPayload, UINT* pGeneration )
+{
+	std::vector<BYTE> data;
+	pChunk->Serialize(&data, pGeneration);
+	ChunkCodec::Encode(m_chunkCodec, m_chunkCodecLevel, m_chunkSize, (const Block*)data.data(), pPayload);
+}
+bool ChunkManager::LoadChunk( int chunkIndex, const std::vector<BYTE>& payload, bool saved )
+{
+	// decoded before the chunk is locked
+	std::vector<Block> blocks(m_chunkSize * m_chunkSize * m_chunkSize);
+	return ChunkCodec::Decode(m_chunkSize, payload.data(), payload.size(), blocks.data()) &&
+		   SetChunkBlocks(chunkIndex, blocks.data(), saved);
+}
+bool ChunkManager::SetChunkBlocks( int chunkIndex, const Block* pBlocks, bool saved )
 {
-	EnterCriticalSection(&m_criticalSection);
-	BlockTypeManager* pManager = m_pTypeMgr;
-	LeaveCriticalSection(&m_criticalSection);
+	Chunk* pChunk = LockChunk(chunkIndex, true);
+	bool loaded = pChunk->Deserialize((const BYTE*)pBlocks, m_chunkSize * m_chunkSize * m_chunkSize * sizeof(Block), saved);
+	if (loaded)
+		UpdateGridOccupancy(pChunk);
+	UnlockChunk();
 
-	return pManager;
+	return loaded;
 }
+int ChunkManager::GetMappedChunkCount()
+{
+	if (!m_pMappedFile)
+		return 0;
 
-void ChunkManager::SetWorldMatrix( float* pMat )
+	int count = 0;
+	for (int i = 0; i < m_width * m_height * m_depth; i++)
+	{
+		Chunk* pChunk = LockChunk(i, false);
+		if (pChunk && pChunk->IsMapped())
+			count++;
+		UnlockChunk();
+	}
+
+	return count;
+}
+void ChunkManager::ReleaseMappedFile()
 {
-	SetWorldMatrix(XMFLOAT4X4(pMat));
+	for (int i = 0; i < m_width * m_height * m_depth; i++)
+	{
+		Chunk* pChunk = LockChunk(i, false);
+		if (pChunk)
+			pChunk->UnmapBlocks();
+		UnlockChunk();
+	}
+
+	UnmapFile(m_pMappedFile, m_mappedSize);
+	m_pMappedFile = NULL;
+	m_mappedSize = 0;
 }
-void ChunkManager::SetWorldMatrix( CXMMATRIX mat )
+bool ChunkManager::IsMappedFile( std::string fileName )
 {
-	XMFLOAT4X4 tmp;
-	XMStoreFloat4x4(&tmp, mat);
-	SetWorldMatrix(tmp);
+	FileId fileId;
+	return m_pMappedFile && GetFileId(fileName.c_str(), &fileId) && fileId == m_mappedFileId;
 }
-void ChunkManager::SetWorldMatrix( XMFLOAT4X4 mat )
+bool ChunkManager::IsSavedFile( std::string fileName )
 {
-	m_matWorld = mat;
+	FileId fileId;
+	if (!GetFileId(fileName.c_str(), &fileId))
+		return false;
 
-	XMMATRIX tmp = XMLoadFloat4x4(&mat);
-	XMVECTOR vec;
-	XMMATRIX inverse = XMMatrixInverse(&vec, tmp);
+	m_settingsMutex.lock();
+	bool saved = m_hasSavedFile && fileId == m_savedFileId;
+	m_settingsMutex.unlock();
 
-	XMStoreFloat4x4(&m_matWorldInverse, inverse);
+	return saved;
+}
+void ChunkManager::MarkChunksSaved( const std::vector<int>& chunkIndices, const std::vector<UINT>& generations )
+{
+	for (UINT i = 0; i < chunkIndices.size(); i++)
+	{
+		Chunk* pChunk = LockChunk(chunkIndices[i], false);
+		if (pChunk)
+			pChunk->MarkSaved(generations[i]);
+		UnlockChunk();
+	}
+}
+void ChunkManager::SetIoThreads( int count )
+{
+	m_ioThreads = count < 0 ? 0 : count;
 }
+int ChunkManager::IoWorkerCount()
+{
+	if (m_ioThreads > 0)
+		return m_ioThreads;
 
-void ChunkManager::ChunkChanged( int* pChunkIndices, int* pBlockIndices )
+	int cores = (int)std::thread::hardware_concurrency();
+	return cores > 2 ? cores - 1 : 1;
+}
+bool ChunkManager::LoadRegion( RegionFile& region, const BYTE* pMapped, __int64 mappedSize, int* pMappedChunks )
 {
-	AddChangedChunk(pChunkIndices[3]);
+	// payloads in file order, a batch spans neighbouring ones and reads
+	// over a few free sectors rather than seeking
+	std::vector<std::pair<__int64, int>> payloads;
+	for (int i = 0; i < region.ChunkCount(); i++)
+	{
+		if (region.HasChunk(i))
+			payloads.push_back(std::make_pair(region.ChunkOffset(i), i));
+	}
+	std::sort(payloads.begin(), payloads.end());
 
-	/*
-	if (pBlockIndices[0] < 0)
+	int workerCount = IoWorkerCount();
+	IO_PIPELINE pipeline(&region, workerCount * 2);
+	for (UINT i = 0; i < payloads.size(); i++)
 	{
-		if (pChunkIndices[0] - 1 >= 0)
+		__int64 offset = payloads[i].first;
+		__int64 end = offset + region.ChunkLength(payloads[i].second);
+
+		IO_BATCH* pBatch = pipeline.batches.empty() ? NULL : &pipeline.batches.back();
+		if (!pBatch || offset - (pBatch->offset + pBatch->length) > RegionFile::SectorSize() * 16 || end - pBatch->offset > IoBatchBytes())
 		{
-			AddChangedChunk(_3dto1d(pChunkIndices[0] - 1, pChunkIndices[1], pChunkIndices[2], m_width, m_height), false);
+			pipeline.batches.push_back(IO_BATCH());
+			pBatch = &pipeline.batches.back();
+			pBatch->offset = offset;
 		}
+
+		pBatch->chunkIndices.push_back(payloads[i].second);
+		pBatch->length = (UINT)(end - pBatch->offset);
 	}
-	else if (pBlockIndices[0] >= m_chunkSize)
+
+	// a mapped file has nothing to read
+	for (UINT i = 0; i < pipeline.batches.size() && pMapped; i++)
+	{
+		IO_BATCH& batch = pipeline.batches[i];
+		if (batch.offset + batch.length <= mappedSize)
+		{
+			batch.pData = pMapped + batch.offset;
+			batch.mapped = true;
+			batch.ready = true;
+		}
+	}
+
+	std::vector<std::thread> workers;
+	for (int i = 0; i < workerCount; i++)
+		workers.push_back(std::thread(&ChunkManager::LoadWorker, this, &pipeline));
+
+	// the i/o stage reads in file order and stays at most a window of
+	// batches ahead of the workers
+	for (int i = 0; i < (int)pipeline.batches.size(); i++)
+	{
+		IO_BATCH& batch = pipeline.batches[i];
+		if (batch.ready)
+			continue;
+
+		std::unique_lock<std::mutex> lock(pipeline.mutex);
+		while (i >= pipeline.finished + pipeline.window)
+			pipeline.condition.wait(lock);
+		lock.unlock();
+
+		batch.data.resize(batch.length);
+		bool read = region.ReadSpan(batch.offset, batch.length, batch.data.data());
+
+		lock.lock();
+		batch.pData = batch.data.data();
+		batch.success = read;
+		batch.ready = true;
+		lock.unlock();
+		pipeline.condition.notify_all();
+	}
+
+	for (UINT i = 0; i < workers.size(); i++)
+		workers[i].join();
+
+	bool success = true;
+	for (UINT i = 0; i < pipeline.batches.size(); i++)
+		success = success && pipeline.batches[i].success;
+
+	*pMappedChunks = pipeline.mappedChunks;
+	return success;
+}
+void ChunkManager::LoadWorker( IO_PIPELINE* pPipeline )
+{
+	std::vector<Block> blocks(m_chunkSize * m_chunkSize * m_chunkSize);
+	std::vector<Chunk*> chunks;
+	for (;;)
+	{
+		std::unique_lock<std::mutex> lock(pPipeline->mutex);
+		if (pPipeline->next >= (int)pPipeline->batches.size())
+			return;
+
+		IO_BATCH& batch = pPipeline->batches[pPipeline->next++];
+		while (!batch.ready)
+			pPipeline->condition.wait(lock);
+		lock.unlock();
+
+		// nobody else sees these chunks yet, they need no manager lock
+		chunks.clear();
+		bool read = batch.success;
+		for (UINT i = 0; i < batch.chunkIndices.size() && read; i++)
+		{
+			int chunkIndex = batch.chunkIndices[i];
+			const BYTE* pPayload = batch.pData + (pPipeline->pRegion->ChunkOffset(chunkIndex) - batch.offset);
+			UINT length = pPipeline->pRegion->ChunkLength(chunkIndex);
+
+			int x, y, z;
+			_1dto3d(chunkIndex, m_height, m_depth, &x, &y, &z);
+			Chunk* pChunk = NewChunk(x, y, z);
+
+			// raw payloads of a mapped file are used in place
+			const Block* pRaw = batch.mapped ? ChunkCodec::RawBlocks(m_chunkSize, pPayload, length) : NULL;
+			if (pRaw)
+			{
+				pChunk->MapBlocks(pRaw);
+				pPipeline->mappedChunks++;
+			}
+			else if (!ChunkCodec::Decode(m_chunkSize, pPayload, length, blocks.data()) ||
+					 !pChunk->Deserialize((const BYTE*)blocks.data(), blocks.size() * sizeof(Block), true))
+			{
+				SAFE_DELETE(pChunk);
+				batch.success = false;
+			}
+
+			if (pChunk)
+				chunks.push_back(pChunk);
+		}
+
+		InsertChunks(chunks);
+		std::vector<BYTE>().swap(batch.data);
+
+		lock.lock();
+		pPipeline->finished++;
+		lock.unlock();
+		pPipeline->condition.notify_all();
+	}
+}
+void ChunkManager::InsertChunks( const std::vector<Chunk*>& chunks )
+{
+	if (chunks.empty())
+		return;
+
+	// one exclusive section per batch instead of one per chunk
+	m_structureLock.LockExclusive();
+	for (UINT i = 0; i < chunks.size(); i++)
+		m_ppChunks[_3dto1d(chunks[i]->GetChunkIndexX(), chunks[i]->GetChunkIndexY(), chunks[i]->GetChunkIndexZ(), m_height, m_depth)] = chunks[i];
+	m_structureLock.UnlockExclusive();
+
+	for (UINT i = 0; i < chunks.size(); i++)
+		UpdateGridOccupancy(chunks[i]);
+
+	// the queue is empty after Init, no need to look for duplicates
+	auto sec = m_tsChunksToChangeIndices.blockSecurity();
+	for (UINT i = 0; i < chunks.size(); i++)
+		sec->push_back(_3dto1d(chunks[i]->GetChunkIndexX(), chunks[i]->GetChunkIndexY(), chunks[i]->GetChunkIndexZ(), m_height, m_depth));
+}
+bool ChunkManager::SaveRegion( RegionFile& region, const std::vector<int>& chunkIndices, std::vector<UINT>* pGenerations )
+{
+	// batches of about IoBatchBytes of blocks, payloads are smaller
+	UINT chunkBytes = m_chunkSize * m_chunkSize * m_chunkSize * sizeof(Block);
+	UINT batchChunks = IoBatchBytes() / chunkBytes > 0 ? IoBatchBytes() / chunkBytes : 1;
+
+	int workerCount = IoWorkerCount();
+	IO_PIPELINE pipeline(&region, workerCount * 2);
+	for (UINT i = 0; i < chunkIndices.size(); i += batchChunks)
+	{
+		UINT end = i + batchChunks < chunkIndices.size() ? i + batchChunks : chunkIndices.size();
+		pipeline.batches.push_back(IO_BATCH());
+		pipeline.batches.back().chunkIndices.assign(chunkIndices.begin() + i, chunkIndices.begin() + end);
+	}
+
+	std::vector<std::thread> workers;
+	for (int i = 0; i < workerCount; i++)
+		workers.push_back(std::thread(&ChunkManager::SaveWorker, this, &pipeline));
+
+	// the i/o stage writes the batches in order, each with one write
+	std::vector<const BYTE*> data;
+	std::vector<UINT> lengths;
+	for (int i = 0; i < (int)pipeline.batches.size(); i++)
+	{
+		IO_BATCH& batch = pipeline.batches[i];
+
+		std::unique_lock<std::mutex> lock(pipeline.mutex);
+		while (!batch.ready)
+			pipeline.condition.wait(lock);
+		lock.unlock();
+
+		data.clear();
+		lengths.clear();
+		for (UINT chunk = 0; chunk < batch.payloads.size(); chunk++)
+		{
+			data.push_back(batch.payloads[chunk].data());
+			lengths.push_back(batch.payloads[chunk].size());
+		}
+
+		bool written = region.WriteChunks(batch.chunkIndices.size(), batch.chunkIndices.data(), data.data(), lengths.data());
+		std::vector<std::vector<BYTE>>().swap(batch.payloads);
+		pGenerations->insert(pGenerations->end(), batch.generations.begin(), batch.generations.end());
+
+		lock.lock();
+		pipeline.staged++;
+		pipeline.failed = !written;
+		lock.unlock();
+		pipeline.condition.notify_all();
+
+		if (!written)
+			break;
+	}
+
+	for (UINT i = 0; i < workers.size(); i++)
+		workers[i].join();
+
+	return !pipeline.failed;
+}
+void ChunkManager::SaveWorker( IO_PIPELINE* pPipeline )
+{
+	for (;;)
+	{
+		// encoded batches wait for the i/o stage, a window of them at most
+		std::unique_lock<std::mutex> lock(pPipeline->mutex);
+		while (!pPipeline->failed && pPipeline->next < (int)pPipeline->batches.size() && pPipeline->next >= pPipeline->staged + pPipeline->window)
+			pPipeline->condition.wait(lock);
+
+		if (pPipeline->failed || pPipeline->next >= (int)pPipeline->batches.size())
+			return;
+
+		IO_BATCH& batch = pPipeline->batches[pPipeline->next++];
+		lock.unlock();
+
+		// a chunk that is gone is removed from the file
+		batch.payloads.resize(batch.chunkIndices.size());
+		batch.generations.assign(batch.chunkIndices.size(), 0);
+		for (UINT i = 0; i < batch.chunkIndices.size(); i++)
+		{
+			Chunk* pChunk = LockChunk(batch.chunkIndices[i], false);
+			if (pChunk)
+				EncodeChunk(pChunk, &batch.payloads[i], &batch.generations[i]);
+			UnlockChunk();
+		}
+
+		lock.lock();
+		batch.ready = true;
+		lock.unlock();
+		pPipeline->condition.notify_all();
+	}
+}
+bool ChunkManager::ConvertLegacyMap( std::string legacyFileName, std::string fileName, int codec, int level )
+{
+	FILE* pFile = fopen(legacyFileName.c_str(), "rb");
+	if (!pFile)
+		return false;
+
+	// written next to the target and swapped in like Serialize, the
+	// target may be a map some manager has mapped
+	std::string tmpFileName = fileName + ".tmp";
+	MapInfo mapInfo;
+	RegionFile region;
+	if (fread(&mapInfo, sizeof(MapInfo), 1, pFile) != 1 ||
+		!region.Create(tmpFileName, mapInfo.width, mapInfo.height, mapInfo.depth, mapInfo.chunkSize, codec, level))
+	{
+		fclose(pFile);
+		return false;
+	}
+
+	// chunks follow in x, y, z order, each behind an exists flag
+	bool success = true;
+	std::vector<BYTE> data(mapInfo.chunkSize * mapInfo.chunkSize * mapInfo.chunkSize * sizeof(Block));
+	std::vector<BYTE> payload;
+	for (int x = 0; x < mapInfo.width && success; x++)
+	{
+		for (int y = 0; y < mapInfo.height && success; y++)
+		{
+			for (int z = 0; z < mapInfo.depth && success; z++)
+			{
+				bool exists = false;
+				success = fread(&exists, 1, 1, pFile) == 1;
+				if (!success || !exists)
+					continue;
+
+				// same layout as _3dto1d
+				int chunkIndex = (x * mapInfo.height + y) * mapInfo.depth + z;
+				success = fread(data.data(), 1, data.size(), pFile) == data.size();
+				if (!success)
+					continue;
+
+				ChunkCodec::Encode(codec, level, mapInfo.chunkSize, (const Block*)data.data(), &payload);
+				success = region.WriteChunk(chunkIndex, payload.data(), payload.size());
+			}
+		}
+	}
+
+	fclose(pFile);
+
+	success = success && region.Flush();
+	region.Close();
+	if (!success || !MoveFileReplace(tmpFileName.c_str(), fileName.c_str()))
+	{
+		remove(tmpFileName.c_str());
+		return false;
+	}
+
+	return true;
+}
+bool ChunkManager::DeserializeLegacy( std::string fileName )
+{
+	FILE* pFile = fopen(fileName.c_str(), "rb");
+	if (!pFile)
+		return false;
+
+	MapInfo mapInfo;
+	if (fread(&mapInfo, sizeof(MapInfo), 1, pFile) != 1 ||
+		!Init(mapInfo.width, mapInfo.height, mapInfo.depth, mapInfo.chunkSize))
+	{
+		fclose(pFile);
+		return false;
+	}
+
+	std::vector<BYTE> data(m_chunkSize * m_chunkSize * m_chunkSize * sizeof(Block));
+	for (int x = 0; x < m_width; x++)
+	{
+		for (int y = 0; y < m_height; y++)
+		{
+			for (int z = 0; z < m_depth; z++)
+			{
+				bool exists = false;
+				fread(&exists, 1, 1, pFile);
+
+				if (exists && fread(data.data(), 1, data.size(), pFile) == data.size() && SetChunkBlocks(_3dto1d(x, y, z, m_height, m_depth), (const Block*)data.data(), false))
+					m_tsChunksToChangeIndices->push_back(_3dto1d(x, y, z, m_height, m_depth));
+			}
+		}
+	}
+
+	fclose(pFile);
+
+	return true;
+}
+
+void ChunkManager::CreateChunk( int ix, int iy, int iz )
+{
+	m_ppChunks[_3dto1d(ix, iy, iz, m_height, m_depth)] = NewChunk(ix, iy, iz);
+}
+Chunk* ChunkManager::NewChunk( int ix, int iy, int iz )
+{
+	Chunk* pChunk = new Chunk(this, ix, iy, iz, XMFLOAT3((float)(ix * (m_absoluteChunkSize)),
+													   (float)(iy * (m_absoluteChunkSize)), 
+													   (float)(iz * (m_absoluteChunkSize))), m_chunkSize, m_absoluteChunkSize / m_chunkSize, this);
+	pChunk->Init();
+	return pChunk;
+}
+BlockTypeManager* ChunkManager::TypeManager()
+{
+	return m_pTypeMgr;
+}
+
+void ChunkManager::SetWorldMatrix( float* pMat )
+{
+	SetWorldMatrix(XMFLOAT4X4(pMat));
+}
+#ifndef CBE_HEADLESS
+void ChunkManager::SetWorldMatrix( CXMMATRIX mat )
+{
+	XMFLOAT4X4 tmp;
+	XMStoreFloat4x4(&tmp, mat);
+	SetWorldMatrix(tmp);
+}
+#endif
+void ChunkManager::SetWorldMatrix( XMFLOAT4X4 mat )
+{
+	m_matWorld = mat;
+
+#ifndef CBE_HEADLESS
+	XMMATRIX tmp = XMLoadFloat4x4(&mat);
+	XMVECTOR vec;
+	XMMATRIX inverse = XMMatrixInverse(&vec, tmp);
+
+	XMStoreFloat4x4(&m_matWorldInverse, inverse);
+#endif
+}
+
+void ChunkManager::ChunkChanged( int* pChunkIndices, int* pBlockIndices )
+{
+	// edits are applied by the thread building the chunks, waking it again
+	// would only cost an empty wake up
+	AddChangedChunk(pChunkIndices[3], false, false);
+
+	/*
+	if (pBlockIndices[0] < 0)
+	{
+		if (pChunkIndices[0] - 1 >= 0)
+		{
+			AddChangedChunk(_3dto1d(pChunkIndices[0] - 1, pChunkIndices[1], pChunkIndices[2], m_height, m_depth), false);
+		}
+	}
+	else if (pBlockIndices[0] >= m_chunkSize)
 	{
 		if (pChunkIndices[0] + 1 < m_chunkSize)
 		{
-			AddChangedChunk(_3dto1d(pChunkIndices[0] + 1, pChunkIndices[1], pChunkIndices[2], m_width, m_height), false);
+			AddChangedChunk(_3dto1d(pChunkIndices[0] + 1, pChunkIndices[1], pChunkIndices[2], m_height, m_depth), false);
 		}
 	}
 
@@ -575,14 +1270,14 @@ void ChunkManager::ChunkChanged( int* pChunkIndices, int* pBlockIndices )
 	{
 		if (pChunkIndices[1] - 1 >= 0)
 		{
-			AddChangedChunk(_3dto1d(pChunkIndices[0], pChunkIndices[1] - 1, pChunkIndices[2], m_width, m_height), false);
+			AddChangedChunk(_3dto1d(pChunkIndices[0], pChunkIndices[1] - 1, pChunkIndices[2], m_height, m_depth), false);
 		}
 	}
 	else if (pBlockIndices[1] >= m_chunkSize)
 	{
 		if (pChunkIndices[1] + 1 < m_chunkSize)
 		{
-			AddChangedChunk(_3dto1d(pChunkIndices[0], pChunkIndices[1] + 1, pChunkIndices[2], m_width, m_height), false);
+			AddChangedChunk(_3dto1d(pChunkIndices[0], pChunkIndices[1] + 1, pChunkIndices[2], m_height, m_depth), false);
 		}
 	}
 
@@ -590,14 +1285,14 @@ void ChunkManager::ChunkChanged( int* pChunkIndices, int* pBlockIndices )
 	{
 		if (pChunkIndices[2] - 1 >= 0)
 		{
-			AddChangedChunk(_3dto1d(pChunkIndices[0], pChunkIndices[1], pChunkIndices[2] - 1, m_width, m_height), false);
+			AddChangedChunk(_3dto1d(pChunkIndices[0], pChunkIndices[1], pChunkIndices[2] - 1, m_height, m_depth), false);
 		}
 	}
 	else if (pBlockIndices[2] >= m_chunkSize)
 	{
 		if (pChunkIndices[2] + 1 < m_chunkSize)
 		{
-			AddChangedChunk(_3dto1d(pChunkIndices[0], pChunkIndices[1], pChunkIndices[2] + 1, m_width, m_height), false);
+			AddChangedChunk(_3dto1d(pChunkIndices[0], pChunkIndices[1], pChunkIndices[2] + 1, m_height, m_depth), false);
 		}
 	}
 	*/
@@ -609,101 +1304,203 @@ void ChunkManager::SetBlockState( int x, int y, int z, BOOL state )
 {
 	UpdateJob job(JOB_TYPE_STATE, state);
 	if (TransformCoords(x, y, z, job.chunkIndices, job.blockIndices))
+	{
 		m_tsUpdateJobs->at(job.chunkIndices[3]).push_back(job);
+		m_workEvent.Set();
+	}
 }
 void ChunkManager::SetBlockType( int x, int y, int z, BlockType& type )
 {
 	UpdateJob job(JOB_TYPE_BLOCKTYPE, type.Id());
 	if (TransformCoords(x, y, z, job.chunkIndices, job.blockIndices))
+	{
 		m_tsUpdateJobs->at(job.chunkIndices[3]).push_back(job);
+		m_workEvent.Set();
+	}
 }
 void ChunkManager::SetBlockGroup( int x, int y, int z, BYTE group )
 {
 	UpdateJob job(JOB_TYPE_GROUP, group);
 	if (TransformCoords(x, y, z, job.chunkIndices, job.blockIndices))
+	{
 		m_tsUpdateJobs->at(job.chunkIndices[3]).push_back(job);
+		m_workEvent.Set();
+	}
 }
 
 void cbe::ChunkManager::SetChunkChanged( int x, int y, int z, bool changed )
 {
-	double tmp = (double)x / m_chunkSize;
-	int ix = (int)(tmp + 0.0000000000005);
+	int chunkIndices[4];
+	int blockIndices[4];
+	if (!TransformCoords(x, y, z, chunkIndices, blockIndices))
+		return;
+
+	Chunk* pChunk = LockChunk(chunkIndices[3], false);
+	if (pChunk)
+		pChunk->SetChunkChanged(true);
+	UnlockChunk();
+}
+
+int cbe::ChunkManager::TransformCoords( int count, const int* pX, const int* pY, const int* pZ, int* pChunkIndices, int* pBlockIndices )
+{
+	if (m_chunkDivider.powerOfTwo)
+		return TransformCoordsBatch<true>(count, pX, pY, pZ, pChunkIndices, pBlockIndices);
+
+	return TransformCoordsBatch<false>(count, pX, pY, pZ, pChunkIndices, pBlockIndices);
+}
+template <bool PowerOfTwo>
+int cbe::ChunkManager::TransformCoordsBatch( int count, const int* pX, const int* pY, const int* pZ, int* pChunkIndices, int* pBlockIndices )
+{
+	// read everything once, the loop body is branch free so it vectorizes
+	const CoordDivider divider = m_chunkDivider;
+	const int chunkSize = m_chunkSize;
+	const int height = m_height;
+	const int depth = m_depth;
+	const unsigned int maxX = chunkSize * m_width;
+	const unsigned int maxY = chunkSize * m_height;
+	const unsigned int maxZ = chunkSize * m_depth;
+
+	int valid = 0;
+	for (int i = 0; i < count; i++)
+	{
+		int x = pX[i];
+		int y = pY[i];
+		int z = pZ[i];
+
+		// negative values wrap around and fail as well
+		int inside = ((unsigned int)x < maxX) & ((unsigned int)y < maxY) & ((unsigned int)z < maxZ);
+		int mask = -inside;
+
+		x &= mask;
+		y &= mask;
+		z &= mask;
+
+		int ix = PowerOfTwo ? divider.DivideShift(x) : divider.DivideReciprocal(x);
+		int iy = PowerOfTwo ? divider.DivideShift(y) : divider.DivideReciprocal(y);
+		int iz = PowerOfTwo ? divider.DivideShift(z) : divider.DivideReciprocal(z);
 
-	tmp  = (double)y / m_chunkSize;
-	int iy = (int)(tmp + 0.0000000000005);
+		int bx = x - ix * chunkSize;
+		int by = y - iy * chunkSize;
+		int bz = z - iz * chunkSize;
 
-	tmp  = (double)z / m_chunkSize;
-	int iz = (int)(tmp + 0.0000000000005);
+		pChunkIndices[i] = (((ix * height + iy) * depth + iz) & mask) | ~mask;
+		pBlockIndices[i] = (((bx * chunkSize + by) * chunkSize + bz) & mask) | ~mask;
 
-	m_ppChunks[_3dto1d(ix, iy, iz, m_width, m_height)]->SetChunkChanged(true);
+		valid += inside;
+	}
 
+	return valid;
 }
 
-void cbe::ChunkManager::AddBuiltChunk( int index )
+void cbe::ChunkManager::SetBlockStates( int count, const int* pX, const int* pY, const int* pZ, BOOL state )
 {
-	auto sec = m_tsChunksToUpdateIndices.blockSecurity();
+	std::vector<int> chunkIndices(count);
+	std::vector<int> blockIndices(count);
+	if (count == 0 || TransformCoords(count, pX, pY, pZ, chunkIndices.data(), blockIndices.data()) == 0)
+		return;
 
-	bool found = false;
-	for (auto it = m_tsChunksToUpdateIndices->begin(); it != m_tsChunksToUpdateIndices->end(); it++)
 	{
-		if (*it == index)
+		auto sec = m_tsUpdateJobs.blockSecurity();
+		for (int i = 0; i < count; i++)
 		{
-			found = true;
-			break;
+			if (chunkIndices[i] < 0)
+				continue;
+
+			UpdateJob job(JOB_TYPE_STATE, state);
+			job.chunkIndices[3] = chunkIndices[i];
+			job.blockIndices[3] = blockIndices[i];
+			sec->at(chunkIndices[i]).push_back(job);
 		}
 	}
 
-	if (!found)
+	m_workEvent.Set();
+}
+int cbe::ChunkManager::GetBlockStates( int count, const int* pX, const int* pY, const int* pZ, bool* pStates )
+{
+	std::vector<int> chunkIndices(count);
+	std::vector<int> blockIndices(count);
+	if (count == 0)
+		return 0;
+
+	int valid = TransformCoords(count, pX, pY, pZ, chunkIndices.data(), blockIndices.data());
+
+	m_structureLock.LockShared();
+
+	for (int i = 0; i < count; i++)
 	{
-		m_tsChunksToUpdateIndices->push_back(index);
+		Chunk* pChunk = chunkIndices[i] < 0 ? NULL : m_ppChunks[chunkIndices[i]];
+		pStates[i] = pChunk ? pChunk->GetBlockState(blockIndices[i]) : false;
 	}
+
+	m_structureLock.UnlockShared();
+
+	return valid;
 }
-void cbe::ChunkManager::AddChangedChunk( int index , bool highPriority )
+
+void cbe::ChunkManager::AddBuiltChunk( int index )
 {
-	auto sec = m_tsChunksToChangeIndices.blockSecurity();
+	// mostly the chunk is queued already, check without blocking other readers
+	{
+		auto sec = m_tsChunksToUpdateIndices.sharedSecurity();
+		if (std::find(sec->begin(), sec->end(), index) != sec->end())
+			return;
+	}
 
-	bool found = false;
-	for (auto it = m_tsChunksToChangeIndices->begin(); it != m_tsChunksToChangeIndices->end(); it++)
+	auto sec = m_tsChunksToUpdateIndices.blockSecurity();
+	if (std::find(sec->begin(), sec->end(), index) == sec->end())
 	{
-		if (*it == index)
-		{
-			found = true;
-			break;
-		}
+		sec->push_back(index);
+	}
+}
+void cbe::ChunkManager::AddChangedChunk( int index , bool highPriority, bool signal )
+{
+	{
+		auto sec = m_tsChunksToChangeIndices.sharedSecurity();
+		if (std::find(sec->begin(), sec->end(), index) != sec->end())
+			return;
 	}
 
-	if (!found)
+	auto sec = m_tsChunksToChangeIndices.blockSecurity();
+	if (std::find(sec->begin(), sec->end(), index) == sec->end())
 	{
 		if (highPriority)
 		{
-			m_tsChunksToChangeIndices->push_front(index);
+			sec->push_front(index);
 		}
 		else
 		{
-			m_tsChunksToChangeIndices->push_back(index);
+			sec->push_back(index);
 		}
-
 	}
+
+	if (signal)
+		m_workEvent.Set();
 }
 
-void cbe::ChunkManager::ProcessPendingJobs()
+bool cbe::ChunkManager::ProcessPendingJobs()
 {
-	std::vector<UpdateJob> jobs;
-	int count = 0;
+	// find a chunk with pending jobs while producers can still read
+	int chunkIndex = -1;
 	{
-		auto sec = m_tsUpdateJobs.blockSecurity();
+		auto sec = m_tsUpdateJobs.sharedSecurity();
 
-		for (auto it = m_tsUpdateJobs->begin(); it != m_tsUpdateJobs->end(); it++)
+		for (UINT i = 0; i < sec->size(); i++)
 		{
-			if(!it->empty())
+			if(!sec->at(i).empty())
 			{
-				jobs = std::vector<UpdateJob>(it->begin(), it->end());
-				it->clear();
+				chunkIndex = i;
 				break;
 			}
 		}
 	}
 
+	std::vector<UpdateJob> jobs;
+	if (chunkIndex >= 0)
+	{
+		auto sec = m_tsUpdateJobs.blockSecurity();
+		jobs.swap(sec->at(chunkIndex));
+	}
+
 	for (auto it2 = jobs.begin(); it2 != jobs.end(); it2++)
 	{
 		UpdateJob currJob = *it2;
@@ -714,57 +1511,1151 @@ void cbe::ChunkManager::ProcessPendingJobs()
 		case JOB_TYPE_BLOCKTYPE:	_setBlockType( currJob.chunkIndices, currJob.blockIndices, currJob.val); break;
 		}
 	}
+
+	// group commit, one write per processed batch
+	if (m_pJournal && !jobs.empty())
+	{
+		m_pJournal->Commit();
+		CompactJournalIfNeeded();
+	}
+
+	return chunkIndex >= 0;
 }
-bool cbe::ChunkManager::UpdateNextChunk()
+void cbe::ChunkManager::UploadChunks()
 {
-	auto sec = m_tsChunksToUpdateIndices.blockSecurity();
+	m_uploadedBytes = 0;
+	m_uploadedChunks = 0;
+
+	// every queued chunk is looked at once at most, chunks still building
+	// go to the back and are retried next frame
+	int remaining = GetUploadBacklog();
+	if (remaining == 0)
+		return;
+
+	double start = TimeMilliseconds();
 
-	bool update = false;
-	if (!m_tsChunksToUpdateIndices->empty())
+	for (; remaining > 0; remaining--)
 	{
-		Chunk* pChunk = m_ppChunks[*m_tsChunksToUpdateIndices->begin()];
+		int index;
+		{
+			auto sec = m_tsChunksToUpdateIndices.blockSecurity();
+			if (sec->empty())
+				break;
 
+			index = sec->front();
+			sec->pop_front();
+		}
+
+		UINT bytes = 0;
+		bool uploaded = false;
+
+		Chunk* pChunk = LockChunk(index, false);
 		if (pChunk)
 		{
-			update = pChunk->Update();
-			if (!update)
-			{
-				m_tsChunksToUpdateIndices->push_back(*m_tsChunksToUpdateIndices->begin());
-			}
+			uploaded = pChunk->Update(&bytes);
+			if (!uploaded)
+				AddBuiltChunk(index);
 		}
-		
-		m_tsChunksToUpdateIndices->erase(m_tsChunksToUpdateIndices->begin());
+		UnlockChunk();
+
+		if (!uploaded)
+			continue;
+
+		SetChunkCullingInfo(index, pChunk);
+		m_uploadedBytes += bytes;
+		m_uploadedChunks++;
+
+		if (m_uploadBudgetBytes != 0 && m_uploadedBytes >= m_uploadBudgetBytes)
+			break;
+
+		if (m_uploadBudgetMs > 0.0f && TimeMilliseconds() - start >= m_uploadBudgetMs)
+			break;
+	}
+}
+void cbe::ChunkManager::SetChunkCullingInfo( int chunkIndex, Chunk* pChunk )
+{
+	XMFLOAT3 min, max;
+	if (!pChunk->GetBounds(&min, &max))
+	{
+		min = XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX);
+		max = XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
 	}
 
-	return update;
+	m_bounds.minX[chunkIndex] = min.x;
+	m_bounds.minY[chunkIndex] = min.y;
+	m_bounds.minZ[chunkIndex] = min.z;
+	m_bounds.maxX[chunkIndex] = max.x;
+	m_bounds.maxY[chunkIndex] = max.y;
+	m_bounds.maxZ[chunkIndex] = max.z;
+
+	m_connectivity[chunkIndex] = pChunk->GetConnectivity();
+	pChunk->GetOccluderLayers(&m_occluderLayers[chunkIndex * CHUNK_OCCLUDER_LAYERS]);
+	pChunk->GetIndexRanges(&m_indexRanges[MeshSlot(chunkIndex, 0) * CHUNK_RANGE_COUNT]);
+	m_allocations[MeshSlot(chunkIndex, 0)] = pChunk->GetAllocation();
+
+	// a new full mesh drops the lod meshes of the chunk
+	m_lodUploaded[chunkIndex] = 0;
+	m_lodRequested[chunkIndex] = 0;
+	for (int level = 1; level < m_lodLevels; level++)
+		SetLodCullingInfo(chunkIndex, level, pChunk);
+
+	pChunk->GetTranslucentQuads(&m_translucentCentroids, &m_translucentIndices);
+	m_translucentSorter.SetQuads(chunkIndex, m_translucentCentroids.data(), m_translucentIndices.data(), m_translucentCentroids.size());
 }
-void cbe::ChunkManager::BuildNextChunk()
+void cbe::ChunkManager::CullChunks()
 {
-	m_tsChunksToChangeIndices.enterSecureMode();
-	if (!m_tsChunksToChangeIndices->empty())
+	int chunkCount = m_width * m_height * m_depth;
+	m_visibleChunks.resize(chunkCount);
+
+	int visible = 0;
+	float matWorldViewProj[16];
+	if (!m_culling)
 	{
-		Chunk* pChunk = m_ppChunks[*m_tsChunksToChangeIndices->begin()];
-		if (pChunk)
+		for (int i = 0; i < chunkCount; i++)
 		{
-			pChunk->Build(this);	
-			AddBuiltChunk(*m_tsChunksToChangeIndices->begin());
+			if (m_bounds.minX[i] <= m_bounds.maxX[i])
+				m_visibleChunks[visible++] = i;
 		}
-		
-		m_tsChunksToChangeIndices->erase(m_tsChunksToChangeIndices->begin());
-		m_tsChunksToChangeIndices.leaveSecureMode();
-	}	
+	}
 	else
 	{
-		m_tsChunksToChangeIndices.leaveSecureMode();
-		WaitForSingleObject(GetStartEvent(), INFINITE);
+		// the bounds are in chunk manager space, so are the planes
+		Frustum::MultiplyMatrix(&m_matWorld.m[0][0], &m_matViewProj.m[0][0], matWorldViewProj);
+		m_frustum.Extract(matWorldViewProj);
+
+		visible = m_frustum.CullAABBs(chunkCount, m_bounds.minX.data(), m_bounds.minY.data(), m_bounds.minZ.data(),
+									  m_bounds.maxX.data(), m_bounds.maxY.data(), m_bounds.maxZ.data(), m_visibleChunks.data());
 	}
-}
 
-void cbe::ChunkManager::CheckChunk( int* pIndices )
+	m_visibleChunks.resize(visible);
+
+	CullByConnectivity();
+
+	if (m_culling)
+		CullByOcclusion(matWorldViewProj);
+
+	SelectLods();
+	SelectDirections();
+}
+void cbe::ChunkManager::SelectDirections()
 {
-	if (!m_ppChunks[pIndices[3]])
+	m_visibleDirections.resize(m_visibleChunks.size());
+	m_submittedTriangles = 0;
+
+	for (UINT i = 0; i < m_visibleChunks.size(); i++)
 	{
-		CreateChunk(pIndices[0], pIndices[1], pIndices[2]);
-	}
+		int index = m_visibleChunks[i];
+		int directions = CHUNK_DIRECTIONS_ALL;
+
+		// every quad lies inside the bounds, so a camera beyond them on one
+		// side sees the backs of all quads facing the other way
+		if (m_hasCamera)
+		{
+			const XMFLOAT3& camera = m_cameraPosition;
+			if (camera.z >= m_bounds.maxZ[index]) directions &= ~(1 << VERT_NORMAL_FRONT_INDEX);
+			if (camera.z <= m_bounds.minZ[index]) directions &= ~(1 << VERT_NORMAL_BACK_INDEX);
+			if (camera.x <= m_bounds.minX[index]) directions &= ~(1 << VERT_NORMAL_RIGHT_INDEX);
+			if (camera.x >= m_bounds.maxX[index]) directions &= ~(1 << VERT_NORMAL_LEFT_INDEX);
+			if (camera.y <= m_bounds.minY[index]) directions &= ~(1 << VERT_NORMAL_UP_INDEX);
+			if (camera.y >= m_bounds.maxY[index]) directions &= ~(1 << VERT_NORMAL_DOWN_INDEX);
+		}
+
+		m_visibleDirections[i] = (unsigned char)directions;
+
+		const Chunk::INDEX_RANGE* pRanges = &m_indexRanges[MeshSlot(index, m_visibleLods[i]) * CHUNK_RANGE_COUNT];
+		for (int direction = 0; direction < VERT_NORMAL_COUNT; direction++)
+		{
+			if (directions & (1 << direction))
+				m_submittedTriangles += pRanges[direction].count / 3;
+		}
+		m_submittedTriangles += pRanges[CHUNK_RANGE_TRANSPARENT].count / 3;
+	}
+}
+void cbe::ChunkManager::SelectLods()
+{
+	m_visibleLods.assign(m_visibleChunks.size(), 0);
+	m_lodChunks = 0;
+	if (!m_hasCamera || m_lodDistance <= 0.0f || m_lodLevels < 2)
+		return;
+
+	const XMFLOAT3& camera = m_cameraPosition;
+	for (UINT i = 0; i < m_visibleChunks.size(); i++)
+	{
+		int index = m_visibleChunks[i];
+
+		// distance to the nearest point of the bounds
+		float dx = camera.x < m_bounds.minX[index] ? m_bounds.minX[index] - camera.x : (camera.x > m_bounds.maxX[index] ? camera.x - m_bounds.maxX[index] : 0.0f);
+		float dy = camera.y < m_bounds.minY[index] ? m_bounds.minY[index] - camera.y : (camera.y > m_bounds.maxY[index] ? camera.y - m_bounds.maxY[index] : 0.0f);
+		float dz = camera.z < m_bounds.minZ[index] ? m_bounds.minZ[index] - camera.z : (camera.z > m_bounds.maxZ[index] ? camera.z - m_bounds.maxZ[index] : 0.0f);
+		float distance = sqrt(dx * dx + dy * dy + dz * dz);
+
+		int level = 0;
+		for (float limit = m_lodDistance; level + 1 < m_lodLevels && distance >= limit; limit *= 2.0f)
+			level++;
+
+		if (level == 0)
+			continue;
+
+		if (!(m_lodUploaded[index] & (1 << level)))
+			RequestLod(index, level);
+
+		for (int drawn = level; drawn > 0; drawn--)
+		{
+			if (m_lodUploaded[index] & (1 << drawn))
+			{
+				m_visibleLods[i] = (unsigned char)drawn;
+				m_lodChunks++;
+				break;
+			}
+		}
+	}
+}
+void cbe::ChunkManager::RequestLod( int chunkIndex, int level )
+{
+	if (m_lodRequested[chunkIndex] & (1 << level))
+		return;
+
+	m_lodRequested[chunkIndex] |= 1 << level;
+
+	bool requested = false;
+	Chunk* pChunk = LockChunk(chunkIndex, false);
+	if (pChunk)
+		requested = pChunk->RequestLod(level);
+	UnlockChunk();
+
+	if (requested)
+	{
+		m_tsLodRequests->push_back(MeshSlot(chunkIndex, level));
+		m_workEvent.Set();
+	}
 }
+bool cbe::ChunkManager::BuildNextLod()
+{
+	int slot = -1;
+	{
+		auto sec = m_tsLodRequests.blockSecurity();
+		if (!sec->empty())
+		{
+			slot = sec->front();
+			sec->pop_front();
+		}
+	}
+
+	if (slot < 0)
+		return false;
+
+	bool built = false;
+	Chunk* pChunk = PinChunk(slot / CHUNK_LOD_LEVELS);
+	if (pChunk)
+		built = pChunk->BuildLod(this, slot % CHUNK_LOD_LEVELS);
+	UnpinChunk(pChunk);
+
+	if (built)
+	{
+		m_tsBuiltLods->push_back(slot);
+		m_lodBuilds++;
+	}
+
+	return true;
+}
+void cbe::ChunkManager::UploadLods()
+{
+	std::deque<int> built;
+	{
+		auto sec = m_tsBuiltLods.blockSecurity();
+		built.swap(**sec);
+	}
+
+	while (!built.empty())
+	{
+		int slot = built.front();
+		int chunkIndex = slot / CHUNK_LOD_LEVELS;
+		int level = slot % CHUNK_LOD_LEVELS;
+
+		UINT bytes = 0;
+		bool retry = false;
+		Chunk* pChunk = LockChunk(chunkIndex, false);
+		if (pChunk)
+		{
+			if (pChunk->UpdateLod(level, &bytes))
+				SetLodCullingInfo(chunkIndex, level, pChunk);
+			else
+				retry = pChunk->GetLodState(level) == CHUNK_LOD_BUILT;
+		}
+		UnlockChunk();
+
+		// a full mesh buffer is retried next frame, the rest was dropped
+		if (retry)
+			break;
+
+		built.pop_front();
+		m_uploadedBytes += bytes;
+	}
+
+	if (!built.empty())
+	{
+		auto sec = m_tsBuiltLods.blockSecurity();
+		sec->insert(sec->begin(), built.begin(), built.end());
+	}
+}
+void cbe::ChunkManager::SetLodCullingInfo( int chunkIndex, int level, Chunk* pChunk )
+{
+	int slot = MeshSlot(chunkIndex, level);
+	XMFLOAT3 min, max;
+	if (!pChunk->GetLodMesh(level, &m_allocations[slot], &m_indexRanges[slot * CHUNK_RANGE_COUNT], &min, &max))
+	{
+		ZeroMemory(&m_allocations[slot], sizeof(MESH_ALLOCATION));
+		ZeroMemory(&m_indexRanges[slot * CHUNK_RANGE_COUNT], CHUNK_RANGE_COUNT * sizeof(Chunk::INDEX_RANGE));
+		return;
+	}
+
+	m_lodUploaded[chunkIndex] |= 1 << level;
+
+	// the coarse mesh may reach past the full one, the bounds cover both
+	if (min.x < m_bounds.minX[chunkIndex]) m_bounds.minX[chunkIndex] = min.x;
+	if (min.y < m_bounds.minY[chunkIndex]) m_bounds.minY[chunkIndex] = min.y;
+	if (min.z < m_bounds.minZ[chunkIndex]) m_bounds.minZ[chunkIndex] = min.z;
+	if (max.x > m_bounds.maxX[chunkIndex]) m_bounds.maxX[chunkIndex] = max.x;
+	if (max.y > m_bounds.maxY[chunkIndex]) m_bounds.maxY[chunkIndex] = max.y;
+	if (max.z > m_bounds.maxZ[chunkIndex]) m_bounds.maxZ[chunkIndex] = max.z;
+}
+void cbe::ChunkManager::SetLodDistance( float distance )
+{
+	m_lodDistance = distance;
+}
+void cbe::ChunkManager::SetMeshCacheSize( UINT bytes )
+{
+	m_meshCache.SetCapacity(bytes);
+}
+bool cbe::ChunkManager::SaveMeshes( std::string fileName )
+{
+	if (!m_ppChunks)
+		return false;
+
+	int chunkCount = m_width * m_height * m_depth;
+	unsigned __int64 typesHash = m_pTypeMgr->GetMeshHash();
+
+	// every built chunk, keyed by its blocks as they are now
+	std::vector<MeshCache::FILE_RECORD> records;
+	std::vector<unsigned __int64> blockHashes;
+	for (int i = 0; i < chunkCount; i++)
+	{
+		Chunk* pChunk = LockChunk(i, false);
+		unsigned __int64 blockHash = pChunk && pChunk->GetMeshKey() != 0 ? pChunk->GetContentHash() : 0;
+		UnlockChunk();
+
+		if (blockHash != 0)
+		{
+			MeshCache::FILE_RECORD record = { i, Chunk::MeshKey(blockHash, typesHash, m_chunkSize), -1 };
+			records.push_back(record);
+			blockHashes.push_back(blockHash);
+		}
+	}
+
+	FILE* pFile = fopen(fileName.c_str(), "wb");
+	if (!pFile)
+		return false;
+
+	std::vector<int> meshRecords;
+	bool success = MeshCache::WriteHeader(pFile, chunkCount, m_chunkSize, typesHash, records, &meshRecords);
+
+	// one mesh at a time, the cache holds only part of a large world. an
+	// edit during the save fails it, the record would not match the mesh
+	CACHED_MESH mesh;
+	for (UINT i = 0; i < meshRecords.size() && success; i++)
+	{
+		const MeshCache::FILE_RECORD& record = records[meshRecords[i]];
+		if (!m_meshCache.Peek(record.key, &mesh))
+		{
+			Chunk* pChunk = PinChunk(record.chunkIndex);
+			success = pChunk && pChunk->BuildCachedMesh(this, blockHashes[meshRecords[i]], &mesh);
+			UnpinChunk(pChunk);
+		}
+
+		success = success && MeshCache::WriteMesh(pFile, mesh);
+	}
+
+	return fclose(pFile) == 0 && success;
+}
+bool cbe::ChunkManager::LoadMeshes( std::string fileName )
+{
+	m_loadedMeshes = 0;
+	if (!m_ppChunks)
+		return false;
+
+	unsigned __int64 typesHash = 0;
+	std::vector<MeshCache::FILE_RECORD> records;
+	std::vector<CACHED_MESH> meshes;
+	if (!MeshCache::Read(fileName, m_width * m_height * m_depth, m_chunkSize, &typesHash, &records, &meshes))
+		return false;
+
+	// meshes of other block types are of no use, every chunk is built
+	if (typesHash != m_pTypeMgr->GetMeshHash())
+		return true;
+
+	std::vector<int> loaded;
+	for (UINT i = 0; i < records.size(); i++)
+	{
+		const MeshCache::FILE_RECORD& record = records[i];
+
+		// the chunk takes the mesh apart, keep the original for the others
+		CACHED_MESH mesh = meshes[record.mesh];
+
+		bool set = false;
+		Chunk* pChunk = LockChunk(record.chunkIndex, false);
+		if (pChunk)
+			set = pChunk->SetMesh(record.key, typesHash, &mesh);
+		UnlockChunk();
+
+		if (!set)
+			continue;
+
+		AddBuiltChunk(record.chunkIndex);
+		loaded.push_back(record.chunkIndex);
+		m_meshCache.Insert(record.key, meshes[record.mesh]);
+	}
+
+	// the loaded chunks are queued by Deserialize, take them off again
+	{
+		auto sec = m_tsChunksToChangeIndices.blockSecurity();
+		for (UINT i = 0; i < loaded.size(); i++)
+			sec->remove(loaded[i]);
+	}
+
+	m_loadedMeshes = loaded.size();
+
+	return true;
+}
+void cbe::ChunkManager::GetChunkCell( const XMFLOAT3& position, int* pX, int* pY, int* pZ )
+{
+	// chunk cells start half a block before the chunk position
+	float halfBlock = m_absoluteChunkSize / m_chunkSize / 2.0f;
+	*pX = (int)floor((position.x + halfBlock) / m_absoluteChunkSize);
+	*pY = (int)floor((position.y + halfBlock) / m_absoluteChunkSize);
+	*pZ = (int)floor((position.z + halfBlock) / m_absoluteChunkSize);
+}
+void cbe::ChunkManager::InitGridOccupancy()
+{
+	OCCUPANCY_LEVEL grid = { m_width, m_height, m_depth, 0 };
+	m_gridLevels.assign(1, grid);
+
+	UINT cells = grid.width * grid.height * grid.depth;
+	while (grid.width > 1 || grid.height > 1 || grid.depth > 1)
+	{
+		grid.width = (grid.width + 1) / 2;
+		grid.height = (grid.height + 1) / 2;
+		grid.depth = (grid.depth + 1) / 2;
+		grid.offset = cells;
+		m_gridLevels.push_back(grid);
+		cells += grid.width * grid.height * grid.depth;
+	}
+
+	m_gridOccupancy.assign(cells, 0);
+}
+bool cbe::ChunkManager::GridChildrenOccupied( int level, int x, int y, int z )
+{
+	const OCCUPANCY_LEVEL& children = m_gridLevels[level - 1];
+	for (int cx = 2 * x; cx <= 2 * x + 1 && cx < children.width; cx++)
+		for (int cy = 2 * y; cy <= 2 * y + 1 && cy < children.height; cy++)
+			for (int cz = 2 * z; cz <= 2 * z + 1 && cz < children.depth; cz++)
+				if (m_gridOccupancy[GridIndex(level - 1, cx, cy, cz)])
+					return true;
+
+	return false;
+}
+void cbe::ChunkManager::UpdateGridOccupancy( Chunk* pChunk )
+{
+	int x = pChunk->GetChunkIndexX();
+	int y = pChunk->GetChunkIndexY();
+	int z = pChunk->GetChunkIndexZ();
+
+	// loaders and the thread applying edits update the grid, the chunk is
+	// read under the lock, so a change made after the read updates again
+	// and the last update sees the last change. most edits keep the bit
+	m_occupancyLock.LockShared();
+	bool current = m_gridOccupancy[GridIndex(0, x, y, z)] == !pChunk->IsEmpty();
+	m_occupancyLock.UnlockShared();
+
+	if (current)
+		return;
+
+	m_occupancyLock.LockExclusive();
+
+	unsigned char occupied = !pChunk->IsEmpty();
+	m_gridOccupancy[GridIndex(0, x, y, z)] = occupied;
+	for (int level = 1; level < (int)m_gridLevels.size(); level++)
+	{
+		x >>= 1;
+		y >>= 1;
+		z >>= 1;
+
+		unsigned char& cell = m_gridOccupancy[GridIndex(level, x, y, z)];
+		unsigned char value = occupied || GridChildrenOccupied(level, x, y, z);
+		if (cell == value)
+			break;
+
+		cell = value;
+	}
+
+	m_occupancyLock.UnlockExclusive();
+}
+bool cbe::ChunkManager::GridRegionOccupied( int level, int x, int y, int z, const int* pMin, const int* pMax, std::vector<int>* pChunks )
+{
+	// called with m_occupancyLock held, occupied chunks the region only
+	// partly covers are collected for a look at their own pyramid
+	if (!m_gridOccupancy[GridIndex(level, x, y, z)])
+		return false;
+
+	int cell[3] = { x, y, z };
+	int blocks[3] = { m_width * m_chunkSize, m_height * m_chunkSize, m_depth * m_chunkSize };
+	bool inside = true;
+	for (int i = 0; i < 3; i++)
+	{
+		int first = (cell[i] << level) * m_chunkSize;
+		int last = ((cell[i] + 1) << level) * m_chunkSize - 1;
+		if (last >= blocks[i])
+			last = blocks[i] - 1;
+
+		inside &= first >= pMin[i] && last <= pMax[i];
+	}
+
+	if (inside)
+		return true;
+
+	if (level == 0)
+	{
+		pChunks->push_back(_3dto1d(x, y, z, m_height, m_depth));
+		return false;
+	}
+
+	const OCCUPANCY_LEVEL& children = m_gridLevels[level - 1];
+	int childBlocks = (1 << (level - 1)) * m_chunkSize;
+	for (int cx = 2 * x; cx <= 2 * x + 1 && cx < children.width; cx++)
+	{
+		if (cx * childBlocks > pMax[0] || (cx + 1) * childBlocks - 1 < pMin[0])
+			continue;
+
+		for (int cy = 2 * y; cy <= 2 * y + 1 && cy < children.height; cy++)
+		{
+			if (cy * childBlocks > pMax[1] || (cy + 1) * childBlocks - 1 < pMin[1])
+				continue;
+
+			for (int cz = 2 * z; cz <= 2 * z + 1 && cz < children.depth; cz++)
+			{
+				if (cz * childBlocks > pMax[2] || (cz + 1) * childBlocks - 1 < pMin[2])
+					continue;
+
+				if (GridRegionOccupied(level - 1, cx, cy, cz, pMin, pMax, pChunks))
+					return true;
+			}
+		}
+	}
+
+	return false;
+}
+bool cbe::ChunkManager::IsRegionEmpty( const int* pMin, const int* pMax )
+{
+	if (!m_ppChunks)
+		return true;
+
+	int blocks[3] = { m_width * m_chunkSize, m_height * m_chunkSize, m_depth * m_chunkSize };
+	int min[3], max[3];
+	for (int i = 0; i < 3; i++)
+	{
+		min[i] = pMin[i] > 0 ? pMin[i] : 0;
+		max[i] = pMax[i] < blocks[i] - 1 ? pMax[i] : blocks[i] - 1;
+		if (min[i] > max[i])
+			return true;
+	}
+
+	std::vector<int> chunks;
+	m_occupancyLock.LockShared();
+	bool occupied = GridRegionOccupied((int)m_gridLevels.size() - 1, 0, 0, 0, min, max, &chunks);
+	m_occupancyLock.UnlockShared();
+
+	if (occupied)
+		return false;
+
+	// the chunks are asked without holding the grid lock
+	for (UINT i = 0; i < chunks.size() && !occupied; i++)
+	{
+		int cx, cy, cz;
+		_1dto3d(chunks[i], m_height, m_depth, &cx, &cy, &cz);
+
+		int origin[3] = { cx * m_chunkSize, cy * m_chunkSize, cz * m_chunkSize };
+		int localMin[3], localMax[3];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			localMin[axis] = min[axis] - origin[axis];
+			localMax[axis] = max[axis] - origin[axis];
+		}
+
+		Chunk* pChunk = LockChunk(chunks[i], false);
+		occupied = pChunk && !pChunk->IsRegionEmpty(localMin, localMax);
+		UnlockChunk();
+	}
+
+	return !occupied;
+}
+bool cbe::ChunkManager::GetEmptyRegion( const int* pBlock, int* pMin, int* pMax )
+{
+	int chunkIndices[4];
+	int blockIndices[4];
+	if (!TransformCoords(pBlock[0], pBlock[1], pBlock[2], chunkIndices, blockIndices))
+		return false;
+
+	int blocks[3] = { m_width * m_chunkSize, m_height * m_chunkSize, m_depth * m_chunkSize };
+
+	// coarsest empty grid cell around the chunk
+	m_occupancyLock.LockShared();
+	int level = (int)m_gridLevels.size() - 1;
+	while (level >= 0 && m_gridOccupancy[GridIndex(level, chunkIndices[0] >> level, chunkIndices[1] >> level, chunkIndices[2] >> level)])
+		level--;
+	m_occupancyLock.UnlockShared();
+
+	if (level >= 0)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			int first = (chunkIndices[i] >> level) << level;
+			pMin[i] = first * m_chunkSize;
+			pMax[i] = (first + (1 << level)) * m_chunkSize - 1;
+			if (pMax[i] >= blocks[i])
+				pMax[i] = blocks[i] - 1;
+		}
+
+		return true;
+	}
+
+	// then inside the chunk, a chunk that does not exist is empty
+	Chunk* pChunk = LockChunk(chunkIndices[3], false);
+	level = pChunk ? pChunk->GetEmptyLevel(blockIndices[0], blockIndices[1], blockIndices[2]) : -2;
+	UnlockChunk();
+
+	if (level == -1)
+		return false;
+
+	for (int i = 0; i < 3; i++)
+	{
+		int first = 0;
+		int last = m_chunkSize - 1;
+		if (level >= 0)
+		{
+			first = (blockIndices[i] >> level) << level;
+			last = first + (1 << level) - 1;
+			if (last >= m_chunkSize)
+				last = m_chunkSize - 1;
+		}
+
+		pMin[i] = chunkIndices[i] * m_chunkSize + first;
+		pMax[i] = chunkIndices[i] * m_chunkSize + last;
+	}
+
+	return true;
+}
+bool cbe::ChunkManager::Raycast( const float* pOrigin, const float* pDirection, float maxDistance, int* pBlock, float* pDistance )
+{
+	float length = sqrt(pDirection[0] * pDirection[0] + pDirection[1] * pDirection[1] + pDirection[2] * pDirection[2]);
+	if (length == 0.0f || !m_ppChunks)
+		return false;
+
+	// blocks are centered on their position, like in GetChunkCell
+	float blockSize = m_absoluteChunkSize / m_chunkSize;
+	float halfBlock = blockSize / 2.0f;
+	int blocks[3] = { m_width * m_chunkSize, m_height * m_chunkSize, m_depth * m_chunkSize };
+
+	// clip the ray to the world
+	float direction[3], inverse[3];
+	float t = 0.0f;
+	float end = maxDistance;
+	for (int i = 0; i < 3; i++)
+	{
+		direction[i] = pDirection[i] / length;
+		inverse[i] = direction[i] != 0.0f ? 1.0f / direction[i] : 0.0f;
+
+		float low = -halfBlock;
+		float high = blocks[i] * blockSize - halfBlock;
+		if (direction[i] == 0.0f)
+		{
+			if (pOrigin[i] < low || pOrigin[i] >= high)
+				return false;
+			continue;
+		}
+
+		float t0 = (low - pOrigin[i]) * inverse[i];
+		float t1 = (high - pOrigin[i]) * inverse[i];
+		if (t0 > t1)
+		{
+			float tmp = t0;
+			t0 = t1;
+			t1 = tmp;
+		}
+
+		if (t0 > t)
+			t = t0;
+		if (t1 < end)
+			end = t1;
+	}
+
+	if (t > end)
+		return false;
+
+	int block[3];
+	for (int i = 0; i < 3; i++)
+	{
+		block[i] = (int)floor((pOrigin[i] + direction[i] * t + halfBlock) / blockSize);
+		block[i] = block[i] < 0 ? 0 : (block[i] >= blocks[i] ? blocks[i] - 1 : block[i]);
+	}
+
+	for (;;)
+	{
+		int min[3], max[3];
+		if (!GetEmptyRegion(block, min, max))
+			break;
+
+		// leave the empty cell through the nearest face
+		int axis = -1;
+		float exit = FLT_MAX;
+		for (int i = 0; i < 3; i++)
+		{
+			if (direction[i] == 0.0f)
+				continue;
+
+			float face = (direction[i] > 0.0f ? max[i] + 1 : min[i]) * blockSize - halfBlock;
+			float tFace = (face - pOrigin[i]) * inverse[i];
+			if (tFace < exit)
+			{
+				exit = tFace;
+				axis = i;
+			}
+		}
+
+		if (axis < 0 || exit > end)
+			return false;
+
+		if (exit > t)
+			t = exit;
+
+		for (int i = 0; i < 3; i++)
+		{
+			if (i == axis)
+			{
+				block[i] = direction[i] > 0.0f ? max[i] + 1 : min[i] - 1;
+				continue;
+			}
+
+			int b = (int)floor((pOrigin[i] + direction[i] * t + halfBlock) / blockSize);
+			block[i] = b < min[i] ? min[i] : (b > max[i] ? max[i] : b);
+		}
+
+		if (block[axis] < 0 || block[axis] >= blocks[axis])
+			return false;
+	}
+
+	memcpy(pBlock, block, sizeof(block));
+	if (pDistance)
+		*pDistance = t;
+
+	return true;
+}
+void cbe::ChunkManager::CullByConnectivity()
+{
+	m_connectivityCulled = 0;
+	if (!m_hasCamera)
+		return;
+
+	float halfBlock = m_absoluteChunkSize / m_chunkSize / 2.0f;
+	int x, y, z;
+	GetChunkCell(m_cameraPosition, &x, &y, &z);
+
+	// from outside the map nothing can be ruled out
+	if (x < 0 || x >= m_width || y < 0 || y >= m_height || z < 0 || z >= m_depth)
+		return;
+
+	static const int offsets[CHUNK_FACE_COUNT][3] = { { 0, 0, -1 }, { 0, 0, 1 }, { -1, 0, 0 }, { 1, 0, 0 }, { 0, -1, 0 }, { 0, 1, 0 } };
+
+	m_reachable.assign(m_width * m_height * m_depth, 0);
+	m_traversal.clear();
+
+	TRAVERSAL_NODE start = { _3dto1d(x, y, z, m_height, m_depth), -1, 0 };
+	m_reachable[start.chunkIndex] = 1;
+	m_traversal.push_back(start);
+
+	for (UINT head = 0; head < m_traversal.size(); head++)
+	{
+		TRAVERSAL_NODE node = m_traversal[head];
+		_1dto3d(node.chunkIndex, m_height, m_depth, &x, &y, &z);
+
+		for (int face = 0; face < CHUNK_FACE_COUNT; face++)
+		{
+			// faces come in pairs, face ^ 1 is the opposite one. never
+			// step back against a direction taken before
+			if (node.directions & (1 << (face ^ 1)))
+				continue;
+
+			// the view has to pass through the chunk from entry to exit
+			if (node.entryFace >= 0 && !(m_connectivity[node.chunkIndex] & (1 << Chunk::FacePairBit(node.entryFace, face))))
+				continue;
+
+			int nx = x + offsets[face][0];
+			int ny = y + offsets[face][1];
+			int nz = z + offsets[face][2];
+			if (nx < 0 || nx >= m_width || ny < 0 || ny >= m_height || nz < 0 || nz >= m_depth)
+				continue;
+
+			int neighbor = _3dto1d(nx, ny, nz, m_height, m_depth);
+			if (m_reachable[neighbor])
+				continue;
+
+			if (m_culling)
+			{
+				XMFLOAT3 min(nx * m_absoluteChunkSize - halfBlock, ny * m_absoluteChunkSize - halfBlock, nz * m_absoluteChunkSize - halfBlock);
+				XMFLOAT3 max(min.x + m_absoluteChunkSize, min.y + m_absoluteChunkSize, min.z + m_absoluteChunkSize);
+				if (!m_frustum.TestAABB(min, max))
+					continue;
+			}
+
+			m_reachable[neighbor] = 1;
+
+			TRAVERSAL_NODE next = { neighbor, face ^ 1, node.directions | (1 << face) };
+			m_traversal.push_back(next);
+		}
+	}
+
+	int visible = 0;
+	for (UINT i = 0; i < m_visibleChunks.size(); i++)
+	{
+		if (m_reachable[m_visibleChunks[i]])
+			m_visibleChunks[visible++] = m_visibleChunks[i];
+	}
+
+	m_connectivityCulled = m_visibleChunks.size() - visible;
+	m_visibleChunks.resize(visible);
+}
+void cbe::ChunkManager::CullByOcclusion( const float* pMatWorldViewProj )
+{
+	m_occlusionCulled = 0;
+	m_occluderQuads = 0;
+	if (!m_occlusionCulling)
+		return;
+
+	double start = TimeMilliseconds();
+
+	// nearest chunks first, ties by index so the occluders are stable
+	m_occlusion.Clear(pMatWorldViewProj);
+	m_occluderOrder.resize(m_visibleChunks.size());
+	for (UINT i = 0; i < m_visibleChunks.size(); i++)
+	{
+		int index = m_visibleChunks[i];
+		XMFLOAT3 center((m_bounds.minX[index] + m_bounds.maxX[index]) / 2.0f,
+						(m_bounds.minY[index] + m_bounds.maxY[index]) / 2.0f,
+						(m_bounds.minZ[index] + m_bounds.maxZ[index]) / 2.0f);
+		m_occluderOrder[i] = std::make_pair(m_occlusion.ViewDepth(center), index);
+	}
+
+	UINT occluders = m_maxOccluders < m_occluderOrder.size() ? m_maxOccluders : m_occluderOrder.size();
+	std::partial_sort(m_occluderOrder.begin(), m_occluderOrder.begin() + occluders, m_occluderOrder.end());
+
+	float blockSize = m_absoluteChunkSize / m_chunkSize;
+	float halfBlock = blockSize / 2.0f;
+	for (UINT i = 0; i < occluders; i++)
+	{
+		int index = m_occluderOrder[i].second;
+		const unsigned __int8* pLayers = &m_occluderLayers[index * CHUNK_OCCLUDER_LAYERS];
+
+		int cell[3];
+		_1dto3d(index, m_height, m_depth, &cell[0], &cell[1], &cell[2]);
+
+		// the layer spans the whole chunk cell, its center plane lies
+		// inside the solid blocks
+		float lo[3], hi[3];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			lo[axis] = cell[axis] * m_absoluteChunkSize - halfBlock;
+			hi[axis] = lo[axis] + m_absoluteChunkSize;
+		}
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			if (pLayers[axis * 2] == CHUNK_NO_OCCLUDER)
+				continue;
+
+			int u = (axis + 1) % 3;
+			int v = (axis + 2) % 3;
+
+			float first[3], last[3];
+			for (int i = 0; i < 3; i++)
+				first[i] = last[i] = (lo[i] + hi[i]) / 2.0f;
+			first[axis] = cell[axis] * m_absoluteChunkSize + pLayers[axis * 2] * blockSize;
+			last[axis] = cell[axis] * m_absoluteChunkSize + pLayers[axis * 2 + 1] * blockSize;
+
+			// the layer nearer to the camera hides everything the other one does
+			float plane = first[axis];
+			if (m_occlusion.ViewDepth(XMFLOAT3(last[0], last[1], last[2])) < m_occlusion.ViewDepth(XMFLOAT3(first[0], first[1], first[2])))
+				plane = last[axis];
+
+			float quad[4][3];
+			for (int corner = 0; corner < 4; corner++)
+			{
+				quad[corner][axis] = plane;
+				quad[corner][u] = (corner == 1 || corner == 2) ? hi[u] : lo[u];
+				quad[corner][v] = (corner >= 2) ? hi[v] : lo[v];
+			}
+
+			XMFLOAT3 corners[4];
+			for (int corner = 0; corner < 4; corner++)
+				corners[corner] = XMFLOAT3(quad[corner][0], quad[corner][1], quad[corner][2]);
+
+			if (m_occlusion.RasterizeQuad(corners))
+				m_occluderQuads++;
+		}
+	}
+
+	m_occlusion.BuildPyramid();
+
+	int visible = 0;
+	for (UINT i = 0; i < m_visibleChunks.size(); i++)
+	{
+		int index = m_visibleChunks[i];
+		XMFLOAT3 min(m_bounds.minX[index], m_bounds.minY[index], m_bounds.minZ[index]);
+		XMFLOAT3 max(m_bounds.maxX[index], m_bounds.maxY[index], m_bounds.maxZ[index]);
+
+		if (m_occlusion.TestAABB(min, max))
+			m_visibleChunks[visible++] = index;
+	}
+
+	m_occlusionCulled = m_visibleChunks.size() - visible;
+	m_visibleChunks.resize(visible);
+
+	m_occlusionTime = (float)(TimeMilliseconds() - start);
+}
+void cbe::ChunkManager::SetOcclusionCulling( bool enable, int width, int height, UINT maxOccluders )
+{
+	m_occlusionCulling = enable;
+	m_maxOccluders = maxOccluders;
+	if (enable && (width != m_occlusion.Width() || height != m_occlusion.Height()))
+		m_occlusion.Init(width, height);
+}
+void cbe::ChunkManager::SetCameraPosition( const float* pPosition )
+{
+	m_hasCamera = pPosition != NULL;
+	if (pPosition)
+		m_cameraPosition = XMFLOAT3(pPosition[0], pPosition[1], pPosition[2]);
+}
+void cbe::ChunkManager::SetViewProjection( const float* pMat )
+{
+	m_culling = pMat != NULL;
+	if (pMat)
+		m_matViewProj = XMFLOAT4X4(pMat);
+}
+void cbe::ChunkManager::SetUploadBudget( float milliseconds, UINT bytes )
+{
+	m_uploadBudgetMs = milliseconds;
+	m_uploadBudgetBytes = bytes;
+}
+int cbe::ChunkManager::GetUploadBacklog()
+{
+	auto sec = m_tsChunksToUpdateIndices.sharedSecurity();
+	return (int)sec->size();
+}
+bool cbe::ChunkManager::BuildNextChunk()
+{
+	// take the chunk off the queue, edits arriving during the build queue it again
+	int index = -1;
+	{
+		auto sec = m_tsChunksToChangeIndices.blockSecurity();
+		if (!sec->empty())
+		{
+			index = sec->front();
+			sec->pop_front();
+		}
+	}
+
+	if (index < 0)
+		return false;
+
+	// meshing takes a while, a chunk creation waiting for the exclusive
+	// lock would hold up every other reader meanwhile
+	Chunk* pChunk = PinChunk(index);
+	if (pChunk)
+	{
+		pChunk->Build(this);
+		AddBuiltChunk(index);
+	}
+	UnpinChunk(pChunk);
+
+	return true;
+}
+
+void cbe::ChunkManager::CheckChunk( int chunkIndex )
+{
+	if (!m_ppChunks[chunkIndex])
+	{
+		int ix, iy, iz;
+		_1dto3d(chunkIndex, m_height, m_depth, &ix, &iy, &iz);
+		CreateChunk(ix, iy, iz);
+	}
+}
+
+Chunk* cbe::ChunkManager::LockChunk( int chunkIndex, bool create )
+{
+	m_structureLock.LockShared();
+
+	Chunk* pChunk = m_ppChunks[chunkIndex];
+	if (pChunk || !create)
+		return pChunk;
+
+	// creating is the only structural change, everything else runs shared
+	m_structureLock.UnlockShared();
+	m_structureLock.LockExclusive();
+	CheckChunk(chunkIndex);
+	m_structureLock.UnlockExclusive();
+
+	m_structureLock.LockShared();
+	return m_ppChunks[chunkIndex];
+}
+void cbe::ChunkManager::UnlockChunk()
+{
+	m_structureLock.UnlockShared();
+}
+Chunk* cbe::ChunkManager::PinChunk( int chunkIndex )
+{
+	m_structureLock.LockShared();
+	Chunk* pChunk = m_ppChunks[chunkIndex];
+	if (pChunk)
+		m_pinnedChunks++;
+	m_structureLock.UnlockShared();
+
+	return pChunk;
+}
+void cbe::ChunkManager::UnpinChunk( Chunk* pChunk )
+{
+	if (pChunk)
+		m_pinnedChunks--;
+}
+
+
+
+bool cbe::ChunkManager::OpenJournal( std::string fileName )
+{
+	if (!m_ppChunks)
+		return false;
+
+	CloseJournal();
+
+	int chunkCount = m_width * m_height * m_depth;
+
+	// bring the loaded map up to date first
+	std::vector<EditJournal::Record> records;
+	if (EditJournal::Read(fileName, chunkCount, m_chunkSize, records))
+		ReplayJournal(records);
+
+	m_pJournal = new EditJournal();
+	if (!m_pJournal->Open(fileName, chunkCount, m_chunkSize))
+	{
+		SAFE_DELETE(m_pJournal);
+		return false;
+	}
+
+	return true;
+}
+void cbe::ChunkManager::CloseJournal()
+{
+	if (m_pJournal)
+		m_pJournal->Close();
+
+	SAFE_DELETE(m_pJournal);
+}
+bool cbe::ChunkManager::CompactJournal( std::string mapFileName )
+{
+	if (!m_pJournal)
+		return false;
+
+	m_pJournal->Commit();
+
+	// Serialize replaces the map only once the new one is complete
+	if (!Serialize(mapFileName))
+		return false;
+
+	return m_pJournal->Truncate();
+}
+void cbe::ChunkManager::SetJournalCompaction( std::string mapFileName, UINT maxRecords )
+{
+	m_settingsMutex.lock();
+	m_compactionFileName = mapFileName;
+	m_compactionThreshold = maxRecords;
+	m_compactionRetry = 0;
+	m_settingsMutex.unlock();
+
+	m_compactionFailures = 0;
+}
+UINT cbe::ChunkManager::GetJournalRecordCount()
+{
+	if (!m_pJournal)
+		return 0;
+
+	return m_pJournal->CommittedRecords() + m_pJournal->PendingRecords();
+}
+
+void cbe::ChunkManager::JournalEdit( int* chunkIndices, int* blockIndices )
+{
+	if (m_pJournal)
+		m_pJournal->Append(chunkIndices[3], blockIndices[3], m_ppChunks[chunkIndices[3]]->GetBlock(blockIndices[3]));
+}
+void cbe::ChunkManager::ReplayJournal( std::vector<EditJournal::Record>& records )
+{
+	int chunkCount = m_width * m_height * m_depth;
+	int blockCount = m_chunkSize * m_chunkSize * m_chunkSize;
+
+	for (auto it = records.begin(); it != records.end(); it++)
+	{
+		if (it->chunkIndex < 0 || it->chunkIndex >= chunkCount ||
+			it->blockIndex < 0 || it->blockIndex >= blockCount)
+		{
+			continue;
+		}
+
+		Block block;
+		block.SetData(it->data);
+
+		Chunk* pChunk = LockChunk(it->chunkIndex, true);
+		pChunk->SetBlock(it->blockIndex, block);
+		UpdateGridOccupancy(pChunk);
+		AddChangedChunk(it->chunkIndex);
+		UnlockChunk();
+	}
+
+	m_upToDate = false;
+}
+void cbe::ChunkManager::CompactJournalIfNeeded()
+{
+	m_settingsMutex.lock();
+	std::string mapFileName = m_compactionFileName;
+	UINT threshold = m_compactionThreshold;
+	UINT retry = m_compactionRetry;
+	m_settingsMutex.unlock();
+
+	UINT records = m_pJournal->CommittedRecords();
+	if (mapFileName.empty() || threshold == 0 || records < threshold || records < retry)
+		return;
+
+	// only called by the thread applying edits, no edit can slip in
+	// between saving and truncating
+	bool compacted = CompactJournal(mapFileName);
+
+	UINT failures = 0;
+	UINT retryAt = 0;
+	if (!compacted)
+	{
+		// a full disk must not cost a save of the whole world per edit batch
+		failures = m_compactionFailures + 1;
+		UINT backoff = threshold << (failures < 16 ? failures - 1 : 15);
+		retryAt = records + backoff;
+	}
+
+	m_settingsMutex.lock();
+	m_compactionRetry = retryAt;
+	m_settingsMutex.unlock();
 
+	m_compactionFailures = failures;
+}
\ No newline at end of file
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "cbe.h"
+
+namespace cbe
+{
+
+//////////////////////////////////////////////////////////////////////////
+// integer division by the chunk size
+//
+// power of two sizes divide by shifting, every other size multiplies by
+// a rounded up fixed point reciprocal (m = ceil(2^(32 + l) / d) with
+// l = ceil(log2(d))), which is exact for all 0 <= n < 2^31
+struct CoordDivider
+{
+	unsigned __int32 divisor;
+	unsigned __int32 shift;
+	unsigned __int64 multiplier;
+	bool powerOfTwo;
+
+	CoordDivider() : divisor(1), shift(0), multiplier(1), powerOfTwo(true) {}
+
+	void Init(unsigned __int32 d)
+	{
+		divisor = d;
+		powerOfTwo = (d & (d - 1)) == 0;
+
+		unsigned __int32 log2 = 0;
+		while ((1u << log2) < d)
+			log2++;
+
+		if (powerOfTwo)
+		{
+			shift = log2;
+			multiplier = 1;
+		}
+		else
+		{
+			shift = 32 + log2;
+			multiplier = (((unsigned __int64)1 << shift) + d - 1) / d;
+		}
+	}
+
+	inline int DivideShift(int n) const			{ return n >> shift; }
+	inline int DivideReciprocal(int n) const	{ return (int)(((unsigned __int64)(unsigned __int32)n * multiplier) >> shift); }
+	inline int Divide(int n) const				{ return powerOfTwo ? DivideShift(n) : DivideReciprocal(n); }
+};
+
+}
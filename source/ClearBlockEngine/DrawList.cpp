@@ -0,0 +1,60 @@
+#include "cbe.h"
+
+using namespace cbe;
+
+static bool CompareBucket( const DRAW_RECORD& a, const DRAW_RECORD& b )
+{
+	return a.bucket < b.bucket;
+}
+
+DrawList::DrawList()
+	: m_frame(0), m_triangles(0)
+{
+}
+
+void DrawList::Clear( UINT frame )
+{
+	m_records.clear();
+	m_frame = frame;
+	m_triangles = 0;
+}
+
+void DrawList::Add( UINT bucket, UINT indexOffset, UINT indexCount, UINT vertexOffset )
+{
+	if (indexCount == 0)
+		return;
+
+	m_triangles += indexCount / 3;
+
+	if (!m_records.empty())
+	{
+		DRAW_RECORD& last = m_records.back();
+		if (last.bucket == bucket && last.vertexOffset == vertexOffset && last.indexOffset + last.indexCount == indexOffset)
+		{
+			last.indexCount += indexCount;
+			return;
+		}
+	}
+
+	DRAW_RECORD record = { bucket, indexOffset, indexCount, vertexOffset };
+	m_records.push_back(record);
+}
+
+void DrawList::Sort()
+{
+	std::stable_sort(m_records.begin(), m_records.end(), CompareBucket);
+}
+
+#ifndef CBE_HEADLESS
+void DrawList::Replay( ID3D11DeviceContext* pContext, UINT bucket ) const
+{
+	// sorted, so the bucket is one run of records
+	for (UINT i = 0; i < m_records.size(); i++)
+	{
+		if (m_records[i].bucket == bucket)
+			pContext->DrawIndexed(m_records[i].indexCount, m_records[i].indexOffset, m_records[i].vertexOffset);
+		else if (m_records[i].bucket > bucket)
+			break;
+	}
+}
+#endif
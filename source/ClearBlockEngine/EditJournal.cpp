@@ -0,0 +1,205 @@
+#include "cbe.h"
+
+using namespace cbe;
+
+EditJournal::EditJournal()
+	: m_pFile(NULL), m_chunkCount(0), m_chunkSize(0), m_committedRecords(0)
+{
+}
+EditJournal::~EditJournal()
+{
+	Close();
+}
+
+bool EditJournal::Open( std::string fileName, int chunkCount, int chunkSize )
+{
+	Close();
+
+	m_mutex.lock();
+
+	m_fileName = fileName;
+	m_chunkCount = chunkCount;
+	m_chunkSize = chunkSize;
+	m_committedRecords = 0;
+
+	// continue an existing journal written against the same map layout
+	m_pFile = fopen(fileName.c_str(), "r+b");
+	if (m_pFile && ReadHeader(m_pFile, chunkCount, chunkSize))
+	{
+		fseek(m_pFile, 0, SEEK_END);
+		long size = ftell(m_pFile) - sizeof(Header);
+
+		// a torn record at the end (crash during commit) gets overwritten
+		m_committedRecords = size / sizeof(Record);
+		fseek(m_pFile, sizeof(Header) + m_committedRecords * sizeof(Record), SEEK_SET);
+
+		m_mutex.unlock();
+		return true;
+	}
+
+	// a journal of another map is left alone, its edits would be lost
+	if (m_pFile)
+	{
+		fseek(m_pFile, 0, SEEK_END);
+		bool foreign = ftell(m_pFile) >= (long)sizeof(Header);
+		fclose(m_pFile);
+		m_pFile = NULL;
+
+		if (foreign)
+		{
+			m_mutex.unlock();
+			return false;
+		}
+	}
+
+	m_pFile = fopen(fileName.c_str(), "wb");
+	bool success = m_pFile && WriteHeader();
+
+	m_mutex.unlock();
+
+	return success;
+}
+void EditJournal::Close()
+{
+	Commit();
+
+	m_mutex.lock();
+	if (m_pFile)
+	{
+		fclose(m_pFile);
+		m_pFile = NULL;
+	}
+	m_pendingRecords.clear();
+	m_mutex.unlock();
+}
+
+void EditJournal::Append( int chunkIndex, int blockIndex, Block block )
+{
+	Record record;
+	record.chunkIndex = chunkIndex;
+	record.blockIndex = blockIndex;
+	record.data = block.Data();
+
+	m_mutex.lock();
+	if (m_pFile)
+		m_pendingRecords.push_back(record);
+	m_mutex.unlock();
+}
+bool EditJournal::Commit()
+{
+	m_mutex.lock();
+
+	if (!m_pFile || m_pendingRecords.empty())
+	{
+		m_mutex.unlock();
+		return true;
+	}
+
+	size_t written = fwrite(m_pendingRecords.data(), sizeof(Record), m_pendingRecords.size(), m_pFile);
+	fflush(m_pFile);
+
+	m_committedRecords += written;
+	bool success = (written == m_pendingRecords.size());
+	m_pendingRecords.clear();
+
+	m_mutex.unlock();
+
+	return success;
+}
+bool EditJournal::Truncate()
+{
+	m_mutex.lock();
+
+	if (!m_pFile)
+	{
+		m_mutex.unlock();
+		return false;
+	}
+
+	fclose(m_pFile);
+	m_pFile = fopen(m_fileName.c_str(), "wb");
+	m_committedRecords = 0;
+	m_pendingRecords.clear();
+
+	bool success = m_pFile && WriteHeader();
+
+	m_mutex.unlock();
+
+	return success;
+}
+
+bool EditJournal::Read( std::string fileName, int chunkCount, int chunkSize, std::vector<Record>& records )
+{
+	FILE* pFile = fopen(fileName.c_str(), "rb");
+	if (!pFile)
+		return false;
+
+	if (!ReadHeader(pFile, chunkCount, chunkSize))
+	{
+		fclose(pFile);
+		return false;
+	}
+
+	fseek(pFile, 0, SEEK_END);
+	long size = ftell(pFile) - sizeof(Header);
+	fseek(pFile, sizeof(Header), SEEK_SET);
+
+	size_t first = records.size();
+	records.resize(first + size / sizeof(Record));
+	size_t read = fread(records.data() + first, sizeof(Record), size / sizeof(Record), pFile);
+	records.resize(first + read);
+
+	fclose(pFile);
+
+	return true;
+}
+
+bool EditJournal::WriteHeader()
+{
+	Header header;
+	memcpy(header.magic, Magic(), 4);
+	header.version = Version();
+	header.chunkCount = m_chunkCount;
+	header.chunkSize = m_chunkSize;
+
+	bool success = fwrite(&header, sizeof(Header), 1, m_pFile) == 1;
+	fflush(m_pFile);
+
+	return success;
+}
+bool EditJournal::ReadHeader( FILE* pFile, int chunkCount, int chunkSize )
+{
+	Header header;
+	if (fread(&header, sizeof(Header), 1, pFile) != 1)
+		return false;
+
+	return memcmp(header.magic, Magic(), 4) == 0 &&
+		   header.version == Version() &&
+		   header.chunkCount == chunkCount &&
+		   header.chunkSize == chunkSize;
+}
+
+bool EditJournal::IsOpen()
+{
+	m_mutex.lock();
+	bool open = m_pFile != NULL;
+	m_mutex.unlock();
+
+	return open;
+}
+UINT EditJournal::CommittedRecords()
+{
+	m_mutex.lock();
+	UINT count = m_committedRecords;
+	m_mutex.unlock();
+
+	return count;
+}
+UINT EditJournal::PendingRecords()
+{
+	m_mutex.lock();
+	UINT count = m_pendingRecords.size();
+	m_mutex.unlock();
+
+	return count;
+}
@@ -0,0 +1,114 @@
+#include "cbe.h"
+
+using namespace cbe;
+
+Frustum::Frustum()
+{
+	// everything passes until a matrix is set
+	for (int plane = 0; plane < 6; plane++)
+	{
+		m_planes[plane][0] = 0.0f;
+		m_planes[plane][1] = 0.0f;
+		m_planes[plane][2] = 0.0f;
+		m_planes[plane][3] = 1.0f;
+	}
+}
+
+void Frustum::Extract( const float* pMatrix )
+{
+	// column j of the matrix
+	#define COL(j, row) pMatrix[(row) * 4 + (j)]
+
+	for (int i = 0; i < 4; i++)
+	{
+		m_planes[0][i] = COL(3, i) + COL(0, i);	// left
+		m_planes[1][i] = COL(3, i) - COL(0, i);	// right
+		m_planes[2][i] = COL(3, i) + COL(1, i);	// bottom
+		m_planes[3][i] = COL(3, i) - COL(1, i);	// top
+		m_planes[4][i] = COL(2, i);				// near
+		m_planes[5][i] = COL(3, i) - COL(2, i);	// far
+	}
+
+	#undef COL
+}
+
+bool Frustum::TestAABB( const XMFLOAT3& min, const XMFLOAT3& max ) const
+{
+	for (int plane = 0; plane < 6; plane++)
+	{
+		const float* p = m_planes[plane];
+		float distance = p[0] * (p[0] > 0.0f ? max.x : min.x) +
+						 p[1] * (p[1] > 0.0f ? max.y : min.y) +
+						 p[2] * (p[2] > 0.0f ? max.z : min.z) + p[3];
+
+		if (!(distance >= 0.0f))
+			return false;
+	}
+
+	return true;
+}
+
+int Frustum::CullAABBs( int count, const float* pMinX, const float* pMinY, const float* pMinZ, const float* pMaxX, const float* pMaxY, const float* pMaxZ, int* pVisible ) const
+{
+#ifdef CBE_SSE
+	int visible = 0;
+	int i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 inside = _mm_cmpeq_ps(_mm_setzero_ps(), _mm_setzero_ps());
+		for (int plane = 0; plane < 6; plane++)
+		{
+			const float* p = m_planes[plane];
+
+			// the sign of the normal picks min or max for all four boxes
+			__m128 x = _mm_loadu_ps((p[0] > 0.0f ? pMaxX : pMinX) + i);
+			__m128 y = _mm_loadu_ps((p[1] > 0.0f ? pMaxY : pMinY) + i);
+			__m128 z = _mm_loadu_ps((p[2] > 0.0f ? pMaxZ : pMinZ) + i);
+
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(p[0])), _mm_mul_ps(y, _mm_set1_ps(p[1]))),
+										 _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(p[2])), _mm_set1_ps(p[3])));
+
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, _mm_setzero_ps()));
+		}
+
+		int mask = _mm_movemask_ps(inside);
+		for (int bit = 0; bit < 4; bit++)
+		{
+			if (mask & (1 << bit))
+				pVisible[visible++] = i + bit;
+		}
+	}
+
+	return visible + CullAABBsScalar(i, count - i, pMinX, pMinY, pMinZ, pMaxX, pMaxY, pMaxZ, pVisible + visible);
+#else
+	return CullAABBsScalar(0, count, pMinX, pMinY, pMinZ, pMaxX, pMaxY, pMaxZ, pVisible);
+#endif
+}
+int Frustum::CullAABBsScalar( int first, int count, const float* pMinX, const float* pMinY, const float* pMinZ, const float* pMaxX, const float* pMaxY, const float* pMaxZ, int* pVisible ) const
+{
+	int visible = 0;
+	for (int i = first; i < first + count; i++)
+	{
+		XMFLOAT3 min(pMinX[i], pMinY[i], pMinZ[i]);
+		XMFLOAT3 max(pMaxX[i], pMaxY[i], pMaxZ[i]);
+
+		if (TestAABB(min, max))
+			pVisible[visible++] = i;
+	}
+
+	return visible;
+}
+
+void Frustum::MultiplyMatrix( const float* pA, const float* pB, float* pOut )
+{
+	for (int row = 0; row < 4; row++)
+	{
+		for (int col = 0; col < 4; col++)
+		{
+			pOut[row * 4 + col] = pA[row * 4 + 0] * pB[0 * 4 + col] +
+								  pA[row * 4 + 1] * pB[1 * 4 + col] +
+								  pA[row * 4 + 2] * pB[2 * 4 + col] +
+								  pA[row * 4 + 3] * pB[3 * 4 + col];
+		}
+	}
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "cbe.h"
+
+namespace cbe
+{
+
+//////////////////////////////////////////////////////////////////////////
+// 64 bit hashing for content keys
+//
+// HashMix64 is the murmur3 finalizer, every input bit flips about half of
+// the output bits. HashCombine folds a value into a running hash, the
+// order of the values matters
+inline unsigned __int64 HashMix64(unsigned __int64 value)
+{
+	value ^= value >> 33;
+	value *= 0xFF51AFD7ED558CCDULL;
+	value ^= value >> 33;
+	value *= 0xC4CEB9FE1A85EC53ULL;
+	value ^= value >> 33;
+	return value;
+}
+
+inline unsigned __int64 HashCombine(unsigned __int64 seed, unsigned __int64 value)
+{
+	return HashMix64(seed ^ (value + 0x9E3779B97F4A7C15ULL + (seed << 6) + (seed >> 2)));
+}
+
+}
@@ -0,0 +1,205 @@
+#include "cbe.h"
+
+using namespace cbe;
+
+#ifdef CBE_HEADLESS
+// only tell the allocators apart
+#define D3D11_BIND_VERTEX_BUFFER	1
+#define D3D11_BIND_INDEX_BUFFER		2
+#endif
+
+MeshBuffer::MeshBuffer()
+	: m_vertexStride(0), m_grows(0)
+{
+#ifndef CBE_HEADLESS
+	m_pVertexBuffer = NULL;
+	m_pIndexBuffer = NULL;
+#endif
+}
+MeshBuffer::~MeshBuffer()
+{
+	Release();
+}
+
+bool MeshBuffer::Init( UINT vertexStride, UINT vertexCapacity, UINT indexCapacity )
+{
+	Release();
+
+	m_vertexStride = vertexStride;
+	m_vertices.Reset(vertexCapacity);
+	m_indices.Reset(indexCapacity);
+	m_grows = 0;
+
+#ifndef CBE_HEADLESS
+	if (!CreateBuffer(D3D11_BIND_VERTEX_BUFFER, vertexCapacity * vertexStride, &m_pVertexBuffer))
+		return false;
+	if (!CreateBuffer(D3D11_BIND_INDEX_BUFFER, indexCapacity * sizeof(DWORD), &m_pIndexBuffer))
+		return false;
+#endif
+
+	return true;
+}
+void MeshBuffer::Release()
+{
+#ifndef CBE_HEADLESS
+	if (m_pVertexBuffer)
+		m_pVertexBuffer->Release();
+	if (m_pIndexBuffer)
+		m_pIndexBuffer->Release();
+
+	m_pVertexBuffer = NULL;
+	m_pIndexBuffer = NULL;
+#endif
+
+	m_vertices.Reset(0);
+	m_indices.Reset(0);
+	m_retired.clear();
+}
+
+bool MeshBuffer::Allocate( const void* pVertices, UINT vertexCount, const DWORD* pIndices, UINT indexCount, MESH_ALLOCATION* pAllocation )
+{
+	ZeroMemory(pAllocation, sizeof(MESH_ALLOCATION));
+	if (vertexCount == 0 || indexCount == 0)
+		return true;
+
+	m_mutex.lock();
+
+	UINT vertexOffset = 0;
+	UINT indexOffset = 0;
+	if (!Reserve(m_vertices, D3D11_BIND_VERTEX_BUFFER, m_vertexStride, vertexCount, &vertexOffset))
+	{
+		m_mutex.unlock();
+		return false;
+	}
+	if (!Reserve(m_indices, D3D11_BIND_INDEX_BUFFER, sizeof(DWORD), indexCount, &indexOffset))
+	{
+		m_vertices.Free(vertexOffset, vertexCount);
+		m_mutex.unlock();
+		return false;
+	}
+
+#ifndef CBE_HEADLESS
+	cgl::CGLManagerConnector conn;
+
+	D3D11_BOX box = { vertexOffset * m_vertexStride, 0, 0, (vertexOffset + vertexCount) * m_vertexStride, 1, 1 };
+	conn.Context()->UpdateSubresource(m_pVertexBuffer, 0, &box, pVertices, 0, 0);
+
+	D3D11_BOX indexBox = { indexOffset * sizeof(DWORD), 0, 0, (indexOffset + indexCount) * sizeof(DWORD), 1, 1 };
+	conn.Context()->UpdateSubresource(m_pIndexBuffer, 0, &indexBox, pIndices, 0, 0);
+#endif
+
+	m_mutex.unlock();
+
+	pAllocation->vertexOffset = vertexOffset;
+	pAllocation->vertexCount = vertexCount;
+	pAllocation->indexOffset = indexOffset;
+	pAllocation->indexCount = indexCount;
+	return true;
+}
+void MeshBuffer::Free( MESH_ALLOCATION* pAllocation, UINT frame )
+{
+	if (pAllocation->indexCount != 0)
+	{
+		RETIRED_ALLOCATION retired = { frame, *pAllocation };
+
+		m_mutex.lock();
+		m_retired.push_back(retired);
+		m_mutex.unlock();
+	}
+
+	ZeroMemory(pAllocation, sizeof(MESH_ALLOCATION));
+}
+void MeshBuffer::Collect( UINT frame )
+{
+	m_mutex.lock();
+
+	// retired in frame order
+	while (!m_retired.empty() && m_retired.front().frame <= frame)
+	{
+		const MESH_ALLOCATION& allocation = m_retired.front().allocation;
+		m_vertices.Free(allocation.vertexOffset, allocation.vertexCount);
+		m_indices.Free(allocation.indexOffset, allocation.indexCount);
+		m_retired.pop_front();
+	}
+
+	m_mutex.unlock();
+}
+
+void MeshBuffer::WriteIndices( UINT indexOffset, const DWORD* pIndices, UINT indexCount )
+{
+#ifndef CBE_HEADLESS
+	if (indexCount == 0)
+		return;
+
+	cgl::CGLManagerConnector conn;
+
+	D3D11_BOX box = { indexOffset * sizeof(DWORD), 0, 0, (indexOffset + indexCount) * sizeof(DWORD), 1, 1 };
+	conn.Context()->UpdateSubresource(m_pIndexBuffer, 0, &box, pIndices, 0, 0);
+#endif
+}
+
+bool MeshBuffer::Reserve( BufferAllocator& allocator, UINT bindFlags, UINT elementSize, UINT count, UINT* pOffset )
+{
+	if (allocator.Allocate(count, pOffset))
+		return true;
+
+	// double until the new space alone holds the mesh
+	UINT capacity = allocator.Capacity() != 0 ? allocator.Capacity() : count;
+	while (capacity - allocator.Capacity() < count)
+		capacity *= 2;
+
+#ifndef CBE_HEADLESS
+	ID3D11Buffer** ppBuffer = bindFlags == D3D11_BIND_VERTEX_BUFFER ? &m_pVertexBuffer : &m_pIndexBuffer;
+	if (!GrowBuffer(bindFlags, allocator.Capacity() * elementSize, capacity * elementSize, ppBuffer))
+		return false;
+#endif
+
+	allocator.Grow(capacity);
+	m_grows++;
+
+	return allocator.Allocate(count, pOffset);
+}
+
+#ifndef CBE_HEADLESS
+bool MeshBuffer::CreateBuffer( UINT bindFlags, UINT byteWidth, ID3D11Buffer** ppBuffer )
+{
+	*ppBuffer = NULL;
+	if (byteWidth == 0)
+		return true;
+
+	D3D11_BUFFER_DESC desc;
+	ZeroMemory(&desc, sizeof(desc));
+	desc.ByteWidth = byteWidth;
+	desc.Usage = D3D11_USAGE_DEFAULT;
+	desc.BindFlags = bindFlags;
+
+	cgl::CGLManagerConnector conn;
+	return SUCCEEDED(conn.Device()->CreateBuffer(&desc, NULL, ppBuffer));
+}
+bool MeshBuffer::GrowBuffer( UINT bindFlags, UINT oldByteWidth, UINT newByteWidth, ID3D11Buffer** ppBuffer )
+{
+	ID3D11Buffer* pBuffer = NULL;
+	if (!CreateBuffer(bindFlags, newByteWidth, &pBuffer))
+		return false;
+
+	if (*ppBuffer)
+	{
+		cgl::CGLManagerConnector conn;
+
+		D3D11_BOX box = { 0, 0, 0, oldByteWidth, 1, 1 };
+		conn.Context()->CopySubresourceRegion(pBuffer, 0, 0, 0, 0, *ppBuffer, 0, &box);
+		(*ppBuffer)->Release();
+	}
+
+	*ppBuffer = pBuffer;
+	return true;
+}
+
+void MeshBuffer::Bind( ID3D11DeviceContext* pContext )
+{
+	UINT offset = 0;
+	pContext->IASetVertexBuffers(0, 1, &m_pVertexBuffer, &m_vertexStride, &offset);
+	pContext->IASetIndexBuffer(m_pIndexBuffer, DXGI_FORMAT_R32_UINT, 0);
+	pContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+}
+#endif
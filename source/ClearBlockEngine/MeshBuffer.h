@@ -0,0 +1,85 @@
+#pragma once
+
+#include "cbe.h"
+#include "BufferAllocator.h"
+
+namespace cbe
+{
+
+// place of one mesh in the mesh buffer, indices are relative to the
+// vertex offset
+struct MESH_ALLOCATION
+{
+	UINT vertexOffset;
+	UINT vertexCount;
+	UINT indexOffset;
+	UINT indexCount;
+};
+
+//////////////////////////////////////////////////////////////////////////
+// shared vertex and index buffer for all chunk meshes
+//
+// one default usage vertex and index buffer, sub-allocated per mesh, so
+// every chunk draws from the same bound buffers by offset. a full buffer
+// grows to twice its size, the old content is copied on the gpu. without
+// d3d (CBE_HEADLESS) only the allocation is done.
+//
+// a draw list built before a mesh was freed may still be replayed, so
+// freed ranges are retired with the frame number and only reused once
+// Collect is called with that frame or a later one.
+class CBE_API MeshBuffer
+{
+private:
+	UINT m_vertexStride;
+	BufferAllocator m_vertices;
+	BufferAllocator m_indices;
+	UINT m_grows;
+	std::mutex m_mutex;
+
+	struct RETIRED_ALLOCATION
+	{
+		UINT frame;
+		MESH_ALLOCATION allocation;
+	};
+	std::deque<RETIRED_ALLOCATION> m_retired;
+
+#ifndef CBE_HEADLESS
+	ID3D11Buffer* m_pVertexBuffer;
+	ID3D11Buffer* m_pIndexBuffer;
+
+	bool CreateBuffer(UINT bindFlags, UINT byteWidth, ID3D11Buffer** ppBuffer);
+	bool GrowBuffer(UINT bindFlags, UINT oldByteWidth, UINT newByteWidth, ID3D11Buffer** ppBuffer);
+#endif
+
+	bool Reserve(BufferAllocator& allocator, UINT bindFlags, UINT elementSize, UINT count, UINT* pOffset);
+
+	MeshBuffer(const MeshBuffer&);
+	MeshBuffer& operator = (const MeshBuffer&);
+
+public:
+	MeshBuffer();
+	~MeshBuffer();
+
+	bool Init(UINT vertexStride, UINT vertexCapacity, UINT indexCapacity);
+	void Release();
+
+	// reserves room for the mesh and uploads it, false if the buffers
+	// could not grow
+	bool Allocate(const void* pVertices, UINT vertexCount, const DWORD* pIndices, UINT indexCount, MESH_ALLOCATION* pAllocation);
+	void Free(MESH_ALLOCATION* pAllocation, UINT frame);
+	void Collect(UINT frame);
+
+	// overwrites allocated indices, e.g. to reorder quads
+	void WriteIndices(UINT indexOffset, const DWORD* pIndices, UINT indexCount);
+
+#ifndef CBE_HEADLESS
+	void Bind(ID3D11DeviceContext* pContext);
+#endif
+
+	inline const BufferAllocator& Vertices() const	{ return m_vertices; }
+	inline const BufferAllocator& Indices() const	{ return m_indices; }
+	inline UINT Grows() const						{ return m_grows; }
+	inline UINT RetiredCount() const				{ return (UINT)m_retired.size(); }
+};
+
+}
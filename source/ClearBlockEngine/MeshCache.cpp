@@ -0,0 +1,267 @@
+#include "cbe.h"
+
+using namespace cbe;
+
+MeshCache::MeshCache()
+	: m_capacity(0), m_bytes(0), m_hits(0), m_misses(0), m_evictions(0)
+{
+}
+
+void MeshCache::SetCapacity( UINT bytes )
+{
+	m_mutex.lock();
+	m_capacity = bytes;
+	Evict(bytes);
+	m_mutex.unlock();
+}
+void MeshCache::Clear()
+{
+	m_mutex.lock();
+	m_entries.clear();
+	m_keys.clear();
+	m_bytes = 0;
+	m_mutex.unlock();
+}
+
+bool MeshCache::Find( unsigned __int64 key, CACHED_MESH* pMesh )
+{
+	m_mutex.lock();
+
+	std::map<unsigned __int64, std::list<ENTRY>::iterator>::iterator it = m_keys.find(key);
+	bool found = it != m_keys.end();
+	if (found)
+	{
+		m_entries.splice(m_entries.begin(), m_entries, it->second);
+		*pMesh = it->second->second;
+		m_hits++;
+	}
+	else
+	{
+		m_misses++;
+	}
+
+	m_mutex.unlock();
+
+	return found;
+}
+bool MeshCache::Peek( unsigned __int64 key, CACHED_MESH* pMesh )
+{
+	m_mutex.lock();
+
+	std::map<unsigned __int64, std::list<ENTRY>::iterator>::iterator it = m_keys.find(key);
+	bool found = it != m_keys.end();
+	if (found)
+		*pMesh = it->second->second;
+
+	m_mutex.unlock();
+
+	return found;
+}
+void MeshCache::Insert( unsigned __int64 key, const CACHED_MESH& mesh )
+{
+	UINT bytes = EntryBytes(mesh);
+
+	m_mutex.lock();
+
+	// a mesh larger than the whole cache would only flush it
+	if (bytes > m_capacity || m_keys.find(key) != m_keys.end())
+	{
+		m_mutex.unlock();
+		return;
+	}
+
+	Evict(m_capacity - bytes);
+
+	m_entries.push_front(ENTRY(key, mesh));
+	m_keys[key] = m_entries.begin();
+	m_bytes += bytes;
+
+	m_mutex.unlock();
+}
+
+void MeshCache::Evict( UINT capacity )
+{
+	// called with the mutex held
+	while (m_bytes > capacity && !m_entries.empty())
+	{
+		m_bytes -= EntryBytes(m_entries.back().second);
+		m_keys.erase(m_entries.back().first);
+		m_entries.pop_back();
+		m_evictions++;
+	}
+}
+UINT MeshCache::EntryBytes( const CACHED_MESH& mesh )
+{
+	return sizeof(CACHED_MESH) + mesh.vertices.size() * sizeof(BlockVertex) + mesh.indices.size() * sizeof(DWORD) + mesh.centroids.size() * sizeof(XMFLOAT3);
+}
+
+float MeshCache::HitRate() const
+{
+	UINT hits = m_hits;
+	UINT lookups = hits + m_misses;
+	return lookups != 0 ? (float)hits / lookups : 0.0f;
+}
+void MeshCache::ResetStatistics()
+{
+	m_hits = 0;
+	m_misses = 0;
+	m_evictions = 0;
+}
+
+bool MeshCache::WriteHeader( FILE* pFile, int chunkCount, int chunkSize, unsigned __int64 typesHash, std::vector<FILE_RECORD>& records, std::vector<int>* pMeshRecords )
+{
+	// one mesh per distinct key
+	std::map<unsigned __int64, int> meshIndices;
+	pMeshRecords->clear();
+	for (UINT i = 0; i < records.size(); i++)
+	{
+		std::map<unsigned __int64, int>::iterator mesh = meshIndices.find(records[i].key);
+		if (mesh == meshIndices.end())
+		{
+			mesh = meshIndices.insert(std::make_pair(records[i].key, (int)pMeshRecords->size())).first;
+			pMeshRecords->push_back(i);
+		}
+
+		records[i].mesh = mesh->second;
+	}
+
+	FILE_HEADER header;
+	memcpy(header.magic, Magic(), 4);
+	header.version = Version();
+	header.chunkCount = chunkCount;
+	header.chunkSize = chunkSize;
+	header.typesHash = typesHash;
+	header.recordCount = (__int32)records.size();
+	header.meshCount = (__int32)pMeshRecords->size();
+
+	bool success = fwrite(&header, sizeof(FILE_HEADER), 1, pFile) == 1;
+	if (success && !records.empty())
+		success = fwrite(records.data(), sizeof(FILE_RECORD), records.size(), pFile) == records.size();
+
+	return success;
+}
+bool MeshCache::Read( std::string fileName, int chunkCount, int chunkSize, unsigned __int64* pTypesHash, std::vector<FILE_RECORD>* pRecords, std::vector<CACHED_MESH>* pMeshes )
+{
+	pRecords->clear();
+	pMeshes->clear();
+
+	FILE* pFile = fopen(fileName.c_str(), "rb");
+	if (!pFile)
+		return false;
+
+	// the counts in the file are checked against its size before anything
+	// is allocated for them
+	__int64 fileSize = FileSeek(pFile, 0, SEEK_END) ? FileTell(pFile) : -1;
+
+	FILE_HEADER header;
+	bool success = fileSize >= 0 && FileSeek(pFile, 0, SEEK_SET) &&
+				   fread(&header, sizeof(FILE_HEADER), 1, pFile) == 1 &&
+				   memcmp(header.magic, Magic(), 4) == 0 &&
+				   header.version == Version() &&
+				   header.chunkCount == chunkCount &&
+				   header.chunkSize == chunkSize &&
+				   header.recordCount >= 0 && header.recordCount <= chunkCount &&
+				   header.meshCount >= 0 && header.meshCount <= header.recordCount;
+
+	if (success)
+	{
+		*pTypesHash = header.typesHash;
+		pRecords->resize(header.recordCount);
+		if (header.recordCount != 0)
+			success = fread(pRecords->data(), sizeof(FILE_RECORD), header.recordCount, pFile) == (size_t)header.recordCount;
+	}
+
+	for (UINT i = 0; i < pRecords->size() && success; i++)
+	{
+		const FILE_RECORD& record = pRecords->at(i);
+		success = record.chunkIndex >= 0 && record.chunkIndex < chunkCount && record.mesh >= 0 && record.mesh < header.meshCount;
+	}
+
+	if (success)
+		pMeshes->resize(header.meshCount);
+	for (UINT i = 0; i < pMeshes->size() && success; i++)
+		success = ReadMesh(pFile, fileSize, &pMeshes->at(i));
+
+	fclose(pFile);
+
+	if (!success)
+	{
+		pRecords->clear();
+		pMeshes->clear();
+	}
+
+	return success;
+}
+
+bool MeshCache::WriteMesh( FILE* pFile, const CACHED_MESH& mesh )
+{
+	FILE_MESH header;
+	header.origin[0] = mesh.origin.x;
+	header.origin[1] = mesh.origin.y;
+	header.origin[2] = mesh.origin.z;
+	header.vertexCount = (__int32)mesh.vertices.size();
+	header.indexCount = (__int32)mesh.indices.size();
+	header.centroidCount = (__int32)mesh.centroids.size();
+	memcpy(header.ranges, mesh.ranges, sizeof(header.ranges));
+	memcpy(header.buildMin, mesh.buildMin, sizeof(header.buildMin));
+	memcpy(header.buildMax, mesh.buildMax, sizeof(header.buildMax));
+	header.connectivity = mesh.connectivity;
+	memcpy(header.occluders, mesh.occluders, sizeof(header.occluders));
+	header.activeBlocks = mesh.activeBlocks;
+	header.opaqueBlocks = mesh.opaqueBlocks;
+	header.visibleBlocks = mesh.visibleBlocks;
+
+	return fwrite(&header, sizeof(FILE_MESH), 1, pFile) == 1 &&
+		   fwrite(mesh.vertices.data(), sizeof(BlockVertex), mesh.vertices.size(), pFile) == mesh.vertices.size() &&
+		   fwrite(mesh.indices.data(), sizeof(DWORD), mesh.indices.size(), pFile) == mesh.indices.size() &&
+		   fwrite(mesh.centroids.data(), sizeof(XMFLOAT3), mesh.centroids.size(), pFile) == mesh.centroids.size();
+}
+bool MeshCache::ReadMesh( FILE* pFile, __int64 fileSize, CACHED_MESH* pMesh )
+{
+	FILE_MESH header;
+	if (fread(&header, sizeof(FILE_MESH), 1, pFile) != 1 ||
+		header.vertexCount < 0 || header.indexCount < 0 || header.centroidCount < 0)
+	{
+		return false;
+	}
+
+	// a damaged count must not allocate gigabytes before the read fails
+	__int64 bytes = (__int64)header.vertexCount * sizeof(BlockVertex) + (__int64)header.indexCount * sizeof(DWORD) + (__int64)header.centroidCount * sizeof(XMFLOAT3);
+	if (bytes > fileSize - FileTell(pFile))
+		return false;
+
+	pMesh->origin = XMFLOAT3(header.origin[0], header.origin[1], header.origin[2]);
+	memcpy(pMesh->ranges, header.ranges, sizeof(header.ranges));
+	memcpy(pMesh->buildMin, header.buildMin, sizeof(header.buildMin));
+	memcpy(pMesh->buildMax, header.buildMax, sizeof(header.buildMax));
+	pMesh->connectivity = header.connectivity;
+	memcpy(pMesh->occluders, header.occluders, sizeof(header.occluders));
+	pMesh->activeBlocks = header.activeBlocks;
+	pMesh->opaqueBlocks = header.opaqueBlocks;
+	pMesh->visibleBlocks = header.visibleBlocks;
+
+	pMesh->vertices.resize(header.vertexCount);
+	pMesh->indices.resize(header.indexCount);
+	pMesh->centroids.resize(header.centroidCount);
+	if (fread(pMesh->vertices.data(), sizeof(BlockVertex), header.vertexCount, pFile) != (size_t)header.vertexCount ||
+		fread(pMesh->indices.data(), sizeof(DWORD), header.indexCount, pFile) != (size_t)header.indexCount ||
+		fread(pMesh->centroids.data(), sizeof(XMFLOAT3), header.centroidCount, pFile) != (size_t)header.centroidCount)
+	{
+		return false;
+	}
+
+	// a damaged file must not hand the gpu indices past the mesh
+	for (int range = 0; range < CHUNK_RANGE_COUNT; range++)
+	{
+		const Chunk::INDEX_RANGE& indexRange = pMesh->ranges[range];
+		if (indexRange.start > (UINT)header.indexCount || indexRange.count > (UINT)header.indexCount - indexRange.start)
+			return false;
+	}
+	for (int i = 0; i < header.indexCount; i++)
+	{
+		if (pMesh->indices[i] >= (DWORD)header.vertexCount)
+			return false;
+	}
+
+	return true;
+}
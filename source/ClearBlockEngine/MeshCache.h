@@ -0,0 +1,139 @@
+#pragma once
+
+#include "cbe.h"
+#include "Chunk.h"
+#include <list>
+
+namespace cbe
+{
+
+// everything a chunk build produces. vertices and centroids are in the
+// space of the chunk that was built at origin, a chunk elsewhere moves
+// them by the difference of the positions
+struct CACHED_MESH
+{
+	XMFLOAT3 origin;
+	std::vector<BlockVertex> vertices;
+	std::vector<DWORD> indices;
+	std::vector<XMFLOAT3> centroids;
+	Chunk::INDEX_RANGE ranges[CHUNK_RANGE_COUNT];
+	int buildMin[3];
+	int buildMax[3];
+	unsigned __int16 connectivity;
+	unsigned __int8 occluders[CHUNK_OCCLUDER_LAYERS];
+	UINT activeBlocks;
+	UINT opaqueBlocks;
+	UINT visibleBlocks;
+};
+
+//////////////////////////////////////////////////////////////////////////
+// chunk meshes by content hash
+//
+// the key hashes the blocks of a chunk together with everything else the
+// mesher reads (see Chunk::Build), so equal keys give equal meshes up to
+// the chunk position. least recently used entries are dropped once the
+// cache holds more than its capacity in bytes.
+//
+// the cache can be written to a sidecar file of the map and read back
+//
+// |Header|Record|Record|...|Mesh|Mesh|...
+//
+// a record maps a chunk index and the key its mesh was built with to one
+// of the meshes, chunks with equal content share one
+class CBE_API MeshCache
+{
+public:
+	#pragma pack(push, 1)
+	struct FILE_RECORD
+	{
+		__int32 chunkIndex;
+		unsigned __int64 key;
+		__int32 mesh;
+	};
+	#pragma pack(pop)
+
+private:
+	#pragma pack(push, 1)
+	struct FILE_HEADER
+	{
+		char magic[4];
+		__int32 version;
+		__int32 chunkCount;
+		__int32 chunkSize;
+		unsigned __int64 typesHash;
+		__int32 recordCount;
+		__int32 meshCount;
+	};
+	struct FILE_MESH
+	{
+		float origin[3];
+		__int32 vertexCount;
+		__int32 indexCount;
+		__int32 centroidCount;
+		Chunk::INDEX_RANGE ranges[CHUNK_RANGE_COUNT];
+		__int32 buildMin[3];
+		__int32 buildMax[3];
+		unsigned __int16 connectivity;
+		unsigned __int8 occluders[CHUNK_OCCLUDER_LAYERS];
+		__int32 activeBlocks;
+		__int32 opaqueBlocks;
+		__int32 visibleBlocks;
+	};
+	#pragma pack(pop)
+
+	static bool ReadMesh(FILE* pFile, __int64 fileSize, CACHED_MESH* pMesh);
+
+	typedef std::pair<unsigned __int64, CACHED_MESH> ENTRY;
+
+	std::list<ENTRY> m_entries; // most recently used first
+	std::map<unsigned __int64, std::list<ENTRY>::iterator> m_keys;
+	std::mutex m_mutex;
+
+	UINT m_capacity;
+	UINT m_bytes;
+
+	std::atomic<UINT> m_hits;
+	std::atomic<UINT> m_misses;
+	std::atomic<UINT> m_evictions;
+
+	static UINT EntryBytes(const CACHED_MESH& mesh);
+	void Evict(UINT capacity);
+
+	MeshCache(const MeshCache&);
+	MeshCache& operator = (const MeshCache&);
+
+public:
+	MeshCache();
+
+	// 0 turns the cache off and drops every entry
+	void SetCapacity(UINT bytes);
+	void Clear();
+
+	// copies the mesh out and marks it used, counts a hit or a miss
+	bool Find(unsigned __int64 key, CACHED_MESH* pMesh);
+	// copies the mesh out and leaves the order and statistics alone
+	bool Peek(unsigned __int64 key, CACHED_MESH* pMesh);
+	void Insert(unsigned __int64 key, const CACHED_MESH& mesh);
+
+	inline bool Enabled() const		{ return m_capacity != 0; }
+	inline UINT Capacity() const	{ return m_capacity; }
+	inline UINT Bytes() const		{ return m_bytes; }
+	inline UINT Entries() const		{ return (UINT)m_keys.size(); }
+	inline UINT Hits() const		{ return m_hits; }
+	inline UINT Misses() const		{ return m_misses; }
+	inline UINT Evictions() const	{ return m_evictions; }
+	float HitRate() const;
+	void ResetStatistics();
+
+	// sidecar files are written mesh by mesh. WriteHeader assigns the
+	// records (chunk index and key) one mesh per distinct key and returns
+	// the first record of each, the meshes have to follow in that order
+	static bool WriteHeader(FILE* pFile, int chunkCount, int chunkSize, unsigned __int64 typesHash, std::vector<FILE_RECORD>& records, std::vector<int>* pMeshRecords);
+	static bool WriteMesh(FILE* pFile, const CACHED_MESH& mesh);
+	static bool Read(std::string fileName, int chunkCount, int chunkSize, unsigned __int64* pTypesHash, std::vector<FILE_RECORD>* pRecords, std::vector<CACHED_MESH>* pMeshes);
+
+	static const char*	Magic()		{ return "CBEM"; }
+	static const int	Version()	{ return 1; }
+};
+
+}
@@ -0,0 +1,235 @@
+#include "cbe.h"
+
+using namespace cbe;
+
+OcclusionBuffer::OcclusionBuffer()
+{
+	Init(256, 128);
+}
+
+void OcclusionBuffer::Init( int width, int height )
+{
+	m_width = (width + 3) & ~3;
+	m_height = height;
+
+	// level 0 is the depth buffer itself, the last level a single texel
+	m_levels.clear();
+	int levelWidth = m_width;
+	int levelHeight = m_height;
+	for (;;)
+	{
+		LEVEL level;
+		level.width = levelWidth;
+		level.height = levelHeight;
+		level.depth.assign(levelWidth * levelHeight, 1.0f);
+		m_levels.push_back(level);
+
+		if (levelWidth == 1 && levelHeight == 1)
+			break;
+
+		levelWidth = (levelWidth + 1) / 2;
+		levelHeight = (levelHeight + 1) / 2;
+	}
+
+	for (int i = 0; i < 16; i++)
+		m_matrix[i] = (i % 5 == 0) ? 1.0f : 0.0f;
+}
+
+void OcclusionBuffer::Clear( const float* pMatrix )
+{
+	memcpy(m_matrix, pMatrix, sizeof(m_matrix));
+
+	for (UINT level = 0; level < m_levels.size(); level++)
+		std::fill(m_levels[level].depth.begin(), m_levels[level].depth.end(), 1.0f);
+}
+
+bool OcclusionBuffer::Project( const XMFLOAT3& point, float* pScreen ) const
+{
+	const float* m = m_matrix;
+	float x = point.x * m[0] + point.y * m[4] + point.z * m[8]  + m[12];
+	float y = point.x * m[1] + point.y * m[5] + point.z * m[9]  + m[13];
+	float z = point.x * m[2] + point.y * m[6] + point.z * m[10] + m[14];
+	float w = point.x * m[3] + point.y * m[7] + point.z * m[11] + m[15];
+
+	if (!(z >= 0.0f) || !(w > 1e-6f))
+		return false;
+
+	pScreen[0] = (x / w * 0.5f + 0.5f) * m_width;
+	pScreen[1] = (0.5f - y / w * 0.5f) * m_height;
+	pScreen[2] = z / w;
+	return true;
+}
+
+float OcclusionBuffer::ViewDepth( const XMFLOAT3& point ) const
+{
+	const float* m = m_matrix;
+	return point.x * m[3] + point.y * m[7] + point.z * m[11] + m[15];
+}
+
+bool OcclusionBuffer::RasterizeQuad( const XMFLOAT3* pCorners )
+{
+	float screen[4][3];
+	float depth = 0.0f;
+	float minX = FLT_MAX, minY = FLT_MAX;
+	float maxX = -FLT_MAX, maxY = -FLT_MAX;
+	for (int i = 0; i < 4; i++)
+	{
+		if (!Project(pCorners[i], screen[i]))
+			return false;
+
+		if (screen[i][0] < minX) minX = screen[i][0];
+		if (screen[i][1] < minY) minY = screen[i][1];
+		if (screen[i][0] > maxX) maxX = screen[i][0];
+		if (screen[i][1] > maxY) maxY = screen[i][1];
+		if (screen[i][2] > depth) depth = screen[i][2];
+	}
+
+	int x0 = minX < 0.0f ? 0 : (int)minX;
+	int y0 = minY < 0.0f ? 0 : (int)minY;
+	int x1 = maxX >= m_width ? m_width - 1 : (int)maxX;
+	int y1 = maxY >= m_height ? m_height - 1 : (int)maxY;
+	if (x0 > x1 || y0 > y1)
+		return false;
+
+	// twice the signed area, the edges below are flipped so the inside of
+	// the quad is positive whatever its winding on screen
+	float area = 0.0f;
+	for (int i = 0; i < 4; i++)
+	{
+		int j = (i + 1) % 4;
+		area += screen[i][0] * screen[j][1] - screen[j][0] * screen[i][1];
+	}
+	if (area == 0.0f)
+		return false;
+
+	float sign = area > 0.0f ? 1.0f : -1.0f;
+
+	// e(x, y) = a * x + b * y + c, pixel centers on an edge count as
+	// inside, so quads sharing an edge leave no cracks between them
+	float a[4], b[4], c[4];
+	for (int i = 0; i < 4; i++)
+	{
+		int j = (i + 1) % 4;
+		a[i] = (screen[i][1] - screen[j][1]) * sign;
+		b[i] = (screen[j][0] - screen[i][0]) * sign;
+		c[i] = (screen[i][0] * screen[j][1] - screen[j][0] * screen[i][1]) * sign;
+	}
+
+	float* pDepth = m_levels[0].depth.data();
+	for (int y = y0; y <= y1; y++)
+	{
+		float* pRow = pDepth + y * m_width;
+		float py = y + 0.5f;
+
+		float rowC[4];
+		for (int i = 0; i < 4; i++)
+			rowC[i] = b[i] * py + c[i];
+
+#ifdef CBE_SSE
+		// the width is a multiple of four, groups never leave the row
+		const __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+		const __m128 quadDepth = _mm_set1_ps(depth);
+		for (int x = x0 & ~3; x <= x1; x += 4)
+		{
+			__m128 px = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+			__m128 inside = _mm_cmpeq_ps(_mm_setzero_ps(), _mm_setzero_ps());
+			for (int i = 0; i < 4; i++)
+			{
+				__m128 e = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(a[i])), _mm_set1_ps(rowC[i]));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(e, _mm_setzero_ps()));
+			}
+
+			__m128 old = _mm_loadu_ps(pRow + x);
+			__m128 nearer = _mm_min_ps(old, quadDepth);
+			_mm_storeu_ps(pRow + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+		}
+#else
+		for (int x = x0; x <= x1; x++)
+		{
+			float px = x + 0.5f;
+			if (a[0] * px + rowC[0] >= 0.0f && a[1] * px + rowC[1] >= 0.0f &&
+				a[2] * px + rowC[2] >= 0.0f && a[3] * px + rowC[3] >= 0.0f &&
+				depth < pRow[x])
+			{
+				pRow[x] = depth;
+			}
+		}
+#endif
+	}
+
+	return true;
+}
+
+void OcclusionBuffer::BuildPyramid()
+{
+	for (UINT level = 1; level < m_levels.size(); level++)
+	{
+		const LEVEL& src = m_levels[level - 1];
+		LEVEL& dst = m_levels[level];
+
+		for (int y = 0; y < dst.height; y++)
+		{
+			// odd sizes, the last texel only has one source row or column
+			int sy0 = y * 2;
+			int sy1 = sy0 + 1 < src.height ? sy0 + 1 : sy0;
+			for (int x = 0; x < dst.width; x++)
+			{
+				int sx0 = x * 2;
+				int sx1 = sx0 + 1 < src.width ? sx0 + 1 : sx0;
+
+				float depth = src.depth[sy0 * src.width + sx0];
+				if (src.depth[sy0 * src.width + sx1] > depth) depth = src.depth[sy0 * src.width + sx1];
+				if (src.depth[sy1 * src.width + sx0] > depth) depth = src.depth[sy1 * src.width + sx0];
+				if (src.depth[sy1 * src.width + sx1] > depth) depth = src.depth[sy1 * src.width + sx1];
+
+				dst.depth[y * dst.width + x] = depth;
+			}
+		}
+	}
+}
+
+bool OcclusionBuffer::TestAABB( const XMFLOAT3& min, const XMFLOAT3& max ) const
+{
+	float minX = FLT_MAX, minY = FLT_MAX, minDepth = FLT_MAX;
+	float maxX = -FLT_MAX, maxY = -FLT_MAX;
+	for (int corner = 0; corner < 8; corner++)
+	{
+		XMFLOAT3 point((corner & 1) ? max.x : min.x, (corner & 2) ? max.y : min.y, (corner & 4) ? max.z : min.z);
+
+		float screen[3];
+		if (!Project(point, screen))
+			return true;
+
+		if (screen[0] < minX) minX = screen[0];
+		if (screen[1] < minY) minY = screen[1];
+		if (screen[0] > maxX) maxX = screen[0];
+		if (screen[1] > maxY) maxY = screen[1];
+		if (screen[2] < minDepth) minDepth = screen[2];
+	}
+
+	// off screen boxes are the frustum's business
+	if (maxX < 0.0f || maxY < 0.0f || minX >= m_width || minY >= m_height)
+		return true;
+
+	int x0 = minX < 0.0f ? 0 : (int)minX;
+	int y0 = minY < 0.0f ? 0 : (int)minY;
+	int x1 = maxX >= m_width ? m_width - 1 : (int)maxX;
+	int y1 = maxY >= m_height ? m_height - 1 : (int)maxY;
+
+	// coarsest level on which the rect is still at most 4x4 texels
+	UINT level = 0;
+	while (level + 1 < m_levels.size() && ((x1 >> level) - (x0 >> level) > 3 || (y1 >> level) - (y0 >> level) > 3))
+		level++;
+
+	const LEVEL& texels = m_levels[level];
+	for (int y = y0 >> level; y <= (y1 >> level); y++)
+	{
+		for (int x = x0 >> level; x <= (x1 >> level); x++)
+		{
+			if (texels.depth[y * texels.width + x] >= minDepth)
+				return true;
+		}
+	}
+
+	return false;
+}
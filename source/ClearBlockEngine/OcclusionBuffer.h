@@ -0,0 +1,61 @@
+#pragma once
+
+#include "cbe.h"
+#include "Frustum.h"
+
+namespace cbe
+{
+
+//////////////////////////////////////////////////////////////////////////
+// software occlusion buffer
+//
+// occluders (convex planar quads) are rasterized into a low resolution
+// depth buffer, four pixels at a time with sse. coverage is sampled at
+// pixel centers and the whole quad is written at its farthest depth, so
+// the buffer never puts an occluder in front of where it really is.
+// BuildPyramid then keeps the farthest depth of every 2x2 texels per
+// level, TestAABB checks the screen rect of a box on the level where it
+// spans only a few texels.
+//
+// matrix and depth follow Frustum (row major, 0 <= z <= w). anything
+// crossing the near plane is never an occluder and never occluded.
+class CBE_API OcclusionBuffer
+{
+private:
+	struct LEVEL
+	{
+		int width;
+		int height;
+		std::vector<float> depth;
+	};
+
+	int m_width;
+	int m_height;
+	float m_matrix[16];
+	std::vector<LEVEL> m_levels;
+
+	// screen x, y and depth, false in front of the near plane
+	bool Project(const XMFLOAT3& point, float* pScreen) const;
+
+public:
+	OcclusionBuffer();
+
+	// width is rounded up to a multiple of four
+	void Init(int width, int height);
+	void Clear(const float* pMatrix);
+
+	// four corners in order around the quad, false if it was skipped
+	bool RasterizeQuad(const XMFLOAT3* pCorners);
+	void BuildPyramid();
+
+	bool TestAABB(const XMFLOAT3& min, const XMFLOAT3& max) const;
+
+	// clip space w, the view depth for perspective projections
+	float ViewDepth(const XMFLOAT3& point) const;
+
+	inline int Width() const { return m_width; }
+	inline int Height() const { return m_height; }
+	inline const float* Depth(int level = 0) const { return m_levels[level].depth.data(); }
+};
+
+}
@@ -0,0 +1,229 @@
+#pragma once
+
+//////////////////////////////////////////////////////////////////////////
+// platform layer
+//
+// the engine core (blocks, chunks, mesher, job pipeline, persistence)
+// only relies on what is declared here and on standard c++ threads.
+// CBE_HEADLESS leaves out cgl/d3d and xnamath, the core then builds on
+// any platform; without windows it is always headless.
+#if !defined(_WIN32) && !defined(CBE_HEADLESS)
+#define CBE_HEADLESS
+#endif
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <cstdint>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// msvc integer keywords and windows types used throughout the engine
+#define __int8	char
+#define __int16	short
+#define __int32	int
+#define __int64	long long
+#define __forceinline inline
+
+typedef int				BOOL;
+typedef unsigned char	BYTE;
+typedef unsigned short	USHORT;
+typedef unsigned int	UINT;
+typedef uint32_t		DWORD;
+typedef int32_t			LONG;
+
+#ifndef TRUE
+#define TRUE 1
+#define FALSE 0
+#endif
+
+#define ZeroMemory(dst, size) memset((dst), 0, (size))
+#endif
+
+#ifndef SAFE_DELETE
+#define SAFE_DELETE(p)			{ if (p) { delete (p); (p) = NULL; } }
+#endif
+#ifndef SAFE_DELETE_ARRAY
+#define SAFE_DELETE_ARRAY(p)	{ if (p) { delete[] (p); (p) = NULL; } }
+#endif
+
+#ifdef CBE_HEADLESS
+// the parts of xnamath the core stores, the math itself stays in the
+// d3d layer
+struct XMFLOAT2
+{
+	float x, y;
+
+	XMFLOAT2() {}
+	XMFLOAT2(float _x, float _y) : x(_x), y(_y) {}
+};
+struct XMFLOAT3
+{
+	float x, y, z;
+
+	XMFLOAT3() {}
+	XMFLOAT3(float _x, float _y, float _z) : x(_x), y(_y), z(_z) {}
+};
+struct XMFLOAT4
+{
+	float x, y, z, w;
+
+	XMFLOAT4() {}
+	XMFLOAT4(float _x, float _y, float _z, float _w) : x(_x), y(_y), z(_z), w(_w) {}
+};
+struct XMFLOAT4X4
+{
+	float m[4][4];
+
+	XMFLOAT4X4() {}
+	XMFLOAT4X4(const float* pArray) { memcpy(m, pArray, sizeof(m)); }
+};
+#endif
+
+namespace cbe
+{
+
+// monotonic time for budgets and latency measurements
+inline double TimeMilliseconds()
+{
+#ifdef _WIN32
+	static double frequency = 0.0;
+	if (frequency == 0.0)
+	{
+		LARGE_INTEGER f;
+		QueryPerformanceFrequency(&f);
+		frequency = (double)f.QuadPart / 1000.0;
+	}
+
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	return (double)counter.QuadPart / frequency;
+#else
+	timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec * 1000.0 + time.tv_nsec / 1000000.0;
+#endif
+}
+
+// replaces an existing file, used to publish fully written saves
+inline bool MoveFileReplace(const char* pSource, const char* pDestination)
+{
+#ifdef _WIN32
+	return MoveFileExA(pSource, pDestination, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return rename(pSource, pDestination) == 0;
+#endif
+}
+
+// 64 bit file positions, map files grow past 2 GB
+inline bool FileSeek(FILE* pFile, __int64 offset, int origin)
+{
+#ifdef _WIN32
+	return _fseeki64(pFile, offset, origin) == 0;
+#else
+	return fseeko(pFile, offset, origin) == 0;
+#endif
+}
+inline __int64 FileTell(FILE* pFile)
+{
+#ifdef _WIN32
+	return _ftelli64(pFile);
+#else
+	return ftello(pFile);
+#endif
+}
+
+// identity of a file, whatever path names it
+struct FileId
+{
+	unsigned __int64 volume;
+	unsigned __int64 index;
+
+	inline bool operator == (const FileId& rhs) const { return volume == rhs.volume && index == rhs.index; }
+};
+inline bool GetFileId(const char* pFileName, FileId* pId)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(pFileName, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	BY_HANDLE_FILE_INFORMATION info;
+	bool success = GetFileInformationByHandle(file, &info) != 0;
+	CloseHandle(file);
+	if (!success)
+		return false;
+
+	pId->volume = info.dwVolumeSerialNumber;
+	pId->index = ((unsigned __int64)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+	return true;
+#else
+	struct stat info;
+	if (stat(pFileName, &info) != 0)
+		return false;
+
+	pId->volume = info.st_dev;
+	pId->index = info.st_ino;
+	return true;
+#endif
+}
+
+// read only view of a whole file, pages are read on first access and
+// shared with every other process mapping the file. NULL on failure
+inline const BYTE* MapFile(const char* pFileName, __int64* pSize)
+{
+	*pSize = 0;
+#ifdef _WIN32
+	HANDLE file = CreateFileA(pFileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return NULL;
+
+	LARGE_INTEGER size;
+	HANDLE mapping = NULL;
+	if (GetFileSizeEx(file, &size) && size.QuadPart != 0)
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+	if (!mapping)
+		return NULL;
+
+	// the view keeps the mapping alive
+	const BYTE* pData = (const BYTE*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (pData)
+		*pSize = size.QuadPart;
+	return pData;
+#else
+	int file = open(pFileName, O_RDONLY);
+	if (file < 0)
+		return NULL;
+
+	struct stat info;
+	void* pData = MAP_FAILED;
+	if (fstat(file, &info) == 0 && info.st_size != 0)
+		pData = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, file, 0);
+	close(file);
+	if (pData == MAP_FAILED)
+		return NULL;
+
+	*pSize = info.st_size;
+	return (const BYTE*)pData;
+#endif
+}
+inline void UnmapFile(const BYTE* pData, __int64 size)
+{
+#ifdef _WIN32
+	UnmapViewOfFile(pData);
+#else
+	munmap((void*)pData, size);
+#endif
+}
+
+}
@@ -0,0 +1,334 @@
+#include "cbe.h"
+
+using namespace cbe;
+
+RegionFile::RegionFile()
+	: m_pFile(NULL), m_writable(false), m_firstFree(0)
+{
+	ZeroMemory(&m_header, sizeof(Header));
+}
+RegionFile::~RegionFile()
+{
+	Close();
+}
+
+bool RegionFile::Create( std::string fileName, int width, int height, int depth, int chunkSize, int codec, int level )
+{
+	Close();
+
+	m_pFile = fopen(fileName.c_str(), "w+b");
+	if (!m_pFile)
+		return false;
+
+	m_fileName = fileName;
+	m_writable = true;
+
+	memcpy(m_header.magic, Magic(), 4);
+	m_header.version = Version();
+	m_header.width = width;
+	m_header.height = height;
+	m_header.depth = depth;
+	m_header.chunkSize = chunkSize;
+	m_header.sectorSize = SectorSize();
+	m_header.codec = codec;
+	m_header.level = level;
+
+	Entry empty = { 0, 0 };
+	m_entries.assign(width * height * depth, empty);
+
+	// header and table fill the first sectors, payloads start behind them
+	m_usedSectors.assign(TableSectors(), true);
+	m_firstFree = TableSectors();
+
+	std::vector<BYTE> table(TableSectors() * SectorSize(), 0);
+	memcpy(table.data(), &m_header, sizeof(Header));
+
+	if (fwrite(table.data(), 1, table.size(), m_pFile) != table.size())
+	{
+		Close();
+		return false;
+	}
+
+	return true;
+}
+bool RegionFile::Open( std::string fileName, bool writable )
+{
+	Close();
+
+	m_pFile = fopen(fileName.c_str(), writable ? "r+b" : "rb");
+	if (!m_pFile)
+		return false;
+
+	m_fileName = fileName;
+	m_writable = writable;
+
+	bool valid = fread(&m_header, sizeof(Header), 1, m_pFile) == 1 &&
+				 memcmp(m_header.magic, Magic(), 4) == 0 &&
+				 m_header.version == Version() &&
+				 m_header.sectorSize == SectorSize() &&
+				 m_header.width > 0 && m_header.height > 0 && m_header.depth > 0 && m_header.chunkSize > 0;
+
+	if (valid)
+	{
+		m_entries.resize(m_header.width * m_header.height * m_header.depth);
+		valid = fread(m_entries.data(), sizeof(Entry), m_entries.size(), m_pFile) == m_entries.size();
+	}
+
+	__int64 fileSectors = 0;
+	if (valid && FileSeek(m_pFile, 0, SEEK_END))
+		fileSectors = FileTell(m_pFile) / SectorSize();
+
+	// payloads have to lie behind the table, inside the file and apart
+	// from each other
+	if (valid)
+		m_usedSectors.assign(TableSectors(), true);
+	for (UINT i = 0; i < m_entries.size() && valid; i++)
+	{
+		const Entry& entry = m_entries[i];
+		if (entry.sector == 0)
+		{
+			valid = entry.length == 0;
+			continue;
+		}
+
+		int count = SectorCount(entry.length);
+		valid = entry.sector >= TableSectors() && entry.length > 0 && entry.sector + (__int64)count <= fileSectors;
+		if (!valid)
+			break;
+
+		if ((int)m_usedSectors.size() < entry.sector + count)
+			m_usedSectors.resize(entry.sector + count, false);
+		for (int sector = entry.sector; sector < entry.sector + count && valid; sector++)
+		{
+			valid = !m_usedSectors[sector];
+			m_usedSectors[sector] = true;
+		}
+	}
+
+	if (!valid)
+	{
+		Close();
+		return false;
+	}
+
+	m_firstFree = TableSectors();
+	while (m_firstFree < (int)m_usedSectors.size() && m_usedSectors[m_firstFree])
+		m_firstFree++;
+
+	return true;
+}
+void RegionFile::Close()
+{
+	if (m_pFile)
+	{
+		fclose(m_pFile);
+		m_pFile = NULL;
+	}
+
+	m_entries.clear();
+	m_usedSectors.clear();
+	m_firstFree = 0;
+	m_writable = false;
+}
+
+bool RegionFile::ReadChunk( int chunkIndex, std::vector<BYTE>* pData )
+{
+	const Entry& entry = m_entries[chunkIndex];
+	if (!m_pFile || entry.sector == 0)
+		return false;
+
+	pData->resize(entry.length);
+	return FileSeek(m_pFile, (__int64)entry.sector * SectorSize(), SEEK_SET) &&
+		   fread(pData->data(), 1, entry.length, m_pFile) == (size_t)entry.length;
+}
+bool RegionFile::ReadSpan( __int64 offset, UINT length, BYTE* pData )
+{
+	return m_pFile && FileSeek(m_pFile, offset, SEEK_SET) && fread(pData, 1, length, m_pFile) == length;
+}
+bool RegionFile::WriteChunk( int chunkIndex, const BYTE* pData, UINT length )
+{
+	return WriteChunks(1, &chunkIndex, &pData, &length);
+}
+bool RegionFile::WriteChunks( int count, const int* pChunkIndices, const BYTE* const* ppData, const UINT* pLengths )
+{
+	if (!m_pFile || !m_writable)
+		return false;
+
+	bool success = true;
+	int sectors = 0;
+	for (int i = 0; i < count; i++)
+	{
+		if (pLengths[i] == 0)
+			success = RemoveChunk(pChunkIndices[i]) && success;
+		sectors += SectorCount(pLengths[i]);
+	}
+	if (sectors == 0)
+		return success;
+
+	// one run for all payloads, each padded to a sector, so the file
+	// always ends on a sector
+	int first = AllocateSectors(sectors);
+	m_writeBuffer.assign(sectors * SectorSize(), 0);
+
+	int sector = first;
+	for (int i = 0; i < count; i++)
+	{
+		memcpy(m_writeBuffer.data() + (__int64)(sector - first) * SectorSize(), ppData[i], pLengths[i]);
+		sector += SectorCount(pLengths[i]);
+	}
+
+	if (!FileSeek(m_pFile, (__int64)first * SectorSize(), SEEK_SET) ||
+		fwrite(m_writeBuffer.data(), 1, m_writeBuffer.size(), m_pFile) != m_writeBuffer.size())
+	{
+		FreeSectors(first, sectors);
+		return false;
+	}
+
+	// the new payloads are written before the entries point to them
+	std::vector<Entry> previous(count);
+	bool rewritten = false;
+	for (int i = 0; i < count; i++)
+	{
+		previous[i] = m_entries[pChunkIndices[i]];
+		rewritten = rewritten || (pLengths[i] != 0 && previous[i].sector != 0);
+	}
+	if (rewritten)
+		fflush(m_pFile);
+
+	int minChunk = -1;
+	int maxChunk = -1;
+	sector = first;
+	for (int i = 0; i < count; i++)
+	{
+		if (pLengths[i] == 0)
+			continue;
+
+		int chunkIndex = pChunkIndices[i];
+		m_entries[chunkIndex].sector = sector;
+		m_entries[chunkIndex].length = pLengths[i];
+		sector += SectorCount(pLengths[i]);
+
+		minChunk = minChunk < 0 || chunkIndex < minChunk ? chunkIndex : minChunk;
+		maxChunk = chunkIndex > maxChunk ? chunkIndex : maxChunk;
+	}
+
+	// neighbouring chunks share one write of the table
+	if (maxChunk - minChunk < count * 4)
+	{
+		success = WriteEntries(minChunk, maxChunk - minChunk + 1) && success;
+	}
+	else
+	{
+		for (int i = 0; i < count; i++)
+		{
+			if (pLengths[i] != 0)
+				success = WriteEntries(pChunkIndices[i], 1) && success;
+		}
+	}
+	if (!success)
+		return false;
+
+	for (int i = 0; i < count; i++)
+	{
+		if (pLengths[i] != 0 && previous[i].sector != 0)
+			FreeSectors(previous[i].sector, SectorCount(previous[i].length));
+	}
+
+	return true;
+}
+bool RegionFile::RemoveChunk( int chunkIndex )
+{
+	if (!m_pFile || !m_writable)
+		return false;
+
+	Entry previous = m_entries[chunkIndex];
+	if (previous.sector == 0)
+		return true;
+
+	m_entries[chunkIndex].sector = 0;
+	m_entries[chunkIndex].length = 0;
+	if (!WriteEntries(chunkIndex, 1))
+		return false;
+
+	FreeSectors(previous.sector, SectorCount(previous.length));
+	return true;
+}
+bool RegionFile::SetCodec( int codec, int level )
+{
+	if (!m_pFile || !m_writable)
+		return false;
+	if (codec == m_header.codec && level == m_header.level)
+		return true;
+
+	m_header.codec = codec;
+	m_header.level = level;
+	return FileSeek(m_pFile, 0, SEEK_SET) && fwrite(&m_header, sizeof(Header), 1, m_pFile) == 1;
+}
+bool RegionFile::Flush()
+{
+	return m_pFile && fflush(m_pFile) == 0;
+}
+
+bool RegionFile::IsRegionFile( std::string fileName )
+{
+	FILE* pFile = fopen(fileName.c_str(), "rb");
+	if (!pFile)
+		return false;
+
+	char magic[4];
+	bool region = fread(magic, 4, 1, pFile) == 1 && memcmp(magic, Magic(), 4) == 0;
+	fclose(pFile);
+
+	return region;
+}
+
+int RegionFile::TableSectors()
+{
+	return SectorCount(sizeof(Header) + m_entries.size() * sizeof(Entry));
+}
+int RegionFile::SectorCount( int length )
+{
+	return (length + SectorSize() - 1) / SectorSize();
+}
+int RegionFile::AllocateSectors( int count )
+{
+	// first fit, a run reaching the end of the file grows it
+	int size = (int)m_usedSectors.size();
+	int start = m_firstFree;
+	int run = 0;
+	for (int sector = m_firstFree; sector < size && run < count; sector++)
+	{
+		if (m_usedSectors[sector])
+		{
+			start = sector + 1;
+			run = 0;
+		}
+		else
+		{
+			run++;
+		}
+	}
+
+	if (start + count > size)
+		m_usedSectors.resize(start + count, false);
+	for (int sector = start; sector < start + count; sector++)
+		m_usedSectors[sector] = true;
+
+	while (m_firstFree < (int)m_usedSectors.size() && m_usedSectors[m_firstFree])
+		m_firstFree++;
+
+	return start;
+}
+void RegionFile::FreeSectors( int sector, int count )
+{
+	for (int i = sector; i < sector + count; i++)
+		m_usedSectors[i] = false;
+
+	if (sector < m_firstFree)
+		m_firstFree = sector;
+}
+bool RegionFile::WriteEntries( int firstChunk, int count )
+{
+	return FileSeek(m_pFile, sizeof(Header) + (__int64)firstChunk * sizeof(Entry), SEEK_SET) &&
+		   fwrite(&m_entries[firstChunk], sizeof(Entry), count, m_pFile) == (size_t)count;
+}
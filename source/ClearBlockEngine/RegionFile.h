@@ -0,0 +1,108 @@
+#pragma once
+
+#include "cbe.h"
+
+namespace cbe
+{
+
+//////////////////////////////////////////////////////////////////////////
+// map file with random access to the chunks
+//
+// |Header|Entry * chunkCount|pad|Sector|Sector|...
+//
+// the entry of a chunk holds the first sector and the length of its
+// payload, sector 0 (the header) marks a missing chunk. payloads start on
+// a sector boundary, so any chunk is read or rewritten on its own.
+// a rewritten chunk goes to free sectors first and only then is its entry
+// updated, a crash in between leaves the old payload in place. freed
+// sectors are reused by later writes.
+//
+// WriteChunks puts the payloads of several chunks into one run of sectors
+// with a single write, ReadSpan reads any part of the file, so loading
+// and saving move large sequential blocks instead of one chunk at a time.
+//
+// payloads are opaque here, each starts with its codec (see ChunkCodec).
+// the header keeps the codec and level chunks of the map are written
+// with, chunks written before a change keep theirs until rewritten.
+class CBE_API RegionFile
+{
+public:
+	#pragma pack(push, 1)
+	struct Header
+	{
+		char magic[4];
+		__int32 version;
+		__int32 width;
+		__int32 height;
+		__int32 depth;
+		__int32 chunkSize;
+		__int32 sectorSize;
+		__int32 codec;
+		__int32 level;
+	};
+	struct Entry
+	{
+		__int32 sector;
+		__int32 length;
+	};
+	#pragma pack(pop)
+
+private:
+	FILE* m_pFile;
+	std::string m_fileName;
+	bool m_writable;
+
+	Header m_header;
+	std::vector<Entry> m_entries;
+	std::vector<bool> m_usedSectors;
+	int m_firstFree;	// no free sector below
+	std::vector<BYTE> m_writeBuffer;
+
+	int TableSectors();
+	int AllocateSectors(int count);
+	void FreeSectors(int sector, int count);
+	int SectorCount(int length);
+	bool WriteEntries(int firstChunk, int count);
+
+	RegionFile(const RegionFile&);
+	RegionFile& operator = (const RegionFile&);
+
+public:
+	RegionFile();
+	~RegionFile();
+
+	// a new file without chunks, an existing one is overwritten
+	bool Create(std::string fileName, int width, int height, int depth, int chunkSize, int codec, int level);
+	bool Open(std::string fileName, bool writable);
+	void Close();
+
+	bool ReadChunk(int chunkIndex, std::vector<BYTE>* pData);
+	bool WriteChunk(int chunkIndex, const BYTE* pData, UINT length);
+	// distinct chunks, an empty payload removes its chunk
+	bool WriteChunks(int count, const int* pChunkIndices, const BYTE* const* ppData, const UINT* pLengths);
+	bool ReadSpan(__int64 offset, UINT length, BYTE* pData);
+	bool RemoveChunk(int chunkIndex);
+	bool SetCodec(int codec, int level);
+	bool Flush();
+
+	inline bool IsOpen()					{ return m_pFile != NULL; }
+	inline bool HasChunk(int chunkIndex)	{ return m_entries[chunkIndex].sector != 0; }
+	inline UINT ChunkLength(int chunkIndex)	{ return m_entries[chunkIndex].length; }
+	inline __int64 ChunkOffset(int chunkIndex)	{ return (__int64)m_entries[chunkIndex].sector * SectorSize(); }
+	inline int ChunkCount()					{ return (int)m_entries.size(); }
+	inline int Width()						{ return m_header.width; }
+	inline int Height()						{ return m_header.height; }
+	inline int Depth()						{ return m_header.depth; }
+	inline int ChunkSize()					{ return m_header.chunkSize; }
+	inline int Codec()						{ return m_header.codec; }
+	inline int Level()						{ return m_header.level; }
+	inline std::string FileName()			{ return m_fileName; }
+
+	static bool IsRegionFile(std::string fileName);
+
+	static const char*	Magic()			{ return "CBER"; }
+	static const int	Version()		{ return 2; }
+	static const int	SectorSize()	{ return 4096; }
+};
+
+}
@@ -0,0 +1,154 @@
+#include "cbe.h"
+
+using namespace cbe;
+
+TranslucentSorter::TranslucentSorter()
+	: m_threshold(1.0f), m_sortedQuads(0)
+{
+}
+
+void TranslucentSorter::Init( UINT chunkCount )
+{
+	m_chunks.clear();
+	m_chunks.resize(chunkCount);
+	for (UINT i = 0; i < chunkCount; i++)
+	{
+		m_chunks[i].version = 0;
+		m_chunks[i].sorted = false;
+	}
+
+	ClearSorted();
+}
+
+void TranslucentSorter::SetQuads( int chunkIndex, const XMFLOAT3* pCentroids, const DWORD* pIndices, UINT quadCount )
+{
+	CHUNK_QUADS& chunk = m_chunks[chunkIndex];
+	chunk.centroids.assign(pCentroids, pCentroids + quadCount);
+	chunk.indices.assign(pIndices, pIndices + quadCount * 6);
+	chunk.version++;
+	chunk.sorted = false;
+}
+
+void TranslucentSorter::SetThreshold( float distance )
+{
+	m_threshold = distance;
+}
+
+void TranslucentSorter::Sort( const XMFLOAT3& camera, const int* pChunkIndices, UINT chunkCount )
+{
+	float threshold = m_threshold * m_threshold;
+	for (UINT i = 0; i < chunkCount; i++)
+	{
+		CHUNK_QUADS& chunk = m_chunks[pChunkIndices[i]];
+		if (chunk.centroids.size() < 2)
+			continue;
+
+		if (chunk.sorted)
+		{
+			float dx = camera.x - chunk.sortedFrom.x;
+			float dy = camera.y - chunk.sortedFrom.y;
+			float dz = camera.z - chunk.sortedFrom.z;
+			if (dx * dx + dy * dy + dz * dz <= threshold)
+				continue;
+		}
+
+		SortChunk(pChunkIndices[i], camera);
+	}
+}
+
+void TranslucentSorter::SortChunk( int chunkIndex, const XMFLOAT3& camera )
+{
+	CHUNK_QUADS& chunk = m_chunks[chunkIndex];
+	UINT count = chunk.centroids.size();
+
+	m_keys.resize(count);
+	m_order.resize(count);
+	m_tmpKeys.resize(count);
+	m_tmpOrder.resize(count);
+
+	// squared distances are positive, their bits sort like the floats.
+	// inverted the farthest quad comes first
+	for (UINT quad = 0; quad < count; quad++)
+	{
+		float dx = chunk.centroids[quad].x - camera.x;
+		float dy = chunk.centroids[quad].y - camera.y;
+		float dz = chunk.centroids[quad].z - camera.z;
+		float distance = dx * dx + dy * dy + dz * dz;
+
+		UINT bits;
+		memcpy(&bits, &distance, sizeof(bits));
+		m_keys[quad] = ~bits;
+		m_order[quad] = quad;
+	}
+
+	RadixSort(count, m_keys.data(), m_order.data(), m_tmpKeys.data(), m_tmpOrder.data());
+
+	SORTED_RANGE range = { chunkIndex, chunk.version, (UINT)m_sortedIndices.size(), count * 6 };
+	m_sortedIndices.resize(range.first + range.count);
+	DWORD* pOut = &m_sortedIndices[range.first];
+	for (UINT quad = 0; quad < count; quad++)
+		memcpy(pOut + quad * 6, &chunk.indices[m_order[quad] * 6], 6 * sizeof(DWORD));
+
+	m_sorted.push_back(range);
+	m_sortedQuads += count;
+
+	chunk.sorted = true;
+	chunk.sortedFrom = camera;
+}
+
+void TranslucentSorter::ClearSorted()
+{
+	m_sorted.clear();
+	m_sortedIndices.clear();
+	m_sortedQuads = 0;
+}
+
+void TranslucentSorter::RadixSort( UINT count, UINT* pKeys, UINT* pValues, UINT* pTmpKeys, UINT* pTmpValues )
+{
+	if (count == 0)
+		return;
+
+	UINT* pResultKeys = pKeys;
+	UINT* pResultValues = pValues;
+
+	// least significant byte first, bytes that are the same for all keys
+	// need no pass
+	for (int shift = 0; shift < 32; shift += 8)
+	{
+		UINT histogram[256] = { 0 };
+		for (UINT i = 0; i < count; i++)
+			histogram[(pKeys[i] >> shift) & 0xFF]++;
+
+		if (histogram[(pKeys[0] >> shift) & 0xFF] == count)
+			continue;
+
+		UINT offset = 0;
+		for (int digit = 0; digit < 256; digit++)
+		{
+			UINT digitCount = histogram[digit];
+			histogram[digit] = offset;
+			offset += digitCount;
+		}
+
+		for (UINT i = 0; i < count; i++)
+		{
+			UINT target = histogram[(pKeys[i] >> shift) & 0xFF]++;
+			pTmpKeys[target] = pKeys[i];
+			pTmpValues[target] = pValues[i];
+		}
+
+		UINT* pSwap = pKeys;
+		pKeys = pTmpKeys;
+		pTmpKeys = pSwap;
+		pSwap = pValues;
+		pValues = pTmpValues;
+		pTmpValues = pSwap;
+	}
+
+	// after an odd number of passes the result is in the temporary arrays
+	if (pKeys != pResultKeys)
+	{
+		memcpy(pResultKeys, pKeys, count * sizeof(UINT));
+		memcpy(pResultValues, pValues, count * sizeof(UINT));
+	}
+}
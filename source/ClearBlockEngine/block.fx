@@ -107,12 +107,42 @@ float4 simplePixelShader(PSINPUT input) : SV_Target
    // return float4(input.normal.x / 2.0f + 0.5f, input.normal.y / 2.0f + 0.5f, input.normal.z / 2.0f + 0.5f, 1.0f);
 }
 
+// lit like the opaque blocks, the alpha comes from the type color and texture
+float4 transparentPixelShader(PSINPUT input) : SV_Target
+{
+	float4 color = simplePixelShader(input);
+	color.a = g_blockTypes[input.typeIndex].color.a * g_textureAtlas[0].Sample(sam, input.texCoord).a;
+	return color;
+}
+
 
 BlendState NoBlend
 { 
     BlendEnable[0] = False;
 };
 
+BlendState AlphaBlend
+{
+    BlendEnable[0] = True;
+    SrcBlend = SRC_ALPHA;
+    DestBlend = INV_SRC_ALPHA;
+    BlendOp = ADD;
+};
+
+DepthStencilState DepthWrite
+{
+	DepthEnable = True;
+	DepthWriteMask = ALL;
+};
+
+// translucent quads are tested against the opaque ones but do not hide
+// each other
+DepthStencilState DepthRead
+{
+	DepthEnable = True;
+	DepthWriteMask = ZERO;
+};
+
 RasterizerState wireframe
 {
 	FILLMODE = WIREFRAME;
@@ -133,7 +163,19 @@ technique11 main
 	pass 
 	{
 		SetBlendState( NoBlend, float4( 0.0f, 0.0f, 0.0f, 0.0f ), 0xFFFFFFFF );
+		SetDepthStencilState( DepthWrite, 0 );
 		SetVertexShader( CompileShader( vs_4_0, simpleVertexShader() ) );
 		SetPixelShader( CompileShader( ps_4_0, simplePixelShader() ) );
 	}
+}
+
+technique11 transparent
+{
+	pass 
+	{
+		SetBlendState( AlphaBlend, float4( 0.0f, 0.0f, 0.0f, 0.0f ), 0xFFFFFFFF );
+		SetDepthStencilState( DepthRead, 0 );
+		SetVertexShader( CompileShader( vs_4_0, simpleVertexShader() ) );
+		SetPixelShader( CompileShader( ps_4_0, transparentPixelShader() ) );
+	}
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 // dllmain.cpp : Definiert den Einstiegspunkt fr die DLL-Anwendung.
 #include "cbe.h"
 
+#ifdef _WIN32
 BOOL APIENTRY DllMain( HMODULE hModule,
                        DWORD  ul_reason_for_call,
                        LPVOID lpReserved
@@ -16,4 +17,5 @@ BOOL APIENTRY DllMain( HMODULE hModule,
 	}
 	return TRUE;
 }
+#endif
 
@@ -0,0 +1,200 @@
+// chunk payload codecs: compression ratio and encode / decode MB/s per
+// codec and level on generated sample chunks, then the size and the
+// save and load MB/s of a whole map for each. built by cmake with
+// CBE_BENCHMARKS
+#include "cbe.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+
+using namespace cbe;
+
+static const int CHUNK_SIZE = 32, SAMPLE_CHUNKS = 16;
+
+enum SAMPLE
+{
+	SAMPLE_TERRAIN,		// hills of three types with caves
+	SAMPLE_SPARSE,		// mostly air, a few houses
+	SAMPLE_WATER,		// sea floor and water up to the sea level
+	SAMPLE_NOISE,		// random types, the worst case
+	SAMPLE_COUNT
+};
+
+static const char* g_sampleNames[SAMPLE_COUNT] = { "terrain", "sparse", "water", "noise" };
+
+static Block MakeBlock( USHORT type )
+{
+	Block block;
+	block.SetType(type);
+	block.SetActive(1);
+	return block;
+}
+
+static void FillSample( int sample, int chunk, Block* pBlocks )
+{
+	srand(chunk + 1);
+	for (int x = 0; x < CHUNK_SIZE; x++)
+	{
+		for (int z = 0; z < CHUNK_SIZE; z++)
+		{
+			int wx = chunk * CHUNK_SIZE + x;
+			int height = 10 + (int)(6.0 * sin(wx * 0.11) + 5.0 * cos(z * 0.07));
+			for (int y = 0; y < CHUNK_SIZE; y++)
+			{
+				Block* pBlock = &pBlocks[(x * CHUNK_SIZE + y) * CHUNK_SIZE + z];
+				switch (sample)
+				{
+				case SAMPLE_TERRAIN:
+					if (y < height && rand() % 16 != 0)
+						*pBlock = MakeBlock(y < height - 4 ? 0 : (y < height - 1 ? 1 : 2));
+					break;
+				case SAMPLE_SPARSE:
+					if (y == 0 || (x % 16 < 5 && z % 16 < 5 && y < 6 && (x % 16 == 0 || x % 16 == 4 || z % 16 == 0 || z % 16 == 4 || y == 5)))
+						*pBlock = MakeBlock(y == 0 ? 0 : 1);
+					break;
+				case SAMPLE_WATER:
+					if (y < height - 4)
+						*pBlock = MakeBlock(0);
+					else if (y <= 12)
+						*pBlock = MakeBlock(3);
+					break;
+				case SAMPLE_NOISE:
+					*pBlock = MakeBlock(rand() % 4);
+					break;
+				}
+			}
+		}
+	}
+}
+
+static void BenchmarkCodec( int codec, int level, const std::vector<Block>* pSamples, int repetitions )
+{
+	const int blockCount = CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE;
+	const double chunkBytes = blockCount * sizeof(Block);
+
+	printf("%s level %d\n", codec == CHUNK_CODEC_RAW ? "raw" : "palette rle", level);
+
+	std::vector<Block> decoded(blockCount);
+	std::vector<BYTE> payload;
+	for (int sample = 0; sample < SAMPLE_COUNT; sample++)
+	{
+		double encodeTime = 0.0, decodeTime = 0.0, payloadBytes = 0.0;
+		bool equal = true;
+		for (int run = 0; run < repetitions; run++)
+		{
+			for (int chunk = 0; chunk < SAMPLE_CHUNKS; chunk++)
+			{
+				const Block* pBlocks = &pSamples[sample][chunk * blockCount];
+
+				double start = TimeMilliseconds();
+				ChunkCodec::Encode(codec, level, CHUNK_SIZE, pBlocks, &payload);
+				encodeTime += TimeMilliseconds() - start;
+
+				start = TimeMilliseconds();
+				ChunkCodec::Decode(CHUNK_SIZE, payload.data(), payload.size(), decoded.data());
+				decodeTime += TimeMilliseconds() - start;
+
+				payloadBytes += payload.size();
+				equal &= memcmp(decoded.data(), pBlocks, chunkBytes) == 0;
+			}
+		}
+
+		double totalBytes = chunkBytes * SAMPLE_CHUNKS * repetitions;
+		printf("  %-8s ratio %6.1f : 1, encode %8.1f MB/s, decode %8.1f MB/s%s\n", g_sampleNames[sample],
+			   totalBytes / payloadBytes, totalBytes / 1e6 / (encodeTime / 1000.0), totalBytes / 1e6 / (decodeTime / 1000.0),
+			   equal ? "" : ", DECODED BLOCKS DIFFER");
+	}
+}
+
+// a map of terrain chunks saved and loaded with the codec
+static void BenchmarkMap( int codec, int level, int size, const std::string& fileName )
+{
+	ChunkManager source;
+	if (!source.Init(size, 1, size, CHUNK_SIZE))
+		return;
+	source.SetChunkCodec(codec, level);
+
+	BlockType types[3];
+	const char* textures[3] = { "stone", "dirt", "grass" };
+	for (int type = 0; type < 3; type++)
+	{
+		types[type].SetTexture(textures[type]);
+		source.TypeManager()->AddType(types[type]);
+	}
+
+	std::vector<Block> blocks(CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE);
+	for (int chunk = 0; chunk < size * size; chunk++)
+	{
+		std::fill(blocks.begin(), blocks.end(), Block());
+		FillSample(SAMPLE_TERRAIN, chunk, blocks.data());
+
+		int cx = chunk / size, cz = chunk % size;
+		for (int i = 0; i < (int)blocks.size(); i++)
+		{
+			if (!blocks[i].Active())
+				continue;
+
+			int x = cx * CHUNK_SIZE + i / (CHUNK_SIZE * CHUNK_SIZE);
+			int y = (i / CHUNK_SIZE) % CHUNK_SIZE;
+			int z = cz * CHUNK_SIZE + i % CHUNK_SIZE;
+			source.SetBlockType(x, y, z, types[blocks[i].Type()]);
+			source.SetBlockState(x, y, z, TRUE);
+		}
+	}
+	source.BuildPending();
+
+	double start = TimeMilliseconds();
+	bool saved = source.Serialize(fileName);
+	double saveTime = TimeMilliseconds() - start;
+	source.Exit();
+
+	ChunkManager loaded;
+	start = TimeMilliseconds();
+	bool read = loaded.Deserialize(fileName);
+	double loadTime = TimeMilliseconds() - start;
+	loaded.Exit();
+
+	FILE* pFile = fopen(fileName.c_str(), "rb");
+	long fileSize = 0;
+	if (pFile)
+	{
+		fseek(pFile, 0, SEEK_END);
+		fileSize = ftell(pFile);
+		fclose(pFile);
+	}
+	remove(fileName.c_str());
+
+	double blockBytes = (double)size * size * CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE * sizeof(Block);
+	printf("  %s level %d: %7.2f MB file, save %8.1f MB/s, load %8.1f MB/s of blocks%s\n",
+		   codec == CHUNK_CODEC_RAW ? "raw        " : "palette rle", level, fileSize / 1e6,
+		   blockBytes / 1e6 / (saveTime / 1000.0), blockBytes / 1e6 / (loadTime / 1000.0), saved && read ? "" : ", FAILED");
+}
+
+int main( int argc, char** argv )
+{
+	int repetitions = argc > 1 ? atoi(argv[1]) : 10;
+	int mapSize = argc > 2 ? atoi(argv[2]) : 16;
+	std::string fileName = argc > 3 ? argv[3] : "CodecBenchmark.map";
+
+	const int blockCount = CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE;
+	std::vector<Block> samples[SAMPLE_COUNT];
+	for (int sample = 0; sample < SAMPLE_COUNT; sample++)
+	{
+		samples[sample].resize(blockCount * SAMPLE_CHUNKS);
+		for (int chunk = 0; chunk < SAMPLE_CHUNKS; chunk++)
+			FillSample(sample, chunk, &samples[sample][chunk * blockCount]);
+	}
+
+	printf("%d chunks of %d^3 per sample\n", SAMPLE_CHUNKS, CHUNK_SIZE);
+	BenchmarkCodec(CHUNK_CODEC_RAW, 0, samples, repetitions);
+	for (int level = 0; level <= ChunkCodec::MaxLevel(); level++)
+		BenchmarkCodec(CHUNK_CODEC_PALETTE_RLE, level, samples, repetitions);
+
+	printf("%d x %d chunk terrain map\n", mapSize, mapSize);
+	BenchmarkMap(CHUNK_CODEC_RAW, 0, mapSize, fileName);
+	for (int level = 0; level <= ChunkCodec::MaxLevel(); level++)
+		BenchmarkMap(CHUNK_CODEC_PALETTE_RLE, level, mapSize, fileName);
+
+	return 0;
+}
@@ -0,0 +1,220 @@
+// lock contention: readers of a ThreadSafe queue under shared and under
+// exclusive guards, and block queries from several threads while the
+// worker of a ChunkManager applies edits and builds chunks. built by cmake
+// with CBE_BENCHMARKS
+#include "cbe.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+using namespace cbe;
+
+static const int MAX_THREADS = 8;
+
+static std::atomic<bool> g_running;
+
+//////////////////////////////////////////////////////////////////////////
+// ThreadSafe readers, one operation in 64 writes
+
+struct QUEUE_READER
+{
+	ThreadSafe<std::deque<int>>* pQueue;
+	bool shared;
+	unsigned int seed;
+	UINT operations;
+	UINT found;
+};
+
+static void ReadQueue( QUEUE_READER* pReader )
+{
+	unsigned int seed = pReader->seed;
+	UINT operations = 0;
+	UINT found = 0;
+	while (g_running)
+	{
+		seed = seed * 1103515245 + 12345;
+		int value = (seed >> 16) % 512;
+
+		if ((seed >> 8) % 64 == 0)
+		{
+			auto sec = pReader->pQueue->blockSecurity();
+			sec->pop_front();
+			sec->push_back(value);
+		}
+		else if (pReader->shared)
+		{
+			auto sec = pReader->pQueue->sharedSecurity();
+			found += std::find(sec->begin(), sec->end(), value) != sec->end();
+		}
+		else
+		{
+			auto sec = pReader->pQueue->blockSecurity();
+			found += std::find(sec->begin(), sec->end(), value) != sec->end();
+		}
+
+		operations++;
+	}
+
+	pReader->operations = operations;
+	pReader->found = found;
+}
+
+static double RunQueue( int threadCount, bool shared, int milliseconds )
+{
+	ThreadSafe<std::deque<int>> queue(new std::deque<int>());
+	for (int i = 0; i < 256; i++)
+		queue->push_back(i * 2);
+
+	QUEUE_READER readers[MAX_THREADS];
+	std::thread threads[MAX_THREADS];
+
+	g_running = true;
+	for (int i = 0; i < threadCount; i++)
+	{
+		readers[i].pQueue = &queue;
+		readers[i].shared = shared;
+		readers[i].seed = i + 1;
+		readers[i].operations = 0;
+		readers[i].found = 0;
+		threads[i] = std::thread(ReadQueue, &readers[i]);
+	}
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+	g_running = false;
+
+	UINT operations = 0;
+	for (int i = 0; i < threadCount; i++)
+	{
+		threads[i].join();
+		operations += readers[i].operations;
+	}
+
+	return operations / (milliseconds / 1000.0) / 1e6;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// block queries while the worker builds
+
+static const int WORLD = 4, CHUNK_SIZE = 32;
+
+struct BLOCK_READER
+{
+	ChunkManager* pManager;
+	unsigned int seed;
+	UINT queries;
+	double worst;
+};
+
+static void QueryBlocks( BLOCK_READER* pReader )
+{
+	int extent = WORLD * CHUNK_SIZE;
+	unsigned int seed = pReader->seed;
+	UINT queries = 0;
+	double worst = 0.0;
+	while (g_running)
+	{
+		seed = seed * 1103515245 + 12345;
+		int x = (seed >> 4) % extent;
+		int y = (seed >> 12) % extent;
+		int z = (seed >> 20) % extent;
+
+		double start = TimeMilliseconds();
+		pReader->pManager->GetBlockState(x, y, z);
+		double time = TimeMilliseconds() - start;
+		if (time > worst)
+			worst = time;
+
+		queries++;
+	}
+
+	pReader->queries = queries;
+	pReader->worst = worst;
+}
+
+static void RunQueries( ChunkManager& manager, int threadCount, int milliseconds )
+{
+	BLOCK_READER readers[MAX_THREADS];
+	std::thread threads[MAX_THREADS];
+
+	g_running = true;
+	for (int i = 0; i < threadCount; i++)
+	{
+		readers[i].pManager = &manager;
+		readers[i].seed = i + 1;
+		readers[i].queries = 0;
+		readers[i].worst = 0.0;
+		threads[i] = std::thread(QueryBlocks, &readers[i]);
+	}
+
+	// edits keep the worker applying jobs and meshing chunks
+	int extent = WORLD * CHUNK_SIZE;
+	UINT edits = 0;
+	double end = TimeMilliseconds() + milliseconds;
+	srand(threadCount);
+	while (TimeMilliseconds() < end)
+	{
+		manager.SetBlockState(rand() % extent, rand() % extent, rand() % extent, rand() % 2);
+		manager.Update();
+		edits++;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	g_running = false;
+
+	UINT queries = 0;
+	double worst = 0.0;
+	for (int i = 0; i < threadCount; i++)
+	{
+		threads[i].join();
+		queries += readers[i].queries;
+		if (readers[i].worst > worst)
+			worst = readers[i].worst;
+	}
+
+	printf("%d threads: %8.2f M queries/s, worst query %7.3f ms, %u edits\n",
+		   threadCount, queries / (milliseconds / 1000.0) / 1e6, worst, edits);
+}
+
+int main( int argc, char** argv )
+{
+	int milliseconds = argc > 1 ? atoi(argv[1]) : 500;
+
+	printf("ThreadSafe queue, M operations/s (shared / exclusive reads)\n");
+	for (int threads = 1; threads <= MAX_THREADS; threads *= 2)
+	{
+		double shared = RunQueue(threads, true, milliseconds);
+		double exclusive = RunQueue(threads, false, milliseconds);
+		printf("%d threads: %8.2f / %8.2f\n", threads, shared, exclusive);
+	}
+
+	ChunkManager manager;
+	if (!manager.Init(WORLD, WORLD, WORLD, CHUNK_SIZE))
+		return 1;
+	manager.SetUploadBudget(0.0f, 0);
+
+	BlockType stone;
+	stone.SetTexture("stone");
+	manager.TypeManager()->AddType(stone);
+
+	// the lower half of the world, with holes
+	srand(1);
+	int extent = WORLD * CHUNK_SIZE;
+	for (int x = 0; x < extent; x++)
+	{
+		for (int z = 0; z < extent; z++)
+		{
+			for (int y = 0; y < extent / 2; y++)
+				manager.SetBlockState(x, y, z, rand() % 8 != 0);
+		}
+	}
+
+	manager.BuildPending();
+	manager.Update();
+	manager.StartAsyncUpdating();
+
+	printf("GetBlockState while the worker builds\n");
+	for (int threads = 1; threads <= MAX_THREADS; threads *= 2)
+		RunQueries(manager, threads, milliseconds);
+
+	manager.Exit();
+	return 0;
+}
@@ -0,0 +1,88 @@
+// times the chunk mesher on generated terrain. built twice by cmake with
+// CBE_BENCHMARKS, once with the mesher specialized per chunk size and
+// once with CBE_RUNTIME_CHUNK_SIZE, compare the two outputs
+#include "cbe.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+using namespace cbe;
+
+static void FillTerrain( Chunk* pChunk, int size, const USHORT* pTypes, int typeCount, unsigned int seed )
+{
+	srand(seed);
+	for (int x = 0; x < size; x++)
+	{
+		for (int z = 0; z < size; z++)
+		{
+			int height = size / 4 + rand() % (size / 2);
+			for (int y = 0; y < height; y++)
+			{
+				// caves, so the merge loops see broken runs
+				if (rand() % 8 == 0)
+					continue;
+
+				Block block;
+				block.SetType(pTypes[rand() % typeCount]);
+				block.SetActive(1);
+				pChunk->SetBlock(z + y * size + x * size * size, block);
+			}
+		}
+	}
+}
+
+int main( int argc, char** argv )
+{
+	int repetitions = argc > 1 ? atoi(argv[1]) : 20;
+	const int sizes[] = { 16, 32, 64 };
+
+#ifdef CBE_RUNTIME_CHUNK_SIZE
+	printf("mesher: runtime chunk size\n");
+#else
+	printf("mesher: specialized chunk size\n");
+#endif
+
+	for (int i = 0; i < 3; i++)
+	{
+		int size = sizes[i];
+
+		ChunkManager manager;
+		if (!manager.Init(1, 1, 1, size))
+			return 1;
+		manager.SetMeshCacheSize(0);
+
+		BlockType types[3];
+		USHORT typeIds[3];
+		const char* textures[3] = { "stone", "dirt", "grass" };
+		for (int type = 0; type < 3; type++)
+		{
+			types[type].SetTexture(textures[type]);
+			manager.TypeManager()->AddType(types[type]);
+			typeIds[type] = types[type].Id();
+		}
+
+		Chunk chunk(&manager, 0, 0, 0, XMFLOAT3(0.0f, 0.0f, 0.0f), size, 1.0f, &manager);
+		FillTerrain(&chunk, size, typeIds, 3, 1);
+
+		// the best run, an edit marks the chunk out of date each time
+		double best = 0.0;
+		for (int run = 0; run < repetitions; run++)
+		{
+			Block block = chunk.GetBlock(0);
+			block.SetActive(!block.Active());
+			chunk.SetBlock(0, block);
+
+			double start = TimeMilliseconds();
+			chunk.Build(&manager);
+			double time = TimeMilliseconds() - start;
+
+			if (run == 0 || time < best)
+				best = time;
+		}
+
+		printf("%2d^3: %8.3f ms per chunk, %u vertices\n", size, best, (UINT)chunk.GetMeshVertices().size());
+		manager.Exit();
+	}
+
+	return 0;
+}
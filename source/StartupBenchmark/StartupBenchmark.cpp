@@ -0,0 +1,148 @@
+// world startup time: a generated world of the given size (256 MB of
+// blocks by default, pass 4096 for a 4 GB world) is written in the old
+// sequential format, converted to region maps and loaded with each codec,
+// streamed and mapped, with one and with all i/o threads. loads run from
+// a warm page cache. built by cmake with CBE_BENCHMARKS
+#include "cbe.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+
+using namespace cbe;
+
+static const int HEIGHT = 4;
+
+// hills about one and a half chunks high over solid ground, with caves
+static void FillChunk( int cx, int cy, int cz, int chunkSize, Block* pBlocks )
+{
+	for (int x = 0; x < chunkSize; x++)
+	{
+		for (int z = 0; z < chunkSize; z++)
+		{
+			int wx = cx * chunkSize + x, wz = cz * chunkSize + z;
+			int height = (int)(chunkSize * (1.5 + 0.4 * sin(wx * 0.05) + 0.3 * cos(wz * 0.04)));
+			for (int y = 0; y < chunkSize; y++)
+			{
+				int wy = cy * chunkSize + y;
+				Block block;
+				if (wy < height && rand() % 16 != 0)
+				{
+					block.SetType(wy < height - 4 ? 0 : (wy < height - 1 ? 1 : 2));
+					block.SetActive(1);
+				}
+				pBlocks[(x * chunkSize + y) * chunkSize + z] = block;
+			}
+		}
+	}
+}
+
+// header and then every chunk in x, y, z order behind an exists flag
+static bool WriteLegacyMap( const std::string& fileName, int width, int depth, int chunkSize )
+{
+	FILE* pFile = fopen(fileName.c_str(), "wb");
+	if (!pFile)
+		return false;
+
+	__int32 header[4] = { width, HEIGHT, depth, chunkSize };
+	bool success = fwrite(header, sizeof(header), 1, pFile) == 1;
+
+	std::vector<Block> blocks(chunkSize * chunkSize * chunkSize);
+	srand(1);
+	for (int x = 0; x < width && success; x++)
+	{
+		for (int y = 0; y < HEIGHT && success; y++)
+		{
+			for (int z = 0; z < depth && success; z++)
+			{
+				FillChunk(x, y, z, chunkSize, blocks.data());
+				bool exists = true;
+				success = fwrite(&exists, 1, 1, pFile) == 1 && fwrite(blocks.data(), sizeof(Block), blocks.size(), pFile) == blocks.size();
+			}
+		}
+	}
+
+	return fclose(pFile) == 0 && success;
+}
+
+static double FileMegabytes( const std::string& fileName )
+{
+	FILE* pFile = fopen(fileName.c_str(), "rb");
+	if (!pFile)
+		return 0.0;
+
+	FileSeek(pFile, 0, SEEK_END);
+	double megabytes = FileTell(pFile) / 1e6;
+	fclose(pFile);
+	return megabytes;
+}
+
+static void MeasureLoad( const std::string& fileName, const char* pName, bool mapped, int ioThreads, double blockMegabytes )
+{
+	ChunkManager manager;
+	manager.SetIoThreads(ioThreads);
+
+	double start = TimeMilliseconds();
+	bool loaded = manager.Deserialize(fileName, mapped);
+	double time = TimeMilliseconds() - start;
+
+	printf("  %-12s %-8s %-4s i/o threads: %9.1f ms, %8.1f MB/s of blocks%s\n", pName, mapped ? "mapped" : "streamed",
+		   ioThreads == 1 ? "one" : "all", time, blockMegabytes / (time / 1000.0), loaded ? "" : ", FAILED");
+
+	manager.Exit();
+}
+
+int main( int argc, char** argv )
+{
+	double megabytes = argc > 1 ? atof(argv[1]) : 256.0;
+	int chunkSize = argc > 2 ? atoi(argv[2]) : 32;
+	std::string baseName = argc > 3 ? argv[3] : "StartupBenchmark";
+
+	// a square world, HEIGHT chunks high
+	double chunkBytes = (double)chunkSize * chunkSize * chunkSize * sizeof(Block);
+	int columns = (int)ceil(megabytes * 1e6 / chunkBytes / HEIGHT);
+	int width = (int)ceil(sqrt((double)columns));
+	int depth = (columns + width - 1) / width;
+	double blockMegabytes = width * HEIGHT * depth * chunkBytes / 1e6;
+
+	std::string legacyName = baseName + ".legacy";
+	std::string rawName = baseName + ".raw.map";
+	std::string rleName = baseName + ".rle.map";
+
+	double start = TimeMilliseconds();
+	if (!WriteLegacyMap(legacyName, width, depth, chunkSize))
+	{
+		printf("could not write %s\n", legacyName.c_str());
+		remove(legacyName.c_str());
+		return 1;
+	}
+	printf("%d x %d x %d chunks of %d^3, %.0f MB of blocks, generated in %.1f s\n",
+		   width, HEIGHT, depth, chunkSize, blockMegabytes, (TimeMilliseconds() - start) / 1000.0);
+
+	start = TimeMilliseconds();
+	bool converted = ChunkManager::ConvertLegacyMap(legacyName, rawName, CHUNK_CODEC_RAW, 0) &&
+					 ChunkManager::ConvertLegacyMap(legacyName, rleName, CHUNK_CODEC_PALETTE_RLE, ChunkCodec::MaxLevel());
+	remove(legacyName.c_str());
+	if (!converted)
+	{
+		printf("could not convert the map\n");
+		remove(rawName.c_str());
+		remove(rleName.c_str());
+		return 1;
+	}
+	printf("converted in %.1f s, raw %.0f MB, palette rle %.0f MB\n",
+		   (TimeMilliseconds() - start) / 1000.0, FileMegabytes(rawName), FileMegabytes(rleName));
+
+	// 0 takes one i/o thread per core
+	const int ioThreads[2] = { 1, 0 };
+	for (int i = 0; i < 2; i++)
+	{
+		MeasureLoad(rawName, "raw", false, ioThreads[i], blockMegabytes);
+		MeasureLoad(rawName, "raw", true, ioThreads[i], blockMegabytes);
+		MeasureLoad(rleName, "palette rle", false, ioThreads[i], blockMegabytes);
+	}
+
+	remove(rawName.c_str());
+	remove(rleName.c_str());
+	return 0;
+}
@@ -0,0 +1,164 @@
+// BufferAllocator and the deferred reuse of MeshBuffer ranges
+#include "cbe.h"
+#include "Check.h"
+
+using namespace cbe;
+
+static void TestAllocateFree()
+{
+	BufferAllocator allocator(100);
+	CHECK(allocator.Capacity() == 100);
+	CHECK(allocator.FreeRangeCount() == 1);
+
+	UINT a, b, c;
+	CHECK(allocator.Allocate(10, &a) && a == 0);
+	CHECK(allocator.Allocate(20, &b) && b == 10);
+	CHECK(allocator.Allocate(30, &c) && c == 30);
+	CHECK(allocator.Used() == 60 && allocator.FreeSpace() == 40);
+	CHECK(allocator.Allocations() == 3);
+
+	UINT d;
+	CHECK(!allocator.Allocate(41, &d));
+	CHECK(!allocator.Allocate(0, &d));
+
+	allocator.Free(b, 20);
+	CHECK(allocator.Used() == 40 && allocator.Allocations() == 2);
+	CHECK(allocator.FreeRangeCount() == 2);
+
+	// the freed range is reused
+	CHECK(allocator.Allocate(20, &d) && d == 10);
+	CHECK(allocator.FreeRangeCount() == 1);
+}
+
+static void TestBestFit()
+{
+	// free ranges of 10 at 0, 5 at 20 and 40 at 60
+	BufferAllocator allocator(100);
+	UINT offsets[5];
+	const UINT sizes[5] = { 10, 10, 5, 35, 40 };
+	for (int i = 0; i < 5; i++)
+		CHECK(allocator.Allocate(sizes[i], &offsets[i]));
+	allocator.Free(offsets[0], 10);
+	allocator.Free(offsets[2], 5);
+	allocator.Free(offsets[4], 40);
+	CHECK(allocator.FreeRangeCount() == 3);
+
+	UINT offset;
+	CHECK(allocator.Allocate(5, &offset) && offset == 20);
+	CHECK(allocator.Allocate(8, &offset) && offset == 0);
+	CHECK(allocator.Allocate(12, &offset) && offset == 60);
+}
+
+static void TestCoalesce()
+{
+	BufferAllocator allocator(40);
+	UINT offsets[4];
+	for (int i = 0; i < 4; i++)
+		CHECK(allocator.Allocate(10, &offsets[i]));
+	CHECK(allocator.FreeRangeCount() == 0);
+
+	// with the next, with the previous, with both
+	allocator.Free(offsets[2], 10);
+	allocator.Free(offsets[1], 10);
+	CHECK(allocator.FreeRangeCount() == 1 && allocator.LargestFreeRange() == 20);
+	allocator.Free(offsets[3], 10);
+	CHECK(allocator.FreeRangeCount() == 1 && allocator.LargestFreeRange() == 30);
+	allocator.Free(offsets[0], 10);
+	CHECK(allocator.FreeRangeCount() == 1 && allocator.LargestFreeRange() == 40);
+	CHECK(allocator.Used() == 0 && allocator.Allocations() == 0);
+}
+
+static void TestGrow()
+{
+	BufferAllocator allocator(20);
+	UINT a, b;
+	CHECK(allocator.Allocate(15, &a));
+	CHECK(!allocator.Allocate(10, &b));
+
+	// the new space joins the free tail, offsets stay valid
+	allocator.Grow(40);
+	CHECK(allocator.Capacity() == 40 && allocator.FreeRangeCount() == 1);
+	CHECK(allocator.Allocate(25, &b) && b == 15);
+
+	allocator.Grow(30);
+	CHECK(allocator.Capacity() == 40);
+}
+
+static void TestFragmentation()
+{
+	BufferAllocator allocator(100);
+	CHECK(allocator.Fragmentation() == 0.0f);
+
+	UINT offsets[10];
+	for (int i = 0; i < 10; i++)
+		CHECK(allocator.Allocate(10, &offsets[i]));
+	CHECK(allocator.Fragmentation() == 0.0f);
+
+	// every other range free: 50 free, the largest piece 10
+	for (int i = 0; i < 10; i += 2)
+		allocator.Free(offsets[i], 10);
+	CHECK(allocator.FreeRangeCount() == 5);
+	CHECK(allocator.LargestFreeRange() == 10);
+	CHECK(fabs(allocator.Fragmentation() - 0.8f) < 1e-6f);
+
+	UINT offset;
+	CHECK(!allocator.Allocate(20, &offset));
+
+	// closing the gaps brings it back to one range
+	for (int i = 1; i < 10; i += 2)
+		allocator.Free(offsets[i], 10);
+	CHECK(allocator.FreeRangeCount() == 1);
+	CHECK(allocator.Fragmentation() == 0.0f);
+}
+
+static void TestDeferredCollect()
+{
+	MeshBuffer buffer;
+	CHECK(buffer.Init(sizeof(BlockVertex), 64, 64));
+
+	std::vector<BlockVertex> vertices(16);
+	std::vector<DWORD> indices(24, 0);
+	MESH_ALLOCATION first, second;
+	CHECK(buffer.Allocate(vertices.data(), 16, indices.data(), 24, &first));
+	CHECK(buffer.Allocate(vertices.data(), 16, indices.data(), 24, &second));
+	CHECK(buffer.Vertices().Used() == 32 && buffer.Indices().Used() == 48);
+
+	// retired in frame 5, still in use until that frame is collected
+	UINT vertexOffset = first.vertexOffset;
+	buffer.Free(&first, 5);
+	CHECK(first.indexCount == 0);
+	CHECK(buffer.RetiredCount() == 1);
+	CHECK(buffer.Vertices().Used() == 32);
+
+	buffer.Collect(4);
+	CHECK(buffer.RetiredCount() == 1 && buffer.Vertices().Used() == 32);
+
+	buffer.Collect(5);
+	CHECK(buffer.RetiredCount() == 0);
+	CHECK(buffer.Vertices().Used() == 16 && buffer.Indices().Used() == 24);
+
+	MESH_ALLOCATION third;
+	CHECK(buffer.Allocate(vertices.data(), 16, indices.data(), 24, &third));
+	CHECK(third.vertexOffset == vertexOffset);
+
+	// a full buffer grows instead of failing
+	MESH_ALLOCATION large;
+	std::vector<BlockVertex> many(100);
+	std::vector<DWORD> manyIndices(150, 0);
+	CHECK(buffer.Allocate(many.data(), 100, manyIndices.data(), 150, &large));
+	CHECK(buffer.Grows() > 0 && buffer.Vertices().Capacity() >= 132);
+
+	buffer.Release();
+}
+
+int main()
+{
+	TestAllocateFree();
+	TestBestFit();
+	TestCoalesce();
+	TestGrow();
+	TestFragmentation();
+	TestDeferredCollect();
+
+	return CHECK_RESULT();
+}
@@ -0,0 +1,62 @@
+// synthetic cameras for the culling tests, row major view projection
+// matrices like d3d's LookAtLH * PerspectiveFovLH (clip = v * M, 0 <= z <= w)
+#pragma once
+
+#include <cmath>
+
+static void Normalize(float* pV)
+{
+	float length = sqrtf(pV[0] * pV[0] + pV[1] * pV[1] + pV[2] * pV[2]);
+	pV[0] /= length;
+	pV[1] /= length;
+	pV[2] /= length;
+}
+
+static void Cross(const float* pA, const float* pB, float* pOut)
+{
+	pOut[0] = pA[1] * pB[2] - pA[2] * pB[1];
+	pOut[1] = pA[2] * pB[0] - pA[0] * pB[2];
+	pOut[2] = pA[0] * pB[1] - pA[1] * pB[0];
+}
+
+// fov is vertical, in radians
+static void ViewProjection(const float* pEye, const float* pAt, float fov, float aspect, float nearZ, float farZ, float* pOut)
+{
+	float up[3] = { 0.0f, 1.0f, 0.0f };
+	float zAxis[3] = { pAt[0] - pEye[0], pAt[1] - pEye[1], pAt[2] - pEye[2] };
+	Normalize(zAxis);
+
+	// looking straight up or down, any horizontal up will do
+	if (fabsf(zAxis[1]) > 0.999f)
+	{
+		up[1] = 0.0f;
+		up[2] = 1.0f;
+	}
+
+	float xAxis[3], yAxis[3];
+	Cross(up, zAxis, xAxis);
+	Normalize(xAxis);
+	Cross(zAxis, xAxis, yAxis);
+
+	float view[16] =
+	{
+		xAxis[0], yAxis[0], zAxis[0], 0.0f,
+		xAxis[1], yAxis[1], zAxis[1], 0.0f,
+		xAxis[2], yAxis[2], zAxis[2], 0.0f,
+		-(xAxis[0] * pEye[0] + xAxis[1] * pEye[1] + xAxis[2] * pEye[2]),
+		-(yAxis[0] * pEye[0] + yAxis[1] * pEye[1] + yAxis[2] * pEye[2]),
+		-(zAxis[0] * pEye[0] + zAxis[1] * pEye[1] + zAxis[2] * pEye[2]), 1.0f
+	};
+
+	float yScale = 1.0f / tanf(fov / 2.0f);
+	float range = farZ / (farZ - nearZ);
+	float projection[16] =
+	{
+		yScale / aspect, 0.0f, 0.0f, 0.0f,
+		0.0f, yScale, 0.0f, 0.0f,
+		0.0f, 0.0f, range, 1.0f,
+		0.0f, 0.0f, -range * nearZ, 0.0f
+	};
+
+	cbe::Frustum::MultiplyMatrix(view, projection, pOut);
+}
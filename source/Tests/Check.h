@@ -0,0 +1,19 @@
+// checks for the headless tests, run by ctest. a failed check is printed
+// and the test returns 1 from main
+#pragma once
+
+#include <cstdio>
+
+static int g_checkFailures = 0;
+
+#define CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #condition); \
+			g_checkFailures++; \
+		} \
+	} while (0)
+
+#define CHECK_RESULT() (g_checkFailures == 0 ? 0 : 1)
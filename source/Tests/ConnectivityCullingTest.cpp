@@ -0,0 +1,183 @@
+// connectivity culling in solid worlds with tunnels: only chunks the view
+// can reach through open space from the camera chunk are visible, with
+// the same result every frame and with the frustum on top
+#include "cbe.h"
+#include "Check.h"
+#include "Camera.h"
+
+using namespace cbe;
+
+static const int CHUNK_SIZE = 16;
+static const int TUNNEL = 8;	// y and z of the tunnels inside the chunks
+
+static BlockType g_stone;
+
+static void BuildSolid(ChunkManager& mgr, int width, int depth)
+{
+	CHECK(mgr.Init(width, 1, depth, CHUNK_SIZE));
+	mgr.TypeManager()->AddType(g_stone);
+	mgr.SetUploadBudget(0.0f, 0);
+
+	for (int x = 0; x < width * CHUNK_SIZE; x++)
+	{
+		for (int y = 0; y < CHUNK_SIZE; y++)
+		{
+			for (int z = 0; z < depth * CHUNK_SIZE; z++)
+			{
+				mgr.SetBlockType(x, y, z, g_stone);
+				mgr.SetBlockState(x, y, z, TRUE);
+			}
+		}
+	}
+}
+
+// carves from first to last, both included, along x or z
+static void Carve(ChunkManager& mgr, bool alongX, int first, int last, int across)
+{
+	for (int i = first; i <= last; i++)
+	{
+		if (alongX)
+			mgr.SetBlockState(i, TUNNEL, across, FALSE);
+		else
+			mgr.SetBlockState(across, TUNNEL, i, FALSE);
+	}
+
+	mgr.BuildPending();
+	mgr.Update();
+}
+
+static void SetCameraToBlock(ChunkManager& mgr, int x, int y, int z)
+{
+	// the worlds are one chunk high
+	float block = mgr.Height() / CHUNK_SIZE;
+	float position[3] = { x * block, y * block, z * block };
+	mgr.SetCameraPosition(position);
+}
+
+static bool VisibleEquals(ChunkManager& mgr, int count, const int* pExpected)
+{
+	std::vector<int> visible = mgr.GetVisibleChunks();
+	std::sort(visible.begin(), visible.end());
+
+	std::vector<int> expected(pExpected, pExpected + count);
+	std::sort(expected.begin(), expected.end());
+
+	return visible == expected;
+}
+
+static void TestStraightTunnel()
+{
+	// a row of 6 chunks, the tunnel leaves the camera chunk and ends in the
+	// middle of chunk 3
+	ChunkManager mgr;
+	BuildSolid(mgr, 6, 1);
+	Carve(mgr, true, 2, 3 * CHUNK_SIZE + CHUNK_SIZE / 2, TUNNEL);
+
+	// everything with blocks without a camera
+	CHECK(mgr.GetVisibleChunks().size() == 6);
+	CHECK(mgr.GetConnectivityCulledCount() == 0);
+
+	SetCameraToBlock(mgr, 4, TUNNEL, TUNNEL);
+	mgr.Update();
+
+	const int reached[4] = { 0, 1, 2, 3 };
+	CHECK(VisibleEquals(mgr, 4, reached));
+	CHECK(mgr.GetConnectivityCulledCount() == 2);
+
+	// the same frame again gives the same chunks in the same order
+	std::vector<int> first = mgr.GetVisibleChunks();
+	for (int i = 0; i < 4; i++)
+	{
+		mgr.Update();
+		CHECK(mgr.GetVisibleChunks() == first);
+	}
+
+	// through to the far end of the world, the edit opens chunks 4 and 5
+	Carve(mgr, true, 3 * CHUNK_SIZE + CHUNK_SIZE / 2, 6 * CHUNK_SIZE - 3, TUNNEL);
+	CHECK(mgr.GetVisibleChunks().size() == 6);
+	CHECK(mgr.GetConnectivityCulledCount() == 0);
+
+	// outside the map nothing is ruled out
+	float outside[3] = { -100.0f, 0.0f, 0.0f };
+	mgr.SetCameraPosition(outside);
+	mgr.Update();
+	CHECK(mgr.GetVisibleChunks().size() == 6);
+	CHECK(mgr.GetConnectivityCulledCount() == 0);
+
+	mgr.Exit();
+}
+
+static void TestBentTunnel()
+{
+	// 3 x 2 chunks, index x * 2 + z. the tunnel runs along x in row z = 0
+	// and turns into chunk (2, 1). (0, 1) touches the camera chunk, (1, 1)
+	// is only next to chunks the view passes straight through
+	ChunkManager mgr;
+	BuildSolid(mgr, 3, 2);
+	int bend = 2 * CHUNK_SIZE + CHUNK_SIZE / 2;
+	Carve(mgr, true, 2, bend, TUNNEL);
+	Carve(mgr, false, TUNNEL, CHUNK_SIZE + CHUNK_SIZE / 2, bend);
+
+	SetCameraToBlock(mgr, 4, TUNNEL, TUNNEL);
+	mgr.Update();
+
+	const int reached[5] = { 0, 1, 2, 4, 5 };
+	CHECK(VisibleEquals(mgr, 5, reached));
+	CHECK(mgr.GetConnectivityCulledCount() == 1);
+
+	// a camera at the bend sees back along the tunnel and into (2, 1). the
+	// tunnel does not leave (0, 0) sideways, so (0, 1) is ruled out as well
+	SetCameraToBlock(mgr, bend, TUNNEL, TUNNEL);
+	mgr.Update();
+	const int fromBend[4] = { 0, 2, 4, 5 };
+	CHECK(VisibleEquals(mgr, 4, fromBend));
+	CHECK(mgr.GetConnectivityCulledCount() == 2);
+
+	mgr.Exit();
+}
+
+static void TestWithFrustum()
+{
+	// the straight tunnel seen along +x: the frustum drops what is behind
+	// the camera, connectivity what is behind the end of the tunnel
+	ChunkManager mgr;
+	BuildSolid(mgr, 6, 1);
+	Carve(mgr, true, 2, 3 * CHUNK_SIZE + CHUNK_SIZE / 2, TUNNEL);
+
+	// camera in chunk 1 looking at the end of the tunnel
+	float block = mgr.Height() / CHUNK_SIZE;
+	float eye[3] = { (CHUNK_SIZE + 4) * block, TUNNEL * block, TUNNEL * block };
+	float at[3] = { eye[0] + 100.0f, eye[1], eye[2] };
+	float viewProj[16];
+	ViewProjection(eye, at, 3.14159265f / 3.0f, 1.0f, 0.5f, 1000.0f, viewProj);
+	mgr.SetViewProjection(viewProj);
+	mgr.SetCameraPosition(eye);
+	mgr.Update();
+
+	const int reached[3] = { 1, 2, 3 };
+	CHECK(VisibleEquals(mgr, 3, reached));
+	CHECK(mgr.GetConnectivityCulledCount() == 2);
+
+	// a second world built the same way culls the same chunks
+	ChunkManager other;
+	BuildSolid(other, 6, 1);
+	Carve(other, true, 2, 3 * CHUNK_SIZE + CHUNK_SIZE / 2, TUNNEL);
+	other.SetViewProjection(viewProj);
+	other.SetCameraPosition(eye);
+	other.Update();
+	CHECK(other.GetVisibleChunks() == mgr.GetVisibleChunks());
+
+	mgr.Exit();
+	other.Exit();
+}
+
+int main()
+{
+	g_stone.SetTexture("stone");
+
+	TestStraightTunnel();
+	TestBentTunnel();
+	TestWithFrustum();
+
+	return CHECK_RESULT();
+}
@@ -0,0 +1,213 @@
+// Frustum against known boxes, the sse path against the scalar one, and
+// the visible chunks of a ChunkManager seen by synthetic cameras
+#include "cbe.h"
+#include "Check.h"
+#include "Camera.h"
+
+using namespace cbe;
+
+static const float PI = 3.14159265f;
+
+static void TestKnownBoxes()
+{
+	// at the origin looking down +z, 90 degrees, near 1 and far 100
+	float eye[3] = { 0.0f, 0.0f, 0.0f };
+	float at[3] = { 0.0f, 0.0f, 1.0f };
+	float viewProj[16];
+	ViewProjection(eye, at, PI / 2.0f, 1.0f, 1.0f, 100.0f, viewProj);
+
+	Frustum frustum;
+	frustum.Extract(viewProj);
+
+	CHECK(frustum.TestAABB(XMFLOAT3(-1, -1, 10), XMFLOAT3(1, 1, 12)));		// ahead
+	CHECK(!frustum.TestAABB(XMFLOAT3(-1, -1, -12), XMFLOAT3(1, 1, -10)));	// behind
+	CHECK(!frustum.TestAABB(XMFLOAT3(30, -1, 10), XMFLOAT3(32, 1, 12)));	// right of the view
+	CHECK(!frustum.TestAABB(XMFLOAT3(-1, 30, 10), XMFLOAT3(1, 32, 12)));	// above
+	CHECK(!frustum.TestAABB(XMFLOAT3(-1, -1, 150), XMFLOAT3(1, 1, 160)));	// beyond far
+	CHECK(frustum.TestAABB(XMFLOAT3(-15, -1, 10), XMFLOAT3(-5, 1, 11)));	// crossing the left plane
+	CHECK(frustum.TestAABB(XMFLOAT3(-1, -1, -1), XMFLOAT3(1, 1, 1)));		// around the camera
+	CHECK(frustum.TestAABB(XMFLOAT3(-1000, -1000, 50), XMFLOAT3(1000, 1000, 60)));	// larger than the view
+
+	// empty boxes never pass
+	CHECK(!frustum.TestAABB(XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX), XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX)));
+}
+
+static float Random(float min, float max)
+{
+	return min + (max - min) * (float)rand() / (float)RAND_MAX;
+}
+
+static void TestSimdMatchesScalar()
+{
+	// not a multiple of four, the tail takes the scalar path
+	const int count = 1003;
+	std::vector<float> minX(count), minY(count), minZ(count), maxX(count), maxY(count), maxZ(count);
+
+	srand(1);
+	for (int i = 0; i < count; i++)
+	{
+		if (i % 17 == 0)
+		{
+			minX[i] = minY[i] = minZ[i] = FLT_MAX;
+			maxX[i] = maxY[i] = maxZ[i] = -FLT_MAX;
+			continue;
+		}
+
+		minX[i] = Random(-200.0f, 200.0f);
+		minY[i] = Random(-200.0f, 200.0f);
+		minZ[i] = Random(-200.0f, 200.0f);
+		maxX[i] = minX[i] + Random(0.0f, 20.0f);
+		maxY[i] = minY[i] + Random(0.0f, 20.0f);
+		maxZ[i] = minZ[i] + Random(0.0f, 20.0f);
+	}
+
+	std::vector<int> simd(count), scalar(count);
+	for (int camera = 0; camera < 16; camera++)
+	{
+		float eye[3] = { Random(-50.0f, 50.0f), Random(-50.0f, 50.0f), Random(-50.0f, 50.0f) };
+		float at[3] = { Random(-50.0f, 50.0f), Random(-50.0f, 50.0f), Random(-50.0f, 50.0f) };
+		float viewProj[16];
+		ViewProjection(eye, at, Random(0.5f, 2.0f), Random(0.5f, 2.0f), 1.0f, Random(50.0f, 400.0f), viewProj);
+
+		Frustum frustum;
+		frustum.Extract(viewProj);
+
+		int simdCount = frustum.CullAABBs(count, minX.data(), minY.data(), minZ.data(), maxX.data(), maxY.data(), maxZ.data(), simd.data());
+		int scalarCount = frustum.CullAABBsScalar(0, count, minX.data(), minY.data(), minZ.data(), maxX.data(), maxY.data(), maxZ.data(), scalar.data());
+
+		// some of the boxes on either side, or the cameras test nothing
+		CHECK(simdCount > 0 && simdCount < count);
+		CHECK(simdCount == scalarCount);
+		CHECK(std::equal(simd.begin(), simd.begin() + simdCount, scalar.begin()));
+
+		for (int i = 0; i < simdCount; i++)
+			CHECK(simd[i] % 17 != 0);
+	}
+}
+
+// 8 x 1 x 8 chunks with a floor of 4 blocks in every one
+static const int WIDTH = 8, DEPTH = 8, CHUNK_SIZE = 16, FLOOR = 4;
+
+static void BuildFloor(ChunkManager& mgr, BlockType& stone)
+{
+	CHECK(mgr.Init(WIDTH, 1, DEPTH, CHUNK_SIZE));
+	mgr.TypeManager()->AddType(stone);
+	mgr.SetUploadBudget(0.0f, 0);
+
+	for (int x = 0; x < WIDTH * CHUNK_SIZE; x++)
+	{
+		for (int z = 0; z < DEPTH * CHUNK_SIZE; z++)
+		{
+			for (int y = 0; y < FLOOR; y++)
+			{
+				mgr.SetBlockType(x, y, z, stone);
+				mgr.SetBlockState(x, y, z, TRUE);
+			}
+		}
+	}
+
+	mgr.BuildPending();
+	mgr.Update();
+}
+
+static bool IsVisible(ChunkManager& mgr, int chunkIndex)
+{
+	const std::vector<int>& visible = mgr.GetVisibleChunks();
+	return std::find(visible.begin(), visible.end(), chunkIndex) != visible.end();
+}
+
+// a chunk is surely visible if a box inside its floor is in the frustum and
+// surely culled if the whole chunk cell is outside. the world is moved by
+// offset along x
+static void CheckCamera(ChunkManager& mgr, const float* pEye, const float* pAt, float offset)
+{
+	float viewProj[16];
+	ViewProjection(pEye, pAt, PI / 3.0f, 1.0f, 1.0f, 1000.0f, viewProj);
+	mgr.SetViewProjection(viewProj);
+	mgr.Update();
+
+	Frustum frustum;
+	frustum.Extract(viewProj);
+
+	float chunk = mgr.Width() / WIDTH;
+	float block = chunk / CHUNK_SIZE;
+	float halfBlock = block / 2.0f;
+
+	int inside = 0, outside = 0;
+	for (int x = 0; x < WIDTH; x++)
+	{
+		for (int z = 0; z < DEPTH; z++)
+		{
+			int index = x * DEPTH + z;
+			XMFLOAT3 cellMin(offset + x * chunk - halfBlock, -halfBlock, z * chunk - halfBlock);
+			XMFLOAT3 cellMax(cellMin.x + chunk, cellMin.y + chunk, cellMin.z + chunk);
+			XMFLOAT3 floorMin(cellMin.x + block, cellMin.y + block, cellMin.z + block);
+			XMFLOAT3 floorMax(cellMax.x - block, cellMin.y + (FLOOR - 1) * block, cellMax.z - block);
+
+			if (frustum.TestAABB(floorMin, floorMax))
+			{
+				CHECK(IsVisible(mgr, index));
+				inside++;
+			}
+			else if (!frustum.TestAABB(cellMin, cellMax))
+			{
+				CHECK(!IsVisible(mgr, index));
+				outside++;
+			}
+		}
+	}
+
+	CHECK(inside > 0 && outside > 0);
+}
+
+static void TestVisibleChunks()
+{
+	BlockType stone;
+	stone.SetTexture("stone");
+
+	ChunkManager mgr;
+	BuildFloor(mgr, stone);
+
+	// without a camera every chunk with blocks is drawn
+	CHECK((int)mgr.GetVisibleChunks().size() == WIDTH * DEPTH);
+
+	// from the middle of the world along both axes in both directions
+	float center = mgr.Width() / 2.0f;
+	float eye[3] = { center, 30.0f, center };
+	float targets[4][3] = { { center + 100.0f, 0.0f, center }, { center - 100.0f, 0.0f, center },
+							{ center, 0.0f, center + 100.0f }, { center, 0.0f, center - 100.0f } };
+	for (int i = 0; i < 4; i++)
+		CheckCamera(mgr, eye, targets[i], 0.0f);
+
+	// looking away from the world nothing is left
+	float away[3] = { center, 30.0f, -100.0f };
+	float awayTarget[3] = { center, 30.0f, -200.0f };
+	float viewProj[16];
+	ViewProjection(away, awayTarget, PI / 3.0f, 1.0f, 1.0f, 1000.0f, viewProj);
+	mgr.SetViewProjection(viewProj);
+	mgr.Update();
+	CHECK(mgr.GetVisibleChunks().empty());
+
+	// the planes follow the world matrix, the same camera sees the moved chunks
+	float world[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 1000, 0, 0, 1 };
+	mgr.SetWorldMatrix(world);
+	float movedEye[3] = { 1000.0f + center, 30.0f, center };
+	float movedTarget[3] = { 1100.0f + center, 0.0f, center };
+	CheckCamera(mgr, movedEye, movedTarget, 1000.0f);
+
+	// culling off again
+	mgr.SetViewProjection(NULL);
+	mgr.Update();
+	CHECK((int)mgr.GetVisibleChunks().size() == WIDTH * DEPTH);
+
+	mgr.Exit();
+}
+
+int main()
+{
+	TestKnownBoxes();
+	TestSimdMatchesScalar();
+	TestVisibleChunks();
+
+	return CHECK_RESULT();
+}
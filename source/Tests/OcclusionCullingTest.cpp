@@ -0,0 +1,149 @@
+// OcclusionBuffer against known occluders, and the occlusion cull rate of
+// a ChunkManager in a scene with a wall in front of the camera and in an
+// open one where nothing may be culled
+#include "cbe.h"
+#include "Check.h"
+#include "Camera.h"
+
+using namespace cbe;
+
+static const float PI = 3.14159265f;
+
+static void TestBuffer()
+{
+	// at the origin looking down +z, a wall at z = 10 covers x < 0
+	float eye[3] = { 0.0f, 0.0f, 0.0f };
+	float at[3] = { 0.0f, 0.0f, 1.0f };
+	float viewProj[16];
+	ViewProjection(eye, at, PI / 2.0f, 1.0f, 1.0f, 100.0f, viewProj);
+
+	OcclusionBuffer buffer;
+	buffer.Init(64, 64);
+	buffer.Clear(viewProj);
+
+	// nothing rasterized, nothing hidden
+	buffer.BuildPyramid();
+	CHECK(buffer.TestAABB(XMFLOAT3(-2, -1, 20), XMFLOAT3(-1, 1, 21)));
+
+	buffer.Clear(viewProj);
+	XMFLOAT3 wall[4] = { XMFLOAT3(-20, -20, 10), XMFLOAT3(0, -20, 10), XMFLOAT3(0, 20, 10), XMFLOAT3(-20, 20, 10) };
+	CHECK(buffer.RasterizeQuad(wall));
+
+	// crossing the near plane, never an occluder
+	XMFLOAT3 floor[4] = { XMFLOAT3(-20, -5, -10), XMFLOAT3(20, -5, -10), XMFLOAT3(20, -5, 50), XMFLOAT3(-20, -5, 50) };
+	CHECK(!buffer.RasterizeQuad(floor));
+	buffer.BuildPyramid();
+
+	CHECK(!buffer.TestAABB(XMFLOAT3(-4, -1, 20), XMFLOAT3(-2, 1, 21)));	// behind the wall
+	CHECK(buffer.TestAABB(XMFLOAT3(-4, -1, 5), XMFLOAT3(-2, 1, 6)));	// in front of it
+	CHECK(buffer.TestAABB(XMFLOAT3(2, -1, 20), XMFLOAT3(4, 1, 21)));	// beside it
+	CHECK(buffer.TestAABB(XMFLOAT3(-4, -1, 20), XMFLOAT3(4, 1, 21)));	// partly beside it
+	CHECK(buffer.TestAABB(XMFLOAT3(-4, -1, -1), XMFLOAT3(-2, 1, 21)));	// crossing the near plane
+}
+
+// 8 x 2 x 8 chunks: solid ground in the lower row of chunks, a pillar in
+// every upper chunk and, with wall, upper chunks at x = 2 filled solid
+static const int WIDTH = 8, HEIGHT = 2, DEPTH = 8, CHUNK_SIZE = 16, WALL = 2;
+
+static void BuildScene(ChunkManager& mgr, BlockType& stone, bool wall)
+{
+	CHECK(mgr.Init(WIDTH, HEIGHT, DEPTH, CHUNK_SIZE));
+	mgr.TypeManager()->AddType(stone);
+	mgr.SetUploadBudget(0.0f, 0);
+
+	for (int x = 0; x < WIDTH * CHUNK_SIZE; x++)
+	{
+		for (int z = 0; z < DEPTH * CHUNK_SIZE; z++)
+		{
+			int cx = x / CHUNK_SIZE;
+			int bx = x % CHUNK_SIZE;
+			int bz = z % CHUNK_SIZE;
+			bool pillar = bx >= 6 && bx < 10 && bz >= 6 && bz < 10;
+
+			for (int y = 0; y < HEIGHT * CHUNK_SIZE; y++)
+			{
+				bool solid = y < CHUNK_SIZE || (wall && cx == WALL) || (pillar && y < CHUNK_SIZE + 8);
+				if (!solid)
+					continue;
+
+				mgr.SetBlockType(x, y, z, stone);
+				mgr.SetBlockState(x, y, z, TRUE);
+			}
+		}
+	}
+
+	mgr.BuildPending();
+	mgr.Update();
+}
+
+// camera in the upper row of chunk 0 looking along +x. returns the share
+// of the chunks in the frustum culled by occlusion
+static float MeasureCullRate(ChunkManager& mgr, const char* pScene, bool wall)
+{
+	float chunk = mgr.Width() / WIDTH;
+	float eye[3] = { chunk / 2.0f, chunk * 1.5f, mgr.Width() / 2.0f };
+	float at[3] = { eye[0] + 100.0f, eye[1], eye[2] };
+	float viewProj[16];
+	ViewProjection(eye, at, PI / 3.0f, 1.0f, 1.0f, 1000.0f, viewProj);
+	mgr.SetViewProjection(viewProj);
+
+	mgr.SetOcclusionCulling(false);
+	mgr.Update();
+	std::vector<int> inFrustum = mgr.GetVisibleChunks();
+
+	mgr.SetOcclusionCulling(true);
+	mgr.Update();
+	std::vector<int> visible = mgr.GetVisibleChunks();
+	CHECK(visible.size() + mgr.GetOcclusionCulledCount() == inFrustum.size());
+
+	// only chunks behind the wall may be culled
+	for (UINT i = 0; i < inFrustum.size(); i++)
+	{
+		int index = inFrustum[i];
+		bool culled = std::find(visible.begin(), visible.end(), index) == visible.end();
+		int x = index / (HEIGHT * DEPTH);
+		if (culled)
+			CHECK(wall && x > WALL);
+	}
+
+	// the same frame again culls the same chunks
+	mgr.Update();
+	CHECK(mgr.GetVisibleChunks() == visible);
+
+	float rate = inFrustum.empty() ? 0.0f : (float)mgr.GetOcclusionCulledCount() / inFrustum.size();
+	printf("%s: %u of %u chunks in the frustum occluded (%.0f%%), %u occluder quads, %.3f ms\n", pScene,
+		   mgr.GetOcclusionCulledCount(), (UINT)inFrustum.size(), rate * 100.0f, mgr.GetOccluderQuadCount(), mgr.GetOcclusionTime());
+
+	return rate;
+}
+
+static void TestCullRates()
+{
+	BlockType stone;
+	stone.SetTexture("stone");
+
+	// everything behind the wall in the frustum is hidden
+	ChunkManager walled;
+	BuildScene(walled, stone, true);
+	float rate = MeasureCullRate(walled, "wall", true);
+	CHECK(rate > 0.75f);
+
+	// all upper chunks behind the wall and the ground below them
+	int behind = (WIDTH - WALL - 1) * DEPTH * HEIGHT;
+	CHECK(walled.GetOcclusionCulledCount() > 0 && (int)walled.GetOcclusionCulledCount() <= behind);
+
+	ChunkManager open;
+	BuildScene(open, stone, false);
+	CHECK(MeasureCullRate(open, "open", false) == 0.0f);
+
+	walled.Exit();
+	open.Exit();
+}
+
+int main()
+{
+	TestBuffer();
+	TestCullRates();
+
+	return CHECK_RESULT();
+}
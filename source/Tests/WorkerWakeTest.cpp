@@ -0,0 +1,112 @@
+// Event wake ups and the worker of a ChunkManager: it sleeps while nothing
+// is queued, wakes once per edit and reports the wake latency
+#include "cbe.h"
+#include "Check.h"
+
+using namespace cbe;
+
+static void SleepMilliseconds(int milliseconds)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+}
+
+static Event g_event;
+static double g_latency = -1.0;
+
+static void WaitForEvent()
+{
+	g_latency = g_event.Wait();
+}
+
+static void TestEvent()
+{
+	// a signal raised before the wait is kept
+	g_event.Set();
+	double latency = g_event.Wait();
+	CHECK(latency >= 0.0 && latency < 1000.0);
+
+	// a sleeping thread is woken, the latency runs from Set to the wake up
+	std::thread waiter(WaitForEvent);
+	SleepMilliseconds(20);
+	g_event.Set();
+	waiter.join();
+	CHECK(g_latency >= 0.0 && g_latency < 1000.0);
+}
+
+// waits until the worker woke after before and went back to sleep, false
+// after a second
+static bool WaitForWakeUp(ChunkManager& mgr, UINT before)
+{
+	for (int i = 0; i < 1000; i++)
+	{
+		if (mgr.GetWorkerWakeups() != before && mgr.GetUploadBacklog() > 0)
+			return true;
+
+		SleepMilliseconds(1);
+	}
+
+	return false;
+}
+
+static void TestWorker()
+{
+	const int EDITS = 100;
+
+	BlockType stone;
+	stone.SetTexture("stone");
+
+	ChunkManager mgr;
+	CHECK(mgr.Init(2, 2, 2, 16));
+	mgr.TypeManager()->AddType(stone);
+	mgr.SetUploadBudget(0.0f, 0);
+	mgr.StartAsyncUpdating();
+
+	// nothing queued, the worker sleeps instead of polling
+	SleepMilliseconds(50);
+	CHECK(mgr.GetWorkerWakeups() == 0);
+
+	std::vector<UINT> latencies;
+	for (int i = 0; i < EDITS; i++)
+	{
+		UINT before = mgr.GetWorkerWakeups();
+
+		// a new block inside chunk 0 each time, no neighbor is rebuilt
+		mgr.SetBlockState(4 + i % 8, 4 + (i / 8) % 8, 4 + i / 64, TRUE);
+
+		bool woken = WaitForWakeUp(mgr, before);
+		CHECK(woken);
+		if (woken)
+			latencies.push_back(mgr.GetWorkerWakeLatency());
+
+		mgr.Update();
+		SleepMilliseconds(2);
+	}
+
+	// one wake up per edit, none while idle
+	SleepMilliseconds(50);
+	UINT wakeups = mgr.GetWorkerWakeups();
+	CHECK(wakeups == EDITS);
+	SleepMilliseconds(50);
+	CHECK(mgr.GetWorkerWakeups() == wakeups);
+
+	if (!latencies.empty())
+	{
+		std::sort(latencies.begin(), latencies.end());
+		UINT median = latencies[latencies.size() / 2];
+		UINT worst = latencies.back();
+		printf("%u wake ups for %d edits, latency median %u us, worst %u us\n", wakeups, EDITS, median, worst);
+
+		// generous, a loaded machine may delay the worker
+		CHECK(median < 50000);
+	}
+
+	mgr.Exit();
+}
+
+int main()
+{
+	TestEvent();
+	TestWorker();
+
+	return CHECK_RESULT();
+}
@@ -0,0 +1,158 @@
+// translucent quad sorting on a water map: the radix sort of
+// TranslucentSorter against std::sort, and the sort time per frame of a
+// ChunkManager with a camera flying over the water for a few thresholds.
+// built by cmake with CBE_BENCHMARKS
+#include "cbe.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+
+using namespace cbe;
+
+static const int CHUNK_SIZE = 32, SEA_LEVEL = 20;
+
+// sea floor below the sea level with islands breaking through
+static int FloorHeight( int x, int z )
+{
+	return 14 + (int)(6.0 * sin(x * 0.07) + 5.0 * cos(z * 0.09));
+}
+
+struct QUAD_DEPTH
+{
+	float depth;
+	UINT quad;
+
+	bool operator < (const QUAD_DEPTH& rhs) const { return depth < rhs.depth; }
+};
+
+// one chunk worth of water surface quads sorted by either method
+static void CompareSorts( int repetitions )
+{
+	const UINT count = CHUNK_SIZE * CHUNK_SIZE;
+	std::vector<XMFLOAT3> centroids(count);
+	std::vector<DWORD> indices(count * 6);
+	for (UINT i = 0; i < count; i++)
+	{
+		centroids[i] = XMFLOAT3((float)(i % CHUNK_SIZE), (float)SEA_LEVEL, (float)(i / CHUNK_SIZE));
+		for (int corner = 0; corner < 6; corner++)
+			indices[i * 6 + corner] = i * 4 + corner % 4;
+	}
+
+	TranslucentSorter sorter;
+	sorter.Init(1);
+	sorter.SetThreshold(0.0f);
+	sorter.SetQuads(0, centroids.data(), indices.data(), count);
+
+	std::vector<QUAD_DEPTH> order(count);
+	std::vector<DWORD> sorted(count * 6);
+
+	double radix = 0.0, comparison = 0.0;
+	int chunkIndex = 0;
+	for (int run = 0; run < repetitions; run++)
+	{
+		XMFLOAT3 camera((float)(run % CHUNK_SIZE), SEA_LEVEL + 10.0f, -5.0f);
+
+		double start = TimeMilliseconds();
+		sorter.Sort(camera, &chunkIndex, 1);
+		radix += TimeMilliseconds() - start;
+		sorter.ClearSorted();
+
+		// the same back to front order with a comparison sort
+		start = TimeMilliseconds();
+		for (UINT i = 0; i < count; i++)
+		{
+			float dx = centroids[i].x - camera.x;
+			float dy = centroids[i].y - camera.y;
+			float dz = centroids[i].z - camera.z;
+			order[i].depth = -(dx * dx + dy * dy + dz * dz);
+			order[i].quad = i;
+		}
+		std::sort(order.begin(), order.end());
+		for (UINT i = 0; i < count; i++)
+			memcpy(&sorted[i * 6], &indices[order[i].quad * 6], 6 * sizeof(DWORD));
+		comparison += TimeMilliseconds() - start;
+	}
+
+	printf("%u quads: radix sort %.3f ms, std::sort %.3f ms\n", count, radix / repetitions, comparison / repetitions);
+}
+
+static void FlyOver( ChunkManager& manager, float threshold, int frames )
+{
+	manager.SetTranslucentSortThreshold(threshold);
+
+	// the map is one chunk high
+	float block = manager.Height() / CHUNK_SIZE;
+
+	// a straight line at a tenth of a block per frame, then back
+	float camera[3] = { manager.Width() / 4.0f, (SEA_LEVEL + 8) * block, manager.Depth() / 2.0f };
+
+	double total = 0.0, worst = 0.0;
+	UINT quads = 0;
+	for (int frame = 0; frame < frames; frame++)
+	{
+		camera[0] += (frame < frames / 2 ? 0.1f : -0.1f) * block;
+		manager.SetCameraPosition(camera);
+		manager.Update();
+
+		double time = manager.GetTranslucentSortTime();
+		total += time;
+		if (time > worst)
+			worst = time;
+		quads += manager.GetTranslucentSortedQuads();
+	}
+
+	printf("threshold %5.2f blocks: %.3f ms per frame, worst %.3f ms, %u quads sorted per frame\n",
+		   threshold / block, total / frames, worst, quads / frames);
+}
+
+int main( int argc, char** argv )
+{
+	int frames = argc > 1 ? atoi(argv[1]) : 200;
+	int size = argc > 2 ? atoi(argv[2]) : 8;
+
+	CompareSorts(frames);
+
+	ChunkManager manager;
+	if (!manager.Init(size, 1, size, CHUNK_SIZE))
+		return 1;
+	manager.SetUploadBudget(0.0f, 0);
+
+	BlockType sand, water;
+	sand.SetTexture("sand");
+	water.SetColor(XMFLOAT4(0.0f, 0.2f, 0.8f, 0.5f));
+	manager.TypeManager()->AddType(sand);
+	manager.TypeManager()->AddType(water);
+
+	for (int x = 0; x < size * CHUNK_SIZE; x++)
+	{
+		for (int z = 0; z < size * CHUNK_SIZE; z++)
+		{
+			int height = FloorHeight(x, z);
+			for (int y = 0; y < height; y++)
+			{
+				manager.SetBlockType(x, y, z, sand);
+				manager.SetBlockState(x, y, z, TRUE);
+			}
+			for (int y = height; y <= SEA_LEVEL; y++)
+			{
+				manager.SetBlockType(x, y, z, water);
+				manager.SetBlockState(x, y, z, TRUE);
+			}
+		}
+	}
+
+	double start = TimeMilliseconds();
+	manager.BuildPending();
+	manager.Update();
+	printf("%d x %d chunks of water built in %.0f ms, %d vertices\n", size, size, TimeMilliseconds() - start, manager.GetVertexCount());
+
+	// every frame, the default of one block and four blocks
+	float block = manager.Height() / CHUNK_SIZE;
+	const float thresholds[3] = { 0.0f, block, 4.0f * block };
+	for (int i = 0; i < 3; i++)
+		FlyOver(manager, thresholds[i], frames);
+
+	manager.Exit();
+	return 0;
+}